@@ -9,6 +9,8 @@ AstNode *init_ast(AstType type) {
         log_error(COMPILER, "Can't allocate memory for AST.");
     }
     ast->type = type;
+    ast->row = 0;
+    ast->col = 0;
 
     switch (ast->type) {
         case AST_COMPOUND:
@@ -25,8 +27,12 @@ AstNode *init_ast(AstType type) {
             return init_ast_function_call(ast);
         case AST_IF_STATEMENT:
             return init_ast_if_statement(ast);
+        case AST_LOOP_STATEMENT:
+            return init_ast_loop_statement(ast);
         case AST_RETURN_STATEMENT:
             return init_ast_return_statement(ast);
+        case AST_IMPORT:
+            return init_ast_import(ast);
         case AST_NOOP:
             return init_ast_noop(ast);
         default:
@@ -81,7 +87,14 @@ AstNode *init_ast_if_statement(AstNode *node) {
     node->data = (AstData) {.if_statement = (IfStatement) {
             .body_node = init_list(sizeof(AstNode *)),
             .else_node = init_list(sizeof(AstNode *)),
-            .condition = init_expression_p(),
+            .condition = NULL,
+    }};
+    return node;
+}
+
+AstNode *init_ast_loop_statement(AstNode *node) {
+    node->data = (AstData) {.loop_statement = (LoopStatement) {
+            .body = init_list(sizeof(AstNode *)),
     }};
     return node;
 }
@@ -91,7 +104,74 @@ AstNode *init_ast_return_statement(AstNode *node) {
     return node;
 }
 
+AstNode *init_ast_import(AstNode *node) {
+    node->data = (AstData) {.import = (Import) {}};
+    return node;
+}
+
 AstNode *init_ast_noop(AstNode *node) {
     node->data = (AstData) {};
     return node;
 }
+
+AstNode *init_ast_literal(DataType type, Value value) {
+    AstNode *node = init_ast(AST_EXPRESSION);
+    node->data.expression.kind = EXPRESSION_LITERAL;
+    node->data.expression.value = init_literal_value(type, value);
+    node->data.expression.contains_variables = 0;
+    return node;
+}
+
+AstNode *init_ast_variable(char *name) {
+    AstNode *node = init_ast(AST_EXPRESSION);
+    node->data.expression.kind = EXPRESSION_VARIABLE;
+    node->data.expression.variable_name = name;
+    node->data.expression.contains_variables = 1;
+    return node;
+}
+
+AstNode *init_ast_binary_expression(TokenType operator, AstNode *left, AstNode *right) {
+    AstNode *node = init_ast(AST_EXPRESSION);
+    node->data.expression.kind = EXPRESSION_BINARY;
+    node->data.expression.operator = operator;
+    node->data.expression.left = left;
+    node->data.expression.right = right;
+    node->data.expression.contains_variables = ast_contains_variables(left) || ast_contains_variables(right);
+    return node;
+}
+
+AstNode *init_ast_unary_expression(TokenType operator, AstNode *operand) {
+    AstNode *node = init_ast(AST_EXPRESSION);
+    node->data.expression.kind = EXPRESSION_UNARY;
+    node->data.expression.operator = operator;
+    node->data.expression.left = operand;
+    node->data.expression.contains_variables = ast_contains_variables(operand);
+    return node;
+}
+
+/*
+Whether the value of an expression node depends on anything
+that is not known at compile time (variables or function calls).
+*/
+int ast_contains_variables(const AstNode *node) {
+    if (node->type == AST_EXPRESSION)
+        return node->data.expression.contains_variables;
+    return 1;
+}
+
+/*
+Whether `node` is a && or a ||, whose right operand only runs if the left one doesn't decide.
+*/
+int ast_is_short_circuit(const AstNode *node) {
+    return node->type == AST_EXPRESSION && node->data.expression.kind == EXPRESSION_BINARY &&
+           (node->data.expression.operator == AND || node->data.expression.operator == OR);
+}
+
+/*
+Sets the source position of `node` to the position of `tok`.
+*/
+AstNode *ast_set_location(AstNode *node, const Token *tok) {
+    node->row = tok->row;
+    node->col = tok->col;
+    return node;
+}
@@ -7,6 +7,7 @@
 #include "../list/list.h"
 
 typedef struct astNode AstNode;
+struct FunctionSignatureStruct;
 
 /**
 \Compound
@@ -34,7 +35,8 @@ Assign new value_expr to a variable.
 */
 typedef struct {
     Token *dst_variable;
-    AstNode *expression; // the expression that will be assigned to the variable (or not, if it is null)
+    AstNode *expression; // the expression that will be assigned to the variable
+    Variable *variable;  // declaration of the assigned variable, set by the resolver
 } Assignment;
 
 /**
@@ -56,6 +58,8 @@ typedef struct {
     char *func_name; // change to some struct..?
     List *args;      // list of AST nodes.
     // type is AST nodes because arguments can be variables, literals or expressions
+    struct FunctionSignatureStruct *signature; // set by the resolver, NULL for builtins (print)
+    AstNode *definition; // set by the resolver, NULL if the function is imported or builtin
 } FunctionCall;
 
 /**
@@ -64,17 +68,37 @@ typedef struct {
 typedef struct {
     List *body_node; // list of AST nodes
     List *else_node; // list of AST nodes
-    Expression *condition;
+    AstNode *condition; // expression
 } IfStatement;
 
+/**
+\LoopStatement
+ A for or while loop. A while loop has no initializer and no step.
+*/
+typedef struct {
+    AstNode *initializer; // declaration or statement that runs before the loop, NULL if none
+    AstNode *condition;   // expression, checked before every iteration
+    AstNode *step;        // assignment that runs after every iteration, NULL if none
+    List *body;           // list of AST nodes
+} LoopStatement;
+
 /**
 \ReturnStatement
  Return value_expr from a function.
 */
 typedef struct {
-    AstNode *value_expr;
+    AstNode *value_expr; // a void literal for `return;`
 } ReturnStatement;
 
+/**
+\Import
+ Import the functions of another source file.
+ Imports may only appear at the beginning of a file.
+*/
+typedef struct {
+    char *path; // path of the imported file, relative to the importing file
+} Import;
+
 typedef enum {
     AST_COMPOUND,             // used as the root node of a file
     AST_EXPRESSION,           // an expression (5+2 or 2*x)
@@ -83,7 +107,9 @@ typedef enum {
     AST_FUNCTION_DEFINITION,
     AST_FUNCTION_CALL,
     AST_IF_STATEMENT,
+    AST_LOOP_STATEMENT,
     AST_RETURN_STATEMENT,
+    AST_IMPORT,
     AST_NOOP, // no operation
 } AstType;
 
@@ -95,11 +121,16 @@ typedef union {
     FunctionDefinition function_definition;
     FunctionCall function_call;
     IfStatement if_statement;
+    LoopStatement loop_statement;
     ReturnStatement return_statement;
+    Import import;
 } AstData;
 
 typedef struct astNode {
     AstType type;
+    unsigned int row; // position in the source, for error reporting
+    unsigned int col;
+    DataType data_type; // type of expressions and function calls, set by the type checker
     AstData data;
 } AstNode;
 
@@ -121,8 +152,26 @@ AstNode *init_ast_function_call(AstNode *node);
 
 AstNode *init_ast_if_statement(AstNode *node);
 
+AstNode *init_ast_loop_statement(AstNode *node);
+
 AstNode *init_ast_return_statement(AstNode *node);
 
+AstNode *init_ast_import(AstNode *node);
+
 AstNode *init_ast_noop(AstNode *node);
 
+AstNode *init_ast_literal(DataType type, Value value);
+
+AstNode *init_ast_variable(char *name);
+
+AstNode *init_ast_binary_expression(TokenType operator, AstNode *left, AstNode *right);
+
+AstNode *init_ast_unary_expression(TokenType operator, AstNode *operand);
+
+int ast_contains_variables(const AstNode *node);
+
+int ast_is_short_circuit(const AstNode *node);
+
+AstNode *ast_set_location(AstNode *node, const Token *tok);
+
 #endif //INFINITY_COMPILER_AST_H
@@ -0,0 +1,534 @@
+#include "ast_image.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../hashmap/hashmap.h"
+#include "../visitor/visitor.h"
+#include "../io/io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef MAP_FIXED_NOREPLACE // before Linux 4.17 the address is only a hint, a different one is relocated
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+/*
+Binary image of a parsed tree, to skip lexing and parsing an unchanged source.
+
+The image holds the nodes, lists, strings, tokens, variables and literals of the
+tree in their in-memory layout, and is used in place once it is mapped. Every
+pointer holds the address its object has when the image is mapped at the base
+address in the header, chosen from the source hash in a range of the address
+space that is usually free (0 is NULL, the header is at the base). Loading maps
+the file privately at that address, then only checks the header.
+
+When something else is mapped there, the image is mapped anywhere and moved like
+a dynamic linker does: the relocation table lists the offset of every pointer,
+and the distance between the two addresses is added to each of them.
+
+    header       AstImageHeader
+    objects      nodes, lists and everything they point to, each string once
+    relocations  relocations_len * u32, offsets of the pointers
+
+Images are only valid for the source they were made from (its hash and length
+are in the header) and for the build that wrote them (the layout fingerprint).
+The header and the relocation table have hashes, the objects are trusted.
+*/
+
+#define AST_IMAGE_MAGIC "IAST"
+#define AST_IMAGE_VERSION 5
+#define AST_IMAGES_MAX 1024
+#define AST_IMAGE_BASE_MIN 0x100000000000ULL // 16 TiB
+#define AST_IMAGE_BASE_SLOTS 4096            // of AST_IMAGE_LEN_MAX bytes, up to 32 TiB
+#define AST_IMAGE_LEN_MAX 0x100000000ULL     // offsets in the relocation table are 32 bit
+
+_Static_assert(sizeof(void *) == sizeof(uint64_t), "AST images store 64 bit pointers");
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t layout;          // sizes of the structs in the image, changes with the AST
+    uint64_t src_hash;
+    uint64_t src_len;
+    uint64_t base;            // address the pointers are written for
+    uint64_t root;            // offset of the root node
+    uint64_t relocations;     // offset of the relocation table
+    uint64_t relocations_len;
+    uint64_t relocations_hash;
+    uint64_t image_len;
+    uint64_t header_hash;     // hash of the fields above
+} AstImageHeader;
+
+/**
+\ImageWriter
+ The image being written, and the offsets of its pointers.
+*/
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+    uint64_t base;
+    uint32_t *relocations;
+    size_t relocations_len;
+    size_t relocations_capacity;
+    HashMap *strings;         // string -> its offset, to write each string once
+    size_t *written;          // offsets of the nodes written whose parent isn't yet, in walk order
+    size_t written_len;
+    size_t written_capacity;
+} ImageWriter;
+
+/**
+\MappedImage
+ A loaded image. Its nodes are not allocated with malloc, they must not be freed.
+*/
+typedef struct {
+    const unsigned char *start;
+    size_t len;
+} MappedImage;
+
+static MappedImage mapped_images[AST_IMAGES_MAX];
+static size_t mapped_images_len = 0;
+static pthread_mutex_t mapped_images_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint temp_files = 0;
+
+static uint64_t ast_image_layout(void) {
+    return (uint64_t) sizeof(AstNode) | (uint64_t) sizeof(List) << 12 | (uint64_t) sizeof(Token) << 24 |
+           (uint64_t) sizeof(Variable) << 36 | (uint64_t) sizeof(LiteralValue) << 48 |
+           (uint64_t) AST_NOOP << 56;
+}
+
+static uint64_t hash_bytes(const void *bytes, size_t len) {
+    const unsigned char *p = bytes;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+Reserves `size` zeroed bytes in the image, aligned to `align`. Returns their offset.
+*/
+static size_t image_alloc(ImageWriter *writer, size_t size, size_t align) {
+    size_t offset = (writer->len + align - 1) & ~(align - 1);
+
+    if (offset + size > writer->capacity) {
+        writer->capacity = MAX(writer->capacity * 2, offset + size);
+        writer->data = realloc(writer->data, writer->capacity);
+        if (!writer->data)
+            log_error(COMPILER, "Can't allocate memory for AST image.");
+    }
+    memset(writer->data + writer->len, 0, offset + size - writer->len);
+    writer->len = offset + size;
+    return offset;
+}
+
+/*
+Points the pointer at offset `field` to the object at offset `target` (0 for NULL).
+*/
+static void image_set_pointer(ImageWriter *writer, size_t field, size_t target) {
+    uint64_t value = target ? writer->base + target : 0;
+
+    memcpy(writer->data + field, &value, sizeof(value));
+    if (!target)
+        return;
+    if (writer->relocations_len == writer->relocations_capacity) {
+        writer->relocations_capacity = MAX(writer->relocations_capacity * 2, 64);
+        writer->relocations = realloc(writer->relocations, writer->relocations_capacity * sizeof(uint32_t));
+        if (!writer->relocations)
+            log_error(COMPILER, "Can't allocate memory for AST image.");
+    }
+    writer->relocations[writer->relocations_len++] = (uint32_t) field;
+}
+
+static size_t write_string(ImageWriter *writer, const char *str) {
+    size_t offset, len;
+
+    if (!str)
+        return 0;
+    offset = (size_t) hashmap_get(writer->strings, str);
+    if (offset)
+        return offset;
+    len = strlen(str) + 1;
+    offset = image_alloc(writer, len, 1);
+    memcpy(writer->data + offset, str, len);
+    hashmap_put(writer->strings, str, (void *) offset);
+    return offset;
+}
+
+static size_t write_literal(ImageWriter *writer, const LiteralValue *value) {
+    LiteralValue copy = {.type = value->type};
+    size_t offset = image_alloc(writer, sizeof(LiteralValue), _Alignof(LiteralValue));
+
+    if (value->type != TYPE_STRING && value->type != TYPE_VOID)
+        copy.value = value->value;
+    memcpy(writer->data + offset, &copy, sizeof(copy));
+    if (value->type == TYPE_STRING)
+        image_set_pointer(writer, offset + offsetof(LiteralValue, value.string_value),
+                          write_string(writer, value->value.string_value));
+    return offset;
+}
+
+static size_t write_variable(ImageWriter *writer, const Variable *variable) {
+    size_t offset = image_alloc(writer, sizeof(Variable), _Alignof(Variable));
+
+    image_set_pointer(writer, offset + offsetof(Variable, name), write_string(writer, variable->name));
+    image_set_pointer(writer, offset + offsetof(Variable, value), write_literal(writer, variable->value));
+    return offset;
+}
+
+static size_t write_token(ImageWriter *writer, const Token *token) {
+    Token copy = {.type = token->type, .row = token->row, .col = token->col, .idx = token->idx};
+    size_t offset = image_alloc(writer, sizeof(Token), _Alignof(Token));
+
+    memcpy(writer->data + offset, &copy, sizeof(copy));
+    image_set_pointer(writer, offset + offsetof(Token, value), write_string(writer, token->value));
+    return offset;
+}
+
+/*
+Writes a list whose items were written at `items_offsets` (a list of nodes),
+or are written by `write_item` (a list of anything else).
+*/
+static size_t write_list(ImageWriter *writer, const List *list, const size_t *items_offsets,
+                         size_t (*write_item)(ImageWriter *, const void *)) {
+    List copy = {.size = list->size, .item_size = list->item_size};
+    size_t offset = image_alloc(writer, sizeof(List), _Alignof(List)), items, i;
+
+    memcpy(writer->data + offset, &copy, sizeof(copy));
+    if (list->size == 0)
+        return offset;
+    items = image_alloc(writer, list->size * sizeof(void *), _Alignof(void *));
+    image_set_pointer(writer, offset + offsetof(List, items), items);
+    for (i = 0; i < list->size; i++)
+        image_set_pointer(writer, items + i * sizeof(void *),
+                          items_offsets ? items_offsets[i] : write_item(writer, list->items[i]));
+    return offset;
+}
+
+static size_t write_variable_item(ImageWriter *writer, const void *variable) {
+    return write_variable(writer, variable);
+}
+
+/*
+Number of children of `node`, in the order the walk visits them.
+*/
+static size_t children_count(const AstNode *node) {
+    const AstData *data = &node->data;
+
+    switch (node->type) {
+        case AST_COMPOUND:
+            return data->compound.children->size;
+        case AST_EXPRESSION:
+            return (data->expression.left != NULL) + (data->expression.right != NULL);
+        case AST_VARIABLE_DECLARATION:
+            return data->variable_declaration.value != NULL;
+        case AST_ASSIGNMENT:
+            return data->assignment.expression != NULL;
+        case AST_FUNCTION_DEFINITION:
+            return data->function_definition.body->size;
+        case AST_FUNCTION_CALL:
+            return data->function_call.args->size;
+        case AST_IF_STATEMENT:
+            return (data->if_statement.condition != NULL) + data->if_statement.body_node->size +
+                   data->if_statement.else_node->size;
+        case AST_LOOP_STATEMENT:
+            return (data->loop_statement.initializer != NULL) + (data->loop_statement.condition != NULL) +
+                   data->loop_statement.body->size + (data->loop_statement.step != NULL);
+        case AST_RETURN_STATEMENT:
+            return data->return_statement.value_expr != NULL;
+        default:
+            return 0;
+    }
+}
+
+/*
+Offset of the next child of a node, 0 for a NULL child.
+*/
+static size_t next_child(const size_t **children, const void *child) {
+    return child ? *(*children)++ : 0;
+}
+
+#define NODE_FIELD(field) (offset + offsetof(AstNode, data.field))
+
+/*
+Writes a node, once all its children are written (post-order),
+and everything else it points to. The bindings of the resolver are not written.
+*/
+static void write_node(AstNode *node, void *context) {
+    ImageWriter *writer = context;
+    const AstData *data = &node->data;
+    AstNode copy = {.type = node->type, .row = node->row, .col = node->col, .data_type = node->data_type};
+    const size_t *children;
+    size_t offset;
+
+    writer->written_len -= children_count(node);
+    children = writer->written + writer->written_len;
+
+    switch (node->type) {
+        case AST_EXPRESSION:
+            copy.data.expression.kind = data->expression.kind;
+            copy.data.expression.operator = data->expression.operator;
+            copy.data.expression.contains_variables = data->expression.contains_variables;
+            break;
+        case AST_FUNCTION_DEFINITION:
+            copy.data.function_definition.returnType = data->function_definition.returnType;
+            break;
+        default:
+            break;
+    }
+    offset = image_alloc(writer, sizeof(AstNode), _Alignof(AstNode));
+    memcpy(writer->data + offset, &copy, sizeof(copy));
+
+    switch (node->type) {
+        case AST_COMPOUND:
+            image_set_pointer(writer, NODE_FIELD(compound.children),
+                              write_list(writer, data->compound.children, children, NULL));
+            break;
+        case AST_EXPRESSION:
+            image_set_pointer(writer, NODE_FIELD(expression.left), next_child(&children, data->expression.left));
+            image_set_pointer(writer, NODE_FIELD(expression.right), next_child(&children, data->expression.right));
+            image_set_pointer(writer, NODE_FIELD(expression.variable_name),
+                              write_string(writer, data->expression.variable_name));
+            if (data->expression.value)
+                image_set_pointer(writer, NODE_FIELD(expression.value),
+                                  write_literal(writer, data->expression.value));
+            break;
+        case AST_VARIABLE_DECLARATION:
+            image_set_pointer(writer, NODE_FIELD(variable_declaration.var),
+                              write_variable(writer, data->variable_declaration.var));
+            image_set_pointer(writer, NODE_FIELD(variable_declaration.value),
+                              next_child(&children, data->variable_declaration.value));
+            break;
+        case AST_ASSIGNMENT:
+            image_set_pointer(writer, NODE_FIELD(assignment.dst_variable),
+                              write_token(writer, data->assignment.dst_variable));
+            image_set_pointer(writer, NODE_FIELD(assignment.expression),
+                              next_child(&children, data->assignment.expression));
+            break;
+        case AST_FUNCTION_DEFINITION:
+            image_set_pointer(writer, NODE_FIELD(function_definition.func_name),
+                              write_string(writer, data->function_definition.func_name));
+            image_set_pointer(writer, NODE_FIELD(function_definition.args),
+                              write_list(writer, data->function_definition.args, NULL, write_variable_item));
+            image_set_pointer(writer, NODE_FIELD(function_definition.body),
+                              write_list(writer, data->function_definition.body, children, NULL));
+            break;
+        case AST_FUNCTION_CALL:
+            image_set_pointer(writer, NODE_FIELD(function_call.func_name),
+                              write_string(writer, data->function_call.func_name));
+            image_set_pointer(writer, NODE_FIELD(function_call.args),
+                              write_list(writer, data->function_call.args, children, NULL));
+            break;
+        case AST_IF_STATEMENT:
+            image_set_pointer(writer, NODE_FIELD(if_statement.condition),
+                              next_child(&children, data->if_statement.condition));
+            image_set_pointer(writer, NODE_FIELD(if_statement.body_node),
+                              write_list(writer, data->if_statement.body_node, children, NULL));
+            children += data->if_statement.body_node->size;
+            image_set_pointer(writer, NODE_FIELD(if_statement.else_node),
+                              write_list(writer, data->if_statement.else_node, children, NULL));
+            break;
+        case AST_LOOP_STATEMENT:
+            image_set_pointer(writer, NODE_FIELD(loop_statement.initializer),
+                              next_child(&children, data->loop_statement.initializer));
+            image_set_pointer(writer, NODE_FIELD(loop_statement.condition),
+                              next_child(&children, data->loop_statement.condition));
+            image_set_pointer(writer, NODE_FIELD(loop_statement.body),
+                              write_list(writer, data->loop_statement.body, children, NULL));
+            children += data->loop_statement.body->size;
+            image_set_pointer(writer, NODE_FIELD(loop_statement.step), next_child(&children, data->loop_statement.step));
+            break;
+        case AST_RETURN_STATEMENT:
+            image_set_pointer(writer, NODE_FIELD(return_statement.value_expr),
+                              next_child(&children, data->return_statement.value_expr));
+            break;
+        case AST_IMPORT:
+            image_set_pointer(writer, NODE_FIELD(import.path), write_string(writer, data->import.path));
+            break;
+        default: // noops
+            break;
+    }
+
+    if (writer->written_len == writer->written_capacity) {
+        writer->written_capacity = MAX(writer->written_capacity * 2, 64);
+        writer->written = realloc(writer->written, writer->written_capacity * sizeof(size_t));
+        if (!writer->written)
+            log_error(COMPILER, "Can't allocate memory for AST image.");
+    }
+    writer->written[writer->written_len++] = offset;
+}
+
+/*
+Writes `len` bytes to a new file next to `path`, renamed over it once complete so a
+reader never maps a half written image. The file gets the permissions fopen gives.
+Returns 0 on success.
+*/
+static int write_file_atomically(const char *path, const void *data, size_t len) {
+    char *tmp_path;
+    FILE *fp = NULL;
+    int fd, result = 0;
+
+    if (alsprintf(&tmp_path, "%s.%ld.%u.tmp", path, (long) getpid(), atomic_fetch_add(&temp_files, 1)) < 0)
+        log_error(COMPILER, "Can't allocate memory for AST image.");
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0666); // the umask applies, like with fopen
+    if (fd >= 0 && !(fp = fdopen(fd, "wb")))
+        close(fd);
+    if (!fp || fwrite(data, 1, len, fp) != len)
+        result = -1;
+    if (fp && fclose(fp) != 0)
+        result = -1;
+    if (fd >= 0 && (result != 0 || rename(tmp_path, path) != 0)) {
+        unlink(tmp_path);
+        result = -1;
+    }
+    free(tmp_path);
+    return result;
+}
+
+/*
+Writes the image of the tree parsed from `src` to `path`.
+Returns 0 on success.
+*/
+int ast_image_write(const char *path, const AstNode *root, const char *src) {
+    ImageWriter writer = {.strings = init_hashmap(1024)};
+    AstImageHeader header = {
+            .magic = AST_IMAGE_MAGIC, .version = AST_IMAGE_VERSION, .layout = ast_image_layout(),
+            .src_hash = hash_string(src), .src_len = strlen(src),
+    };
+    size_t header_offset = image_alloc(&writer, sizeof(AstImageHeader), _Alignof(AstImageHeader));
+    AstVisitor visitor = {.post = write_node, .context = &writer};
+    int result = -1;
+
+    header.base = writer.base = AST_IMAGE_BASE_MIN + header.src_hash % AST_IMAGE_BASE_SLOTS * AST_IMAGE_LEN_MAX;
+    ast_walk((AstNode *) root, &visitor);
+    header.root = writer.written_len > 0 ? writer.written[0] : 0;
+    header.relocations = image_alloc(&writer, writer.relocations_len * sizeof(uint32_t), _Alignof(uint32_t));
+    header.relocations_len = writer.relocations_len;
+    if (writer.relocations_len > 0)
+        memcpy(writer.data + header.relocations, writer.relocations, writer.relocations_len * sizeof(uint32_t));
+    header.relocations_hash = hash_bytes(writer.data + header.relocations, writer.relocations_len * sizeof(uint32_t));
+    header.image_len = writer.len;
+    header.header_hash = hash_bytes(&header, offsetof(AstImageHeader, header_hash));
+    memcpy(writer.data + header_offset, &header, sizeof(header));
+
+    if (writer.len <= AST_IMAGE_LEN_MAX)
+        result = write_file_atomically(path, writer.data, writer.len);
+    free(writer.data);
+    free(writer.relocations);
+    hashmap_dispose(writer.strings);
+    free(writer.written);
+    return result;
+}
+
+/*
+Returns 1 if the header is intact, and is the one of an image of `src` that fits in `len` bytes.
+*/
+static int ast_image_header_valid(const AstImageHeader *header, size_t len, const char *src) {
+    return memcmp(header->magic, AST_IMAGE_MAGIC, 4) == 0 && header->version == AST_IMAGE_VERSION &&
+           header->layout == ast_image_layout() &&
+           header->header_hash == hash_bytes(header, offsetof(AstImageHeader, header_hash)) &&
+           header->image_len == len && len <= AST_IMAGE_LEN_MAX &&
+           header->src_len == strlen(src) && header->src_hash == hash_string(src) &&
+           header->base >= AST_IMAGE_BASE_MIN &&
+           header->base < AST_IMAGE_BASE_MIN + AST_IMAGE_BASE_SLOTS * AST_IMAGE_LEN_MAX &&
+           header->base % AST_IMAGE_LEN_MAX == 0 &&
+           header->relocations >= sizeof(AstImageHeader) + sizeof(AstNode) && header->relocations <= len &&
+           header->relocations % _Alignof(uint32_t) == 0 &&
+           header->relocations_len <= (len - header->relocations) / sizeof(uint32_t) &&
+           header->root >= sizeof(AstImageHeader) && header->root <= header->relocations - sizeof(AstNode) &&
+           header->root % _Alignof(AstNode) == 0;
+}
+
+/*
+Moves the pointers of an image mapped at `image` instead of its base address.
+Returns 0 if the relocation table is damaged.
+*/
+static int ast_image_relocate(unsigned char *image, const AstImageHeader *header) {
+    const uint32_t *relocations = (const uint32_t *) (image + header->relocations);
+    uint64_t pointer, delta = (uintptr_t) image - header->base;
+    size_t i;
+
+    if (header->relocations_hash != hash_bytes(relocations, header->relocations_len * sizeof(uint32_t)))
+        return 0;
+    for (i = 0; i < header->relocations_len; i++) {
+        if (relocations[i] < sizeof(AstImageHeader) || relocations[i] > header->relocations - sizeof(uint64_t))
+            return 0;
+        memcpy(&pointer, image + relocations[i], sizeof(pointer));
+        // the pointers and what they point to lie between the header and the relocation table
+        if (pointer - header->base < sizeof(AstImageHeader) || pointer - header->base >= header->relocations)
+            return 0;
+        pointer += delta;
+        memcpy(image + relocations[i], &pointer, sizeof(pointer));
+    }
+    return 1;
+}
+
+/*
+Maps the image at `path` and returns its root, ready to use in place.
+Returns NULL if the image is missing, damaged, or not made from `src`.
+*/
+AstNode *ast_image_load(const char *path, const char *src) {
+    AstImageHeader header;
+    struct stat st;
+    unsigned char *image;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        !ast_image_header_valid(&header, st.st_size, src)) {
+        close(fd);
+        return NULL;
+    }
+    // private, so the passes can write to the tree without changing the file
+    image = mmap((void *) (uintptr_t) header.base, st.st_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, 0);
+    if (image == MAP_FAILED)
+        image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return NULL;
+    if ((uintptr_t) image != header.base && !ast_image_relocate(image, &header))
+        goto invalid;
+
+    pthread_mutex_lock(&mapped_images_mutex);
+    if (mapped_images_len == AST_IMAGES_MAX) {
+        pthread_mutex_unlock(&mapped_images_mutex);
+        goto invalid;
+    }
+    mapped_images[mapped_images_len++] = (MappedImage) {.start = image, .len = st.st_size};
+    pthread_mutex_unlock(&mapped_images_mutex);
+    return (AstNode *) (image + header.root);
+
+    invalid:
+    munmap(image, st.st_size);
+    return NULL;
+}
+
+/*
+Returns 1 if `ptr` points into a loaded image.
+*/
+int ast_image_owns(const void *ptr) {
+    const unsigned char *p = ptr;
+    size_t i;
+    int owns = 0;
+
+    pthread_mutex_lock(&mapped_images_mutex);
+    for (i = 0; i < mapped_images_len && !owns; i++)
+        owns = p >= mapped_images[i].start && p < mapped_images[i].start + mapped_images[i].len;
+    pthread_mutex_unlock(&mapped_images_mutex);
+    return owns;
+}
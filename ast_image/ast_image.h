@@ -0,0 +1,14 @@
+#ifndef INFINITY_COMPILER_AST_IMAGE_H
+#define INFINITY_COMPILER_AST_IMAGE_H
+
+#include "../ast/ast.h"
+
+#define AST_IMAGE_EXTENSION ".astbin"
+
+int ast_image_write(const char *path, const AstNode *root, const char *src);
+
+AstNode *ast_image_load(const char *path, const char *src);
+
+int ast_image_owns(const void *ptr);
+
+#endif //INFINITY_COMPILER_AST_IMAGE_H
@@ -0,0 +1,384 @@
+#include "../list/list.h"
+#include "../lexer/lexer.h"
+#include "../token/token.h"
+#include "../ast/ast.h"
+#include "../io/io.h"
+#include "../config/globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+Microbenchmarks for the hot primitives of the compiler.
+
+Every benchmark is run a few times to warm up caches and the allocator,
+then sampled repeatedly. Each sample times one full run of the benchmark body
+and is divided by the amount of operations the body performs, so all the
+results are reported as nanoseconds per operation.
+
+Usage: bench_micro [--samples N] [--warmup N] [filter]
+Only benchmarks whose name contains `filter` are run.
+*/
+
+#define DEFAULT_SAMPLES 51
+#define DEFAULT_WARMUP 5
+
+#define LIST_OPS 4096
+#define LIST_INSERT_OPS 1024
+#define LEXER_UNITS 2048
+#define AST_NODES 4096
+#define ALSPRINTF_OPS 4096
+
+typedef struct {
+    const char *name;
+    size_t ops;                  // operations performed by one run of `run`
+    void (*setup)(void *ctx);    // untimed, before each run
+    void (*run)(void *ctx);      // timed
+    void (*teardown)(void *ctx); // untimed, after each run
+    void *ctx;
+} Benchmark;
+
+static int samples_count = DEFAULT_SAMPLES;
+static int warmup_count = DEFAULT_WARMUP;
+
+// prevents the compiler from optimizing away benchmark results
+static volatile size_t sink;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+Returns the value at percentile `p` (0..100) of a sorted array,
+using the nearest-rank method.
+*/
+static double percentile(const double *sorted, int len, double p) {
+    double position = p / 100 * len;
+    int rank = (int) position; // the smallest rank covering p percent is ceil(position)
+
+    if (rank < position)
+        rank++;
+    return sorted[MIN(MAX(rank - 1, 0), len - 1)];
+}
+
+static void bench_run(const Benchmark *bench) {
+    int i;
+    double start, *samples = malloc(samples_count * sizeof(double));
+
+    for (i = 0; i < warmup_count; i++) {
+        if (bench->setup) bench->setup(bench->ctx);
+        bench->run(bench->ctx);
+        if (bench->teardown) bench->teardown(bench->ctx);
+    }
+
+    for (i = 0; i < samples_count; i++) {
+        if (bench->setup) bench->setup(bench->ctx);
+        start = now_ns();
+        bench->run(bench->ctx);
+        samples[i] = (now_ns() - start) / (double) bench->ops;
+        if (bench->teardown) bench->teardown(bench->ctx);
+    }
+
+    qsort(samples, samples_count, sizeof(double), compare_doubles);
+    printf("%-36s %8zu %10.2f %10.2f %10.2f %10.2f\n", bench->name, bench->ops,
+           samples[0],
+           percentile(samples, samples_count, 50),
+           percentile(samples, samples_count, 90),
+           percentile(samples, samples_count, 99));
+    free(samples);
+}
+
+/** List */
+
+typedef struct {
+    List *list;
+    size_t ops;
+} ListContext;
+
+static int list_value;
+
+static void list_setup_empty(void *ctx) {
+    ((ListContext *) ctx)->list = init_list(sizeof(void *));
+}
+
+static void list_setup_full(void *ctx) {
+    ListContext *c = ctx;
+    size_t i;
+    c->list = init_list(sizeof(void *));
+    for (i = 0; i < c->ops; i++)
+        list_push(c->list, &list_value);
+}
+
+static void list_teardown(void *ctx) {
+    // items are not owned by the list, so list_dispose can't be used
+    List *list = ((ListContext *) ctx)->list;
+    sink += list->size;
+    free(list->items);
+    free(list);
+}
+
+static void list_push_run(void *ctx) {
+    ListContext *c = ctx;
+    size_t i;
+    for (i = 0; i < c->ops; i++)
+        list_push(c->list, &list_value);
+}
+
+static void list_pop_run(void *ctx) {
+    ListContext *c = ctx;
+    size_t i;
+    for (i = 0; i < c->ops; i++)
+        sink += (size_t) list_pop(c->list);
+}
+
+static void list_insert_run(void *ctx) {
+    ListContext *c = ctx;
+    size_t i;
+    list_push(c->list, &list_value);
+    for (i = 1; i < c->ops; i++)
+        list_insert(c->list, 0, &list_value);
+}
+
+/** Lexer */
+
+typedef struct {
+    const char *unit; // source snippet that is repeated to build the input
+    char *src;
+    Lexer *lexer;
+    Token **tokens;
+    size_t tokens_len;
+} LexerContext;
+
+static char *repeat_string(const char *unit, size_t times) {
+    size_t unit_len = strlen(unit), i;
+    char *str = malloc(unit_len * times + 1);
+    for (i = 0; i < times; i++)
+        memcpy(str + i * unit_len, unit, unit_len);
+    str[unit_len * times] = '\0';
+    return str;
+}
+
+static void lexer_setup(void *ctx) {
+    LexerContext *c = ctx;
+    c->lexer = init_lexer(c->src);
+    c->tokens_len = 0;
+}
+
+static void lexer_teardown(void *ctx) {
+    LexerContext *c = ctx;
+    size_t i;
+    for (i = 0; i < c->tokens_len; i++)
+        token_dispose(c->tokens[i]);
+    lexer_dispose(c->lexer);
+}
+
+static void lexer_next_token_run(void *ctx) {
+    LexerContext *c = ctx;
+    Token *tok;
+    while ((tok = lexer_next_token(c->lexer))->type != EOF_TOKEN)
+        c->tokens[c->tokens_len++] = tok;
+    c->tokens[c->tokens_len++] = tok;
+}
+
+static void lexer_parse_string_token_run(void *ctx) {
+    LexerContext *c = ctx;
+    while (c->lexer->c == '"') {
+        c->tokens[c->tokens_len++] = lexer_parse_string_token(c->lexer);
+        lexer_forward(c->lexer); // closing quote
+        lexer_skip_whitespace(c->lexer);
+    }
+}
+
+/*
+Builds the input of a lexer benchmark and returns
+the amount of tokens `run` produces from it.
+*/
+static size_t lexer_context_prepare(LexerContext *c, void (*run)(void *)) {
+    Token *tok;
+    Lexer *lexer;
+    size_t count = 0;
+
+    c->src = repeat_string(c->unit, LEXER_UNITS);
+    lexer = init_lexer(c->src);
+    while ((tok = lexer_next_token(lexer))->type != EOF_TOKEN) {
+        token_dispose(tok);
+        count++;
+    }
+    token_dispose(tok);
+    lexer_dispose(lexer);
+    count++; // EOF token
+
+    c->tokens = malloc(count * sizeof(Token *));
+    c->tokens_len = 0;
+    if (run == lexer_parse_string_token_run)
+        count--; // string benchmark does not read the EOF token
+    return count;
+}
+
+/** AST */
+
+typedef struct {
+    AstType type;
+    AstNode *nodes[AST_NODES];
+} AstContext;
+
+static void bench_ast_dispose(AstNode *node) {
+    switch (node->type) {
+        case AST_COMPOUND:
+            list_dispose(node->data.compound.children);
+            break;
+        case AST_FUNCTION_DEFINITION:
+            list_dispose(node->data.function_definition.args);
+            list_dispose(node->data.function_definition.body);
+            break;
+        case AST_FUNCTION_CALL:
+            list_dispose(node->data.function_call.args);
+            break;
+        case AST_IF_STATEMENT:
+            list_dispose(node->data.if_statement.body_node);
+            list_dispose(node->data.if_statement.else_node);
+            break;
+        case AST_LOOP_STATEMENT:
+            list_dispose(node->data.loop_statement.body);
+            break;
+        default:
+            break;
+    }
+    ast_dispose(node);
+}
+
+static void init_ast_run(void *ctx) {
+    AstContext *c = ctx;
+    int i;
+    for (i = 0; i < AST_NODES; i++)
+        c->nodes[i] = init_ast(c->type);
+}
+
+static void init_ast_teardown(void *ctx) {
+    AstContext *c = ctx;
+    int i;
+    for (i = 0; i < AST_NODES; i++)
+        bench_ast_dispose(c->nodes[i]);
+}
+
+static struct {
+    AstType type;
+    char *name;
+} ast_kinds[] = {
+        {AST_COMPOUND, "compound"},
+        {AST_EXPRESSION, "expression"},
+        {AST_VARIABLE_DECLARATION, "variable_declaration"},
+        {AST_ASSIGNMENT, "assignment"},
+        {AST_FUNCTION_DEFINITION, "function_definition"},
+        {AST_FUNCTION_CALL, "function_call"},
+        {AST_IF_STATEMENT, "if_statement"},
+        {AST_LOOP_STATEMENT, "loop_statement"},
+        {AST_RETURN_STATEMENT, "return_statement"},
+        {AST_IMPORT, "import"},
+        {AST_NOOP, "noop"},
+};
+
+/** io */
+
+static void alsprintf_run(void *ctx) {
+    char *buf;
+    int i;
+    for (i = 0; i < ALSPRINTF_OPS; i++) {
+        sink += alsprintf(&buf, "Unexpected token: '%s'. Expecting '%s' at %d", "foo", "<SEMICOLON>", i);
+        free(buf);
+    }
+}
+
+static int matches_filter(const char *name, const char *filter) {
+    return !filter || strstr(name, filter);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = NULL;
+    int i;
+    char *name;
+    ListContext list_ctx[3] = {{.ops = LIST_OPS}, {.ops = LIST_OPS}, {.ops = LIST_INSERT_OPS}};
+    LexerContext lexer_ctx[] = {
+            {.unit = "foo bar_baz x1 counter "},
+            {.unit = "int func return if else "},
+            {.unit = "0 42 1234567 99 "},
+            {.unit = "( ) { } ; , : = "},
+            {.unit = "== >= <= -> ++ -- "},
+            {.unit = "\"hello world\" \"x\" "},
+            {.unit = "// comment\n/- multi\nline -/ a "},
+    };
+    char *lexer_class_names[] = {"identifiers", "keywords", "integers", "punctuation", "operators", "strings",
+                                 "comments"};
+    LexerContext string_ctx = {.unit = "\"line\\n\\ttab \\\"quoted\\\" end\" "};
+    AstContext *ast_ctx;
+    Benchmark bench;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples_count = atoi(argv[++i]);
+            samples_count = MAX(samples_count, 1);
+        }
+        else if (!strcmp(argv[i], "--warmup") && i + 1 < argc)
+            warmup_count = atoi(argv[++i]);
+        else
+            filter = argv[i];
+    }
+
+    printf("%d samples, %d warmup runs. Times are ns/op.\n", samples_count, warmup_count);
+    printf("%-36s %8s %10s %10s %10s %10s\n", "benchmark", "ops", "min", "median", "p90", "p99");
+
+    // list
+    bench = (Benchmark) {"list_push", LIST_OPS, list_setup_empty, list_push_run, list_teardown, &list_ctx[0]};
+    if (matches_filter(bench.name, filter)) bench_run(&bench);
+    bench = (Benchmark) {"list_pop", LIST_OPS, list_setup_full, list_pop_run, list_teardown, &list_ctx[1]};
+    if (matches_filter(bench.name, filter)) bench_run(&bench);
+    bench = (Benchmark) {"list_insert_front", LIST_INSERT_OPS, list_setup_empty, list_insert_run, list_teardown,
+                         &list_ctx[2]};
+    if (matches_filter(bench.name, filter)) bench_run(&bench);
+
+    // lexer, one benchmark per token class
+    for (i = 0; i < ARRLEN(lexer_ctx); i++) {
+        alsprintf(&name, "lexer_next_token/%s", lexer_class_names[i]);
+        if (matches_filter(name, filter)) {
+            bench = (Benchmark) {name, lexer_context_prepare(&lexer_ctx[i], lexer_next_token_run), lexer_setup,
+                                 lexer_next_token_run, lexer_teardown, &lexer_ctx[i]};
+            bench_run(&bench);
+            free(lexer_ctx[i].src);
+            free(lexer_ctx[i].tokens);
+        }
+        free(name);
+    }
+    bench = (Benchmark) {"lexer_parse_string_token/escapes", 0, lexer_setup, lexer_parse_string_token_run,
+                         lexer_teardown, &string_ctx};
+    if (matches_filter(bench.name, filter)) {
+        bench.ops = lexer_context_prepare(&string_ctx, lexer_parse_string_token_run);
+        bench_run(&bench);
+        free(string_ctx.src);
+        free(string_ctx.tokens);
+    }
+
+    // ast, one benchmark per node kind
+    ast_ctx = malloc(sizeof(AstContext));
+    for (i = 0; i < ARRLEN(ast_kinds); i++) {
+        alsprintf(&name, "init_ast/%s", ast_kinds[i].name);
+        ast_ctx->type = ast_kinds[i].type;
+        bench = (Benchmark) {name, AST_NODES, NULL, init_ast_run, init_ast_teardown, ast_ctx};
+        if (matches_filter(name, filter)) bench_run(&bench);
+        free(name);
+    }
+    free(ast_ctx);
+
+    // io
+    bench = (Benchmark) {"alsprintf", ALSPRINTF_OPS, NULL, alsprintf_run, NULL, NULL};
+    if (matches_filter(bench.name, filter)) bench_run(&bench);
+
+    return 0;
+}
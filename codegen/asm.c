@@ -0,0 +1,219 @@
+#include "asm.h"
+
+/*
+Writes a machine program as assembly text, in Intel syntax for GNU as or NASM.
+Everything goes through the writer's buffer: names and numbers are copied and
+formatted in place, nothing is formatted with printf.
+*/
+
+typedef struct {
+    const MachineProgram *program;
+    AsmSyntax syntax;
+    Writer *writer;
+    size_t function; // index of the function being written, labels are local to it
+} AsmOutput;
+
+static void write_label(AsmOutput *out, int label) {
+    writer_puts(out->writer, ".L");
+    writer_int(out->writer, (long) out->function);
+    writer_putc(out->writer, '_');
+    writer_int(out->writer, label);
+}
+
+static void write_size(AsmOutput *out, int size) {
+    if (out->syntax == ASM_GAS)
+        writer_puts(out->writer, size == 8 ? "QWORD PTR " : size == 4 ? "DWORD PTR " : "BYTE PTR ");
+    else
+        writer_puts(out->writer, size == 8 ? "qword " : size == 4 ? "dword " : "byte ");
+}
+
+static void write_memory(AsmOutput *out, const MachineOperand *operand, int sized) {
+    Writer *writer = out->writer;
+
+    if (sized)
+        write_size(out, operand->size);
+    writer_putc(writer, '[');
+    if (operand->reg == REG_RIP) {
+        writer_puts(writer, out->syntax == ASM_GAS ? "rip+" : "rel ");
+        writer_puts(writer, out->program->symbols[operand->symbol].name);
+    } else {
+        writer_puts(writer, register_to_str(operand->reg, 8));
+    }
+    if (operand->value > 0)
+        writer_putc(writer, '+');
+    if (operand->value != 0)
+        writer_int(writer, operand->value);
+    writer_putc(writer, ']');
+}
+
+static void write_operand(AsmOutput *out, const MachineOperand *operand, int sized) {
+    const MachineSymbol *symbol;
+
+    switch (operand->kind) {
+        case OPERAND_REGISTER:
+            if (IS_VIRTUAL_REGISTER(operand->reg)) { // not allocated, for debugging
+                writer_putc(out->writer, 'v');
+                writer_int(out->writer, operand->reg - FIRST_VIRTUAL_REGISTER);
+                break;
+            }
+            writer_puts(out->writer, register_to_str(operand->reg, operand->size));
+            break;
+        case OPERAND_IMMEDIATE:
+            writer_int(out->writer, operand->value);
+            break;
+        case OPERAND_MEMORY:
+            write_memory(out, operand, sized);
+            break;
+        case OPERAND_LABEL:
+            write_label(out, operand->value);
+            break;
+        case OPERAND_SYMBOL:
+            symbol = &out->program->symbols[operand->symbol];
+            writer_puts(out->writer, symbol->name);
+            // GNU as calls undefined functions through the PLT by itself
+            if (out->syntax == ASM_NASM && symbol->section == SECTION_UNDEFINED)
+                writer_puts(out->writer, " wrt ..plt");
+            break;
+        default:
+            break;
+    }
+}
+
+static void write_instruction(AsmOutput *out, const MachineInstruction *instruction) {
+    Writer *writer = out->writer;
+    int sized = instruction->op != X86_LEA; // lea only computes the address
+
+    if (instruction->op == X86_LABEL) {
+        write_label(out, instruction->dst.value);
+        writer_puts(writer, ":\n");
+        return;
+    }
+    writer_putc(writer, '\t');
+    writer_puts(writer, x86_opcode_to_str(instruction->op));
+    if (instruction->op == X86_SETCC || instruction->op == X86_JCC)
+        writer_puts(writer, condition_code_to_str(instruction->cond));
+    if (instruction->dst.kind != OPERAND_NONE) {
+        writer_putc(writer, ' ');
+        write_operand(out, &instruction->dst, sized);
+    }
+    if (instruction->src.kind != OPERAND_NONE) {
+        writer_puts(writer, ", ");
+        write_operand(out, &instruction->src, sized);
+    }
+    writer_putc(writer, '\n');
+}
+
+static void write_function(AsmOutput *out, const MachineFunction *function) {
+    const MachineSymbol *symbol = &out->program->symbols[function->symbol];
+    size_t i;
+
+    if (symbol->global) {
+        writer_puts(out->writer, out->syntax == ASM_GAS ? "\t.globl " : "global ");
+        writer_puts(out->writer, symbol->name);
+        writer_putc(out->writer, '\n');
+    }
+    writer_puts(out->writer, symbol->name);
+    writer_puts(out->writer, ":\n");
+    for (i = 0; i < function->len; i++)
+        write_instruction(out, &function->code[i]);
+}
+
+/*
+A string constant, with escapes for everything but printable ASCII.
+*/
+static void write_string(AsmOutput *out, const char *str) {
+    Writer *writer = out->writer;
+    unsigned char c;
+    int quoted = 0;
+
+    if (out->syntax == ASM_GAS) {
+        writer_puts(writer, "\t.string \"");
+        for (; (c = *str); str++) {
+            if (c == '"' || c == '\\') {
+                writer_putc(writer, '\\');
+                writer_putc(writer, (char) c);
+            } else if (c >= ' ' && c < 127) {
+                writer_putc(writer, (char) c);
+            } else { // octal
+                writer_putc(writer, '\\');
+                writer_putc(writer, (char) ('0' + (c >> 6)));
+                writer_putc(writer, (char) ('0' + ((c >> 3) & 7)));
+                writer_putc(writer, (char) ('0' + (c & 7)));
+            }
+        }
+        writer_puts(writer, "\"\n");
+        return;
+    }
+
+    // NASM strings have no escapes: quoted runs of printable characters, and numbers
+    writer_puts(writer, "\tdb ");
+    for (; (c = *str); str++) {
+        if (c >= ' ' && c < 127 && c != '"') {
+            if (!quoted)
+                writer_putc(writer, '"');
+            quoted = 1;
+            writer_putc(writer, (char) c);
+            continue;
+        }
+        if (quoted)
+            writer_puts(writer, "\", ");
+        quoted = 0;
+        writer_int(writer, c);
+        writer_puts(writer, ", ");
+    }
+    writer_puts(writer, quoted ? "\", 0\n" : "0\n");
+}
+
+static void write_data(AsmOutput *out) {
+    const MachineProgram *program = out->program;
+    Writer *writer = out->writer;
+    size_t i;
+
+    writer_puts(writer, out->syntax == ASM_GAS ? "\t.section .rodata\n" : "section .rodata\n");
+    for (i = 0; i < program->symbols_len; i++) {
+        if (program->symbols[i].section != SECTION_RODATA)
+            continue;
+        writer_puts(writer, program->symbols[i].name);
+        writer_puts(writer, ":\n");
+        write_string(out, program->symbols[i].data);
+    }
+
+    writer_puts(writer, out->syntax == ASM_GAS ? "\t.bss\n\t.align 8\n" : "section .bss\nalignb 8\n");
+    for (i = 0; i < program->symbols_len; i++) {
+        if (program->symbols[i].section != SECTION_BSS)
+            continue;
+        writer_puts(writer, program->symbols[i].name);
+        writer_puts(writer, ":\n");
+        if (program->symbols[i].size == 0)
+            continue;
+        writer_puts(writer, out->syntax == ASM_GAS ? "\t.zero " : "\tresb ");
+        writer_int(writer, (long) program->symbols[i].size);
+        writer_putc(writer, '\n');
+    }
+}
+
+void asm_write(const MachineProgram *program, AsmSyntax syntax, Writer *writer) {
+    AsmOutput out = {.program = program, .syntax = syntax, .writer = writer};
+    size_t i;
+
+    if (syntax == ASM_GAS) {
+        writer_puts(writer, "\t.intel_syntax noprefix\n\t.text\n");
+    } else {
+        for (i = 0; i < program->symbols_len; i++) {
+            if (program->symbols[i].section != SECTION_UNDEFINED)
+                continue;
+            writer_puts(writer, "extern ");
+            writer_puts(writer, program->symbols[i].name);
+            writer_putc(writer, '\n');
+        }
+        writer_puts(writer, "section .text\n");
+    }
+
+    for (out.function = 0; out.function < program->functions->size; out.function++)
+        write_function(&out, program->functions->items[out.function]);
+    write_data(&out);
+
+    // the stack doesn't need to be executable
+    writer_puts(writer, syntax == ASM_GAS ? "\t.section .note.GNU-stack,\"\",@progbits\n"
+                                          : "section .note.GNU-stack noalloc noexec nowrite progbits\n");
+}
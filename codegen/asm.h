@@ -0,0 +1,14 @@
+#ifndef INFINITY_COMPILER_ASM_H
+#define INFINITY_COMPILER_ASM_H
+
+#include "machine.h"
+#include "../io/writer.h"
+
+typedef enum {
+    ASM_GAS,  // GNU as, Intel syntax
+    ASM_NASM,
+} AsmSyntax;
+
+void asm_write(const MachineProgram *program, AsmSyntax syntax, Writer *writer);
+
+#endif //INFINITY_COMPILER_ASM_H
@@ -0,0 +1,676 @@
+#include "codegen.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include "../regalloc/regalloc.h"
+#include "../peephole/peephole.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+x86-64 code generation from the IR, for the System V calling convention.
+
+The values of the IR are virtual registers, except constants, which are immediates.
+The register allocator maps the virtual registers to registers and frame slots once
+a function is compiled. Phis are copies at the end of the predecessors of their
+block. Top level variables are in `infinity_globals`.
+The prologue and epilogue come last, when the frame size and the callee saved
+registers to preserve are known. The program's functions are named `inf_<name>`, and `main` runs the top level
+statements of every module, in import order, then the program's `main`.
+Integers are 32 bit and wrap around, like in the VM.
+*/
+
+#define ARGUMENT_REGISTERS_LEN 6
+#define SLOT_SIZE 8
+#define STACK_ALIGNMENT 16
+#define TOP_LEVEL_SYMBOL "infinity_top_level"
+#define GLOBALS_SYMBOL "infinity_globals"
+
+static const Register argument_registers[ARGUMENT_REGISTERS_LEN] = {
+        REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9,
+};
+
+/**
+\Runtime
+ The symbols of the helper functions every program is linked with.
+*/
+typedef struct {
+    unsigned int print_int;
+    unsigned int print_bool;
+    unsigned int print_string;
+    unsigned int divide;
+    unsigned int globals;
+} Runtime;
+
+typedef struct {
+    MachineProgram *program;
+    IrProgram *ir;
+    IrFunction *source;        // the IR of the function being compiled
+    MachineFunction *function; // the function being compiled
+    MachineFunction **functions; // by IR function index
+    MachineOperand *values;    // by IR value: an immediate or a virtual register
+    size_t values_capacity;
+    int *block_labels;         // by IR block
+    size_t block_labels_capacity;
+    uint32_t block;            // the IR block being compiled
+    int return_label;
+    Runtime runtime;
+} CodeGenerator;
+
+static int value_size(DataType type) {
+    return type == TYPE_STRING ? 8 : 4;
+}
+
+static size_t emit(CodeGenerator *gen, X86Opcode op, MachineOperand dst, MachineOperand src) {
+    return machine_emit(gen->function, op, dst, src);
+}
+
+static MachineOperand new_register(CodeGenerator *gen, int size) {
+    return operand_register(machine_new_register(gen->function), size);
+}
+
+static MachineOperand value_of(CodeGenerator *gen, uint32_t value) {
+    return gen->values[value];
+}
+
+static void load(CodeGenerator *gen, Register reg, MachineOperand value) {
+    emit(gen, X86_MOV, operand_register(reg, value.size), value);
+}
+
+/*
+The number of arguments in registers tells the register allocator which ones the call reads.
+*/
+static void emit_call(CodeGenerator *gen, unsigned int symbol, size_t register_args) {
+    size_t index = emit(gen, X86_CALL, operand_symbol(symbol), NO_OPERAND);
+    gen->function->code[index].cond = (unsigned char) MIN(register_args, ARGUMENT_REGISTERS_LEN);
+}
+
+static MachineOperand global_slot(CodeGenerator *gen, uint32_t global) {
+    return operand_global(gen->runtime.globals, (int) global * SLOT_SIZE, value_size(gen->ir->globals[global]));
+}
+
+static ConditionCode comparison_condition(IrOpcode op) {
+    switch (op) {
+        case IR_LT:
+            return CC_L;
+        case IR_GT:
+            return CC_G;
+        case IR_LE:
+            return CC_LE;
+        case IR_GE:
+            return CC_GE;
+        case IR_NE:
+            return CC_NE;
+        default:
+            return CC_E;
+    }
+}
+
+/*
+The condition of the same comparison with its operands swapped.
+*/
+static ConditionCode mirror_condition(ConditionCode cond) {
+    switch (cond) {
+        case CC_L:
+            return CC_G;
+        case CC_G:
+            return CC_L;
+        case CC_LE:
+            return CC_GE;
+        case CC_GE:
+            return CC_LE;
+        default:
+            return cond;
+    }
+}
+
+static int is_comparison(IrOpcode op) {
+    return op == IR_EQ || op == IR_NE || op == IR_LT || op == IR_GT || op == IR_LE || op == IR_GE;
+}
+
+/*
+Dividing by a constant is inlined, dividing by a variable or by zero calls the
+runtime, which stops the program on division by zero.
+*/
+static void compile_divide(CodeGenerator *gen, MachineOperand left, MachineOperand right) {
+    if (right.kind == OPERAND_IMMEDIATE && right.value == -1) { // idiv would trap on INT_MIN / -1
+        load(gen, REG_RAX, left);
+        emit(gen, X86_NEG, operand_register(REG_RAX, 4), NO_OPERAND);
+    } else if (right.kind == OPERAND_IMMEDIATE && right.value != 0) { // a variable can be a known 0 in SSA
+        load(gen, REG_RAX, left);
+        load(gen, REG_RCX, right);
+        emit(gen, X86_CDQ, NO_OPERAND, NO_OPERAND);
+        emit(gen, X86_IDIV, operand_register(REG_RCX, 4), NO_OPERAND);
+    } else {
+        load(gen, REG_RDI, left);
+        load(gen, REG_RSI, right);
+        emit_call(gen, gen->runtime.divide, 2);
+    }
+}
+
+static void compile_binary(CodeGenerator *gen, const IrInstruction *instruction, MachineOperand result) {
+    MachineOperand left = value_of(gen, instruction->a), right = value_of(gen, instruction->b);
+    MachineOperand result_byte = result;
+
+    result_byte.size = 1;
+    switch (instruction->op) {
+        case IR_ADD:
+            emit(gen, X86_MOV, result, left);
+            emit(gen, X86_ADD, result, right);
+            break;
+        case IR_SUB:
+            emit(gen, X86_MOV, result, left);
+            emit(gen, X86_SUB, result, right);
+            break;
+        case IR_MUL:
+            emit(gen, X86_MOV, result, left);
+            emit(gen, X86_IMUL, result, right);
+            break;
+        case IR_DIV:
+            compile_divide(gen, left, right);
+            emit(gen, X86_MOV, result, operand_register(REG_RAX, 4));
+            break;
+        default: // comparisons
+            if (left.kind == OPERAND_IMMEDIATE) { // cmp takes a constant on the right only
+                emit(gen, X86_MOV, result, left);
+                left = result;
+            }
+            emit(gen, X86_CMP, left, right);
+            machine_emit_condition(gen->function, X86_SETCC, comparison_condition(instruction->op), result_byte);
+            emit(gen, X86_MOVZX, result, result_byte);
+            break;
+    }
+}
+
+static void compile_print(CodeGenerator *gen, const IrInstruction *instruction) {
+    unsigned int symbol;
+
+    switch (instruction->type) {
+        case TYPE_BOOL:
+            symbol = gen->runtime.print_bool;
+            break;
+        case TYPE_STRING:
+            symbol = gen->runtime.print_string;
+            break;
+        default:
+            symbol = gen->runtime.print_int;
+            break;
+    }
+    load(gen, REG_RDI, value_of(gen, instruction->a));
+    emit_call(gen, symbol, 1);
+}
+
+/*
+The first six arguments are passed in registers, the others on the stack,
+which stays aligned to 16 bytes at the call.
+*/
+static void compile_function_call(CodeGenerator *gen, const IrInstruction *instruction, MachineOperand result) {
+    uint32_t *args = ir_list(gen->source, instruction->b);
+    size_t args_len = ir_list_len(gen->source, instruction->b), stack_args, i;
+    MachineOperand arg;
+
+    stack_args = args_len > ARGUMENT_REGISTERS_LEN ? args_len - ARGUMENT_REGISTERS_LEN : 0;
+    if (stack_args % 2)
+        emit(gen, X86_SUB, operand_register(REG_RSP, 8), operand_immediate(SLOT_SIZE));
+    for (i = args_len; i-- > ARGUMENT_REGISTERS_LEN;) {
+        arg = value_of(gen, args[i]);
+        arg.size = 8;
+        emit(gen, X86_PUSH, arg, NO_OPERAND);
+    }
+    for (i = 0; i < args_len && i < ARGUMENT_REGISTERS_LEN; i++)
+        load(gen, argument_registers[i], value_of(gen, args[i]));
+    emit_call(gen, gen->functions[instruction->a]->symbol, args_len);
+    if (stack_args)
+        emit(gen, X86_ADD, operand_register(REG_RSP, 8), operand_immediate((int) (stack_args + stack_args % 2) * SLOT_SIZE));
+    if (result.kind == OPERAND_REGISTER)
+        emit(gen, X86_MOV, result, operand_register(REG_RAX, result.size));
+}
+
+/*
+Arguments after the sixth are above the return address and the saved rbp.
+*/
+static void compile_argument(CodeGenerator *gen, uint32_t index, MachineOperand result) {
+    if (index < ARGUMENT_REGISTERS_LEN)
+        emit(gen, X86_MOV, result, operand_register(argument_registers[index], result.size));
+    else
+        emit(gen, X86_MOV, result,
+             operand_memory(REG_RBP, (int) (2 + index - ARGUMENT_REGISTERS_LEN) * SLOT_SIZE, result.size));
+}
+
+static uint32_t phis_len(const IrFunction *source, uint32_t block) {
+    const IrBlock *target = &source->blocks[block];
+    uint32_t len = 0;
+
+    while (len < target->len && source->instructions[target->code[len]].op == IR_PHI)
+        len++;
+    return len;
+}
+
+/*
+The phis of `target` take their values from the current block: all of them are
+copied to temporaries first, as a phi can be the operand of another.
+*/
+static void compile_phi_copies(CodeGenerator *gen, uint32_t target) {
+    IrFunction *source = gen->source;
+    IrBlock *block = &source->blocks[target];
+    uint32_t index = ir_predecessor_index(source, target, gen->block), len = phis_len(source, target), i;
+    MachineOperand *temporaries;
+    IrInstruction *phi;
+
+    if (len == 0)
+        return;
+    temporaries = malloc(len * sizeof(MachineOperand));
+    if (!temporaries)
+        log_error(CODE_GENERATOR, "Can't allocate memory for code generation.");
+    for (i = 0; i < len; i++) {
+        phi = &source->instructions[block->code[i]];
+        temporaries[i] = new_register(gen, value_size(phi->type));
+        emit(gen, X86_MOV, temporaries[i], value_of(gen, ir_list(source, phi->b)[index]));
+    }
+    for (i = 0; i < len; i++)
+        emit(gen, X86_MOV, value_of(gen, block->code[i]), temporaries[i]);
+    free(temporaries);
+}
+
+/*
+Goes to `target`, through the copies of its phis. The jump is left out if `target` comes next.
+*/
+static void compile_jump(CodeGenerator *gen, uint32_t target) {
+    compile_phi_copies(gen, target);
+    if (target != gen->block + 1)
+        emit(gen, X86_JMP, operand_label(gen->block_labels[target]), NO_OPERAND);
+}
+
+/*
+Sets the flags for a branch on `value`, returns the condition under which it is true.
+A comparison without a register is only used by the branch and compares right here:
+    cmp <left>, <right>
+*/
+static ConditionCode compile_test(CodeGenerator *gen, uint32_t value) {
+    IrInstruction *comparison = &gen->source->instructions[value];
+    MachineOperand condition = value_of(gen, value), left, right;
+    ConditionCode cond;
+
+    if (condition.kind != OPERAND_NONE) {
+        emit(gen, X86_TEST, condition, condition);
+        return CC_NE;
+    }
+    left = value_of(gen, comparison->a);
+    right = value_of(gen, comparison->b);
+    cond = comparison_condition(comparison->op);
+    if (left.kind == OPERAND_IMMEDIATE && right.kind != OPERAND_IMMEDIATE) { // cmp takes a constant on the right only
+        left = right;
+        right = value_of(gen, comparison->a);
+        cond = mirror_condition(cond);
+    } else if (left.kind == OPERAND_IMMEDIATE) {
+        condition = new_register(gen, value_size(gen->source->instructions[comparison->a].type));
+        emit(gen, X86_MOV, condition, left);
+        left = condition;
+    }
+    emit(gen, X86_CMP, left, right);
+    return cond;
+}
+
+/*
+The conditional jump goes straight to a successor without phis, and the other
+one follows:
+    <test>   j<not condition> else   <copies of then>   jmp then
+When both successors have phis, the else edge gets its own copies:
+    ...   jmp then   false: <copies of else>   jmp else
+*/
+static void compile_branch(CodeGenerator *gen, const IrInstruction *instruction) {
+    IrBlock *block = &gen->source->blocks[gen->block];
+    uint32_t taken = block->successors[1], other = block->successors[0];
+    MachineOperand condition = value_of(gen, instruction->a);
+    ConditionCode cond;
+    int when = 0, label;
+
+    if (condition.kind == OPERAND_IMMEDIATE) {
+        compile_jump(gen, block->successors[condition.value ? 0 : 1]);
+        return;
+    }
+    if (phis_len(gen->source, taken) > 0 || (taken == gen->block + 1 && phis_len(gen->source, other) == 0)) {
+        taken = block->successors[0];
+        other = block->successors[1];
+        when = 1;
+    }
+    label = phis_len(gen->source, taken) > 0 ? machine_new_label(gen->function) : gen->block_labels[taken];
+    cond = compile_test(gen, instruction->a);
+    machine_emit_condition(gen->function, X86_JCC, when ? cond : negate_condition(cond), operand_label(label));
+    if (label == gen->block_labels[taken]) {
+        compile_jump(gen, other);
+        return;
+    }
+    compile_phi_copies(gen, other);
+    emit(gen, X86_JMP, operand_label(gen->block_labels[other]), NO_OPERAND);
+    machine_place_label(gen->function, label);
+    compile_jump(gen, taken);
+}
+
+static void compile_instruction(CodeGenerator *gen, uint32_t id) {
+    IrInstruction *instruction = &gen->source->instructions[id];
+    MachineOperand result = value_of(gen, id), value;
+
+    switch (instruction->op) {
+        case IR_CONST:
+        case IR_PHI:
+            break;
+        case IR_STRING:
+            emit(gen, X86_LEA, result, operand_global(machine_add_string(gen->program, gen->ir->strings[instruction->a]),
+                                                      0, 8));
+            break;
+        case IR_ARG:
+            compile_argument(gen, instruction->a, result);
+            break;
+        case IR_NEG:
+            emit(gen, X86_MOV, result, value_of(gen, instruction->a));
+            emit(gen, X86_NEG, result, NO_OPERAND);
+            break;
+        case IR_LOAD_GLOBAL:
+            emit(gen, X86_MOV, result, global_slot(gen, instruction->a));
+            break;
+        case IR_STORE_GLOBAL:
+            value = global_slot(gen, instruction->a);
+            emit(gen, X86_MOV, value, value_of(gen, instruction->b));
+            break;
+        case IR_CALL:
+            compile_function_call(gen, instruction, result);
+            break;
+        case IR_PRINT:
+            compile_print(gen, instruction);
+            break;
+        case IR_JUMP:
+            compile_jump(gen, gen->source->blocks[gen->block].successors[0]);
+            break;
+        case IR_BRANCH:
+            compile_branch(gen, instruction);
+            break;
+        case IR_RETURN:
+            if (instruction->a != IR_NONE)
+                load(gen, REG_RAX, value_of(gen, instruction->a));
+            emit(gen, X86_JMP, operand_label(gen->return_label), NO_OPERAND);
+            break;
+        default:
+            if (result.kind != OPERAND_NONE) // else the branch compares
+                compile_binary(gen, instruction, result);
+            break;
+    }
+}
+
+/*
+Gives every value of the function its operand, before any code is compiled:
+phis are assigned by the copies at the end of their predecessors. A comparison
+only used by the branch at the end of its block gets none, the branch compares
+its operands itself.
+*/
+static void assign_values(CodeGenerator *gen) {
+    IrFunction *source = gen->source;
+    IrInstruction *instruction;
+    IrBlock *block;
+    uint32_t *uses = calloc(source->len + 1, sizeof(uint32_t)), *operands, len, b, i, k;
+
+    if (!uses)
+        log_error(CODE_GENERATOR, "Can't allocate memory for code generation.");
+    if (source->len > gen->values_capacity) {
+        gen->values_capacity = MAX(gen->values_capacity * 2, source->len);
+        gen->values = realloc(gen->values, gen->values_capacity * sizeof(MachineOperand));
+        if (!gen->values)
+            log_error(CODE_GENERATOR, "Can't allocate memory for code generation.");
+    }
+    for (i = 0; i < source->len; i++) {
+        instruction = &source->instructions[i];
+        if (instruction->op == IR_CONST)
+            gen->values[i] = operand_immediate((int) instruction->a);
+        else if (instruction->type != TYPE_VOID && instruction->op != IR_PRINT && instruction->op != IR_NOP)
+            gen->values[i] = new_register(gen, value_size(instruction->type));
+        else
+            gen->values[i] = NO_OPERAND;
+        operands = ir_value_operands(source, instruction, &len);
+        for (k = 0; k < len; k++)
+            uses[operands[k]]++;
+    }
+    for (b = 0; b < source->blocks_len; b++) {
+        block = &source->blocks[b];
+        instruction = &source->instructions[block->code[block->len - 1]];
+        if (instruction->op == IR_BRANCH && is_comparison(source->instructions[instruction->a].op) &&
+            source->instructions[instruction->a].block == b && uses[instruction->a] == 1)
+            gen->values[instruction->a] = NO_OPERAND;
+    }
+    free(uses);
+}
+
+/*
+Once the registers are allocated, the body gets its prologue and epilogue:
+    push rbp   mov rbp, rsp   sub rsp, <frame size>   <save callee saved registers>
+    <body>
+    <restore callee saved registers>   mov rsp, rbp   pop rbp   ret
+*/
+static void end_function(CodeGenerator *gen) {
+    MachineFunction *function = gen->function;
+    MachineInstruction *body;
+    unsigned int callee_saved, reg;
+    size_t body_len, saved_len = 0, index, i;
+    int saved_slots[REGISTERS_LEN];
+
+    machine_place_label(function, gen->return_label);
+    peephole_optimize(function);
+    callee_saved = allocate_registers(function);
+    for (reg = 0; reg < REGISTERS_LEN; reg++) {
+        if (callee_saved & 1u << reg) {
+            function->frame_size += SLOT_SIZE;
+            saved_slots[reg] = -(int) function->frame_size;
+            saved_len++;
+        }
+    }
+    function->frame_size = (function->frame_size + STACK_ALIGNMENT - 1) / STACK_ALIGNMENT * STACK_ALIGNMENT;
+
+    body = function->code;
+    body_len = function->len;
+    function->code = NULL;
+    function->len = function->capacity = 0;
+    emit(gen, X86_PUSH, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_MOV, operand_register(REG_RBP, 8), operand_register(REG_RSP, 8));
+    if (function->frame_size > 0)
+        emit(gen, X86_SUB, operand_register(REG_RSP, 8), operand_immediate((int) function->frame_size));
+    for (reg = 0; saved_len > 0 && reg < REGISTERS_LEN; reg++) {
+        if (callee_saved & 1u << reg)
+            emit(gen, X86_MOV, operand_memory(REG_RBP, saved_slots[reg], 8), operand_register(reg, 8));
+    }
+    for (i = 0; i < body_len; i++) {
+        index = machine_emit(function, body[i].op, body[i].dst, body[i].src);
+        function->code[index].cond = body[i].cond;
+    }
+    free(body);
+    for (reg = 0; saved_len > 0 && reg < REGISTERS_LEN; reg++) {
+        if (callee_saved & 1u << reg)
+            emit(gen, X86_MOV, operand_register(reg, 8), operand_memory(REG_RBP, saved_slots[reg], 8));
+    }
+    emit(gen, X86_MOV, operand_register(REG_RSP, 8), operand_register(REG_RBP, 8));
+    emit(gen, X86_POP, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+    peephole_optimize(function);
+}
+
+/*
+Blocks are laid out in the order of the IR, with a label each, except the ones
+nothing jumps to. Every path ends with a return, which jumps to the epilogue.
+*/
+static void compile_function(CodeGenerator *gen, IrFunction *source, MachineFunction *function) {
+    IrBlock *block;
+    uint32_t b, i;
+
+    gen->source = source;
+    gen->function = function;
+    gen->return_label = machine_new_label(function);
+    if (source->blocks_len > gen->block_labels_capacity) {
+        gen->block_labels_capacity = MAX(gen->block_labels_capacity * 2, source->blocks_len);
+        gen->block_labels = realloc(gen->block_labels, gen->block_labels_capacity * sizeof(int));
+        if (!gen->block_labels)
+            log_error(CODE_GENERATOR, "Can't allocate memory for code generation.");
+    }
+    for (b = 0; b < source->blocks_len; b++)
+        gen->block_labels[b] = machine_new_label(function);
+    assign_values(gen);
+
+    for (b = 0; b < source->blocks_len; b++) {
+        block = &source->blocks[b];
+        if (b > 0 && block->predecessors_len == 0)
+            continue; // code after a return
+        gen->block = b;
+        machine_place_label(function, gen->block_labels[b]);
+        for (i = 0; i < block->len; i++)
+            compile_instruction(gen, block->code[i]);
+    }
+    end_function(gen);
+}
+
+static unsigned int add_symbol(MachineProgram *program, const char *name, Section section) {
+    return machine_add_symbol(program, strdup(name), section);
+}
+
+static MachineFunction *init_runtime_function(CodeGenerator *gen, const char *name) {
+    gen->function = init_machine_function(gen->program, add_symbol(gen->program, name, SECTION_TEXT));
+    return gen->function;
+}
+
+/*
+print(int), print(bool) and print(string) print their argument on a line with printf and puts.
+The stack is aligned to 16 bytes after pushing rbp.
+*/
+static void compile_print_functions(CodeGenerator *gen) {
+    MachineProgram *program = gen->program;
+    unsigned int printf_symbol = add_symbol(program, "printf", SECTION_UNDEFINED);
+    unsigned int puts_symbol = add_symbol(program, "puts", SECTION_UNDEFINED);
+    MachineFunction *function;
+    int label;
+
+    function = init_runtime_function(gen, "infinity_print_int");
+    gen->runtime.print_int = function->symbol;
+    emit(gen, X86_PUSH, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_MOV, operand_register(REG_RSI, 4), operand_register(REG_RDI, 4));
+    emit(gen, X86_LEA, operand_register(REG_RDI, 8), operand_global(machine_add_string(program, "%d\n"), 0, 8));
+    emit(gen, X86_XOR, operand_register(REG_RAX, 4), operand_register(REG_RAX, 4)); // no vector arguments
+    emit(gen, X86_CALL, operand_symbol(printf_symbol), NO_OPERAND);
+    emit(gen, X86_XOR, operand_register(REG_RAX, 4), operand_register(REG_RAX, 4));
+    emit(gen, X86_POP, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+
+    function = init_runtime_function(gen, "infinity_print_bool");
+    gen->runtime.print_bool = function->symbol;
+    label = machine_new_label(function);
+    emit(gen, X86_PUSH, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_TEST, operand_register(REG_RDI, 4), operand_register(REG_RDI, 4));
+    emit(gen, X86_LEA, operand_register(REG_RDI, 8), operand_global(machine_add_string(program, "true"), 0, 8));
+    machine_emit_condition(function, X86_JCC, CC_NE, operand_label(label));
+    emit(gen, X86_LEA, operand_register(REG_RDI, 8), operand_global(machine_add_string(program, "false"), 0, 8));
+    machine_place_label(function, label);
+    emit(gen, X86_CALL, operand_symbol(puts_symbol), NO_OPERAND);
+    emit(gen, X86_XOR, operand_register(REG_RAX, 4), operand_register(REG_RAX, 4));
+    emit(gen, X86_POP, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+
+    function = init_runtime_function(gen, "infinity_print_string");
+    gen->runtime.print_string = function->symbol;
+    emit(gen, X86_PUSH, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_CALL, operand_symbol(puts_symbol), NO_OPERAND);
+    emit(gen, X86_XOR, operand_register(REG_RAX, 4), operand_register(REG_RAX, 4));
+    emit(gen, X86_POP, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+}
+
+/*
+edi / esi, wrapping around on INT_MIN / -1.
+Division by zero prints an error and exits with 1, like in the VM.
+*/
+static void compile_divide_function(CodeGenerator *gen) {
+    MachineProgram *program = gen->program;
+    unsigned int puts_symbol = machine_lookup_symbol(program, "puts");
+    unsigned int exit_symbol = add_symbol(program, "exit", SECTION_UNDEFINED);
+    MachineFunction *function = init_runtime_function(gen, "infinity_divide");
+    int negate = machine_new_label(function), zero = machine_new_label(function);
+
+    gen->runtime.divide = function->symbol;
+    emit(gen, X86_TEST, operand_register(REG_RSI, 4), operand_register(REG_RSI, 4));
+    machine_emit_condition(function, X86_JCC, CC_E, operand_label(zero));
+    emit(gen, X86_CMP, operand_register(REG_RSI, 4), operand_immediate(-1));
+    machine_emit_condition(function, X86_JCC, CC_E, operand_label(negate));
+    emit(gen, X86_MOV, operand_register(REG_RAX, 4), operand_register(REG_RDI, 4));
+    emit(gen, X86_CDQ, NO_OPERAND, NO_OPERAND);
+    emit(gen, X86_IDIV, operand_register(REG_RSI, 4), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+
+    machine_place_label(function, negate);
+    emit(gen, X86_MOV, operand_register(REG_RAX, 4), operand_register(REG_RDI, 4));
+    emit(gen, X86_NEG, operand_register(REG_RAX, 4), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+
+    machine_place_label(function, zero);
+    emit(gen, X86_PUSH, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_LEA, operand_register(REG_RDI, 8),
+         operand_global(machine_add_string(program, "Division by zero."), 0, 8));
+    emit(gen, X86_CALL, operand_symbol(puts_symbol), NO_OPERAND);
+    emit(gen, X86_MOV, operand_register(REG_RDI, 4), operand_immediate(1));
+    emit(gen, X86_CALL, operand_symbol(exit_symbol), NO_OPERAND);
+}
+
+/*
+The C entry point: runs the top level code, then the program's `main`.
+Its result is the exit code if it returns an int, like in the VM.
+*/
+static void compile_entry(CodeGenerator *gen, unsigned int top_level) {
+    MachineProgram *program = gen->program;
+    size_t main_id = (size_t) hashmap_get(gen->ir->function_ids, "main");
+    IrFunction *main = main_id ? gen->ir->functions->items[main_id - 1] : NULL;
+    unsigned int symbol = add_symbol(program, ENTRY_SYMBOL, SECTION_TEXT);
+
+    program->symbols[symbol].global = 1;
+    gen->function = init_machine_function(program, symbol);
+    emit(gen, X86_PUSH, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_MOV, operand_register(REG_RBP, 8), operand_register(REG_RSP, 8));
+    emit(gen, X86_CALL, operand_symbol(top_level), NO_OPERAND);
+    if (main) {
+        if (main->args_len > 0)
+            log_error(CODE_GENERATOR, "'main' must not take arguments.");
+        emit(gen, X86_CALL, operand_symbol(gen->functions[main_id - 1]->symbol), NO_OPERAND);
+    }
+    if (!main || main->return_type != TYPE_INT)
+        emit(gen, X86_XOR, operand_register(REG_RAX, 4), operand_register(REG_RAX, 4));
+    emit(gen, X86_POP, operand_register(REG_RBP, 8), NO_OPERAND);
+    emit(gen, X86_RET, NO_OPERAND, NO_OPERAND);
+}
+
+/*
+Compiles the IR of a whole program. Function 0 is the top level code of all the
+modules, which runs before `main`.
+*/
+MachineProgram *codegen_compile(IrProgram *ir) {
+    MachineProgram *program = init_machine_program();
+    CodeGenerator gen = {.program = program, .ir = ir};
+    IrFunction *source;
+    size_t i;
+    char *name;
+
+    gen.functions = malloc(ir->functions->size * sizeof(MachineFunction *));
+    if (!gen.functions)
+        log_error(CODE_GENERATOR, "Can't allocate memory for code generation.");
+
+    compile_print_functions(&gen);
+    compile_divide_function(&gen);
+    gen.runtime.globals = add_symbol(program, GLOBALS_SYMBOL, SECTION_BSS);
+    program->symbols[gen.runtime.globals].size = ir->globals_len * SLOT_SIZE;
+    for (i = 1; i < ir->functions->size; i++) {
+        source = ir->functions->items[i];
+        alsprintf(&name, "%s%s", FUNCTION_SYMBOL_PREFIX, source->name);
+        gen.functions[i] = init_machine_function(program, machine_add_symbol(program, name, SECTION_TEXT));
+    }
+    gen.functions[0] = init_machine_function(program, add_symbol(program, TOP_LEVEL_SYMBOL, SECTION_TEXT));
+    compile_entry(&gen, gen.functions[0]->symbol);
+
+    for (i = 0; i < ir->functions->size; i++)
+        compile_function(&gen, ir->functions->items[i], gen.functions[i]);
+
+    free(gen.functions);
+    free(gen.values);
+    free(gen.block_labels);
+    return program;
+}
@@ -0,0 +1,12 @@
+#ifndef INFINITY_COMPILER_CODEGEN_H
+#define INFINITY_COMPILER_CODEGEN_H
+
+#include "machine.h"
+#include "../ir/ir.h"
+
+#define ENTRY_SYMBOL "main"
+#define FUNCTION_SYMBOL_PREFIX "inf_" // keeps the program's functions apart from the C library's
+
+MachineProgram *codegen_compile(IrProgram *ir);
+
+#endif //INFINITY_COMPILER_CODEGEN_H
@@ -0,0 +1,493 @@
+#include "encoder.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Encodes machine programs as x86-64 machine code.
+
+The instructions of a function are encoded once, except jumps, which take 2 bytes
+while their target is close enough and 5 or 6 otherwise: their sizes are settled
+by growing the ones that don't reach, until none grows, then the function is
+copied to the text with its jumps.
+*/
+
+#define FUNCTION_ALIGNMENT 16
+#define BSS_ALIGNMENT 8
+#define PADDING 0xCC // int3 between functions
+
+/**
+\SymbolReference
+ A 32 bit field of an instruction that refers to a symbol.
+*/
+typedef struct {
+    size_t instruction;
+    size_t offset; // from the start of the instruction
+    unsigned int symbol;
+    long addend;
+} SymbolReference;
+
+typedef struct {
+    const MachineProgram *program;
+    MachineCode *code;
+    unsigned char *bytes; // the instructions of the current function, without jumps
+    size_t bytes_len;
+    size_t bytes_capacity;
+    size_t *starts;       // by instruction: start in `bytes`, and the end after the last one
+    size_t *addresses;    // by instruction: offset from the start of the function, and its size after the last one
+    unsigned char *long_jumps;
+    size_t instructions_capacity;
+    size_t *labels;       // by label: offset from the start of the function
+    size_t labels_capacity;
+    SymbolReference *references;
+    size_t references_len;
+    size_t references_capacity;
+    size_t instruction;   // being encoded
+} Encoder;
+
+static void *grow(void *array, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity)
+        return array;
+    *capacity = MAX(MAX(*capacity * 2, needed), 64);
+    array = realloc(array, *capacity * item_size);
+    if (!array)
+        log_error(CODE_GENERATOR, "Can't allocate memory for machine code.");
+    return array;
+}
+
+static void put(Encoder *e, unsigned char byte) {
+    e->bytes = grow(e->bytes, &e->bytes_capacity, e->bytes_len + 1, 1);
+    e->bytes[e->bytes_len++] = byte;
+}
+
+static void store32(unsigned char *field, long value) {
+    field[0] = (unsigned char) value;
+    field[1] = (unsigned char) (value >> 8);
+    field[2] = (unsigned char) (value >> 16);
+    field[3] = (unsigned char) (value >> 24);
+}
+
+static void put32(Encoder *e, long value) {
+    e->bytes = grow(e->bytes, &e->bytes_capacity, e->bytes_len + 4, 1);
+    store32(e->bytes + e->bytes_len, value);
+    e->bytes_len += 4;
+}
+
+static void put_immediate(Encoder *e, long value, int len) {
+    if (len == 1)
+        put(e, (unsigned char) value);
+    else
+        put32(e, value);
+}
+
+static int is_int8(long value) {
+    return value >= -128 && value <= 127;
+}
+
+/*
+The next 4 bytes refer to `symbol`.
+*/
+static void add_reference(Encoder *e, unsigned int symbol, long addend) {
+    e->references = grow(e->references, &e->references_capacity, e->references_len + 1, sizeof(SymbolReference));
+    e->references[e->references_len++] = (SymbolReference) {
+            .instruction = e->instruction, .offset = e->bytes_len - e->starts[e->instruction],
+            .symbol = symbol, .addend = addend,
+    };
+}
+
+static int extended(const MachineOperand *operand) {
+    return (operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) && operand->reg != REG_RIP &&
+           (operand->reg & 8);
+}
+
+/*
+The REX prefix, if the instruction needs one: for 64 bit operands, registers from
+r8 on, and spl, bpl, sil and dil, which are ah, ch, dh and bh without it.
+`reg` is the register or opcode extension of the ModRM reg field.
+*/
+static void put_rex(Encoder *e, int wide, int reg, int reg_byte, const MachineOperand *rm, int rm_byte) {
+    unsigned char rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (extended(rm) ? 1 : 0);
+    int needed = rex != 0x40;
+
+    if (reg_byte && reg >= 4 && reg < 8)
+        needed = 1;
+    if (rm_byte && rm->kind == OPERAND_REGISTER && rm->reg >= 4 && rm->reg < 8)
+        needed = 1;
+    if (needed)
+        put(e, rex);
+}
+
+/*
+ModRM, SIB and displacement for the register or memory operand `rm`.
+A rip relative displacement is counted from the end of the instruction,
+after the `immediate_len` bytes of its immediate.
+*/
+static void put_modrm(Encoder *e, int reg, const MachineOperand *rm, int immediate_len) {
+    int low = (int) rm->reg & 7;
+
+    reg &= 7;
+    if (IS_VIRTUAL_REGISTER(rm->reg))
+        log_error(CODE_GENERATOR, "Can't encode a virtual register.");
+    if (rm->kind == OPERAND_REGISTER) {
+        put(e, 0xC0 | reg << 3 | low);
+        return;
+    }
+    if (rm->reg == REG_RIP) {
+        put(e, reg << 3 | 5);
+        add_reference(e, rm->symbol, rm->value - 4 - immediate_len);
+        put32(e, 0);
+        return;
+    }
+    // rbp and r13 as base always take a displacement, rsp and r12 a SIB byte
+    if (rm->value == 0 && low != REG_RBP)
+        put(e, reg << 3 | low);
+    else
+        put(e, (is_int8(rm->value) ? 0x40 : 0x80) | reg << 3 | low);
+    if (low == REG_RSP)
+        put(e, 0x24);
+    if (rm->value != 0 || low == REG_RBP)
+        put_immediate(e, rm->value, is_int8(rm->value) ? 1 : 4);
+}
+
+/*
+An instruction with a ModRM byte. Opcodes of two bytes are written as 0x0Fxx.
+*/
+static void put_instruction(Encoder *e, int opcode, int wide, int reg, int reg_byte, const MachineOperand *rm,
+                            int rm_byte, int immediate_len) {
+    put_rex(e, wide, reg, reg_byte, rm, rm_byte);
+    if (opcode > 0xFF)
+        put(e, (unsigned char) (opcode >> 8));
+    put(e, (unsigned char) opcode);
+    put_modrm(e, reg, rm, immediate_len);
+}
+
+/*
+add, sub, xor and cmp, whose opcodes follow the same pattern, `digit` tells them apart.
+*/
+static void encode_arithmetic(Encoder *e, int digit, const MachineOperand *dst, const MachineOperand *src) {
+    int wide = dst->size == 8, byte = dst->size == 1;
+
+    if (src->kind == OPERAND_IMMEDIATE) {
+        if (byte || is_int8(src->value)) {
+            put_instruction(e, byte ? 0x80 : 0x83, wide, digit, 0, dst, byte, 1);
+            put(e, (unsigned char) src->value);
+        } else {
+            put_instruction(e, 0x81, wide, digit, 0, dst, byte, 4);
+            put32(e, src->value);
+        }
+    } else if (src->kind == OPERAND_MEMORY) {
+        put_instruction(e, digit * 8 + (byte ? 2 : 3), wide, (int) dst->reg, byte, src, 0, 0);
+    } else {
+        put_instruction(e, digit * 8 + (byte ? 0 : 1), wide, (int) src->reg, byte, dst, byte, 0);
+    }
+}
+
+static void encode_move(Encoder *e, const MachineOperand *dst, const MachineOperand *src) {
+    int wide = dst->size == 8, byte = dst->size == 1;
+
+    if (src->kind == OPERAND_IMMEDIATE && dst->kind == OPERAND_REGISTER && !wide) {
+        put_rex(e, 0, 0, 0, dst, byte);
+        put(e, (byte ? 0xB0 : 0xB8) + (dst->reg & 7));
+        put_immediate(e, src->value, byte ? 1 : 4);
+    } else if (src->kind == OPERAND_IMMEDIATE) { // sign extended to 64 bits
+        put_instruction(e, byte ? 0xC6 : 0xC7, wide, 0, 0, dst, byte, byte ? 1 : 4);
+        put_immediate(e, src->value, byte ? 1 : 4);
+    } else if (src->kind == OPERAND_MEMORY) {
+        put_instruction(e, byte ? 0x8A : 0x8B, wide, (int) dst->reg, byte, src, 0, 0);
+    } else {
+        put_instruction(e, byte ? 0x88 : 0x89, wide, (int) src->reg, byte, dst, byte, 0);
+    }
+}
+
+/*
+Everything but jumps and labels, which take no bytes here.
+*/
+static void encode_instruction(Encoder *e, const MachineInstruction *instruction) {
+    const MachineOperand *dst = &instruction->dst, *src = &instruction->src;
+    int wide = dst->size == 8, byte = dst->size == 1;
+
+    switch (instruction->op) {
+        case X86_MOV:
+            encode_move(e, dst, src);
+            break;
+        case X86_MOVZX:
+            put_instruction(e, 0x0FB6, wide, (int) dst->reg, 0, src, 1, 0);
+            break;
+        case X86_LEA:
+            put_instruction(e, 0x8D, 1, (int) dst->reg, 0, src, 0, 0);
+            break;
+        case X86_ADD:
+            encode_arithmetic(e, 0, dst, src);
+            break;
+        case X86_SUB:
+            encode_arithmetic(e, 5, dst, src);
+            break;
+        case X86_XOR:
+            encode_arithmetic(e, 6, dst, src);
+            break;
+        case X86_CMP:
+            encode_arithmetic(e, 7, dst, src);
+            break;
+        case X86_IMUL:
+            if (src->kind != OPERAND_IMMEDIATE) {
+                put_instruction(e, 0x0FAF, wide, (int) dst->reg, 0, src, 0, 0);
+            } else if (is_int8(src->value)) {
+                put_instruction(e, 0x6B, wide, (int) dst->reg, 0, dst, 0, 1);
+                put(e, (unsigned char) src->value);
+            } else {
+                put_instruction(e, 0x69, wide, (int) dst->reg, 0, dst, 0, 4);
+                put32(e, src->value);
+            }
+            break;
+        case X86_SHL:
+            if (src->value == 1) { // without the immediate
+                put_instruction(e, byte ? 0xD0 : 0xD1, wide, 4, 0, dst, byte, 0);
+                break;
+            }
+            put_instruction(e, byte ? 0xC0 : 0xC1, wide, 4, 0, dst, byte, 1);
+            put(e, (unsigned char) src->value);
+            break;
+        case X86_NEG:
+            put_instruction(e, byte ? 0xF6 : 0xF7, wide, 3, 0, dst, byte, 0);
+            break;
+        case X86_IDIV:
+            put_instruction(e, byte ? 0xF6 : 0xF7, wide, 7, 0, dst, byte, 0);
+            break;
+        case X86_CDQ:
+            put(e, 0x99);
+            break;
+        case X86_TEST:
+            put_instruction(e, byte ? 0x84 : 0x85, wide, (int) src->reg, byte, dst, byte, 0);
+            break;
+        case X86_SETCC:
+            put_instruction(e, 0x0F90 + instruction->cond, 0, 0, 0, dst, 1, 0);
+            break;
+        case X86_CALL:
+            put(e, 0xE8);
+            add_reference(e, dst->symbol, -4);
+            put32(e, 0);
+            break;
+        case X86_RET:
+            put(e, 0xC3);
+            break;
+        case X86_PUSH:
+            if (dst->kind == OPERAND_REGISTER) {
+                put_rex(e, 0, 0, 0, dst, 0);
+                put(e, 0x50 + (dst->reg & 7));
+            } else if (dst->kind == OPERAND_IMMEDIATE) {
+                put(e, is_int8(dst->value) ? 0x6A : 0x68);
+                put_immediate(e, dst->value, is_int8(dst->value) ? 1 : 4);
+            } else {
+                put_instruction(e, 0xFF, 0, 6, 0, dst, 0, 0);
+            }
+            break;
+        case X86_POP:
+            put_rex(e, 0, 0, 0, dst, 0);
+            put(e, 0x58 + (dst->reg & 7));
+            break;
+        default: // jumps and labels
+            break;
+    }
+}
+
+static size_t instruction_size(const Encoder *e, const MachineInstruction *instruction, size_t i) {
+    switch (instruction->op) {
+        case X86_JMP:
+            return e->long_jumps[i] ? 5 : 2;
+        case X86_JCC:
+            return e->long_jumps[i] ? 6 : 2;
+        default:
+            return e->starts[i + 1] - e->starts[i];
+    }
+}
+
+/*
+Sets the offsets of the instructions and labels, with the current jump sizes.
+Returns 1 if a short jump doesn't reach its label.
+*/
+static int place_instructions(Encoder *e, const MachineFunction *function) {
+    const MachineInstruction *instruction;
+    size_t address = 0, i;
+    long displacement;
+    int grown = 0;
+
+    for (i = 0; i < function->len; i++) {
+        instruction = &function->code[i];
+        e->addresses[i] = address;
+        if (instruction->op == X86_LABEL)
+            e->labels[instruction->dst.value] = address;
+        address += instruction_size(e, instruction, i);
+    }
+    e->addresses[function->len] = address;
+
+    for (i = 0; i < function->len; i++) {
+        instruction = &function->code[i];
+        if ((instruction->op != X86_JMP && instruction->op != X86_JCC) || e->long_jumps[i])
+            continue;
+        displacement = (long) e->labels[instruction->dst.value] - (long) (e->addresses[i] + 2);
+        if (!is_int8(displacement)) {
+            e->long_jumps[i] = 1;
+            grown = 1;
+        }
+    }
+    return grown;
+}
+
+static void put_text(MachineCode *code, const unsigned char *bytes, size_t len) {
+    code->text = grow(code->text, &code->text_capacity, code->text_len + len, 1);
+    memcpy(code->text + code->text_len, bytes, len);
+    code->text_len += len;
+}
+
+static void encode_jump(Encoder *e, const MachineInstruction *instruction, size_t i) {
+    unsigned char bytes[6];
+    long displacement = (long) e->labels[instruction->dst.value] - (long) e->addresses[i + 1];
+    size_t len = 0;
+
+    if (!e->long_jumps[i]) {
+        bytes[len++] = instruction->op == X86_JMP ? 0xEB : 0x70 + instruction->cond;
+        bytes[len++] = (unsigned char) displacement;
+    } else {
+        if (instruction->op == X86_JMP) {
+            bytes[len++] = 0xE9;
+        } else {
+            bytes[len++] = 0x0F;
+            bytes[len++] = 0x80 + instruction->cond;
+        }
+        store32(bytes + len, displacement);
+        len += 4;
+    }
+    put_text(e->code, bytes, len);
+}
+
+static void encode_function(Encoder *e, const MachineFunction *function) {
+    MachineCode *code = e->code;
+    const MachineInstruction *instruction;
+    const SymbolReference *reference;
+    const unsigned char padding = PADDING;
+    size_t start, i;
+
+    if (function->len + 1 > e->instructions_capacity) {
+        e->instructions_capacity = MAX(e->instructions_capacity * 2, function->len + 1);
+        e->starts = realloc(e->starts, e->instructions_capacity * sizeof(size_t));
+        e->addresses = realloc(e->addresses, e->instructions_capacity * sizeof(size_t));
+        e->long_jumps = realloc(e->long_jumps, e->instructions_capacity);
+        if (!e->starts || !e->addresses || !e->long_jumps)
+            log_error(CODE_GENERATOR, "Can't allocate memory for machine code.");
+    }
+    e->labels = grow(e->labels, &e->labels_capacity, (size_t) function->labels_len, sizeof(size_t));
+    e->bytes_len = 0;
+    e->references_len = 0;
+    for (i = 0; i < function->len; i++) {
+        e->starts[i] = e->bytes_len;
+        e->instruction = i;
+        e->long_jumps[i] = 0;
+        encode_instruction(e, &function->code[i]);
+    }
+    e->starts[function->len] = e->bytes_len;
+    while (place_instructions(e, function)); // growing a jump can put others out of reach
+
+    while (code->text_len % FUNCTION_ALIGNMENT)
+        put_text(code, &padding, 1);
+    start = code->text_len;
+    code->offsets[function->symbol] = start;
+    for (i = 0; i < function->len; i++) {
+        instruction = &function->code[i];
+        if (instruction->op == X86_JMP || instruction->op == X86_JCC)
+            encode_jump(e, instruction, i);
+        else
+            put_text(code, e->bytes + e->starts[i], e->starts[i + 1] - e->starts[i]);
+    }
+    code->sizes[function->symbol] = code->text_len - start;
+
+    for (i = 0; i < e->references_len; i++) {
+        reference = &e->references[i];
+        code->relocations = grow(code->relocations, &code->relocations_capacity, code->relocations_len + 1,
+                                 sizeof(MachineRelocation));
+        code->relocations[code->relocations_len++] = (MachineRelocation) {
+                .offset = start + e->addresses[reference->instruction] + reference->offset,
+                .symbol = reference->symbol, .addend = reference->addend,
+                .type = e->program->symbols[reference->symbol].section == SECTION_UNDEFINED ? RELOCATION_PLT32
+                                                                                            : RELOCATION_PC32,
+        };
+    }
+}
+
+/*
+Strings go one after another in the read only data, variables in the bss.
+*/
+static void place_data(MachineCode *code, const MachineProgram *program) {
+    const MachineSymbol *symbol;
+    size_t rodata_capacity = 0, i;
+
+    for (i = 0; i < program->symbols_len; i++) {
+        symbol = &program->symbols[i];
+        if (symbol->section == SECTION_RODATA) {
+            code->sizes[i] = strlen(symbol->data) + 1;
+            code->offsets[i] = code->rodata_len;
+            code->rodata = grow(code->rodata, &rodata_capacity, code->rodata_len + code->sizes[i], 1);
+            memcpy(code->rodata + code->rodata_len, symbol->data, code->sizes[i]);
+            code->rodata_len += code->sizes[i];
+        } else if (symbol->section == SECTION_BSS) {
+            code->bss_len = (code->bss_len + BSS_ALIGNMENT - 1) / BSS_ALIGNMENT * BSS_ALIGNMENT;
+            code->sizes[i] = symbol->size;
+            code->offsets[i] = code->bss_len;
+            code->bss_len += symbol->size;
+        }
+    }
+}
+
+/*
+Patches the calls between the program's functions, the other relocations stay.
+*/
+static void resolve_calls(MachineCode *code, const MachineProgram *program) {
+    const MachineRelocation *relocation;
+    size_t kept = 0, i;
+
+    for (i = 0; i < code->relocations_len; i++) {
+        relocation = &code->relocations[i];
+        if (program->symbols[relocation->symbol].section != SECTION_TEXT) {
+            code->relocations[kept++] = *relocation;
+            continue;
+        }
+        store32(code->text + relocation->offset,
+                (long) code->offsets[relocation->symbol] + relocation->addend - (long) relocation->offset);
+    }
+    code->relocations_len = kept;
+}
+
+MachineCode *encode_program(const MachineProgram *program) {
+    MachineCode *code = calloc(1, sizeof(MachineCode));
+    Encoder e = {.program = program, .code = code};
+    size_t i;
+
+    if (!code)
+        log_error(CODE_GENERATOR, "Can't allocate memory for machine code.");
+    code->offsets = calloc(program->symbols_len + 1, sizeof(size_t));
+    code->sizes = calloc(program->symbols_len + 1, sizeof(size_t));
+    if (!code->offsets || !code->sizes)
+        log_error(CODE_GENERATOR, "Can't allocate memory for machine code.");
+
+    place_data(code, program);
+    for (i = 0; i < program->functions->size; i++)
+        encode_function(&e, program->functions->items[i]);
+    resolve_calls(code, program);
+
+    free(e.bytes);
+    free(e.starts);
+    free(e.addresses);
+    free(e.long_jumps);
+    free(e.labels);
+    free(e.references);
+    return code;
+}
+
+void machine_code_dispose(MachineCode *code) {
+    free(code->text);
+    free(code->rodata);
+    free(code->offsets);
+    free(code->sizes);
+    free(code->relocations);
+    free(code);
+}
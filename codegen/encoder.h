@@ -0,0 +1,47 @@
+#ifndef INFINITY_COMPILER_ENCODER_H
+#define INFINITY_COMPILER_ENCODER_H
+
+#include "machine.h"
+
+typedef enum {
+    RELOCATION_PC32,  // symbol + addend - address of the field, for rip relative operands
+    RELOCATION_PLT32, // the same through the PLT, for calls to functions of other objects
+} RelocationType;
+
+/**
+\MachineRelocation
+ A 32 bit field of the text that refers to a symbol outside of it.
+*/
+typedef struct {
+    size_t offset; // of the field in the text
+    unsigned int symbol;
+    long addend;
+    RelocationType type;
+} MachineRelocation;
+
+/**
+\MachineCode
+ A program encoded as x86-64 machine code: the functions one after another in
+ the text, the strings in the read only data, and the variables in the bss.
+ Calls between the program's functions are resolved, references to the data
+ and to other objects are relocations.
+*/
+typedef struct {
+    unsigned char *text;
+    size_t text_len;
+    size_t text_capacity;
+    char *rodata;
+    size_t rodata_len;
+    size_t bss_len;
+    size_t *offsets; // by symbol: offset in its section
+    size_t *sizes;   // by symbol: size in bytes
+    MachineRelocation *relocations;
+    size_t relocations_len;
+    size_t relocations_capacity;
+} MachineCode;
+
+MachineCode *encode_program(const MachineProgram *program);
+
+void machine_code_dispose(MachineCode *code);
+
+#endif //INFINITY_COMPILER_ENCODER_H
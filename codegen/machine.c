@@ -0,0 +1,195 @@
+#include "machine.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include <stdlib.h>
+#include <string.h>
+
+MachineProgram *init_machine_program() {
+    MachineProgram *program = calloc(1, sizeof(MachineProgram));
+
+    if (!program)
+        log_error(CODE_GENERATOR, "Can't allocate memory for program.");
+    program->functions = init_list(sizeof(MachineFunction *));
+    program->symbol_ids = init_hashmap(64);
+    program->string_ids = init_hashmap(64);
+    return program;
+}
+
+void machine_program_dispose(MachineProgram *program) {
+    MachineFunction *function;
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++) {
+        function = program->functions->items[i];
+        free(function->code);
+        free(function);
+    }
+    free(program->functions->items);
+    free(program->functions);
+    for (i = 0; i < program->symbols_len; i++)
+        free(program->symbols[i].name);
+    free(program->symbols);
+    hashmap_dispose(program->symbol_ids);
+    hashmap_dispose(program->string_ids);
+    free(program);
+}
+
+/*
+Adds a symbol named `name`, which the program takes ownership of.
+Returns its index.
+*/
+unsigned int machine_add_symbol(MachineProgram *program, char *name, Section section) {
+    if (program->symbols_len == program->symbols_capacity) {
+        program->symbols_capacity = MAX(program->symbols_capacity * 2, 64);
+        program->symbols = realloc(program->symbols, program->symbols_capacity * sizeof(MachineSymbol));
+        if (!program->symbols)
+            log_error(CODE_GENERATOR, "Can't allocate memory for symbols.");
+    }
+    program->symbols[program->symbols_len] = (MachineSymbol) {.name = name, .section = section};
+    hashmap_put(program->symbol_ids, name, (void *) (program->symbols_len + 1));
+    return program->symbols_len++;
+}
+
+/*
+Returns the index of the symbol named `name`, or -1.
+*/
+long machine_lookup_symbol(const MachineProgram *program, const char *name) {
+    return (long) (size_t) hashmap_get(program->symbol_ids, name) - 1;
+}
+
+/*
+Returns the symbol of a read only copy of `str`, equal strings share it.
+*/
+unsigned int machine_add_string(MachineProgram *program, const char *str) {
+    size_t id = (size_t) hashmap_get(program->string_ids, str);
+    char *name;
+
+    if (id)
+        return id - 1;
+    alsprintf(&name, "infinity_string_%zu", program->string_ids->size);
+    id = machine_add_symbol(program, name, SECTION_RODATA);
+    program->symbols[id].data = str;
+    hashmap_put(program->string_ids, str, (void *) (id + 1));
+    return id;
+}
+
+MachineFunction *init_machine_function(MachineProgram *program, unsigned int symbol) {
+    MachineFunction *function = calloc(1, sizeof(MachineFunction));
+
+    if (!function)
+        log_error(CODE_GENERATOR, "Can't allocate memory for function.");
+    function->symbol = symbol;
+    list_push(program->functions, function);
+    return function;
+}
+
+/*
+Appends an instruction to `function`, returns its index.
+*/
+size_t machine_emit(MachineFunction *function, X86Opcode op, MachineOperand dst, MachineOperand src) {
+    if (function->len == function->capacity) {
+        function->capacity = MAX(function->capacity * 2, 64);
+        function->code = realloc(function->code, function->capacity * sizeof(MachineInstruction));
+        if (!function->code)
+            log_error(CODE_GENERATOR, "Can't allocate memory for machine code.");
+    }
+    function->code[function->len] = (MachineInstruction) {.op = op, .dst = dst, .src = src};
+    return function->len++;
+}
+
+size_t machine_emit_condition(MachineFunction *function, X86Opcode op, ConditionCode cond, MachineOperand dst) {
+    size_t index = machine_emit(function, op, dst, NO_OPERAND);
+    function->code[index].cond = cond;
+    return index;
+}
+
+int machine_new_label(MachineFunction *function) {
+    return function->labels_len++;
+}
+
+unsigned int machine_new_register(MachineFunction *function) {
+    return FIRST_VIRTUAL_REGISTER + function->registers_len++;
+}
+
+void machine_place_label(MachineFunction *function, int label) {
+    machine_emit(function, X86_LABEL, operand_label(label), NO_OPERAND);
+}
+
+MachineOperand operand_register(unsigned int reg, int size) {
+    return (MachineOperand) {.kind = OPERAND_REGISTER, .size = size, .reg = reg};
+}
+
+MachineOperand operand_immediate(int value) {
+    return (MachineOperand) {.kind = OPERAND_IMMEDIATE, .size = 4, .value = value};
+}
+
+MachineOperand operand_memory(unsigned int base, int displacement, int size) {
+    return (MachineOperand) {.kind = OPERAND_MEMORY, .size = size, .reg = base, .value = displacement};
+}
+
+MachineOperand operand_global(unsigned int symbol, int displacement, int size) {
+    return (MachineOperand) {.kind = OPERAND_MEMORY, .size = size, .reg = REG_RIP, .value = displacement,
+                             .symbol = symbol};
+}
+
+MachineOperand operand_label(int label) {
+    return (MachineOperand) {.kind = OPERAND_LABEL, .value = label};
+}
+
+MachineOperand operand_symbol(unsigned int symbol) {
+    return (MachineOperand) {.kind = OPERAND_SYMBOL, .size = 8, .symbol = symbol};
+}
+
+char *x86_opcode_to_str(X86Opcode op) {
+    static char *names[] = {
+            "mov", "movzx", "lea", "add", "sub", "imul", "shl", "neg", "xor", "cdq", "idiv",
+            "cmp", "test", "set", "jmp", "j", "call", "ret", "push", "pop", "label",
+    };
+    return op < X86_OPCODES_LEN ? names[op] : "unknown";
+}
+
+ConditionCode negate_condition(ConditionCode cond) {
+    return cond ^ 1; // the last bit of the encoding inverts the condition
+}
+
+char *condition_code_to_str(ConditionCode cond) {
+    switch (cond) {
+        case CC_E:
+            return "e";
+        case CC_NE:
+            return "ne";
+        case CC_L:
+            return "l";
+        case CC_GE:
+            return "ge";
+        case CC_LE:
+            return "le";
+        case CC_G:
+            return "g";
+        default:
+            return "?";
+    }
+}
+
+/*
+Name of a register used as an operand of `size` bytes.
+*/
+char *register_to_str(unsigned int reg, int size) {
+    static char *names64[] = {
+            "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+            "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rip",
+    };
+    static char *names32[] = {
+            "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+            "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d", "eip",
+    };
+    static char *names8[] = {
+            "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+            "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b", "?",
+    };
+
+    if (reg >= REGISTERS_LEN)
+        return "?";
+    return size == 8 ? names64[reg] : size == 4 ? names32[reg] : names8[reg];
+}
@@ -0,0 +1,190 @@
+#ifndef INFINITY_COMPILER_MACHINE_H
+#define INFINITY_COMPILER_MACHINE_H
+
+#include "../list/list.h"
+#include "../hashmap/hashmap.h"
+
+/*
+x86-64 code in memory: the code generator produces it, then it is written out as
+assembly text or encoded to an object file. Registers and condition codes are numbered like in the encoding.
+*/
+
+typedef enum {
+    REG_RAX,
+    REG_RCX,
+    REG_RDX,
+    REG_RBX,
+    REG_RSP,
+    REG_RBP,
+    REG_RSI,
+    REG_RDI,
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+    REG_RIP, // base of memory operands relative to a symbol
+    REGISTERS_LEN,
+} Register;
+
+// registers from this one on are virtual, the register allocator replaces them
+#define FIRST_VIRTUAL_REGISTER 32
+#define IS_VIRTUAL_REGISTER(reg) ((reg) >= FIRST_VIRTUAL_REGISTER)
+
+typedef enum {
+    CC_E = 4,
+    CC_NE = 5,
+    CC_L = 12,
+    CC_GE = 13,
+    CC_LE = 14,
+    CC_G = 15,
+} ConditionCode;
+
+typedef enum {
+    X86_MOV,
+    X86_MOVZX,
+    X86_LEA,
+    X86_ADD,
+    X86_SUB,
+    X86_IMUL,
+    X86_SHL,
+    X86_NEG,
+    X86_XOR,
+    X86_CDQ,
+    X86_IDIV,
+    X86_CMP,
+    X86_TEST,
+    X86_SETCC,
+    X86_JMP,
+    X86_JCC,
+    X86_CALL,
+    X86_RET,
+    X86_PUSH,
+    X86_POP,
+    X86_LABEL, // not an instruction: places the label `dst`
+    X86_OPCODES_LEN,
+} X86Opcode;
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_REGISTER,
+    OPERAND_IMMEDIATE,
+    OPERAND_MEMORY, // [reg + value], or [rip + symbol + value]
+    OPERAND_LABEL,  // a label of the same function
+    OPERAND_SYMBOL, // a function, for calls
+} OperandKind;
+
+typedef struct {
+    unsigned char kind;
+    unsigned char size;  // in bytes: 1, 4 or 8
+    unsigned int reg;    // register, or base register of memory operands
+    int value;           // immediate, displacement or label
+    unsigned int symbol; // of memory operands relative to rip, and symbol operands
+} MachineOperand;
+
+#define NO_OPERAND ((MachineOperand) {})
+
+/**
+\MachineInstruction
+ One instruction, with Intel operand order.
+*/
+typedef struct {
+    unsigned char op;
+    unsigned char cond; // condition of SETcc and Jcc, arguments passed in registers to a CALL
+    MachineOperand dst;
+    MachineOperand src;
+} MachineInstruction;
+
+/**
+\MachineFunction
+ The code of a function, an array of instructions.
+ Labels are numbered from 0 in each function.
+*/
+typedef struct {
+    unsigned int symbol;
+    MachineInstruction *code;
+    size_t len;
+    size_t capacity;
+    int labels_len;
+    unsigned int registers_len; // virtual registers
+    size_t frame_size;          // bytes of locals below rbp
+} MachineFunction;
+
+typedef enum {
+    SECTION_UNDEFINED, // defined by another object file, like printf
+    SECTION_TEXT,
+    SECTION_RODATA,
+    SECTION_BSS,
+} Section;
+
+/**
+\MachineSymbol
+ A function, a string constant or a variable of a program.
+*/
+typedef struct {
+    char *name;
+    Section section;
+    int global;       // visible to the linker, or local to the object file
+    const char *data; // rodata: a string, with its terminating '\0'
+    size_t size;      // bss: bytes
+} MachineSymbol;
+
+/**
+\MachineProgram
+ All the code and data of a compiled program.
+*/
+typedef struct {
+    List *functions; // list of MachineFunctions, in output order
+    MachineSymbol *symbols;
+    size_t symbols_len;
+    size_t symbols_capacity;
+    HashMap *symbol_ids; // name -> index + 1
+    HashMap *string_ids; // rodata strings by content -> index + 1
+} MachineProgram;
+
+MachineProgram *init_machine_program();
+
+void machine_program_dispose(MachineProgram *program);
+
+unsigned int machine_add_symbol(MachineProgram *program, char *name, Section section);
+
+long machine_lookup_symbol(const MachineProgram *program, const char *name);
+
+unsigned int machine_add_string(MachineProgram *program, const char *str);
+
+MachineFunction *init_machine_function(MachineProgram *program, unsigned int symbol);
+
+size_t machine_emit(MachineFunction *function, X86Opcode op, MachineOperand dst, MachineOperand src);
+
+size_t machine_emit_condition(MachineFunction *function, X86Opcode op, ConditionCode cond, MachineOperand dst);
+
+int machine_new_label(MachineFunction *function);
+
+unsigned int machine_new_register(MachineFunction *function);
+
+void machine_place_label(MachineFunction *function, int label);
+
+MachineOperand operand_register(unsigned int reg, int size);
+
+MachineOperand operand_immediate(int value);
+
+MachineOperand operand_memory(unsigned int base, int displacement, int size);
+
+MachineOperand operand_global(unsigned int symbol, int displacement, int size);
+
+MachineOperand operand_label(int label);
+
+MachineOperand operand_symbol(unsigned int symbol);
+
+char *x86_opcode_to_str(X86Opcode op);
+
+ConditionCode negate_condition(ConditionCode cond);
+
+char *condition_code_to_str(ConditionCode cond);
+
+char *register_to_str(unsigned int reg, int size);
+
+#endif //INFINITY_COMPILER_MACHINE_H
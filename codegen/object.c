@@ -0,0 +1,216 @@
+#include "object.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Writes an encoded program as an ELF64 relocatable object file for x86-64, with
+the sections and symbols GNU as makes of the assembly of -S.
+*/
+
+typedef enum {
+    OBJECT_NULL,
+    OBJECT_TEXT,
+    OBJECT_RODATA,
+    OBJECT_BSS,
+    OBJECT_NOTE, // .note.GNU-stack: the stack doesn't need to be executable
+    OBJECT_SYMTAB,
+    OBJECT_STRTAB,
+    OBJECT_RELA_TEXT,
+    OBJECT_SHSTRTAB,
+    OBJECT_SECTIONS_LEN,
+} ObjectSection;
+
+static const char *const section_names[OBJECT_SECTIONS_LEN] = {
+        "", ".text", ".rodata", ".bss", ".note.GNU-stack", ".symtab", ".strtab", ".rela.text", ".shstrtab",
+};
+
+/**
+\StringTable
+ Names of an ELF string table, one after another with their '\0'.
+*/
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} StringTable;
+
+/*
+Returns the offset of `str` in the table.
+*/
+static Elf64_Word string_table_add(StringTable *table, const char *str) {
+    size_t len = strlen(str) + 1, offset = table->len;
+
+    if (table->len + len > table->capacity) {
+        table->capacity = MAX(MAX(table->capacity * 2, table->len + len), 256);
+        table->data = realloc(table->data, table->capacity);
+        if (!table->data)
+            log_error(CODE_GENERATOR, "Can't allocate memory for the object file.");
+    }
+    memcpy(table->data + table->len, str, len);
+    table->len += len;
+    return (Elf64_Word) offset;
+}
+
+static const ObjectSection symbol_sections[] = {
+        [SECTION_UNDEFINED] = OBJECT_NULL,
+        [SECTION_TEXT] = OBJECT_TEXT,
+        [SECTION_RODATA] = OBJECT_RODATA,
+        [SECTION_BSS] = OBJECT_BSS,
+};
+
+static const unsigned char symbol_types[] = {
+        [SECTION_UNDEFINED] = STT_NOTYPE,
+        [SECTION_TEXT] = STT_FUNC,
+        [SECTION_RODATA] = STT_OBJECT,
+        [SECTION_BSS] = STT_OBJECT,
+};
+
+/*
+The symbol table lists the local symbols first, `first_global` is the index of the
+first global one. Returns the index of every symbol of the program in `ids`.
+*/
+static Elf64_Sym *build_symbols(const MachineProgram *program, const MachineCode *code, StringTable *names,
+                                unsigned int *ids, size_t *len, size_t *first_global) {
+    Elf64_Sym *symbols = calloc(program->symbols_len + 1, sizeof(Elf64_Sym));
+    const MachineSymbol *symbol;
+    size_t i;
+    int global, pass;
+
+    if (!symbols)
+        log_error(CODE_GENERATOR, "Can't allocate memory for the object file.");
+    *len = 1; // the null symbol
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            *first_global = *len;
+        for (i = 0; i < program->symbols_len; i++) {
+            symbol = &program->symbols[i];
+            global = symbol->global || symbol->section == SECTION_UNDEFINED;
+            if (global != pass)
+                continue;
+            ids[i] = (unsigned int) *len;
+            symbols[(*len)++] = (Elf64_Sym) {
+                    .st_name = string_table_add(names, symbol->name),
+                    .st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, symbol_types[symbol->section]),
+                    .st_shndx = symbol_sections[symbol->section],
+                    .st_value = code->offsets[i],
+                    .st_size = code->sizes[i],
+            };
+        }
+    }
+    return symbols;
+}
+
+static Elf64_Rela *build_relocations(const MachineCode *code, const unsigned int *ids) {
+    Elf64_Rela *relocations = calloc(code->relocations_len + 1, sizeof(Elf64_Rela));
+    const MachineRelocation *relocation;
+    size_t i;
+
+    if (!relocations)
+        log_error(CODE_GENERATOR, "Can't allocate memory for the object file.");
+    for (i = 0; i < code->relocations_len; i++) {
+        relocation = &code->relocations[i];
+        relocations[i] = (Elf64_Rela) {
+                .r_offset = relocation->offset,
+                .r_info = ELF64_R_INFO(ids[relocation->symbol],
+                                       relocation->type == RELOCATION_PLT32 ? R_X86_64_PLT32 : R_X86_64_PC32),
+                .r_addend = relocation->addend,
+        };
+    }
+    return relocations;
+}
+
+/*
+Places a section at the end of the file, `offset` is the end before and after.
+*/
+static void place_section(Elf64_Shdr *section, Elf64_Word type, Elf64_Xword flags, Elf64_Xword alignment,
+                          Elf64_Xword size, size_t *offset) {
+    section->sh_type = type;
+    section->sh_flags = flags;
+    section->sh_addralign = alignment;
+    section->sh_size = size;
+    section->sh_offset = (*offset + alignment - 1) / alignment * alignment;
+    if (type != SHT_NOBITS)
+        *offset = section->sh_offset + size;
+}
+
+static void write_padding(Writer *writer, size_t *offset, size_t end) {
+    for (; *offset < end; (*offset)++)
+        writer_putc(writer, '\0');
+}
+
+void object_write(const MachineProgram *program, const MachineCode *code, Writer *writer) {
+    Elf64_Shdr sections[OBJECT_SECTIONS_LEN] = {};
+    const void *contents[OBJECT_SECTIONS_LEN] = {};
+    StringTable names = {}, shstrtab = {};
+    Elf64_Ehdr header = {};
+    Elf64_Sym *symbols;
+    Elf64_Rela *relocations;
+    unsigned int *ids = calloc(program->symbols_len + 1, sizeof(unsigned int));
+    size_t symbols_len, first_global, offset = sizeof(Elf64_Ehdr), i;
+
+    if (!ids)
+        log_error(CODE_GENERATOR, "Can't allocate memory for the object file.");
+    string_table_add(&names, "");
+    symbols = build_symbols(program, code, &names, ids, &symbols_len, &first_global);
+    relocations = build_relocations(code, ids);
+    for (i = 0; i < OBJECT_SECTIONS_LEN; i++)
+        sections[i].sh_name = string_table_add(&shstrtab, section_names[i]);
+
+    place_section(&sections[OBJECT_TEXT], SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 16, code->text_len, &offset);
+    place_section(&sections[OBJECT_RODATA], SHT_PROGBITS, SHF_ALLOC, 1, code->rodata_len, &offset);
+    place_section(&sections[OBJECT_BSS], SHT_NOBITS, SHF_ALLOC | SHF_WRITE, 8, code->bss_len, &offset);
+    place_section(&sections[OBJECT_NOTE], SHT_PROGBITS, 0, 1, 0, &offset);
+    place_section(&sections[OBJECT_SYMTAB], SHT_SYMTAB, 0, 8, symbols_len * sizeof(Elf64_Sym), &offset);
+    place_section(&sections[OBJECT_STRTAB], SHT_STRTAB, 0, 1, names.len, &offset);
+    place_section(&sections[OBJECT_RELA_TEXT], SHT_RELA, SHF_INFO_LINK, 8,
+                  code->relocations_len * sizeof(Elf64_Rela), &offset);
+    place_section(&sections[OBJECT_SHSTRTAB], SHT_STRTAB, 0, 1, shstrtab.len, &offset);
+    sections[OBJECT_SYMTAB].sh_link = OBJECT_STRTAB;
+    sections[OBJECT_SYMTAB].sh_info = first_global;
+    sections[OBJECT_SYMTAB].sh_entsize = sizeof(Elf64_Sym);
+    sections[OBJECT_RELA_TEXT].sh_link = OBJECT_SYMTAB;
+    sections[OBJECT_RELA_TEXT].sh_info = OBJECT_TEXT;
+    sections[OBJECT_RELA_TEXT].sh_entsize = sizeof(Elf64_Rela);
+    contents[OBJECT_TEXT] = code->text;
+    contents[OBJECT_RODATA] = code->rodata;
+    contents[OBJECT_SYMTAB] = symbols;
+    contents[OBJECT_STRTAB] = names.data;
+    contents[OBJECT_RELA_TEXT] = relocations;
+    contents[OBJECT_SHSTRTAB] = shstrtab.data;
+
+    memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    header.e_type = ET_REL;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = (offset + 7) / 8 * 8;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = OBJECT_SECTIONS_LEN;
+    header.e_shstrndx = OBJECT_SHSTRTAB;
+
+    offset = 0;
+    writer_write(writer, (const char *) &header, sizeof(header));
+    offset += sizeof(header);
+    for (i = 0; i < OBJECT_SECTIONS_LEN; i++) {
+        if (!contents[i] || sections[i].sh_type == SHT_NOBITS)
+            continue;
+        write_padding(writer, &offset, sections[i].sh_offset);
+        writer_write(writer, contents[i], sections[i].sh_size);
+        offset += sections[i].sh_size;
+    }
+    write_padding(writer, &offset, header.e_shoff);
+    writer_write(writer, (const char *) sections, sizeof(sections));
+
+    free(ids);
+    free(symbols);
+    free(relocations);
+    free(names.data);
+    free(shstrtab.data);
+}
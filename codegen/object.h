@@ -0,0 +1,9 @@
+#ifndef INFINITY_COMPILER_OBJECT_H
+#define INFINITY_COMPILER_OBJECT_H
+
+#include "encoder.h"
+#include "../io/writer.h"
+
+void object_write(const MachineProgram *program, const MachineCode *code, Writer *writer);
+
+#endif //INFINITY_COMPILER_OBJECT_H
@@ -4,34 +4,404 @@
 #include "../logging/logging.h"
 #include "../io/io.h"
 #include "../config/globals.h"
+#include "../config/options.h"
+#include "../perf/perf.h"
+#include "../folding/folding.h"
+#include "../resolver/resolver.h"
+#include "../type_checker/type_checker.h"
+#include "../vm/vm.h"
+#include "../incremental/incremental.h"
+#include "../parallel_parse/parallel_parse.h"
+#include "../ast_image/ast_image.h"
+#include "../diagnostics/diagnostics.h"
+#include "../codegen/codegen.h"
+#include "../codegen/asm.h"
+#include "../codegen/object.h"
+#include "../jit/jit.h"
+#include "../ir/ir_build.h"
+#include "../ir/ir_inline.h"
+#include "../ir/ir_sccp.h"
+#include "../ir/ir_dce.h"
+#include "../ir/ir_loop.h"
+#include "../io/writer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-void compiler_compile(char *src) {
-    Lexer *lexer;
-    Parser *parser;
-    AstNode *root;
+#define WATCH_INTERVAL_US 100000
+
+/*
+Parses the module, or loads its AST image if it is up to date (--emit-ast-bin).
+*/
+static void compiler_parse_module(Module *module) {
+    PerfPhase phase;
+    Diagnostics *diagnostics;
+    char *image_path = NULL, *errMsg;
+
+    if (compiler_options.emit_ast_bin) {
+        alsprintf(&image_path, "%s%s", module->path, AST_IMAGE_EXTENSION);
+        perf_phase_begin(&phase, "load ast image");
+        module->root = ast_image_load(image_path, module->src);
+        perf_phase_end(&phase);
+    }
+
+    if (!module->root) {
+        // the parser pulls its tokens from the lexer, so both run in this phase
+        perf_phase_begin(&phase, "lex+parse");
+        diagnostics = init_diagnostics(compiler_options.error_limit);
+        module->root = parallel_parse(module->src, compiler_options.jobs, diagnostics);
+        perf_phase_end(&phase);
+        // report every syntax error of the file at once
+        diagnostics_print(diagnostics);
+        if (diagnostics->count > 0)
+            exit(1);
+        diagnostics_dispose(diagnostics);
+
+        if (image_path) {
+            perf_phase_begin(&phase, "write ast image");
+            if (ast_image_write(image_path, module->root, module->src) != 0) {
+                alsprintf(&errMsg, "Can't write AST image file \"%s\".", image_path);
+                log_error(COMPILER, errMsg);
+            }
+            perf_phase_end(&phase);
+        }
+    }
+    free(image_path);
+}
+
+void compiler_compile_module(Module *module) {
+    PerfPhase phase;
     // Token *tok;
-    lexer = init_lexer(src);
-    parser = init_parser(lexer);
-    init_globals();
 
-//    parser_parse_function_definition(parser);
-    root = parser_parse(parser);
+    compiler_parse_module(module);
+
+    perf_phase_begin(&phase, "resolve names");
+    resolve_module(module);
+    perf_phase_end(&phase);
+
+    perf_phase_begin(&phase, "type check");
+    type_check(module->root, module->src);
+    perf_phase_end(&phase);
+
+    perf_phase_begin(&phase, "fold constants");
+    fold_constants(module->root, module->src);
+    perf_phase_end(&phase);
 
     // while ((tok = lexer_next_token(lexer))->type != EOF_TOKEN)
     // {
     //     printf("token '%s'\t%s\n", tok->value_expr, token_type_to_str(tok->type));
     // }
 
-    lexer_dispose(lexer);
     // token_dispose(tok);
-    clean_globals();
 }
 
-void compiler_compile_file(const char *filename) {
-    char *src;
+/**
+\WatchState
+ The module being watched, and the edit being checked.
+*/
+typedef struct {
+    Module *module;
+    IncrementalParse *parse; // NULL after errors, then the next edit parses the whole file
+    char *src;               // the new source, owned by `parse` once it is parsed
+    IncrementalEdit edit;
+    Diagnostics *diagnostics;
+} WatchState;
+
+static void watch_parse_edit(WatchState *state) {
+    state->edit = incremental_parse_update(state->parse, state->src);
+}
+
+static void watch_parse_full(WatchState *state) {
+    state->parse = init_incremental_parse(state->src, state->diagnostics);
+    state->edit = (IncrementalEdit) {.full_reparse = 1, .signatures_changed = 1};
+}
+
+static void watch_check(WatchState *state) {
+    Module *module = state->module;
+    IncrementalEdit *edit = &state->edit;
+    size_t i;
+
+    module->src = state->parse->src;
+    module->root = state->parse->root;
+    if (edit->full_reparse || edit->signatures_changed) {
+        resolve_module(module);
+        type_check(module->root, module->src);
+        fold_constants(module->root, module->src);
+        return;
+    }
+    resolve_functions(module, edit->reparsed);
+    for (i = 0; i < edit->reparsed->size; i++) {
+        type_check(edit->reparsed->items[i], module->src);
+        fold_constants(edit->reparsed->items[i], module->src);
+    }
+}
+
+/*
+Runs a step of the watch loop. The errors it throws are collected instead of
+exiting the compiler, the step stops at the first one it doesn't recover from.
+Returns 0 if it stopped.
+*/
+static int watch_try(WatchState *state, void (*step)(WatchState *)) {
+    jmp_buf recover;
+
+    state->diagnostics->recover = &recover;
+    if (setjmp(recover) != 0) {
+        state->diagnostics->recover = NULL;
+        return 0;
+    }
+    step(state);
+    state->diagnostics->recover = NULL;
+    return 1;
+}
+
+/*
+Parses and checks the new source of the module.
+*/
+static void watch_update(WatchState *state) {
+    char *src_copy;
+
+    if (state->parse) {
+        src_copy = strdup(state->src);
+        if (watch_try(state, watch_parse_edit)) {
+            free(src_copy);
+        } else {
+            // the reparsed functions stop at the first syntax error, parse the whole file to report all of them
+            diagnostics_clear(state->diagnostics);
+            incremental_parse_dispose(state->parse);
+            state->parse = NULL;
+            state->src = src_copy;
+        }
+    }
+    if (!state->parse)
+        watch_try(state, watch_parse_full);
+    if (state->diagnostics->count == 0)
+        watch_try(state, watch_check);
+}
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (double) (end.tv_sec - start->tv_sec) * 1000 + (double) (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+Whether the file at `path` was saved since `last`, which is updated then. The
+modification time is compared to the nanosecond, and the size with it, as the
+clock of a file system can tick slower than two saves.
+*/
+static int file_changed(const char *path, struct stat *last) {
+    struct stat st;
+
+    if (stat(path, &st) != 0)
+        return 0;
+    if (st.st_mtim.tv_sec == last->st_mtim.tv_sec && st.st_mtim.tv_nsec == last->st_mtim.tv_nsec &&
+        st.st_size == last->st_size)
+        return 0;
+    *last = st;
+    return 1;
+}
+
+/*
+Checks the root module again every time its file changes, until the compiler is interrupted.
+Only the edited top level functions are parsed and checked again, unless an edit changed
+a function signature or something outside the functions.
+Errors are printed, then the compiler waits for the next edit.
+*/
+static void watch_module(Module *module) {
+    Diagnostics *diagnostics = init_diagnostics(compiler_options.error_limit);
+    WatchState state = {.module = module, .diagnostics = diagnostics};
+    struct timespec start;
+    struct stat last;
+
+    // the module compiled without errors
+    diagnostics_install(diagnostics);
+    state.src = strdup(module->src);
+    watch_update(&state);
+    diagnostics_clear(diagnostics); // the warnings were printed already
+
+    stat(module->path, &last);
+    printf("Watching %s\n", module->path);
+    fflush(stdout);
+    while (1) {
+        usleep(WATCH_INTERVAL_US);
+        if (!file_changed(module->path, &last))
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        state.src = read_file(module->path);
+        watch_update(&state);
+
+        diagnostics_print(diagnostics);
+        if (diagnostics->count > 0) {
+            // parts of the tree may be missing or unchecked, the next edit starts over
+            if (state.parse)
+                incremental_parse_dispose(state.parse);
+            state.parse = NULL;
+        } else if (state.edit.full_reparse) {
+            printf("Checked %s in %.2f ms (full reparse)\n", module->path, elapsed_ms(&start));
+        } else {
+            printf("Checked %s in %.2f ms (%zu functions reparsed)\n", module->path, elapsed_ms(&start),
+                   state.edit.reparsed->size);
+        }
+        fflush(stdout);
+        diagnostics_clear(diagnostics);
+        if (state.edit.reparsed) { // the definitions are in the tree now
+            free(state.edit.reparsed->items);
+            free(state.edit.reparsed);
+            state.edit.reparsed = NULL;
+        }
+    }
+}
+
+/*
+Runs an optimization pass over the IR as a phase of its own, checked after it with --verify-ir.
+*/
+static void compiler_run_ir_pass(IrProgram *ir, const char *name, void (*pass)(IrProgram *)) {
+    PerfPhase phase;
+
+    perf_phase_begin(&phase, name);
+    pass(ir);
+    perf_phase_end(&phase);
+    if (compiler_options.verify_ir)
+        ir_verify(ir);
+}
+
+static void compiler_inline(IrProgram *ir) {
+    ir_inline(ir, compiler_options.inline_budget < 0 ? 0 : (uint32_t) compiler_options.inline_budget);
+}
+
+/*
+Writes the IR of the program next to the source file (--emit-ir).
+*/
+static void compiler_write_ir(IrProgram *ir, const char *filename) {
+    char *path = replace_file_extension(filename, ".ir"), *errMsg;
+    FILE *file = fopen(path, "w");
+    Writer *writer;
+    int failed;
+
+    if (file) {
+        writer = init_writer(file);
+        ir_print(ir, writer);
+        failed = writer_dispose(writer);
+        failed |= fclose(file) != 0;
+    }
+    if (!file || failed) {
+        alsprintf(&errMsg, "Can't write IR file \"%s\".", path);
+        log_error(COMPILER, errMsg);
+    }
+    free(path);
+}
+
+/*
+Path of an output file: the -o file, or the source file with `extension`.
+With both -S and -c, -o names the object file.
+*/
+static char *compiler_output_path(const char *filename, const char *extension) {
+    if (compiler_options.output && (compiler_options.emit_object == !strcmp(extension, ".o")))
+        return strdup(compiler_options.output);
+    return replace_file_extension(filename, extension);
+}
+
+/*
+Writes the program as assembly (-S).
+*/
+static void compiler_write_asm(const MachineProgram *program, const char *filename) {
+    char *path = compiler_output_path(filename, ".s"), *errMsg;
+    PerfPhase phase;
+    Writer *writer;
+    FILE *file;
+    int failed;
+
+    perf_phase_begin(&phase, "write assembly");
+    file = fopen(path, "w");
+    if (file) {
+        writer = init_writer(file);
+        asm_write(program, compiler_options.asm_syntax, writer);
+        failed = writer_dispose(writer);
+        failed |= fclose(file) != 0;
+    }
+    perf_phase_end(&phase);
+    if (!file || failed) {
+        alsprintf(&errMsg, "Can't write assembly file \"%s\".", path);
+        log_error(COMPILER, errMsg);
+    }
+    free(path);
+}
+
+/*
+Writes the encoded program as an object file (-c).
+*/
+static void compiler_write_object(const MachineProgram *program, const MachineCode *code, const char *filename) {
+    char *path = compiler_output_path(filename, ".o"), *errMsg;
+    PerfPhase phase;
+    Writer *writer;
+    FILE *file;
+    int failed;
+
+    perf_phase_begin(&phase, "write object");
+    file = fopen(path, "wb");
+    if (file) {
+        writer = init_writer(file);
+        object_write(program, code, writer);
+        failed = writer_dispose(writer);
+        failed |= fclose(file) != 0;
+    }
+    perf_phase_end(&phase);
+    if (!file || failed) {
+        alsprintf(&errMsg, "Can't write object file \"%s\".", path);
+        log_error(COMPILER, errMsg);
+    }
+    free(path);
+}
+
+/*
+Compiles the IR to machine code, written as assembly or as an object file, or run
+in memory (--jit). Returns the exit code of the program if it was run, 0 otherwise.
+*/
+static int compiler_compile_native(IrProgram *ir, const char *filename) {
+    MachineProgram *program;
+    MachineCode *code;
+    PerfPhase phase;
+    int exit_code = 0;
+
+    perf_phase_begin(&phase, "codegen");
+    program = codegen_compile(ir);
+    perf_phase_end(&phase);
+
+    if (compiler_options.emit_asm)
+        compiler_write_asm(program, filename);
+    if (compiler_options.emit_object || compiler_options.jit) {
+        perf_phase_begin(&phase, "encode");
+        code = encode_program(program);
+        perf_phase_end(&phase);
+        if (compiler_options.emit_object)
+            compiler_write_object(program, code, filename);
+        if (compiler_options.jit) {
+            perf_phase_begin(&phase, "jit run");
+            exit_code = jit_run(program, code);
+            perf_phase_end(&phase);
+        }
+        machine_code_dispose(code);
+    }
+    machine_program_dispose(program);
+    return exit_code;
+}
+
+/*
+Compiles the file and everything it imports.
+Returns the exit code of the program if it was run (--run or --jit), 0 otherwise.
+*/
+int compiler_compile_file(const char *filename) {
+    ModuleGraph *graph;
+    Program *program;
+    IrProgram *ir;
+    PerfPhase phase;
+    int build_ir = compiler_options.emit_asm || compiler_options.emit_object || compiler_options.jit ||
+                   compiler_options.emit_ir || compiler_options.verify_ir;
+    int exit_code = 0;
 
 #ifdef INF_DEBUG
     clock_t start, end;
@@ -42,11 +412,51 @@ void compiler_compile_file(const char *filename) {
 #endif
 
     /** Compiler Action */
-    src = read_file(filename);
+    init_globals();
 
-    compiler_compile(src);
+    // read the file and everything it imports
+    perf_phase_begin(&phase, "module graph");
+    graph = module_graph_build(filename);
+    perf_phase_end(&phase);
 
-    free(src);
+    // only checking, the trees of the imports aren't needed if their interfaces are up to date
+    module_graph_compile(graph, compiler_options.jobs, !build_ir && !compiler_options.run, compiler_compile_module);
+
+    if (compiler_options.watch)
+        watch_module(graph->root);
+
+    if (build_ir) {
+        perf_phase_begin(&phase, "build ir");
+        ir = ir_build(graph);
+        perf_phase_end(&phase);
+        if (compiler_options.verify_ir)
+            ir_verify(ir);
+        compiler_run_ir_pass(ir, "inline", compiler_inline);
+        compiler_run_ir_pass(ir, "sccp", ir_sccp);
+        compiler_run_ir_pass(ir, "loops", ir_optimize_loops);
+        compiler_run_ir_pass(ir, "dce", ir_dce);
+        if (compiler_options.emit_ir)
+            compiler_write_ir(ir, filename);
+        if (compiler_options.emit_asm || compiler_options.emit_object || compiler_options.jit)
+            exit_code = compiler_compile_native(ir, filename);
+        ir_program_dispose(ir);
+    }
+
+    if (compiler_options.run) {
+        perf_phase_begin(&phase, "bytecode");
+        program = bytecode_compile(graph);
+        perf_phase_end(&phase);
+
+        perf_phase_begin(&phase, "run");
+        exit_code = vm_run(program);
+        perf_phase_end(&phase);
+        program_dispose(program);
+    }
+
+    module_graph_dispose(graph);
+    clean_globals();
+
+    perf_report();
 
 #ifdef INF_DEBUG
     // Print done message with time elapsed
@@ -62,4 +472,6 @@ void compiler_compile_file(const char *filename) {
     }
     log_debug(COMPILER, done_msg);
 #endif
+
+    return exit_code;
 }
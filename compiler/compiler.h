@@ -1,8 +1,10 @@
 #ifndef INFINITY_COMPILER_COMPILER_H
 #define INFINITY_COMPILER_COMPILER_H
 
-void compiler_compile(char *src);
+#include "../module/module.h"
 
-void compiler_compile_file(const char *filename);
+void compiler_compile_module(Module *module);
+
+int compiler_compile_file(const char *filename);
 
 #endif //INFINITY_COMPILER_COMPILER_H
@@ -7,6 +7,7 @@
 #define _GNU_SOURCE
 //#define INF_DEBUG
 #define EXTENSION "txt"
+#define PRINT_FUNCTION "print" // builtin
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
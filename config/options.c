@@ -0,0 +1,102 @@
+#include "options.h"
+#include "../diagnostics/diagnostics.h"
+#include "../codegen/asm.h"
+#include "../ir/ir_inline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_PROFILE_PATH "infinity_profile.folded"
+
+CompilerOptions compiler_options = {.error_limit = DEFAULT_ERROR_LIMIT, .inline_budget = DEFAULT_INLINE_BUDGET};
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s [options] <file>\n", program_name);
+    printf("Options:\n");
+    printf("  --time-report     Print the time spent in each compilation phase\n");
+    printf("  --perf-counters   Add hardware performance counters to the time report (Linux only)\n");
+    printf("  -j <n>, --jobs=<n> Compile up to <n> modules in parallel (default: one per cpu)\n");
+    printf("  --self-profile[=<file>]\n");
+    printf("                    Sample the compiler while it runs and write folded stacks for\n");
+    printf("                    flame graphs to <file> (default: %s)\n", DEFAULT_PROFILE_PATH);
+    printf("  --run             Run the program in the bytecode VM, the exit code is main's result\n");
+    printf("  --jit             Run the program as x86-64 code generated in memory, without\n");
+    printf("                    assembling or linking it\n");
+    printf("  --emit-ast-bin    Write the parsed tree of every module to <file>.astbin, and load it\n");
+    printf("                    instead of parsing when the source didn't change\n");
+    printf("  --watch           Check the file again every time it changes, reparsing only the\n");
+    printf("                    edited functions\n");
+    printf("  --error-limit=<n> Stop parsing a file after <n> syntax errors, 0 for no limit\n");
+    printf("                    (default: %d)\n", DEFAULT_ERROR_LIMIT);
+    printf("  -S                Write the program as x86-64 assembly to <file>.s\n");
+    printf("  --asm-syntax=<gas|nasm>\n");
+    printf("                    Assembler syntax of -S (default: gas)\n");
+    printf("  -c                Write the program as an x86-64 ELF object file to <file>.o\n");
+    printf("  --emit-ir         Write the intermediate representation of the program to <file>.ir\n");
+    printf("  --verify-ir       Check the intermediate representation after every pass\n");
+    printf("  --inline-budget=<n>\n");
+    printf("                    Inline calls to functions of at most <n> IR instructions, 0 to\n");
+    printf("                    inline nothing (default: %d)\n", DEFAULT_INLINE_BUDGET);
+    printf("  -o <file>         Write the output to <file>\n");
+    printf("  --help            Print this message\n");
+}
+
+/*
+Fills `compiler_options` from the command line arguments.
+Exits on unknown options.
+*/
+void parse_options(int argc, char **argv) {
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--time-report")) {
+            compiler_options.time_report = 1;
+        } else if (!strcmp(argv[i], "--perf-counters")) {
+            compiler_options.time_report = 1;
+            compiler_options.perf_counters = 1;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            compiler_options.jobs = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--jobs=", strlen("--jobs="))) {
+            compiler_options.jobs = atoi(argv[i] + strlen("--jobs="));
+        } else if (!strcmp(argv[i], "--self-profile")) {
+            compiler_options.self_profile = DEFAULT_PROFILE_PATH;
+        } else if (!strncmp(argv[i], "--self-profile=", strlen("--self-profile="))) {
+            compiler_options.self_profile = argv[i] + strlen("--self-profile=");
+        } else if (!strcmp(argv[i], "--run")) {
+            compiler_options.run = 1;
+        } else if (!strcmp(argv[i], "--jit")) {
+            compiler_options.jit = 1;
+        } else if (!strcmp(argv[i], "--emit-ast-bin")) {
+            compiler_options.emit_ast_bin = 1;
+        } else if (!strcmp(argv[i], "--watch")) {
+            compiler_options.watch = 1;
+        } else if (!strncmp(argv[i], "--error-limit=", strlen("--error-limit="))) {
+            compiler_options.error_limit = atoi(argv[i] + strlen("--error-limit="));
+        } else if (!strcmp(argv[i], "-S")) {
+            compiler_options.emit_asm = 1;
+        } else if (!strcmp(argv[i], "--asm-syntax=gas")) {
+            compiler_options.asm_syntax = ASM_GAS;
+        } else if (!strcmp(argv[i], "--asm-syntax=nasm")) {
+            compiler_options.asm_syntax = ASM_NASM;
+        } else if (!strcmp(argv[i], "-c")) {
+            compiler_options.emit_object = 1;
+        } else if (!strcmp(argv[i], "--emit-ir")) {
+            compiler_options.emit_ir = 1;
+        } else if (!strcmp(argv[i], "--verify-ir")) {
+            compiler_options.verify_ir = 1;
+        } else if (!strncmp(argv[i], "--inline-budget=", strlen("--inline-budget="))) {
+            compiler_options.inline_budget = atoi(argv[i] + strlen("--inline-budget="));
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            compiler_options.output = argv[++i];
+        } else if (!strcmp(argv[i], "--help")) {
+            print_usage(argv[0]);
+            exit(0);
+        } else if (argv[i][0] == '-') {
+            printf("Unknown option '%s'.\n", argv[i]);
+            print_usage(argv[0]);
+            exit(1);
+        } else {
+            compiler_options.target_file = argv[i];
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef INFINITY_COMPILER_OPTIONS_H
+#define INFINITY_COMPILER_OPTIONS_H
+
+/**
+\CompilerOptions
+ Options given to the compiler as command line arguments.
+*/
+typedef struct {
+    char *target_file;
+    int time_report;   // print how long each compilation phase took
+    int perf_counters; // record hardware performance counters for each phase (Linux only)
+    int jobs;          // threads compiling modules in parallel, 0 means one per cpu
+    char *self_profile; // path of the folded-stacks file to write the sampled profile into, or NULL
+    int run;           // run the program in the bytecode VM instead of only compiling it
+    int jit;           // run the program as x86-64 code generated in memory
+    int emit_ast_bin;  // cache the parsed tree of every module in a binary image next to its source
+    int watch;         // recheck the target file every time it changes, reparsing only the edited functions
+    int error_limit;   // syntax errors reported per file before the parser gives up, 0 for no limit
+    int emit_asm;      // write the program as x86-64 assembly
+    int asm_syntax;    // AsmSyntax of the assembly
+    int emit_object;   // write the program as an x86-64 ELF object file
+    int emit_ir;       // write the IR of the program to <file>.ir
+    int verify_ir;     // check the IR after it is built and after every pass
+    int inline_budget; // instructions a function can have to be inlined, 0 to inline nothing
+    char *output;      // path of the output file, or NULL to put it next to the source file
+} CompilerOptions;
+
+extern CompilerOptions compiler_options;
+
+void print_usage(const char *program_name);
+
+void parse_options(int argc, char **argv);
+
+#endif //INFINITY_COMPILER_OPTIONS_H
@@ -0,0 +1,79 @@
+#include "diagnostics.h"
+#include "../logging/logging.h"
+#include "../io/io.h"
+#include <stdlib.h>
+
+/*
+Diagnostics of the current thread, the modules and the functions of a module
+are parsed on different threads.
+*/
+static _Thread_local Diagnostics *installed_diagnostics = NULL;
+
+static void diagnostics_open(Diagnostics *diagnostics) {
+    diagnostics->stream = open_memstream(&diagnostics->text, &diagnostics->len);
+    if (!diagnostics->stream)
+        log_error(COMPILER, "Can't allocate memory for diagnostics.");
+}
+
+Diagnostics *init_diagnostics(size_t limit) {
+    Diagnostics *diagnostics = calloc(1, sizeof(Diagnostics));
+    if (!diagnostics)
+        log_error(COMPILER, "Can't allocate memory for diagnostics.");
+
+    diagnostics_open(diagnostics);
+    diagnostics->limit = limit;
+    return diagnostics;
+}
+
+void diagnostics_dispose(Diagnostics *diagnostics) {
+    fclose(diagnostics->stream);
+    free(diagnostics->text);
+    free(diagnostics);
+}
+
+/*
+Forgets the errors reported so far.
+*/
+void diagnostics_clear(Diagnostics *diagnostics) {
+    fclose(diagnostics->stream);
+    free(diagnostics->text);
+    diagnostics_open(diagnostics);
+    diagnostics->count = 0;
+}
+
+/*
+Makes the errors thrown on this thread go to `diagnostics` (NULL to exit on errors again).
+Returns the diagnostics installed before.
+*/
+Diagnostics *diagnostics_install(Diagnostics *diagnostics) {
+    Diagnostics *previous = installed_diagnostics;
+    installed_diagnostics = diagnostics;
+    return previous;
+}
+
+Diagnostics *diagnostics_installed(void) {
+    return installed_diagnostics;
+}
+
+int diagnostics_limit_reached(const Diagnostics *diagnostics) {
+    return diagnostics->limit > 0 && diagnostics->count >= diagnostics->limit;
+}
+
+/*
+Prints the errors and warnings reported so far, and how many errors there are.
+*/
+void diagnostics_print(Diagnostics *diagnostics) {
+    char *msg;
+
+    fflush(diagnostics->stream);
+    fwrite(diagnostics->text, 1, diagnostics->len, stdout);
+    if (diagnostics->count > 0) {
+        if (diagnostics_limit_reached(diagnostics))
+            alsprintf(&msg, "Stopped after %zu errors (--error-limit)", diagnostics->count);
+        else
+            alsprintf(&msg, "%zu error%s", diagnostics->count, diagnostics->count == 1 ? "" : "s");
+        log_debug(COMPILER, msg);
+        free(msg);
+    }
+    fflush(stdout);
+}
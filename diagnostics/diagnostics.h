@@ -0,0 +1,38 @@
+#ifndef INFINITY_COMPILER_DIAGNOSTICS_H
+#define INFINITY_COMPILER_DIAGNOSTICS_H
+
+#include <stdio.h>
+#include <setjmp.h>
+
+#define DEFAULT_ERROR_LIMIT 20
+
+/**
+\Diagnostics
+ Errors of a pass that recovers from them, printed together at the end.\n
+ While installed on a thread with a `recover` point, the errors thrown on the
+ thread are written to `stream` and jump to `recover`, instead of exiting.
+*/
+typedef struct {
+    FILE *stream;     // writes to `text`
+    char *text;
+    size_t len;
+    size_t count;     // errors reported
+    size_t limit;     // the pass stops after this many errors, 0 for no limit
+    jmp_buf *recover; // where errors jump to, NULL to exit on errors
+} Diagnostics;
+
+Diagnostics *init_diagnostics(size_t limit);
+
+void diagnostics_dispose(Diagnostics *diagnostics);
+
+void diagnostics_clear(Diagnostics *diagnostics);
+
+Diagnostics *diagnostics_install(Diagnostics *diagnostics);
+
+Diagnostics *diagnostics_installed(void);
+
+int diagnostics_limit_reached(const Diagnostics *diagnostics);
+
+void diagnostics_print(Diagnostics *diagnostics);
+
+#endif //INFINITY_COMPILER_DIAGNOSTICS_H
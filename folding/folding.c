@@ -0,0 +1,168 @@
+#include "folding.h"
+#include "../logging/logging.h"
+#include "../ast_image/ast_image.h"
+#include "../visitor/visitor.h"
+#include <limits.h>
+
+/*
+Constant folding.
+Every expression without variables or function calls is evaluated at compile
+time and replaced by a literal, with the semantics of 32 bit integers:
+overflow and division by zero are compile errors, division truncates toward zero.
+*/
+
+static int is_literal(const AstNode *node, DataType type) {
+    return node->type == AST_EXPRESSION && node->data.expression.kind == EXPRESSION_LITERAL &&
+           node->data.expression.value->type == type;
+}
+
+static void dispose_literal(AstNode *node) {
+    // the nodes of a loaded AST image are mapped, not allocated
+    if (!node || ast_image_owns(node))
+        return;
+    literal_value_dispose(node->data.expression.value);
+    ast_dispose(node);
+}
+
+/*
+Turns `node` into a literal, in place, so its parent doesn't change.
+*/
+static void replace_with_literal(AstNode *node, DataType type, Value value) {
+    Expression *expr = &node->data.expression;
+
+    dispose_literal(expr->left);
+    dispose_literal(expr->right);
+    expr->kind = EXPRESSION_LITERAL;
+    expr->left = NULL;
+    expr->right = NULL;
+    expr->value = init_literal_value(type, value);
+    expr->contains_variables = 0;
+}
+
+static void fold_logical(AstNode *node) {
+    Expression *expr = &node->data.expression;
+    int a = expr->left->data.expression.value->value.bool_value != 0;
+    int b = expr->right->data.expression.value->value.bool_value != 0;
+
+    switch (expr->operator) {
+        case EQUALS:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a == b});
+            break;
+        case NOT_EQUALS:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a != b});
+            break;
+        case AND:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a && b});
+            break;
+        case OR:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a || b});
+            break;
+        default:
+            break;
+    }
+}
+
+static void fold_binary(AstNode *node, const char *src) {
+    Expression *expr = &node->data.expression;
+    int a, b, result;
+
+    // dividing by a constant zero is an error even if the dividend isn't constant
+    if (expr->operator == DIVIDE && is_literal(expr->right, TYPE_INT) &&
+        expr->right->data.expression.value->value.integer_value == 0)
+        throw_exception_at(OPTIMIZER, src, node->row, node->col, "Division by zero");
+
+    if (is_literal(expr->left, TYPE_BOOL) && is_literal(expr->right, TYPE_BOOL)) {
+        fold_logical(node);
+        return;
+    }
+    if (!is_literal(expr->left, TYPE_INT) || !is_literal(expr->right, TYPE_INT))
+        return; // not constant, or a type error that is not reported here
+
+    a = expr->left->data.expression.value->value.integer_value;
+    b = expr->right->data.expression.value->value.integer_value;
+    switch (expr->operator) {
+        case ADD:
+            if (__builtin_add_overflow(a, b, &result))
+                throw_exception_at(OPTIMIZER, src, node->row, node->col, "Integer overflow in constant expression");
+            break;
+        case SUB:
+            if (__builtin_sub_overflow(a, b, &result))
+                throw_exception_at(OPTIMIZER, src, node->row, node->col, "Integer overflow in constant expression");
+            break;
+        case MUL:
+            if (__builtin_mul_overflow(a, b, &result))
+                throw_exception_at(OPTIMIZER, src, node->row, node->col, "Integer overflow in constant expression");
+            break;
+        case DIVIDE:
+            if (a == INT_MIN && b == -1)
+                throw_exception_at(OPTIMIZER, src, node->row, node->col, "Integer overflow in constant expression");
+            result = a / b;
+            break;
+        case EQUALS:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a == b});
+            return;
+        case NOT_EQUALS:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a != b});
+            return;
+        case GRATER_THAN:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a > b});
+            return;
+        case LOWER_THAN:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a < b});
+            return;
+        case GRATER_EQUAL:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a >= b});
+            return;
+        case LOWER_EQUAL:
+            replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = a <= b});
+            return;
+        default:
+            return;
+    }
+    replace_with_literal(node, TYPE_INT, (Value) {.integer_value = result});
+}
+
+static void fold_unary(AstNode *node, const char *src) {
+    Expression *expr = &node->data.expression;
+    int value;
+
+    if (expr->operator == NOT && is_literal(expr->left, TYPE_BOOL)) {
+        replace_with_literal(node, TYPE_BOOL, (Value) {.bool_value = !expr->left->data.expression.value->value.bool_value});
+        return;
+    }
+    if (expr->operator != SUB || !is_literal(expr->left, TYPE_INT))
+        return;
+    value = expr->left->data.expression.value->value.integer_value;
+    if (value == INT_MIN)
+        throw_exception_at(OPTIMIZER, src, node->row, node->col, "Integer overflow in constant expression");
+    replace_with_literal(node, TYPE_INT, (Value) {.integer_value = -value});
+}
+
+/*
+Called after the operands are folded (post-order), so constant subexpressions
+of expressions with variables are folded too: x * (2 + 3) -> x * 5
+*/
+static void fold_node(AstNode *node, void *src) {
+    if (node->type != AST_EXPRESSION)
+        return;
+
+    switch (node->data.expression.kind) {
+        case EXPRESSION_BINARY:
+            fold_binary(node, src);
+            break;
+        case EXPRESSION_UNARY:
+            fold_unary(node, src);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+Folds all the constant expressions of a module.
+`src` is the source of the module, for error messages.
+*/
+void fold_constants(AstNode *root, const char *src) {
+    AstVisitor visitor = {.post = fold_node, .context = (void *) src};
+    ast_walk(root, &visitor);
+}
@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_FOLDING_H
+#define INFINITY_COMPILER_FOLDING_H
+
+#include "../ast/ast.h"
+
+void fold_constants(AstNode *root, const char *src);
+
+#endif //INFINITY_COMPILER_FOLDING_H
@@ -0,0 +1,246 @@
+#include "function_scan.h"
+#include "../parser/parser.h"
+#include "../lexer/lexer.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+Splits a source into its top level functions without parsing it.
+A function goes from its `func` keyword to the brace closing its body, found by
+matching braces. Each function can then be parsed on its own.
+*/
+
+static void scan_push(FunctionScan *scan, const TopLevelFunction *function) {
+    if (scan->len == scan->capacity) {
+        scan->capacity = MAX(scan->capacity * 2, 16);
+        scan->functions = realloc(scan->functions, scan->capacity * sizeof(TopLevelFunction));
+        if (!scan->functions)
+            log_error(PARSER, "Can't allocate memory for function scan.");
+    }
+    scan->functions[scan->len++] = *function;
+}
+
+/**
+\ScanCursor
+ Position of the scan, counted the way the lexer counts it.
+*/
+typedef struct {
+    const char *src;
+    unsigned int idx;
+    unsigned int row;
+    unsigned int col;
+} ScanCursor;
+
+/**
+\ScanToken
+ A token seen by the scan. Only the tokens that delimit functions have their own type,
+ every other token is an ID.
+*/
+typedef struct {
+    TokenType type;
+    unsigned int idx;
+    unsigned int row;
+    unsigned int col;
+} ScanToken;
+
+static void scan_forward(ScanCursor *cursor) {
+    if (cursor->src[cursor->idx] == 0)
+        return;
+    cursor->idx++;
+    cursor->col++;
+}
+
+static void scan_new_line(ScanCursor *cursor) {
+    cursor->row++;
+    cursor->col = -1;
+    scan_forward(cursor);
+}
+
+/*
+Skips whitespace and comments like the lexer does.
+Returns 0 at an unclosed comment, which the lexer reports when it gets there.
+*/
+static int scan_skip_blank(ScanCursor *cursor) {
+    const char *src = cursor->src;
+
+    while (1) {
+        switch (src[cursor->idx]) {
+            case '\n':
+                scan_new_line(cursor);
+                break;
+            case ' ':
+            case '\t':
+                scan_forward(cursor);
+                break;
+            case '/':
+                if (src[cursor->idx + 1] == '/') {
+                    while (src[cursor->idx] != 0 && src[cursor->idx] != '\n')
+                        scan_forward(cursor);
+                } else if (src[cursor->idx + 1] == '-') {
+                    scan_forward(cursor);
+                    scan_forward(cursor);
+                    while (!(src[cursor->idx] == '-' && src[cursor->idx + 1] == '/')) {
+                        if (src[cursor->idx] == 0)
+                            return 0;
+                        if (src[cursor->idx] == '\n')
+                            scan_new_line(cursor);
+                        else
+                            scan_forward(cursor);
+                    }
+                    scan_forward(cursor);
+                    scan_forward(cursor);
+                } else {
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+}
+
+/*
+Reads the next token without allocating it. The source is valid for the lexer up to
+the token, but the token itself isn't checked: the parser reports invalid ones.
+*/
+static ScanToken scan_next_token(ScanCursor *cursor) {
+    const char *src = cursor->src;
+    ScanToken tok;
+    unsigned int len;
+
+    if (!scan_skip_blank(cursor))
+        return (ScanToken) {.type = EOF_TOKEN, .idx = cursor->idx, .row = cursor->row, .col = cursor->col};
+    tok = (ScanToken) {.type = ID, .idx = cursor->idx, .row = cursor->row, .col = cursor->col};
+
+    if (isalpha(src[cursor->idx])) {
+        while (isalnum(src[cursor->idx]) || src[cursor->idx] == '_')
+            scan_forward(cursor);
+        len = cursor->idx - tok.idx;
+        if (len == strlen("func") && !memcmp(src + tok.idx, "func", len))
+            tok.type = FUNC_KEYWORD;
+        else if (len == strlen("define") && !memcmp(src + tok.idx, "define", len))
+            tok.type = DEFINE_KEYWORD;
+        return tok;
+    }
+
+    switch (src[cursor->idx]) {
+        case 0:
+            tok.type = EOF_TOKEN;
+            return tok;
+        case '{':
+            tok.type = L_CURLY_BRACE;
+            break;
+        case '}':
+            tok.type = R_CURLY_BRACE;
+            break;
+        case '"':
+            // the lexer counts the new lines in strings as columns
+            scan_forward(cursor);
+            while (src[cursor->idx] != '"') {
+                if (src[cursor->idx] == 0)
+                    return (ScanToken) {.type = EOF_TOKEN, .idx = cursor->idx, .row = cursor->row,
+                            .col = cursor->col};
+                if (src[cursor->idx] == '\\')
+                    scan_forward(cursor);
+                scan_forward(cursor);
+            }
+            break;
+        default:
+            // the other tokens are one character long as far as the scan is concerned,
+            // no two character token has a second character that starts a comment or a string
+            break;
+    }
+    scan_forward(cursor);
+    return tok;
+}
+
+/*
+Finds the top level functions in src[idx..end), by matching braces.
+`row` and `col` are the position of `idx`.
+The scan only looks at characters, it costs a fraction of lexing the range.
+*/
+FunctionScan scan_top_level_functions(char *src, unsigned int idx, unsigned int row, unsigned int col,
+                                      unsigned int end) {
+    FunctionScan scan = {.blank = 1, .only_functions = 1};
+    TopLevelFunction function = {};
+    ScanCursor cursor = {.src = src, .idx = idx, .row = row, .col = col};
+    ScanToken tok;
+    long depth = 0;
+    int in_function = 0, in_define = 0;
+    unsigned int define_row = 0;
+
+    while ((tok = scan_next_token(&cursor)).type != EOF_TOKEN && tok.idx < end) {
+        // the replacement of a macro is the rest of its `define` line
+        if (in_define && tok.row == define_row) {
+            if (tok.type == FUNC_KEYWORD || tok.type == L_CURLY_BRACE || tok.type == R_CURLY_BRACE)
+                scan.brace_macros = 1;
+            continue;
+        }
+        in_define = 0;
+
+        switch (tok.type) {
+            case FUNC_KEYWORD:
+                if (!in_function && depth == 0) {
+                    function = (TopLevelFunction) {
+                            .start = tok.idx, .start_row = tok.row, .start_col = tok.col,
+                            .blank_before = scan.blank,
+                    };
+                    in_function = 1;
+                }
+                break;
+            case L_CURLY_BRACE:
+                depth++;
+                break;
+            case R_CURLY_BRACE:
+                if (--depth < 0)
+                    scan.only_functions = 0;
+                if (in_function && depth == 0) {
+                    function.end = tok.idx + 1;
+                    function.end_row = tok.row;
+                    function.end_col = tok.col;
+                    scan_push(&scan, &function);
+                    in_function = 0;
+                    scan.blank = 1;
+                    continue;
+                }
+                break;
+            case DEFINE_KEYWORD:
+                scan.macros_end = tok.idx + 1;
+                scan.only_functions = 0;
+                in_define = 1;
+                define_row = tok.row;
+                break;
+            default:
+                break;
+        }
+        if (!in_function) {
+            scan.blank = 0;
+            scan.only_functions = 0;
+        }
+    }
+    if (in_function || (tok.type == EOF_TOKEN && src[tok.idx] != 0)) // unclosed function, comment or string
+        scan.only_functions = 0;
+    scan.next_idx = tok.type == EOF_TOKEN ? (unsigned int) strlen(src) : tok.idx;
+    return scan;
+}
+
+/*
+Parses the function at `function` on its own, expanding the macros of `preprocessor`.
+*/
+AstNode *parse_top_level_function(Preprocessor *preprocessor, char *src, size_t src_len,
+                                  const TopLevelFunction *function) {
+    Lexer *lexer = init_lexer_at(src, src_len, function->start, function->start_row, function->start_col);
+    Parser parser = {.lexer = lexer, .preprocessor = preprocessor};
+    AstNode *node;
+
+    preprocessor->lexer = lexer;
+    parser.token = preprocessor_next_token(preprocessor);
+    node = parser_parse_function_definition(&parser);
+
+    token_dispose(parser.token);
+    lexer_dispose(lexer);
+    return node;
+}
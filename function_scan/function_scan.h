@@ -0,0 +1,42 @@
+#ifndef INFINITY_COMPILER_FUNCTION_SCAN_H
+#define INFINITY_COMPILER_FUNCTION_SCAN_H
+
+#include "../ast/ast.h"
+#include "../preprocessor/preprocessor.h"
+
+/**
+\TopLevelFunction
+ The source range of a top level function, and its parsed definition.
+*/
+typedef struct {
+    unsigned int start;      // index of the `func` keyword
+    unsigned int end;        // index after the closing brace
+    unsigned int start_row, start_col;
+    unsigned int end_row, end_col; // position of the closing brace
+    int blank_before;        // only whitespace and comments since the previous function (or the file start)
+    size_t child_index;      // index of the definition in the children of the root
+    AstNode *node;
+} TopLevelFunction;
+
+/**
+\FunctionScan
+ The top level functions found in a range of the source.
+*/
+typedef struct {
+    TopLevelFunction *functions;
+    size_t len;
+    size_t capacity;
+    int blank;               // no tokens outside functions since the last function
+    int only_functions;      // every token in the range belongs to a function
+    unsigned int macros_end; // index after the last `define` keyword, 0 if there is none
+    int brace_macros;        // a macro expands to braces or `func`, the functions can't be found without expanding it
+    unsigned int next_idx;   // index of the first token after the range
+} FunctionScan;
+
+FunctionScan scan_top_level_functions(char *src, unsigned int idx, unsigned int row, unsigned int col,
+                                      unsigned int end);
+
+AstNode *parse_top_level_function(Preprocessor *preprocessor, char *src, size_t src_len,
+                                  const TopLevelFunction *function);
+
+#endif //INFINITY_COMPILER_FUNCTION_SCAN_H
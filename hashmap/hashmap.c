@@ -0,0 +1,105 @@
+#include "hashmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHMAP_MIN_CAPACITY 16
+// grow when more than 3/4 of the entries are used
+#define HASHMAP_LOAD_FACTOR_NUM 3
+#define HASHMAP_LOAD_FACTOR_DEN 4
+
+/*
+FNV-1a hash of a null terminated string.
+*/
+size_t hash_string(const char *str) {
+    size_t hash = 14695981039346656037ULL;
+    while (*str) {
+        hash ^= (unsigned char) *str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+HashMap *init_hashmap(size_t capacity) {
+    HashMap *map = malloc(sizeof(HashMap));
+    size_t real_capacity = HASHMAP_MIN_CAPACITY;
+    if (!map) {
+        printf("Can't allocate memory for hash map.\n");
+        exit(1);
+    }
+
+    while (real_capacity < capacity)
+        real_capacity <<= 1;
+    map->capacity = real_capacity;
+    map->size = 0;
+    map->entries = calloc(real_capacity, sizeof(HashMapEntry));
+    if (!map->entries) {
+        printf("Can't allocate memory for hash map.\n");
+        exit(1);
+    }
+
+    return map;
+}
+
+void hashmap_dispose(HashMap *map) {
+    free(map->entries);
+    free(map);
+}
+
+/*
+Returns the entry of `key`, or the empty entry where it should be inserted.
+*/
+static HashMapEntry *hashmap_find_entry(HashMapEntry *entries, size_t capacity, const char *key, size_t hash) {
+    size_t i = hash & (capacity - 1);
+    // linear probing, the map is never full so an empty entry is always found
+    while (entries[i].key && (entries[i].hash != hash || strcmp(entries[i].key, key) != 0))
+        i = (i + 1) & (capacity - 1);
+    return &entries[i];
+}
+
+static void hashmap_grow(HashMap *map) {
+    size_t new_capacity = map->capacity * 2, i;
+    HashMapEntry *new_entries = calloc(new_capacity, sizeof(HashMapEntry));
+    if (!new_entries) {
+        printf("Can't allocate memory for hash map.\n");
+        exit(1);
+    }
+
+    for (i = 0; i < map->capacity; i++) {
+        if (map->entries[i].key)
+            *hashmap_find_entry(new_entries, new_capacity, map->entries[i].key, map->entries[i].hash) =
+                    map->entries[i];
+    }
+    free(map->entries);
+    map->entries = new_entries;
+    map->capacity = new_capacity;
+}
+
+/*
+Returns the value of `key`, or NULL if it is not in the map.
+*/
+void *hashmap_get(const HashMap *map, const char *key) {
+    return hashmap_find_entry(map->entries, map->capacity, key, hash_string(key))->value;
+}
+
+/*
+Sets the value of `key`.
+Returns the previous value of `key`, or NULL if it was not in the map.
+*/
+void *hashmap_put(HashMap *map, const char *key, void *value) {
+    size_t hash = hash_string(key);
+    HashMapEntry *entry;
+    void *previous;
+
+    if ((map->size + 1) * HASHMAP_LOAD_FACTOR_DEN > map->capacity * HASHMAP_LOAD_FACTOR_NUM)
+        hashmap_grow(map);
+
+    entry = hashmap_find_entry(map->entries, map->capacity, key, hash);
+    previous = entry->value;
+    if (!entry->key) {
+        entry->key = key;
+        entry->hash = hash;
+        map->size++;
+    }
+    entry->value = value;
+    return previous;
+}
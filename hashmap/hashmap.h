@@ -0,0 +1,33 @@
+#ifndef INFINITY_COMPILER_HASHMAP_H
+#define INFINITY_COMPILER_HASHMAP_H
+
+#include <stdio.h>
+
+typedef struct {
+    const char *key; // NULL if the entry is empty
+    size_t hash;
+    void *value;
+} HashMapEntry;
+
+/**
+\HashMap
+ Open addressing hash map from strings to pointers.
+ Keys and values are not owned by the map.
+*/
+typedef struct {
+    HashMapEntry *entries;
+    size_t capacity; // always a power of 2
+    size_t size;
+} HashMap;
+
+size_t hash_string(const char *str);
+
+HashMap *init_hashmap(size_t capacity);
+
+void hashmap_dispose(HashMap *map);
+
+void *hashmap_get(const HashMap *map, const char *key);
+
+void *hashmap_put(HashMap *map, const char *key, void *value);
+
+#endif //INFINITY_COMPILER_HASHMAP_H
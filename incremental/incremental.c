@@ -0,0 +1,323 @@
+#include "incremental.h"
+#include "../parser/parser.h"
+#include "../lexer/lexer.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../variable/variable.h"
+#include "../visitor/visitor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Incremental parsing at the granularity of top level functions.
+
+The source is split into top level functions by matching braces over the
+tokens: a function goes from its `func` keyword to the brace closing its body.
+After an edit, only the functions (and the blank gaps between them) that the
+edit touched are lexed and parsed again. Everything before them is unchanged,
+everything after them only moved. Edits that touch anything else, like imports,
+macros or top level statements, fall back to parsing the whole file.
+*/
+
+static void parse_full(IncrementalParse *parse) {
+    Lexer *lexer = init_lexer(parse->src);
+    Parser *parser = init_parser(lexer);
+    FunctionScan scan;
+    AstNode *child;
+    size_t i, j = 0;
+
+    parser->diagnostics = parse->diagnostics;
+    parse->root = parser_parse(parser);
+    // keep the macros, the functions parsed later may use them
+    if (parse->preprocessor)
+        preprocessor_dispose(parse->preprocessor);
+    parse->preprocessor = parser->preprocessor;
+    token_dispose(parser->token);
+    free(parser);
+    lexer_dispose(lexer);
+
+    scan = scan_top_level_functions(parse->src, 0, 0, 0, parse->src_len);
+    for (i = 0; i < parse->root->data.compound.children->size; i++) {
+        child = parse->root->data.compound.children->items[i];
+        if (child->type != AST_FUNCTION_DEFINITION)
+            continue;
+        if (j < scan.len) {
+            scan.functions[j].child_index = i;
+            scan.functions[j].node = child;
+        }
+        j++;
+    }
+
+    free(parse->functions);
+    parse->functions = scan.functions;
+    parse->functions_len = scan.len;
+    parse->blank_after = scan.blank;
+    parse->macros_end = scan.macros_end;
+    if (scan.brace_macros || j != scan.len) {
+        // the functions can't be found without expanding the macros, every edit reparses the whole file
+        parse->functions_len = 0;
+        parse->macros_end = parse->src_len + 1;
+    }
+}
+
+/*
+Parses `src`, which is owned by the parse from now on.
+The syntax errors of the full parses are collected in `diagnostics`, if not NULL.
+The functions reparsed after an edit don't recover from errors.
+*/
+IncrementalParse *init_incremental_parse(char *src, Diagnostics *diagnostics) {
+    IncrementalParse *parse = calloc(1, sizeof(IncrementalParse));
+    if (!parse)
+        log_error(PARSER, "Can't allocate memory for incremental parse.");
+
+    parse->src = src;
+    parse->src_len = strlen(src);
+    parse->diagnostics = diagnostics;
+    parse_full(parse);
+    return parse;
+}
+
+void incremental_parse_dispose(IncrementalParse *parse) {
+    preprocessor_dispose(parse->preprocessor);
+    free(parse->functions);
+    free(parse->src);
+    free(parse);
+}
+
+static int shift_row(AstNode *node, void *delta) {
+    node->row += *(int *) delta;
+    return 0;
+}
+
+static void shift_rows(AstNode *node, int delta) {
+    AstVisitor visitor = {.pre = shift_row, .context = &delta};
+    ast_walk(node, &visitor);
+}
+
+static int count_lines(const char *src, unsigned int start, unsigned int end) {
+    int lines = 0;
+    const char *p = src + start, *stop = src + end;
+    while ((p = memchr(p, '\n', stop - p))) {
+        lines++;
+        p++;
+    }
+    return lines;
+}
+
+static int same_signature(const FunctionDefinition *a, const FunctionDefinition *b) {
+    size_t i;
+
+    if (strcmp(a->func_name, b->func_name) != 0 || a->returnType != b->returnType ||
+        a->args->size != b->args->size)
+        return 0;
+    for (i = 0; i < a->args->size; i++) {
+        if (((Variable *) a->args->items[i])->value->type != ((Variable *) b->args->items[i])->value->type)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+Index of the first child of the root after the functions [a, b).
+The gaps between the touched functions are blank, so it is right after them.
+*/
+static size_t first_child_after(const IncrementalParse *parse, size_t a, size_t b) {
+    if (b > a)
+        return parse->functions[b - 1].child_index + 1;
+    if (a < parse->functions_len)
+        return parse->functions[a].child_index;
+    return parse->root->data.compound.children->size;
+}
+
+static IncrementalEdit reparse_full(IncrementalParse *parse, char *new_src) {
+    free(parse->src);
+    parse->src = new_src;
+    parse->src_len = strlen(new_src);
+    parse_full(parse);
+    return (IncrementalEdit) {.full_reparse = 1, .signatures_changed = 1};
+}
+
+/*
+Replaces the functions [a, b) with the `added` functions of `scan`,
+in the function table and in the children of the root.
+*/
+static void splice_functions(IncrementalParse *parse, size_t a, size_t b, FunctionScan *scan, List *added) {
+    List *children = parse->root->data.compound.children;
+    size_t removed = b - a, first_child, i;
+    TopLevelFunction *functions;
+    void **items;
+
+    // the gap after the last function is blank, there are no children after it
+    first_child = a < parse->functions_len ? parse->functions[a].child_index : children->size;
+
+    items = malloc((children->size - removed + added->size + 1) * sizeof(void *));
+    functions = malloc((parse->functions_len - removed + scan->len + 1) * sizeof(TopLevelFunction));
+    if (!items || !functions)
+        log_error(PARSER, "Can't allocate memory for incremental parse.");
+
+    memcpy(items, children->items, first_child * sizeof(void *));
+    if (added->size > 0)
+        memcpy(items + first_child, added->items, added->size * sizeof(void *));
+    memcpy(items + first_child + added->size, children->items + first_child + removed,
+           (children->size - first_child - removed) * sizeof(void *));
+    free(children->items);
+    children->items = items;
+    children->size = children->size - removed + added->size;
+
+    memcpy(functions, parse->functions, a * sizeof(TopLevelFunction));
+    for (i = 0; i < scan->len; i++) {
+        functions[a + i] = scan->functions[i];
+        functions[a + i].child_index = first_child + i;
+        functions[a + i].node = added->items[i];
+    }
+    memcpy(functions + a + scan->len, parse->functions + b, (parse->functions_len - b) * sizeof(TopLevelFunction));
+    for (i = a + scan->len; i < parse->functions_len - removed + scan->len; i++)
+        functions[i].child_index = functions[i].child_index - removed + added->size;
+    free(parse->functions);
+    parse->functions = functions;
+    parse->functions_len = parse->functions_len - removed + scan->len;
+}
+
+/*
+Updates the parse after src[edit_start..old_end) was replaced by new_src[edit_start..new_end).
+`new_src` is owned by the parse from now on.
+Reparses only the top level functions the edit touched, if it can.
+*/
+IncrementalEdit incremental_parse_edit(IncrementalParse *parse, char *new_src,
+                                       unsigned int edit_start, unsigned int old_end, unsigned int new_end) {
+    IncrementalEdit edit = {};
+    TopLevelFunction *functions = parse->functions;
+    size_t n = parse->functions_len, a = 0, b, lo, hi, i;
+    unsigned int region_start, region_end, region_row = 0, region_col = 0, old_next_idx, new_src_len;
+    long delta = (long) new_end - (long) old_end;
+    int gap_before, gap_after, blank_entering, blank_leaving, following_blank, line_delta;
+    List *children = parse->root->data.compound.children;
+    FunctionScan scan;
+    Lexer *lexer;
+    Token *tok;
+    List *added;
+    AstNode *node;
+
+    // touched functions are [a, b): the first that ends at or after the edit,
+    // up to the last that starts at or before its end
+    lo = 0, hi = n;
+    while (lo < hi) {
+        i = (lo + hi) / 2;
+        if (functions[i].end < edit_start)
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    a = lo;
+    for (b = a; b < n && functions[b].start <= old_end; b++);
+
+    // the gaps the edit touched, around and between the touched functions, must be blank
+    gap_before = a == b || edit_start < functions[a].start;
+    gap_after = a == b || old_end > functions[b - 1].end;
+    blank_entering = a < n ? functions[a].blank_before : parse->blank_after;
+    blank_leaving = b < n ? functions[b].blank_before : parse->blank_after;
+    if ((gap_before && !blank_entering) || (gap_after && !blank_leaving))
+        return reparse_full(parse, new_src);
+    for (i = a + 1; i < b; i++) {
+        if (!functions[i].blank_before)
+            return reparse_full(parse, new_src);
+    }
+
+    if (gap_before) {
+        region_start = a > 0 ? functions[a - 1].end : 0;
+        if (a > 0) {
+            region_row = functions[a - 1].end_row;
+            region_col = functions[a - 1].end_col + 1;
+        }
+    } else {
+        region_start = functions[a].start;
+        region_row = functions[a].start_row;
+        region_col = functions[a].start_col;
+    }
+    region_end = gap_after ? (b < n ? functions[b].start : parse->src_len) : functions[b - 1].end;
+
+    // macros are defined in order, a function after the last one sees all of them
+    if (parse->macros_end && region_start < parse->macros_end)
+        return reparse_full(parse, new_src);
+    // the first token after the region, which must not move other than by `delta`
+    lexer = init_lexer_at(parse->src, parse->src_len, region_end, 0, 0);
+    tok = lexer_next_token(lexer);
+    old_next_idx = tok->type == EOF_TOKEN ? parse->src_len : tok->idx;
+    token_dispose(tok);
+    lexer_dispose(lexer);
+    // the columns of the tokens on the line the edit ends would change
+    if (old_next_idx < parse->src_len && !memchr(parse->src + old_end, '\n', old_next_idx - old_end))
+        return reparse_full(parse, new_src);
+
+    new_src_len = strlen(new_src);
+    scan = scan_top_level_functions(new_src, region_start, region_row, region_col, region_end + delta);
+    if (!scan.only_functions || scan.next_idx != old_next_idx + delta) {
+        free(scan.functions);
+        return reparse_full(parse, new_src);
+    }
+
+    added = init_list(sizeof(AstNode *));
+    for (i = 0; i < scan.len; i++)
+        list_push(added, parse_top_level_function(parse->preprocessor, new_src, new_src_len, &scan.functions[i]));
+
+    edit.signatures_changed = scan.len != b - a;
+    for (i = 0; !edit.signatures_changed && i < scan.len; i++) {
+        edit.signatures_changed = !same_signature(&functions[a + i].node->data.function_definition,
+                                                  &((AstNode *) added->items[i])->data.function_definition);
+    }
+
+    // shift everything after the region, top level statements included
+    line_delta = count_lines(new_src, edit_start, new_end) - count_lines(parse->src, edit_start, old_end);
+    if (line_delta) {
+        for (i = first_child_after(parse, a, b); i < children->size; i++)
+            shift_rows(children->items[i], line_delta);
+    }
+    for (i = b; i < n; i++) {
+        functions[i].start += delta;
+        functions[i].end += delta;
+        functions[i].start_row += line_delta;
+        functions[i].end_row += line_delta;
+    }
+
+    // the region has only functions, so the gaps inside it are blank
+    following_blank = (scan.len > 0 || blank_entering) && blank_leaving;
+    for (i = 0; i < scan.len; i++)
+        scan.functions[i].blank_before = i == 0 ? blank_entering : 1;
+    if (b < n)
+        functions[b].blank_before = following_blank;
+    else
+        parse->blank_after = following_blank;
+
+    if (!edit.signatures_changed) {
+        // reuse the old nodes, so the calls bound to them stay valid
+        for (i = 0; i < scan.len; i++) {
+            node = added->items[i];
+            *functions[a + i].node = *node;
+            ast_dispose(node);
+            added->items[i] = functions[a + i].node;
+        }
+    }
+    splice_functions(parse, a, b, &scan, added);
+    free(scan.functions);
+
+    free(parse->src);
+    parse->src = new_src;
+    parse->src_len = new_src_len;
+    edit.reparsed = added;
+    return edit;
+}
+
+/*
+Updates the parse to `new_src`, finding the edited range by comparing it with the old source.
+*/
+IncrementalEdit incremental_parse_update(IncrementalParse *parse, char *new_src) {
+    unsigned int new_len = strlen(new_src), prefix = 0, suffix = 0;
+
+    while (prefix < parse->src_len && prefix < new_len && parse->src[prefix] == new_src[prefix])
+        prefix++;
+    while (suffix < parse->src_len - prefix && suffix < new_len - prefix &&
+           parse->src[parse->src_len - 1 - suffix] == new_src[new_len - 1 - suffix])
+        suffix++;
+
+    return incremental_parse_edit(parse, new_src, prefix, parse->src_len - suffix, new_len - suffix);
+}
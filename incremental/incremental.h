@@ -0,0 +1,46 @@
+#ifndef INFINITY_COMPILER_INCREMENTAL_H
+#define INFINITY_COMPILER_INCREMENTAL_H
+
+#include "../ast/ast.h"
+#include "../preprocessor/preprocessor.h"
+#include "../function_scan/function_scan.h"
+#include "../diagnostics/diagnostics.h"
+
+/**
+\IncrementalParse
+ A parsed source file that can be updated after an edit by reparsing only the
+ top level functions the edit touched. Everything else is kept, including the
+ macros defined by the last full parse.
+*/
+typedef struct {
+    char *src;
+    unsigned int src_len;
+    AstNode *root;
+    Preprocessor *preprocessor; // macros of the last full parse
+    unsigned int macros_end;    // functions before this index can't be reparsed alone
+    TopLevelFunction *functions; // in source order
+    size_t functions_len;
+    int blank_after;            // only whitespace and comments after the last function
+    Diagnostics *diagnostics;   // collects the syntax errors of full parses, NULL to exit on them
+} IncrementalParse;
+
+/**
+\IncrementalEdit
+ What an edit changed.
+*/
+typedef struct {
+    int full_reparse;        // the whole file was parsed again
+    int signatures_changed;  // a function was added or removed, or its signature changed
+    List *reparsed;          // the new definitions, if not `full_reparse`
+} IncrementalEdit;
+
+IncrementalParse *init_incremental_parse(char *src, Diagnostics *diagnostics);
+
+void incremental_parse_dispose(IncrementalParse *parse);
+
+IncrementalEdit incremental_parse_edit(IncrementalParse *parse, char *new_src,
+                                       unsigned int edit_start, unsigned int old_end, unsigned int new_end);
+
+IncrementalEdit incremental_parse_update(IncrementalParse *parse, char *new_src);
+
+#endif //INFINITY_COMPILER_INCREMENTAL_H
@@ -3,9 +3,6 @@
 #include <string.h>
 #include <stdarg.h>
 
-// Chunk size for reading files
-#define CHUNK_SIZE 128
-
 /*
 Gets the size of the file in bytes.
 Sets the file pointer to the beginning of the file.
@@ -30,17 +27,12 @@ unsigned long file_size(const char *file_name) {
 }
 
 /*
-Reads a file in text mode and return its contents as (char *).
-Reads in chunks. CHUNK_SIZE is the size of each chunk.
+Reads a file and return its contents as (char *).
 */
 char *read_file(const char *filename) {
     FILE *fp;
     char *content;
     unsigned long flen;
-    // unsigned long bytes_read = 0;
-    // unsigned short reading_amount;
-    char chunk[CHUNK_SIZE];
-    chunk[CHUNK_SIZE - 1] = '\0';
 
     // open file for reading
     fp = fopen(filename, "r");
@@ -57,13 +49,9 @@ char *read_file(const char *filename) {
         fclose(fp);
         return NULL;
     }
-    content[0] = '\0';
-
-    // read file into the buffer
-    while (fgets(chunk, CHUNK_SIZE - 1, fp) != NULL) {
-        strcat(content, chunk);
-    }
 
+    // read the whole file at once, appending chunks with strcat is quadratic
+    flen = fread(content, 1, flen, fp);
     content[flen] = '\0';
 
     fclose(fp);
@@ -78,13 +66,34 @@ char *get_file_extension(char *filename) {
     return strdup(p + 1);
 }
 
+/*
+Returns a copy of `filename` with `extension` instead of its extension,
+or with `extension` appended if it has none: main.txt -> main.s
+*/
+char *replace_file_extension(const char *filename, const char *extension) {
+    const char *dot = strrchr(filename, '.'), *slash = strrchr(filename, '/');
+    size_t len = dot && (!slash || dot > slash) ? (size_t) (dot - filename) : strlen(filename);
+    char *path = malloc(len + strlen(extension) + 1);
+
+    if (!path) {
+        printf("Error allocating memory\n");
+        exit(1);
+    }
+    memcpy(path, filename, len);
+    strcpy(path + len, extension);
+    return path;
+}
+
 int alsprintf(char **buf, const char *format, ...) {
-    va_list args;
+    va_list args, args_copy;
     int printed_chars;
     va_start(args, format);
+    // the first vsnprintf consumes `args`, so the second one needs a copy
+    va_copy(args_copy, args);
 
     // Get the size of the buffer needed to hold the formatted string
-    printed_chars = vsnprintf(NULL, 0, format, args);
+    printed_chars = vsnprintf(NULL, 0, format, args_copy);
+    va_end(args_copy);
     if (printed_chars < 0) {
         // An error occurred
         va_end(args);
@@ -9,6 +9,8 @@ char *read_file(const char *filename);
 
 char *get_file_extension(char *filename);
 
+char *replace_file_extension(const char *filename, const char *extension);
+
 int alsprintf(char **buf, const char *format, ...);
 
 #endif //INFINITY_COMPILER_IO_H
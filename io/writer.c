@@ -0,0 +1,71 @@
+#include "writer.h"
+#include "../logging/logging.h"
+#include <stdlib.h>
+#include <string.h>
+
+Writer *init_writer(FILE *file) {
+    Writer *writer = malloc(sizeof(Writer));
+
+    if (!writer || !(writer->buffer = malloc(WRITER_BUFFER_SIZE)))
+        log_error(COMPILER, "Can't allocate memory for output buffer.");
+    writer->file = file;
+    writer->len = 0;
+    writer->failed = 0;
+    return writer;
+}
+
+/*
+Flushes and frees the writer, the file stays open.
+Returns nonzero if any write failed.
+*/
+int writer_dispose(Writer *writer) {
+    int failed;
+
+    writer_flush(writer);
+    failed = writer->failed || fflush(writer->file) != 0;
+    free(writer->buffer);
+    free(writer);
+    return failed;
+}
+
+void writer_flush(Writer *writer) {
+    if (writer->len > 0 && fwrite(writer->buffer, 1, writer->len, writer->file) != writer->len)
+        writer->failed = 1;
+    writer->len = 0;
+}
+
+void writer_write(Writer *writer, const char *data, size_t len) {
+    if (writer->len + len > WRITER_BUFFER_SIZE) {
+        writer_flush(writer);
+        if (len > WRITER_BUFFER_SIZE) { // too big to buffer
+            if (fwrite(data, 1, len, writer->file) != len)
+                writer->failed = 1;
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->len, data, len);
+    writer->len += len;
+}
+
+void writer_puts(Writer *writer, const char *str) {
+    writer_write(writer, str, strlen(str));
+}
+
+void writer_putc(Writer *writer, char c) {
+    if (writer->len == WRITER_BUFFER_SIZE)
+        writer_flush(writer);
+    writer->buffer[writer->len++] = c;
+}
+
+void writer_int(Writer *writer, long value) {
+    char digits[24], *p = digits + sizeof(digits);
+    unsigned long magnitude = value < 0 ? 0ul - (unsigned long) value : (unsigned long) value;
+
+    do {
+        *--p = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+        *--p = '-';
+    writer_write(writer, p, digits + sizeof(digits) - p);
+}
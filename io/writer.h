@@ -0,0 +1,34 @@
+#ifndef INFINITY_COMPILER_WRITER_H
+#define INFINITY_COMPILER_WRITER_H
+
+#include <stdio.h>
+
+#define WRITER_BUFFER_SIZE (1 << 20)
+
+/**
+\Writer
+ Buffered output to a file, written with a single fwrite per megabyte.
+ Numbers are formatted in place, without printf.
+*/
+typedef struct {
+    FILE *file;
+    char *buffer;
+    size_t len;
+    int failed; // a write to the file failed
+} Writer;
+
+Writer *init_writer(FILE *file);
+
+int writer_dispose(Writer *writer);
+
+void writer_flush(Writer *writer);
+
+void writer_write(Writer *writer, const char *data, size_t len);
+
+void writer_puts(Writer *writer, const char *str);
+
+void writer_putc(Writer *writer, char c);
+
+void writer_int(Writer *writer, long value);
+
+#endif //INFINITY_COMPILER_WRITER_H
@@ -0,0 +1,799 @@
+#include "ir.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(sizeof(IrInstruction) == 16, "IR instructions are 16 bytes");
+
+static void *grow(void *array, uint32_t *capacity, size_t item_size) {
+    *capacity = MAX(*capacity * 2, 16);
+    array = realloc(array, *capacity * item_size);
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    return array;
+}
+
+IrProgram *init_ir_program() {
+    IrProgram *program = calloc(1, sizeof(IrProgram));
+
+    if (!program)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    program->functions = init_list(sizeof(IrFunction *));
+    program->function_ids = init_hashmap(64);
+    return program;
+}
+
+static void ir_function_dispose(IrFunction *function) {
+    uint32_t i;
+
+    for (i = 0; i < function->blocks_len; i++) {
+        free(function->blocks[i].code);
+        free(function->blocks[i].predecessors);
+    }
+    free(function->blocks);
+    free(function->instructions);
+    free(function->operands);
+    free(function);
+}
+
+void ir_program_dispose(IrProgram *program) {
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++)
+        ir_function_dispose(program->functions->items[i]);
+    free(program->functions->items);
+    free(program->functions);
+    hashmap_dispose(program->function_ids);
+    free(program->strings);
+    free(program->globals);
+    free(program);
+}
+
+/*
+Adds a function to the program, named after its definition so calls can find it.
+*/
+IrFunction *init_ir_function(IrProgram *program, char *name, DataType return_type, uint32_t args_len) {
+    IrFunction *function = calloc(1, sizeof(IrFunction));
+
+    if (!function)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    function->name = name;
+    function->return_type = return_type;
+    function->args_len = args_len;
+    if (name)
+        hashmap_put(program->function_ids, name, (void *) (program->functions->size + 1));
+    list_push(program->functions, function);
+    return function;
+}
+
+/*
+Drops the functions that `used` doesn't mark, none of them called by the others.
+The top level code stays first, and calls refer to the new indexes.
+*/
+void ir_remove_functions(IrProgram *program, const uint8_t *used) {
+    uint32_t *numbers = malloc((program->functions->size + 1) * sizeof(uint32_t)), b, i;
+    IrInstruction *instruction;
+    IrFunction *function;
+    size_t len = 0, f;
+
+    if (!numbers)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    hashmap_dispose(program->function_ids);
+    program->function_ids = init_hashmap(64);
+    for (f = 0; f < program->functions->size; f++) {
+        function = program->functions->items[f];
+        if (!used[f]) {
+            ir_function_dispose(function);
+            continue;
+        }
+        numbers[f] = len;
+        program->functions->items[len++] = function;
+        if (function->name)
+            hashmap_put(program->function_ids, function->name, (void *) len);
+    }
+    program->functions->size = len;
+    for (f = 0; f < len; f++) {
+        function = program->functions->items[f];
+        for (b = 0; b < function->blocks_len; b++) {
+            for (i = 0; i < function->blocks[b].len; i++) {
+                instruction = &function->instructions[function->blocks[b].code[i]];
+                if (instruction->op == IR_CALL)
+                    instruction->a = numbers[instruction->a];
+            }
+        }
+    }
+    free(numbers);
+}
+
+uint32_t ir_add_string(IrProgram *program, const char *str) {
+    if (program->strings_len == program->strings_capacity)
+        program->strings = grow(program->strings, &program->strings_capacity, sizeof(char *));
+    program->strings[program->strings_len] = str;
+    return program->strings_len++;
+}
+
+uint32_t ir_add_global(IrProgram *program, DataType type) {
+    if (program->globals_len == program->globals_capacity)
+        program->globals = grow(program->globals, &program->globals_capacity, sizeof(DataType));
+    program->globals[program->globals_len] = type;
+    return program->globals_len++;
+}
+
+uint32_t ir_add_block(IrFunction *function) {
+    if (function->blocks_len == function->blocks_capacity)
+        function->blocks = grow(function->blocks, &function->blocks_capacity, sizeof(IrBlock));
+    function->blocks[function->blocks_len] = (IrBlock) {0};
+    return function->blocks_len++;
+}
+
+void ir_add_edge(IrFunction *function, uint32_t from, uint32_t to) {
+    IrBlock *source = &function->blocks[from], *target = &function->blocks[to];
+
+    source->successors[source->successors_len++] = to;
+    if (target->predecessors_len == target->predecessors_capacity)
+        target->predecessors = grow(target->predecessors, &target->predecessors_capacity, sizeof(uint32_t));
+    target->predecessors[target->predecessors_len++] = from;
+}
+
+/*
+Moves every block `b` to `numbers[b]`, or drops it if that is IR_NONE: blocks
+are dropped once nothing jumps to them and their instructions are removed.
+*/
+void ir_renumber_blocks(IrFunction *function, const uint32_t *numbers) {
+    IrBlock *blocks = malloc((function->blocks_capacity + 1) * sizeof(IrBlock)), *block;
+    uint32_t blocks_len = 0, b, i;
+
+    if (!blocks)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    for (b = 0; b < function->blocks_len; b++) {
+        if (numbers[b] == IR_NONE) {
+            free(function->blocks[b].code);
+            free(function->blocks[b].predecessors);
+            continue;
+        }
+        blocks[numbers[b]] = function->blocks[b];
+        blocks_len++;
+    }
+    free(function->blocks);
+    function->blocks = blocks;
+    function->blocks_len = blocks_len;
+    for (b = 0; b < blocks_len; b++) {
+        block = &blocks[b];
+        for (i = 0; i < block->len; i++)
+            function->instructions[block->code[i]].block = b;
+        for (i = 0; i < block->successors_len; i++)
+            block->successors[i] = numbers[block->successors[i]];
+        for (i = 0; i < block->predecessors_len; i++)
+            block->predecessors[i] = numbers[block->predecessors[i]];
+    }
+}
+
+/*
+An instruction in no block yet, returns its id.
+*/
+uint32_t ir_new_instruction(IrFunction *function, IrOpcode op, DataType type, uint32_t a, uint32_t b) {
+    if (function->len == function->capacity)
+        function->instructions = grow(function->instructions, &function->capacity, sizeof(IrInstruction));
+    function->instructions[function->len] = (IrInstruction) {.op = op, .type = type, .block = IR_NONE, .a = a, .b = b};
+    return function->len++;
+}
+
+/*
+Inserts the instruction `id` in `block`, before the one at `position`.
+*/
+void ir_insert(IrFunction *function, uint32_t block, uint32_t position, uint32_t id) {
+    IrBlock *target = &function->blocks[block];
+
+    if (target->len == target->capacity)
+        target->code = grow(target->code, &target->capacity, sizeof(uint32_t));
+    memmove(target->code + position + 1, target->code + position, (target->len - position) * sizeof(uint32_t));
+    target->code[position] = id;
+    target->len++;
+    function->instructions[id].block = block;
+}
+
+/*
+Appends an instruction to `block`, returns its id.
+*/
+uint32_t ir_emit(IrFunction *function, uint32_t block, IrOpcode op, DataType type, uint32_t a, uint32_t b) {
+    uint32_t id = ir_new_instruction(function, op, type, a, b);
+    ir_insert(function, block, function->blocks[block].len, id);
+    return id;
+}
+
+/*
+Takes an instruction out of its block. Its uses are replaced by `replacement`
+when they are resolved.
+*/
+void ir_remove(IrFunction *function, uint32_t id, uint32_t replacement) {
+    IrInstruction *instruction = &function->instructions[id];
+    IrBlock *block;
+    uint32_t i;
+
+    if (instruction->block != IR_NONE) {
+        block = &function->blocks[instruction->block];
+        for (i = 0; i < block->len && block->code[i] != id; i++);
+        memmove(block->code + i, block->code + i + 1, (block->len - i - 1) * sizeof(uint32_t));
+        block->len--;
+    }
+    *instruction = (IrInstruction) {.op = IR_NOP, .type = instruction->type, .block = IR_NONE, .a = replacement};
+}
+
+/*
+The value that stands for `value`, following removed instructions.
+*/
+uint32_t ir_resolve(const IrFunction *function, uint32_t value) {
+    while (value != IR_NONE && function->instructions[value].op == IR_NOP)
+        value = function->instructions[value].a;
+    return value;
+}
+
+/*
+Removes the edge to the successor `index` of `from`, with the operands that
+the phis of the successor take from it.
+*/
+void ir_remove_edge(IrFunction *function, uint32_t from, uint32_t index) {
+    IrBlock *source = &function->blocks[from], *target = &function->blocks[source->successors[index]];
+    uint32_t predecessor = ir_predecessor_index(function, source->successors[index], from), *operands, len, i;
+    IrInstruction *phi;
+
+    for (i = 0; i < target->len && function->instructions[target->code[i]].op == IR_PHI; i++) {
+        phi = &function->instructions[target->code[i]];
+        operands = ir_list(function, phi->b);
+        len = ir_list_len(function, phi->b);
+        memmove(operands + predecessor, operands + predecessor + 1, (len - predecessor - 1) * sizeof(uint32_t));
+        function->operands[phi->b]--;
+    }
+    memmove(target->predecessors + predecessor, target->predecessors + predecessor + 1,
+            (target->predecessors_len - predecessor - 1) * sizeof(uint32_t));
+    target->predecessors_len--;
+    if (index == 0)
+        source->successors[0] = source->successors[1];
+    source->successors_len--;
+}
+
+/*
+Copies `ids` to the operand pool, returns the index of the list.
+*/
+uint32_t ir_add_operands(IrFunction *function, const uint32_t *ids, uint32_t len) {
+    uint32_t list;
+
+    while (function->operands_len + len + 1 > function->operands_capacity)
+        function->operands = grow(function->operands, &function->operands_capacity, sizeof(uint32_t));
+    list = function->operands_len;
+    function->operands[list] = len;
+    memcpy(function->operands + list + 1, ids, len * sizeof(uint32_t));
+    function->operands_len += len + 1;
+    return list;
+}
+
+uint32_t ir_list_len(const IrFunction *function, uint32_t list) {
+    return list == IR_NONE ? 0 : function->operands[list];
+}
+
+uint32_t *ir_list(const IrFunction *function, uint32_t list) {
+    return list == IR_NONE ? NULL : function->operands + list + 1;
+}
+
+/*
+The operands of an instruction that are values, in place so passes can replace them.
+*/
+uint32_t *ir_value_operands(IrFunction *function, IrInstruction *instruction, uint32_t *len) {
+    switch (instruction->op) {
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            *len = 2;
+            return &instruction->a;
+        case IR_NEG:
+        case IR_PRINT:
+        case IR_BRANCH:
+            *len = 1;
+            return &instruction->a;
+        case IR_RETURN:
+            *len = instruction->a != IR_NONE;
+            return &instruction->a;
+        case IR_STORE_GLOBAL:
+            *len = 1;
+            return &instruction->b;
+        case IR_PHI:
+        case IR_CALL:
+            *len = ir_list_len(function, instruction->b);
+            return ir_list(function, instruction->b);
+        default:
+            *len = 0;
+            return NULL;
+    }
+}
+
+/*
+Replaces the operands that name removed instructions by what replaced them.
+*/
+void ir_resolve_operands(IrFunction *function) {
+    IrInstruction *instruction;
+    uint32_t *operands, len, b, i, k;
+
+    for (b = 0; b < function->blocks_len; b++) {
+        for (i = 0; i < function->blocks[b].len; i++) {
+            instruction = &function->instructions[function->blocks[b].code[i]];
+            operands = ir_value_operands(function, instruction, &len);
+            for (k = 0; k < len; k++)
+                operands[k] = ir_resolve(function, operands[k]);
+        }
+    }
+}
+
+int ir_is_terminator(IrOpcode op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN;
+}
+
+/*
+Index of `predecessor` among the predecessors of `block`, which is the index of
+its operand in the phis of the block.
+*/
+uint32_t ir_predecessor_index(const IrFunction *function, uint32_t block, uint32_t predecessor) {
+    const IrBlock *target = &function->blocks[block];
+    uint32_t i;
+
+    for (i = 0; i < target->predecessors_len; i++) {
+        if (target->predecessors[i] == predecessor)
+            return i;
+    }
+    return IR_NONE;
+}
+
+char *ir_opcode_to_str(IrOpcode op) {
+    static char *names[] = {
+            "const", "string", "arg", "phi", "add", "sub", "mul", "div", "neg",
+            "eq", "ne", "lt", "gt", "le", "ge", "load_global", "store_global", "call", "print",
+            "jump", "branch", "return", "nop",
+    };
+    return op < IR_OPCODES_LEN ? names[op] : "unknown";
+}
+
+static void print_value(Writer *writer, uint32_t value) {
+    writer_putc(writer, '%');
+    writer_int(writer, value);
+}
+
+static void print_block_name(Writer *writer, uint32_t block) {
+    writer_putc(writer, 'b');
+    writer_int(writer, block);
+}
+
+static void print_string(Writer *writer, const char *str) {
+    writer_putc(writer, '"');
+    for (; *str; str++) {
+        if (*str == '\n') {
+            writer_puts(writer, "\\n");
+        } else if (*str == '\t') {
+            writer_puts(writer, "\\t");
+        } else {
+            if (*str == '"' || *str == '\\')
+                writer_putc(writer, '\\');
+            writer_putc(writer, *str);
+        }
+    }
+    writer_putc(writer, '"');
+}
+
+static void print_instruction(const IrProgram *program, const IrFunction *function, uint32_t id, Writer *writer) {
+    const IrInstruction *instruction = &function->instructions[id];
+    const IrBlock *block = &function->blocks[instruction->block];
+    const IrFunction *callee;
+    uint32_t *list, len, i;
+
+    writer_puts(writer, "    ");
+    if (instruction->type != TYPE_VOID && instruction->op != IR_PRINT && instruction->op != IR_RETURN) {
+        print_value(writer, id);
+        writer_putc(writer, ' ');
+        writer_puts(writer, data_type_to_str(instruction->type));
+        writer_puts(writer, " = ");
+    }
+    writer_puts(writer, ir_opcode_to_str(instruction->op));
+    switch (instruction->op) {
+        case IR_CONST:
+        case IR_ARG:
+            writer_putc(writer, ' ');
+            writer_int(writer, (int32_t) instruction->a);
+            break;
+        case IR_STRING:
+            writer_putc(writer, ' ');
+            print_string(writer, program->strings[instruction->a]);
+            break;
+        case IR_PHI:
+            list = ir_list(function, instruction->b);
+            len = ir_list_len(function, instruction->b);
+            for (i = 0; i < len; i++) {
+                writer_puts(writer, i ? ", [" : " [");
+                print_value(writer, list[i]);
+                writer_puts(writer, ", ");
+                print_block_name(writer, i < block->predecessors_len ? block->predecessors[i] : IR_NONE);
+                writer_putc(writer, ']');
+            }
+            break;
+        case IR_LOAD_GLOBAL:
+        case IR_STORE_GLOBAL:
+            writer_puts(writer, " @");
+            writer_int(writer, instruction->a);
+            if (instruction->op == IR_STORE_GLOBAL) {
+                writer_puts(writer, ", ");
+                print_value(writer, instruction->b);
+            }
+            break;
+        case IR_CALL:
+            callee = program->functions->items[instruction->a];
+            writer_putc(writer, ' ');
+            writer_puts(writer, callee->name);
+            writer_putc(writer, '(');
+            list = ir_list(function, instruction->b);
+            len = ir_list_len(function, instruction->b);
+            for (i = 0; i < len; i++) {
+                if (i)
+                    writer_puts(writer, ", ");
+                print_value(writer, list[i]);
+            }
+            writer_putc(writer, ')');
+            break;
+        case IR_JUMP:
+            writer_putc(writer, ' ');
+            print_block_name(writer, block->successors[0]);
+            break;
+        case IR_BRANCH:
+            writer_putc(writer, ' ');
+            print_value(writer, instruction->a);
+            writer_puts(writer, ", ");
+            print_block_name(writer, block->successors[0]);
+            writer_puts(writer, ", ");
+            print_block_name(writer, block->successors[1]);
+            break;
+        case IR_PRINT:
+            writer_putc(writer, ' ');
+            writer_puts(writer, data_type_to_str(instruction->type));
+            writer_putc(writer, ' ');
+            print_value(writer, instruction->a);
+            break;
+        case IR_RETURN:
+            if (instruction->a != IR_NONE) {
+                writer_putc(writer, ' ');
+                print_value(writer, instruction->a);
+            }
+            break;
+        default: // arithmetic and comparisons
+            writer_putc(writer, ' ');
+            print_value(writer, instruction->a);
+            if (instruction->op != IR_NEG) {
+                writer_puts(writer, ", ");
+                print_value(writer, instruction->b);
+            }
+            break;
+    }
+    writer_putc(writer, '\n');
+}
+
+static void print_function(const IrProgram *program, const IrFunction *function, Writer *writer) {
+    const IrBlock *block;
+    uint32_t b, i;
+
+    writer_puts(writer, "function ");
+    writer_puts(writer, function->name ? function->name : "<top level>");
+    writer_putc(writer, '(');
+    writer_int(writer, function->args_len);
+    writer_puts(writer, function->args_len == 1 ? " argument) -> " : " arguments) -> ");
+    writer_puts(writer, data_type_to_str(function->return_type));
+    writer_putc(writer, '\n');
+    for (b = 0; b < function->blocks_len; b++) {
+        block = &function->blocks[b];
+        print_block_name(writer, b);
+        writer_putc(writer, ':');
+        for (i = 0; i < block->predecessors_len; i++) {
+            writer_puts(writer, i ? ", " : "    ; from ");
+            print_block_name(writer, block->predecessors[i]);
+        }
+        writer_putc(writer, '\n');
+        for (i = 0; i < block->len; i++)
+            print_instruction(program, function, block->code[i], writer);
+    }
+}
+
+void ir_print(const IrProgram *program, Writer *writer) {
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++) {
+        if (i)
+            writer_putc(writer, '\n');
+        print_function(program, program->functions->items[i], writer);
+    }
+}
+
+/*
+Cooper, Harvey and Kennedy's iterative algorithm, on the reverse postorder.
+*/
+IrDominators ir_compute_dominators(const IrFunction *function) {
+    uint32_t n = function->blocks_len, *order = malloc(n * sizeof(uint32_t)), *rpo_index = malloc(n * sizeof(uint32_t));
+    uint32_t *stack = malloc(n * sizeof(uint32_t)), *next = calloc(n, sizeof(uint32_t));
+    uint32_t *children = calloc(n, sizeof(uint32_t)), *children_start = calloc(n + 1, sizeof(uint32_t));
+    uint32_t order_len = 0, stack_len = 0, counter = 0, b, i, p, a, c, new_idom;
+    IrDominators dominators = {malloc(n * sizeof(uint32_t)), malloc(n * sizeof(uint32_t)), malloc(n * sizeof(uint32_t))};
+    const IrBlock *block;
+    int changed = 1;
+
+    if (!order || !rpo_index || !stack || !next || !children || !children_start || !dominators.idom ||
+        !dominators.first || !dominators.last)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    for (b = 0; b < n; b++)
+        rpo_index[b] = dominators.idom[b] = dominators.first[b] = dominators.last[b] = IR_NONE;
+
+    // postorder, without recursion
+    stack[stack_len++] = 0;
+    rpo_index[0] = 0;
+    while (stack_len > 0) {
+        b = stack[stack_len - 1];
+        block = &function->blocks[b];
+        if (next[b] < block->successors_len) {
+            c = block->successors[next[b]++];
+            if (rpo_index[c] == IR_NONE) {
+                rpo_index[c] = 0;
+                stack[stack_len++] = c;
+            }
+            continue;
+        }
+        order[order_len++] = b;
+        stack_len--;
+    }
+    for (i = 0; i < order_len / 2; i++) {
+        b = order[i], order[i] = order[order_len - 1 - i], order[order_len - 1 - i] = b;
+    }
+    for (i = 0; i < order_len; i++)
+        rpo_index[order[i]] = i;
+
+    dominators.idom[0] = 0;
+    while (changed) {
+        changed = 0;
+        for (i = 1; i < order_len; i++) {
+            b = order[i];
+            block = &function->blocks[b];
+            new_idom = IR_NONE;
+            for (p = 0; p < block->predecessors_len; p++) {
+                a = block->predecessors[p];
+                if (dominators.idom[a] == IR_NONE)
+                    continue;
+                if (new_idom == IR_NONE) {
+                    new_idom = a;
+                    continue;
+                }
+                c = new_idom;
+                while (a != c) {
+                    while (rpo_index[a] > rpo_index[c])
+                        a = dominators.idom[a];
+                    while (rpo_index[c] > rpo_index[a])
+                        c = dominators.idom[c];
+                }
+                new_idom = a;
+            }
+            if (dominators.idom[b] != new_idom) {
+                dominators.idom[b] = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    // number the dominator tree depth first
+    for (i = 1; i < order_len; i++)
+        children_start[dominators.idom[order[i]] + 1]++;
+    for (b = 0; b < n; b++)
+        children_start[b + 1] += children_start[b];
+    memset(next, 0, n * sizeof(uint32_t));
+    for (i = 1; i < order_len; i++) {
+        b = dominators.idom[order[i]];
+        children[children_start[b] + next[b]++] = order[i];
+    }
+    memset(next, 0, n * sizeof(uint32_t));
+    stack_len = 0;
+    stack[stack_len++] = 0;
+    dominators.first[0] = counter++;
+    while (stack_len > 0) {
+        b = stack[stack_len - 1];
+        if (children_start[b] + next[b] < children_start[b + 1]) {
+            c = children[children_start[b] + next[b]++];
+            dominators.first[c] = counter++;
+            stack[stack_len++] = c;
+            continue;
+        }
+        dominators.last[b] = counter - 1;
+        stack_len--;
+    }
+
+    free(order);
+    free(rpo_index);
+    free(stack);
+    free(next);
+    free(children);
+    free(children_start);
+    return dominators;
+}
+
+/*
+Whether `a` dominates `b`, both reachable.
+*/
+int ir_dominates(const IrDominators *dominators, uint32_t a, uint32_t b) {
+    return dominators->first[a] <= dominators->first[b] && dominators->first[b] <= dominators->last[a];
+}
+
+void ir_dominators_dispose(IrDominators *dominators) {
+    free(dominators->idom);
+    free(dominators->first);
+    free(dominators->last);
+}
+
+static char *verify_error(const IrFunction *function, const char *msg, uint32_t block, uint32_t value) {
+    char *errMsg;
+
+    alsprintf(&errMsg, "Invalid IR in %s, b%u, %%%u: %s", function->name ? function->name : "<top level>", block,
+              value, msg);
+    return errMsg;
+}
+
+/*
+Checks the shape of the blocks, their edges, the operands of every instruction,
+and that every value is computed before its uses on all paths.
+Returns an error message, NULL if the function is valid.
+*/
+char *ir_verify_function(const IrProgram *program, IrFunction *function) {
+    uint32_t *positions = malloc((function->len + 1) * sizeof(uint32_t)), *operands, len, b, i, k, id, value;
+    uint32_t from, definition;
+    IrInstruction *instruction;
+    IrBlock *block;
+    IrFunction *callee;
+    IrDominators dominators = {0};
+    char *errMsg = NULL;
+
+    if (!positions)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    if (function->blocks_len == 0) {
+        errMsg = verify_error(function, "no blocks", 0, IR_NONE);
+        goto done;
+    }
+    for (i = 0; i < function->len; i++)
+        positions[i] = IR_NONE;
+
+    for (b = 0; b < function->blocks_len; b++) {
+        block = &function->blocks[b];
+        if (block->len == 0) {
+            errMsg = verify_error(function, "empty block", b, IR_NONE);
+            goto done;
+        }
+        for (i = 0; i < block->len; i++) {
+            id = block->code[i];
+            if (id >= function->len || positions[id] != IR_NONE || function->instructions[id].block != b) {
+                errMsg = verify_error(function, "instruction misplaced", b, id);
+                goto done;
+            }
+            positions[id] = i;
+            instruction = &function->instructions[id];
+            if (instruction->op >= IR_NOP)
+                errMsg = verify_error(function, "removed instruction in a block", b, id);
+            else if (instruction->op == IR_PHI && i > 0 && function->instructions[block->code[i - 1]].op != IR_PHI)
+                errMsg = verify_error(function, "phi after the body of the block", b, id);
+            else if (ir_is_terminator(instruction->op) != (i == block->len - 1))
+                errMsg = verify_error(function, "blocks end with their only jump, branch or return", b, id);
+            if (errMsg)
+                goto done;
+        }
+        instruction = &function->instructions[block->code[block->len - 1]];
+        if (block->successors_len != (instruction->op == IR_JUMP ? 1 : instruction->op == IR_BRANCH ? 2 : 0)) {
+            errMsg = verify_error(function, "successors don't match the end of the block", b, IR_NONE);
+            goto done;
+        }
+        for (k = 0; k < block->successors_len; k++) {
+            if (block->successors[k] >= function->blocks_len ||
+                ir_predecessor_index(function, block->successors[k], b) == IR_NONE) {
+                errMsg = verify_error(function, "successor without the block as predecessor", b, IR_NONE);
+                goto done;
+            }
+        }
+        for (k = 0; k < block->predecessors_len; k++) {
+            from = block->predecessors[k];
+            if (from >= function->blocks_len || (function->blocks[from].successors[0] != b &&
+                                                 (function->blocks[from].successors_len < 2 ||
+                                                  function->blocks[from].successors[1] != b))) {
+                errMsg = verify_error(function, "predecessor without the block as successor", b, IR_NONE);
+                goto done;
+            }
+        }
+    }
+
+    dominators = ir_compute_dominators(function);
+    for (b = 0; b < function->blocks_len; b++) {
+        block = &function->blocks[b];
+        for (i = 0; i < block->len; i++) {
+            id = block->code[i];
+            instruction = &function->instructions[id];
+            switch (instruction->op) {
+                case IR_PHI:
+                    if (ir_list_len(function, instruction->b) != block->predecessors_len)
+                        errMsg = verify_error(function, "phi without a value for each predecessor", b, id);
+                    break;
+                case IR_CALL:
+                    callee = instruction->a < program->functions->size ? program->functions->items[instruction->a]
+                                                                       : NULL;
+                    if (!callee || !callee->name || callee->args_len != ir_list_len(function, instruction->b))
+                        errMsg = verify_error(function, "call to an unknown function", b, id);
+                    break;
+                case IR_STRING:
+                    if (instruction->a >= program->strings_len)
+                        errMsg = verify_error(function, "unknown string", b, id);
+                    break;
+                case IR_LOAD_GLOBAL:
+                case IR_STORE_GLOBAL:
+                    if (instruction->a >= program->globals_len)
+                        errMsg = verify_error(function, "unknown global", b, id);
+                    break;
+                case IR_ARG:
+                    if (instruction->a >= function->args_len || b != 0)
+                        errMsg = verify_error(function, "argument outside the entry block", b, id);
+                    break;
+                case IR_RETURN:
+                    if ((instruction->a == IR_NONE) != (function->return_type == TYPE_VOID))
+                        errMsg = verify_error(function, "return doesn't match the return type", b, id);
+                    break;
+                default:
+                    break;
+            }
+            if (errMsg)
+                goto done;
+
+            operands = ir_value_operands(function, instruction, &len);
+            for (k = 0; k < len; k++) {
+                value = operands[k];
+                if (value >= function->len || positions[value] == IR_NONE) {
+                    errMsg = verify_error(function, "operand in no block", b, id);
+                    goto done;
+                }
+                if (function->instructions[value].type == TYPE_VOID) {
+                    errMsg = verify_error(function, "operand without a value", b, id);
+                    goto done;
+                }
+                // a phi uses its operands at the end of the predecessors
+                from = instruction->op == IR_PHI ? block->predecessors[k] : b;
+                if (dominators.idom[from] == IR_NONE)
+                    continue; // unreachable
+                definition = function->instructions[value].block;
+                if (definition == from ? instruction->op != IR_PHI && positions[value] >= i
+                                       : dominators.idom[definition] == IR_NONE ||
+                                         !ir_dominates(&dominators, definition, from)) {
+                    errMsg = verify_error(function, "operand doesn't dominate its use", b, id);
+                    goto done;
+                }
+            }
+        }
+    }
+
+    done:
+    free(positions);
+    ir_dominators_dispose(&dominators);
+    return errMsg;
+}
+
+/*
+Stops the compiler if a function of the program is invalid, for debugging passes.
+*/
+void ir_verify(const IrProgram *program) {
+    char *errMsg;
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++) {
+        errMsg = ir_verify_function(program, program->functions->items[i]);
+        if (errMsg)
+            log_error(OPTIMIZER, errMsg);
+    }
+}
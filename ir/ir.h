@@ -0,0 +1,181 @@
+#ifndef INFINITY_COMPILER_IR_H
+#define INFINITY_COMPILER_IR_H
+
+#include <stdint.h>
+#include "../list/list.h"
+#include "../hashmap/hashmap.h"
+#include "../types/types.h"
+#include "../io/writer.h"
+
+/*
+The intermediate representation between the tree and machine code: functions made
+of basic blocks of three address instructions, in SSA form.
+
+The instructions of a function are fixed size structs in one array, and a value is
+the index of the instruction that computes it, so operands are 32 bit ids. Blocks
+list the ids of their instructions in order: phis first, then the body, then one
+jump, branch or return. Phis and calls take operand lists, which are stored in
+the function's operand pool as a count followed by the ids.
+*/
+
+#define IR_NONE UINT32_MAX
+
+typedef enum {
+    IR_CONST,        // a: the value
+    IR_STRING,       // a: index in the program's strings
+    IR_ARG,          // a: index of the argument
+    IR_PHI,          // b: operand list, the value coming from each predecessor, in order
+    IR_ADD,          // a + b
+    IR_SUB,          // a - b
+    IR_MUL,          // a * b
+    IR_DIV,          // a / b, stops the program on division by zero
+    IR_NEG,          // -a
+    IR_EQ,           // a == b
+    IR_NE,           // a != b
+    IR_LT,           // a < b
+    IR_GT,           // a > b
+    IR_LE,           // a <= b
+    IR_GE,           // a >= b
+    IR_LOAD_GLOBAL,  // a: index in the program's globals
+    IR_STORE_GLOBAL, // a: index in the program's globals, b: value
+    IR_CALL,         // a: index of the function, b: operand list of the arguments
+    IR_PRINT,        // a: value, printed according to the type of the instruction
+    IR_JUMP,         // to the first successor of the block
+    IR_BRANCH,       // a: condition, to the first successor if it is true, to the second otherwise
+    IR_RETURN,       // a: value, IR_NONE in void functions
+    IR_NOP,          // a removed instruction, in no block. a: the value that replaces it, or IR_NONE
+    IR_OPCODES_LEN,
+} IrOpcode;
+
+/**
+\IrInstruction
+ 16 bytes. `type` is the DataType of the result, TYPE_VOID if there is none.
+*/
+typedef struct {
+    uint8_t op;
+    uint8_t type;
+    uint32_t block;
+    uint32_t a;
+    uint32_t b;
+} IrInstruction;
+
+/**
+\IrBlock
+ A basic block: ids of its instructions, and the edges of the control flow graph.
+*/
+typedef struct {
+    uint32_t *code;
+    uint32_t len;
+    uint32_t capacity;
+    uint32_t *predecessors;
+    uint32_t predecessors_len;
+    uint32_t predecessors_capacity;
+    uint32_t successors[2];
+    uint32_t successors_len;
+} IrBlock;
+
+/**
+\IrFunction
+ A function of the program. The top level code of all the modules is a function
+ without a name. Its entry is block 0.
+*/
+typedef struct {
+    char *name; // of the function definition, NULL for the top level code
+    DataType return_type;
+    uint32_t args_len;
+    IrInstruction *instructions;
+    uint32_t len;
+    uint32_t capacity;
+    uint32_t *operands; // operand lists: a count, then the ids
+    uint32_t operands_len;
+    uint32_t operands_capacity;
+    IrBlock *blocks;
+    uint32_t blocks_len;
+    uint32_t blocks_capacity;
+} IrFunction;
+
+/**
+\IrProgram
+ The functions, strings and global variables of all the modules.
+*/
+typedef struct {
+    List *functions;       // IrFunctions, the top level code first
+    HashMap *function_ids; // function name -> index + 1
+    const char **strings;  // string constants, owned by the tree
+    uint32_t strings_len;
+    uint32_t strings_capacity;
+    DataType *globals;     // types of the top level variables
+    uint32_t globals_len;
+    uint32_t globals_capacity;
+} IrProgram;
+
+/**
+\IrDominators
+ The dominator tree of the blocks reachable from the entry, numbered in depth
+ first order: a dominates b if b is numbered between a's first and last numbers.
+*/
+typedef struct {
+    uint32_t *idom;  // IR_NONE for unreachable blocks
+    uint32_t *first; // number of the block in the dominator tree
+    uint32_t *last;  // highest number in its subtree
+} IrDominators;
+
+IrProgram *init_ir_program();
+
+void ir_program_dispose(IrProgram *program);
+
+IrFunction *init_ir_function(IrProgram *program, char *name, DataType return_type, uint32_t args_len);
+
+void ir_remove_functions(IrProgram *program, const uint8_t *used);
+
+uint32_t ir_add_string(IrProgram *program, const char *str);
+
+uint32_t ir_add_global(IrProgram *program, DataType type);
+
+uint32_t ir_add_block(IrFunction *function);
+
+void ir_add_edge(IrFunction *function, uint32_t from, uint32_t to);
+
+void ir_remove_edge(IrFunction *function, uint32_t from, uint32_t index);
+
+void ir_renumber_blocks(IrFunction *function, const uint32_t *numbers);
+
+uint32_t ir_new_instruction(IrFunction *function, IrOpcode op, DataType type, uint32_t a, uint32_t b);
+
+uint32_t ir_emit(IrFunction *function, uint32_t block, IrOpcode op, DataType type, uint32_t a, uint32_t b);
+
+void ir_insert(IrFunction *function, uint32_t block, uint32_t position, uint32_t id);
+
+void ir_remove(IrFunction *function, uint32_t id, uint32_t replacement);
+
+uint32_t ir_resolve(const IrFunction *function, uint32_t value);
+
+uint32_t ir_add_operands(IrFunction *function, const uint32_t *ids, uint32_t len);
+
+uint32_t ir_list_len(const IrFunction *function, uint32_t list);
+
+uint32_t *ir_list(const IrFunction *function, uint32_t list);
+
+uint32_t *ir_value_operands(IrFunction *function, IrInstruction *instruction, uint32_t *len);
+
+void ir_resolve_operands(IrFunction *function);
+
+int ir_is_terminator(IrOpcode op);
+
+uint32_t ir_predecessor_index(const IrFunction *function, uint32_t block, uint32_t predecessor);
+
+IrDominators ir_compute_dominators(const IrFunction *function);
+
+int ir_dominates(const IrDominators *dominators, uint32_t a, uint32_t b);
+
+void ir_dominators_dispose(IrDominators *dominators);
+
+char *ir_opcode_to_str(IrOpcode op);
+
+void ir_print(const IrProgram *program, Writer *writer);
+
+char *ir_verify_function(const IrProgram *program, IrFunction *function);
+
+void ir_verify(const IrProgram *program);
+
+#endif //INFINITY_COMPILER_IR_H
@@ -0,0 +1,962 @@
+#include "ir_build.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include "../visitor/visitor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Builds the IR of the checked trees of a program, in SSA form, after Braun et al.,
+"Simple and Efficient Construction of Static Single Assignment Form".
+
+Local variables have no storage: each block remembers the value last assigned to
+each variable, and reading a variable a block doesn't assign looks it up in the
+predecessors, with a phi where several of them meet. A block is sealed once all
+its predecessors are known; until then, reads get a phi whose operands are added
+when it is sealed. Phis that merge a single value are removed.
+Top level variables are globals, loaded and stored in memory.
+*/
+
+#define EMPTY_KEY UINT64_MAX
+
+/**
+\Binding
+ A variable visible to the code being built.
+*/
+typedef struct {
+    Variable *variable;
+    uint32_t id; // number of the local variable in its function, or index of the global
+    int global;
+} Binding;
+
+/**
+\DefinitionTable
+ Open addressing hash table from (block, variable) to the current value of the variable.
+*/
+typedef struct {
+    uint64_t *keys; // block << 32 | variable, EMPTY_KEY if free
+    uint32_t *values;
+    size_t capacity; // a power of 2
+    size_t len;
+} DefinitionTable;
+
+typedef struct {
+    IrProgram *program;
+    IrFunction *function;      // the function being built
+    AstNode *definition;       // of the function being built, NULL for the top level code
+    uint32_t block;            // where the code goes
+    List *locals;              // Bindings of the current function, innermost last
+    List *globals;             // Bindings of the top level variables of the current module
+    uint32_t *values;          // the values computed and not used yet, a stack
+    size_t values_len;
+    size_t values_capacity;
+    size_t depth;              // nesting of blocks, top level variables are global
+    size_t value_depth;        // number of enclosing nodes that use the value of the current one
+    List *scopes;              // size of `locals` when each enclosing block was entered
+    List *blocks;              // blocks where the enclosing if statements and loops go on
+    AstNode *condition;        // of the if statement or loop being walked, the walk skips it
+    DataType *variable_types;  // of the local variables of the function
+    uint32_t variables_len;
+    uint32_t variables_capacity;
+    DefinitionTable definitions;
+    uint8_t *sealed;           // by block
+    uint32_t sealed_capacity;
+    uint8_t *walking;          // by block, those with one predecessor that a lookup goes through
+    uint32_t walking_capacity;
+    uint32_t *incomplete;      // (block, variable, phi) of the phis of unsealed blocks
+    uint32_t incomplete_len;
+    uint32_t incomplete_capacity;
+    uint32_t *lookups;         // (block, walked) of the blocks a variable is looked up in, a stack
+    uint32_t lookups_len;
+    uint32_t lookups_capacity;
+    const char *src;           // source of the current module, for error messages
+} IrBuilder;
+
+static void *grow(void *array, uint32_t *capacity, uint32_t needed, size_t item_size) {
+    if (needed <= *capacity)
+        return array;
+    *capacity = MAX(MAX(*capacity * 2, needed), 16);
+    array = realloc(array, *capacity * item_size);
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    return array;
+}
+
+static void build_error(IrBuilder *builder, const AstNode *node, const char *msg) {
+    throw_exception_at(OPTIMIZER, builder->src, node->row, node->col, msg);
+}
+
+static size_t table_slot(const DefinitionTable *table, uint64_t key) {
+    size_t i = (size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (table->capacity - 1);
+
+    while (table->keys[i] != EMPTY_KEY && table->keys[i] != key)
+        i = (i + 1) & (table->capacity - 1);
+    return i;
+}
+
+static void table_clear(DefinitionTable *table) {
+    memset(table->keys, 0xff, table->capacity * sizeof(uint64_t));
+    table->len = 0;
+}
+
+static void table_resize(DefinitionTable *table, size_t capacity) {
+    uint64_t *keys = table->keys;
+    uint32_t *values = table->values;
+    size_t old_capacity = table->capacity, i, slot;
+
+    table->capacity = capacity;
+    table->keys = malloc(capacity * sizeof(uint64_t));
+    table->values = malloc(capacity * sizeof(uint32_t));
+    if (!table->keys || !table->values)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    table_clear(table);
+    for (i = 0; i < old_capacity; i++) {
+        if (keys[i] == EMPTY_KEY)
+            continue;
+        slot = table_slot(table, keys[i]);
+        table->keys[slot] = keys[i];
+        table->values[slot] = values[i];
+        table->len++;
+    }
+    free(keys);
+    free(values);
+}
+
+static void table_put(DefinitionTable *table, uint64_t key, uint32_t value) {
+    size_t slot;
+
+    if ((table->len + 1) * 2 > table->capacity)
+        table_resize(table, MAX(table->capacity * 2, 256));
+    slot = table_slot(table, key);
+    if (table->keys[slot] == EMPTY_KEY)
+        table->len++;
+    table->keys[slot] = key;
+    table->values[slot] = value;
+}
+
+static uint32_t table_get(const DefinitionTable *table, uint64_t key) {
+    size_t slot = table_slot(table, key);
+    return table->keys[slot] == EMPTY_KEY ? IR_NONE : table->values[slot];
+}
+
+static uint32_t emit(IrBuilder *builder, IrOpcode op, DataType type, uint32_t a, uint32_t b) {
+    return ir_emit(builder->function, builder->block, op, type, a, b);
+}
+
+static void push_value(IrBuilder *builder, uint32_t value) {
+    if (builder->values_len == builder->values_capacity) {
+        builder->values_capacity = MAX(builder->values_capacity * 2, 64);
+        builder->values = realloc(builder->values, builder->values_capacity * sizeof(uint32_t));
+        if (!builder->values)
+            log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    }
+    builder->values[builder->values_len++] = value;
+}
+
+static uint32_t pop_value(IrBuilder *builder) {
+    return builder->values[--builder->values_len];
+}
+
+static uint32_t new_block(IrBuilder *builder) {
+    uint32_t block = ir_add_block(builder->function);
+
+    builder->sealed = grow(builder->sealed, &builder->sealed_capacity, block + 1, sizeof(uint8_t));
+    builder->sealed[block] = 0;
+    builder->walking = grow(builder->walking, &builder->walking_capacity, block + 1, sizeof(uint8_t));
+    builder->walking[block] = 0;
+    return block;
+}
+
+/*
+The value of a variable that is read before it is assigned, which only happens in
+unreachable code. It goes first in the entry block, which dominates everything.
+*/
+static uint32_t undefined_value(IrBuilder *builder, DataType type) {
+    uint32_t id = ir_new_instruction(builder->function, IR_CONST, type, 0, 0);
+    ir_insert(builder->function, 0, 0, id);
+    return id;
+}
+
+static uint32_t new_phi(IrBuilder *builder, uint32_t block, DataType type) {
+    IrFunction *function = builder->function;
+    uint32_t id = ir_new_instruction(function, IR_PHI, type, 0, IR_NONE), position = 0;
+
+    while (position < function->blocks[block].len &&
+           function->instructions[function->blocks[block].code[position]].op == IR_PHI)
+        position++;
+    ir_insert(function, block, position, id);
+    return id;
+}
+
+static void write_variable(IrBuilder *builder, uint32_t variable, uint32_t block, uint32_t value) {
+    table_put(&builder->definitions, (uint64_t) block << 32 | variable, value);
+}
+
+/*
+Replaces a phi whose operands are all the same value, or itself, by that value.
+*/
+static uint32_t remove_trivial_phi(IrBuilder *builder, uint32_t phi) {
+    IrFunction *function = builder->function;
+    uint32_t *operands = ir_list(function, function->instructions[phi].b), same = IR_NONE, value, i;
+
+    for (i = 0; i < ir_list_len(function, function->instructions[phi].b); i++) {
+        value = ir_resolve(function, operands[i]);
+        if (value == same || value == phi)
+            continue;
+        if (same != IR_NONE)
+            return phi;
+        same = value;
+    }
+    if (same == IR_NONE)
+        same = undefined_value(builder, function->instructions[phi].type);
+    ir_remove(function, phi, same);
+    return same;
+}
+
+static void push_lookup(IrBuilder *builder, uint32_t block) {
+    builder->lookups = grow(builder->lookups, &builder->lookups_capacity, 2 * (builder->lookups_len + 1),
+                            sizeof(uint32_t));
+    builder->lookups[2 * builder->lookups_len] = block;
+    builder->lookups[2 * builder->lookups_len++ + 1] = 0;
+}
+
+static uint32_t current_definition(IrBuilder *builder, uint32_t variable, uint32_t block) {
+    uint32_t value = table_get(&builder->definitions, (uint64_t) block << 32 | variable);
+    return value == IR_NONE ? IR_NONE : ir_resolve(builder->function, value);
+}
+
+/*
+The predecessors of `block` have a value for `variable`: gives `block` its own, the
+value of its single predecessor, or the operands of the phi it got when walked.
+*/
+static void finish_lookup(IrBuilder *builder, uint32_t variable, uint32_t block) {
+    IrFunction *function = builder->function;
+    uint32_t len = function->blocks[block].predecessors_len, phi, i;
+    uint32_t *operands;
+
+    if (len == 1) {
+        builder->walking[block] = 0;
+        write_variable(builder, variable, block,
+                       current_definition(builder, variable, function->blocks[block].predecessors[0]));
+        return;
+    }
+    operands = malloc((len + 1) * sizeof(uint32_t));
+    if (!operands)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    phi = table_get(&builder->definitions, (uint64_t) block << 32 | variable);
+    for (i = 0; i < len; i++)
+        operands[i] = current_definition(builder, variable, function->blocks[block].predecessors[i]);
+    function->instructions[phi].b = ir_add_operands(function, operands, len);
+    free(operands);
+    write_variable(builder, variable, block, remove_trivial_phi(builder, phi));
+}
+
+/*
+The value of `variable` in `block`, which a lookup is walking through: the
+definition of the first block before it that has one, like the phi of a loop
+header, or the undefined value if its predecessors go round a cycle nothing enters.
+*/
+static uint32_t walked_definition(IrBuilder *builder, uint32_t variable, uint32_t block) {
+    IrFunction *function = builder->function;
+    uint32_t b = block, value, steps;
+
+    for (steps = 0; steps < function->blocks_len; steps++) {
+        value = current_definition(builder, variable, b);
+        if (value != IR_NONE)
+            return value;
+        if (!builder->walking[b])
+            break;
+        b = function->blocks[b].predecessors[0];
+    }
+    return undefined_value(builder, builder->variable_types[variable]);
+}
+
+/*
+Finds the value of `variable` in `block`, which doesn't assign it, in the blocks
+before it. The walk goes back through the predecessors with a stack, as a long
+chain of blocks would overflow the C stack: a block is walked once, and finished
+once its predecessors have values. An unsealed block gets an incomplete phi and
+stops the walk there, and a block with several predecessors gets its phi before
+they are walked, which stops it around loops.
+*/
+static uint32_t read_variable_before(IrBuilder *builder, uint32_t variable, uint32_t block) {
+    IrFunction *function = builder->function;
+    DataType type = builder->variable_types[variable];
+    uint32_t *lookup, b, len, predecessor, value, i;
+
+    builder->lookups_len = 0;
+    push_lookup(builder, block);
+    while (builder->lookups_len > 0) {
+        lookup = &builder->lookups[2 * (builder->lookups_len - 1)];
+        b = lookup[0];
+        if (lookup[1]) {
+            builder->lookups_len--;
+            finish_lookup(builder, variable, b);
+            continue;
+        }
+        lookup[1] = 1;
+        len = function->blocks[b].predecessors_len;
+        if (table_get(&builder->definitions, (uint64_t) b << 32 | variable) != IR_NONE) { // reached another way
+            builder->lookups_len--;
+            continue;
+        }
+        if (!builder->sealed[b] || len == 0) {
+            if (!builder->sealed[b]) {
+                value = new_phi(builder, b, type);
+                builder->incomplete = grow(builder->incomplete, &builder->incomplete_capacity,
+                                           3 * (builder->incomplete_len + 1), sizeof(uint32_t));
+                builder->incomplete[3 * builder->incomplete_len] = b;
+                builder->incomplete[3 * builder->incomplete_len + 1] = variable;
+                builder->incomplete[3 * builder->incomplete_len++ + 2] = value;
+            } else {
+                value = undefined_value(builder, type);
+            }
+            write_variable(builder, variable, b, value);
+            builder->lookups_len--;
+            continue;
+        }
+        if (len > 1)
+            write_variable(builder, variable, b, new_phi(builder, b, type));
+        else
+            builder->walking[b] = 1;
+        for (i = len; i-- > 0;) { // the first predecessor is walked first
+            predecessor = function->blocks[b].predecessors[i];
+            if (builder->walking[predecessor]) // around a loop, or a cycle that nothing enters
+                write_variable(builder, variable, predecessor, walked_definition(builder, variable, predecessor));
+            else if (table_get(&builder->definitions, (uint64_t) predecessor << 32 | variable) == IR_NONE)
+                push_lookup(builder, predecessor);
+        }
+    }
+    return current_definition(builder, variable, block);
+}
+
+static uint32_t read_variable(IrBuilder *builder, uint32_t variable, uint32_t block) {
+    uint32_t value = current_definition(builder, variable, block);
+    return value != IR_NONE ? value : read_variable_before(builder, variable, block);
+}
+
+/*
+Gives an incomplete phi its operands, once its block is sealed.
+*/
+static uint32_t add_phi_operands(IrBuilder *builder, uint32_t variable, uint32_t phi) {
+    IrFunction *function = builder->function;
+    uint32_t block = function->instructions[phi].block, len = function->blocks[block].predecessors_len, i;
+    uint32_t *operands = malloc((len + 1) * sizeof(uint32_t));
+
+    if (!operands)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+    for (i = 0; i < len; i++) // the reads may add instructions
+        operands[i] = read_variable(builder, variable, function->blocks[block].predecessors[i]);
+    function->instructions[phi].b = ir_add_operands(function, operands, len);
+    free(operands);
+    return remove_trivial_phi(builder, phi);
+}
+
+/*
+All the predecessors of `block` are known: completes its phis.
+*/
+static void seal_block(IrBuilder *builder, uint32_t block) {
+    uint32_t i = 0, variable, phi;
+
+    while (i < builder->incomplete_len) {
+        if (builder->incomplete[3 * i] != block) {
+            i++;
+            continue;
+        }
+        variable = builder->incomplete[3 * i + 1];
+        phi = builder->incomplete[3 * i + 2];
+        builder->incomplete_len--;
+        memcpy(builder->incomplete + 3 * i, builder->incomplete + 3 * builder->incomplete_len, 3 * sizeof(uint32_t));
+        add_phi_operands(builder, variable, phi);
+    }
+    builder->sealed[block] = 1;
+}
+
+/*
+The end of a function that doesn't return a value: 0, or nothing in void functions.
+*/
+static void emit_default_return(IrBuilder *builder) {
+    DataType type = builder->function->return_type;
+    emit(builder, IR_RETURN, TYPE_VOID, type == TYPE_VOID ? IR_NONE : emit(builder, IR_CONST, type, 0, 0), 0);
+}
+
+/*
+Ends the current block with a jump to `target`. Code after a return is in a block
+without predecessors, which ends with a return of its own instead.
+*/
+static void jump_to(IrBuilder *builder, uint32_t target) {
+    if (builder->block != 0 && builder->function->blocks[builder->block].predecessors_len == 0) {
+        emit_default_return(builder);
+        return;
+    }
+    emit(builder, IR_JUMP, TYPE_VOID, 0, 0);
+    ir_add_edge(builder->function, builder->block, target);
+}
+
+static Binding *lookup_variable(IrBuilder *builder, const AstNode *node, const Variable *variable) {
+    Binding *binding;
+    size_t i;
+
+    for (i = builder->locals->size; i-- > 0;) {
+        binding = builder->locals->items[i];
+        if (binding->variable == variable)
+            return binding;
+    }
+    for (i = 0; i < builder->globals->size; i++) {
+        binding = builder->globals->items[i];
+        if (binding->variable == variable)
+            return binding;
+    }
+    build_error(builder, node, "Unresolved variable");
+    return NULL;
+}
+
+static void bind_variable(IrBuilder *builder, Variable *variable, uint32_t id, int global) {
+    Binding *binding = malloc(sizeof(Binding));
+
+    if (!binding)
+        log_error(OPTIMIZER, "Can't allocate memory for variable.");
+    binding->variable = variable;
+    binding->id = id;
+    binding->global = global;
+    list_push(global ? builder->globals : builder->locals, binding);
+}
+
+static uint32_t new_local(IrBuilder *builder, DataType type) {
+    builder->variable_types = grow(builder->variable_types, &builder->variables_capacity, builder->variables_len + 1,
+                                   sizeof(DataType));
+    builder->variable_types[builder->variables_len] = type;
+    return builder->variables_len++;
+}
+
+/*
+Drops the bindings declared after the first `size` ones, at the end of a block.
+*/
+static void truncate_bindings(List *bindings, size_t size) {
+    while (bindings->size > size)
+        free(list_pop(bindings));
+}
+
+static void compile_literal(IrBuilder *builder, const LiteralValue *value) {
+    switch (value->type) {
+        case TYPE_INT:
+            push_value(builder, emit(builder, IR_CONST, TYPE_INT, (uint32_t) value->value.integer_value, 0));
+            break;
+        case TYPE_CHAR:
+            push_value(builder, emit(builder, IR_CONST, TYPE_CHAR, (uint32_t) (int) value->value.char_value, 0));
+            break;
+        case TYPE_BOOL:
+            push_value(builder, emit(builder, IR_CONST, TYPE_BOOL, value->value.bool_value != 0, 0));
+            break;
+        case TYPE_STRING:
+            push_value(builder, emit(builder, IR_STRING, TYPE_STRING,
+                                     ir_add_string(builder->program, value->value.string_value), 0));
+            break;
+        default: // void
+            push_value(builder, IR_NONE);
+            break;
+    }
+}
+
+static IrOpcode binary_opcode(TokenType operator) {
+    switch (operator) {
+        case ADD:
+            return IR_ADD;
+        case SUB:
+            return IR_SUB;
+        case MUL:
+            return IR_MUL;
+        case DIVIDE:
+            return IR_DIV;
+        case EQUALS:
+            return IR_EQ;
+        case NOT_EQUALS:
+            return IR_NE;
+        case LOWER_THAN:
+            return IR_LT;
+        case GRATER_THAN:
+            return IR_GT;
+        case LOWER_EQUAL:
+            return IR_LE;
+        case GRATER_EQUAL:
+            return IR_GE;
+        default:
+            return IR_OPCODES_LEN;
+    }
+}
+
+static void compile_logical(IrBuilder *builder, AstNode *node);
+
+/*
+Called after the operands are compiled, except the ones of && and ||.
+*/
+static void compile_expression(IrBuilder *builder, AstNode *node) {
+    Expression *expr = &node->data.expression;
+    Binding *binding;
+    uint32_t left, right;
+    IrOpcode op;
+
+    switch (expr->kind) {
+        case EXPRESSION_LITERAL:
+            compile_literal(builder, expr->value);
+            break;
+        case EXPRESSION_VARIABLE:
+            binding = lookup_variable(builder, node, expr->variable);
+            if (binding->global)
+                push_value(builder, emit(builder, IR_LOAD_GLOBAL, builder->program->globals[binding->id], binding->id, 0));
+            else
+                push_value(builder, read_variable(builder, binding->id, builder->block));
+            break;
+        case EXPRESSION_BINARY:
+            if (ast_is_short_circuit(node)) {
+                compile_logical(builder, node);
+                break;
+            }
+            right = pop_value(builder);
+            left = pop_value(builder);
+            op = binary_opcode(expr->operator);
+            if (op == IR_OPCODES_LEN)
+                build_error(builder, node, "Unsupported operator");
+            push_value(builder, emit(builder, op, node->data_type, left, right));
+            break;
+        case EXPRESSION_UNARY:
+            if (expr->operator == NOT) // x == false
+                push_value(builder, emit(builder, IR_EQ, TYPE_BOOL, pop_value(builder),
+                                         emit(builder, IR_CONST, TYPE_BOOL, 0, 0)));
+            else
+                push_value(builder, emit(builder, IR_NEG, node->data_type, pop_value(builder), 0));
+            break;
+    }
+}
+
+/*
+Called after the arguments are compiled.
+*/
+static void compile_function_call(IrBuilder *builder, AstNode *node) {
+    FunctionCall *call = &node->data.function_call;
+    AstNode *arg;
+    uint32_t args_len = call->args->size, list, value;
+
+    // the resolver checked the function exists and the arguments count
+    if (!call->signature) { // print
+        arg = call->args->items[0];
+        emit(builder, IR_PRINT, arg->data_type, pop_value(builder), 0);
+        if (builder->value_depth > 0)
+            push_value(builder, emit(builder, IR_CONST, TYPE_INT, 0, 0));
+        return;
+    }
+    list = ir_add_operands(builder->function, builder->values + builder->values_len - args_len, args_len);
+    builder->values_len -= args_len;
+    value = emit(builder, IR_CALL, node->data_type,
+                 (uint32_t) (size_t) hashmap_get(builder->program->function_ids, call->func_name) - 1, list);
+    if (builder->value_depth > 0)
+        push_value(builder, value);
+}
+
+static void compile_declaration(IrBuilder *builder, AstNode *node) {
+    Variable *variable = node->data.variable_declaration.var;
+    uint32_t value = pop_value(builder), id;
+
+    if (builder->definition || builder->depth > 0) {
+        id = new_local(builder, variable->value->type);
+        write_variable(builder, id, builder->block, value);
+        bind_variable(builder, variable, id, 0);
+        return;
+    }
+    id = ir_add_global(builder->program, variable->value->type);
+    emit(builder, IR_STORE_GLOBAL, TYPE_VOID, id, value);
+    bind_variable(builder, variable, id, 1);
+}
+
+static void compile_assignment(IrBuilder *builder, AstNode *node) {
+    Binding *binding = lookup_variable(builder, node, node->data.assignment.variable);
+    uint32_t value = pop_value(builder);
+
+    if (binding->global)
+        emit(builder, IR_STORE_GLOBAL, TYPE_VOID, binding->id, value);
+    else
+        write_variable(builder, binding->id, builder->block, value);
+}
+
+/*
+The code that follows a return goes to a new block, which nothing jumps to.
+*/
+static void compile_return(IrBuilder *builder) {
+    uint32_t value = pop_value(builder);
+
+    if (builder->function->return_type == TYPE_VOID)
+        value = IR_NONE;
+    emit(builder, IR_RETURN, TYPE_VOID, value, 0);
+    builder->block = new_block(builder);
+    builder->sealed[builder->block] = 1;
+}
+
+static void compile_tree(IrBuilder *builder, AstNode *node);
+
+static uint32_t compile_condition(IrBuilder *builder, AstNode *condition) {
+    builder->value_depth++;
+    compile_tree(builder, condition);
+    builder->value_depth--;
+    return pop_value(builder);
+}
+
+/*
+Ends the current block by going to `if_true` or `if_false`, as the condition says.
+No boolean is computed on the way: && and || go to a block that tests their right
+operand only if the left one doesn't decide, and ! swaps the targets. The
+comparisons left are used by a branch only, which becomes a cmp and a jcc.
+*/
+static void compile_branch(IrBuilder *builder, AstNode *condition, uint32_t if_true, uint32_t if_false) {
+    Expression *expr = &condition->data.expression;
+    uint32_t right;
+
+    if (condition->type == AST_EXPRESSION && expr->kind == EXPRESSION_UNARY && expr->operator == NOT) {
+        compile_branch(builder, expr->left, if_false, if_true);
+        return;
+    }
+    if (ast_is_short_circuit(condition)) {
+        right = new_block(builder);
+        if (expr->operator == AND)
+            compile_branch(builder, expr->left, right, if_false);
+        else
+            compile_branch(builder, expr->left, if_true, right);
+        seal_block(builder, right);
+        builder->block = right;
+        compile_branch(builder, expr->right, if_true, if_false);
+        return;
+    }
+    emit(builder, IR_BRANCH, TYPE_VOID, compile_condition(builder, condition), 0);
+    ir_add_edge(builder->function, builder->block, if_true);
+    ir_add_edge(builder->function, builder->block, if_false);
+}
+
+/*
+&& and || used as values: a variable set to true or false on each side of the
+branch, which becomes a phi where they meet.
+*/
+static void compile_logical(IrBuilder *builder, AstNode *node) {
+    uint32_t if_true = new_block(builder), if_false = new_block(builder), end = new_block(builder);
+    uint32_t variable = new_local(builder, TYPE_BOOL);
+
+    compile_branch(builder, node, if_true, if_false);
+    seal_block(builder, if_true);
+    seal_block(builder, if_false);
+    builder->block = if_true;
+    write_variable(builder, variable, if_true, emit(builder, IR_CONST, TYPE_BOOL, 1, 0));
+    jump_to(builder, end);
+    builder->block = if_false;
+    write_variable(builder, variable, if_false, emit(builder, IR_CONST, TYPE_BOOL, 0, 0));
+    jump_to(builder, end);
+    seal_block(builder, end);
+    builder->block = end;
+    push_value(builder, read_variable(builder, variable, end));
+}
+
+/*
+Called before the children of `node`. Expressions and statements use the
+values of their children. The conditions of if statements and loops are
+built as branches when their bodies are entered, and the operands of && and ||
+when the operator is.
+*/
+static int enter_node(AstNode *node, void *context) {
+    IrBuilder *builder = context;
+
+    if (node == builder->condition)
+        return 1;
+    switch (node->type) {
+        case AST_FUNCTION_DEFINITION:
+            // function definitions are built on their own
+            return node != builder->definition;
+        case AST_IF_STATEMENT:
+            builder->condition = node->data.if_statement.condition;
+            return 0;
+        case AST_LOOP_STATEMENT:
+            // the variable of the initializer is local to the loop, even at the top level
+            builder->depth++;
+            list_push(builder->scopes, (void *) builder->locals->size);
+            builder->condition = node->data.loop_statement.condition;
+            return 0;
+        case AST_COMPOUND:
+        case AST_IMPORT:
+        case AST_NOOP:
+            return 0;
+        default:
+            builder->value_depth++;
+            return ast_is_short_circuit(node);
+    }
+}
+
+/*
+The end of a loop, once its step is built: the body is sealed once the back
+edges are known, its phis are the loop variables.
+*/
+static void exit_loop(IrBuilder *builder, AstNode *node) {
+    uint32_t end = (uint32_t) (size_t) list_pop(builder->blocks);
+    uint32_t body = (uint32_t) (size_t) list_pop(builder->blocks);
+
+    // the end of the body is unreachable after a return
+    if (builder->function->blocks[builder->block].predecessors_len == 0)
+        emit_default_return(builder);
+    else
+        compile_branch(builder, node->data.loop_statement.condition, body, end);
+    seal_block(builder, body);
+    seal_block(builder, end);
+    builder->block = end;
+    truncate_bindings(builder->locals, (size_t) list_pop(builder->scopes));
+    builder->depth--;
+}
+
+/*
+Called after the children of `node`.
+*/
+static void compile_node(AstNode *node, void *context) {
+    IrBuilder *builder = context;
+
+    if (node == builder->condition) {
+        builder->condition = NULL;
+        return;
+    }
+    switch (node->type) {
+        case AST_EXPRESSION:
+            builder->value_depth--;
+            compile_expression(builder, node);
+            break;
+        case AST_FUNCTION_CALL:
+            builder->value_depth--;
+            compile_function_call(builder, node);
+            break;
+        case AST_VARIABLE_DECLARATION:
+            builder->value_depth--;
+            compile_declaration(builder, node);
+            break;
+        case AST_ASSIGNMENT:
+            builder->value_depth--;
+            compile_assignment(builder, node);
+            break;
+        case AST_RETURN_STATEMENT:
+            builder->value_depth--;
+            compile_return(builder);
+            break;
+        case AST_LOOP_STATEMENT:
+            exit_loop(builder, node);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+The blocks of if statements:
+    <branch on the condition to then or else>   then: <body> jump end   else: <else block> jump end   end:
+Without an else block, the condition goes to the end directly.
+Loops are rotated, the condition is tested at the bottom, so an iteration takes a
+single branch. A copy of the test guards the loop:
+    <initializer> <branch on the condition to preheader or end>
+    preheader: jump body
+    body: <body> <step> <branch on the condition to body or end>
+    end:
+The preheader runs once before the loop, the loop passes put the invariant code there.
+*/
+static void enter_block(AstNode *owner, List *block, void *context) {
+    IrBuilder *builder = context;
+    uint32_t preheader, body, other;
+
+    if (owner->type == AST_LOOP_STATEMENT) {
+        preheader = new_block(builder);
+        body = new_block(builder);
+        other = new_block(builder);
+        compile_branch(builder, owner->data.loop_statement.condition, preheader, other);
+        seal_block(builder, preheader);
+        builder->block = preheader;
+        jump_to(builder, body);
+        builder->block = body;
+        list_push(builder->blocks, (void *) (size_t) body);
+        list_push(builder->blocks, (void *) (size_t) other);
+    } else if (owner->type != AST_IF_STATEMENT) {
+        return;
+    } else if (block == owner->data.if_statement.body_node) {
+        body = new_block(builder);
+        other = new_block(builder);
+        compile_branch(builder, owner->data.if_statement.condition, body, other);
+        seal_block(builder, body);
+        list_push(builder->blocks, (void *) (size_t) other);
+        builder->block = body;
+    }
+    builder->depth++;
+    list_push(builder->scopes, (void *) builder->locals->size);
+}
+
+static void exit_block(AstNode *owner, List *block, void *context) {
+    IrBuilder *builder = context;
+    uint32_t other, end;
+
+    if (owner->type != AST_IF_STATEMENT && owner->type != AST_LOOP_STATEMENT)
+        return;
+    builder->depth--;
+    truncate_bindings(builder->locals, (size_t) list_pop(builder->scopes));
+
+    if (owner->type == AST_LOOP_STATEMENT)
+        return;
+    if (block == owner->data.if_statement.else_node) {
+        if (block->size > 0) {
+            end = (uint32_t) (size_t) list_pop(builder->blocks);
+            jump_to(builder, end);
+            seal_block(builder, end);
+            builder->block = end;
+        }
+        return;
+    }
+    other = (uint32_t) (size_t) list_pop(builder->blocks);
+    if (owner->data.if_statement.else_node->size > 0) {
+        seal_block(builder, other);
+        end = new_block(builder);
+        jump_to(builder, end);
+        list_push(builder->blocks, (void *) (size_t) end);
+    } else {
+        jump_to(builder, other);
+        seal_block(builder, other);
+    }
+    builder->block = other;
+}
+
+static void compile_tree(IrBuilder *builder, AstNode *node) {
+    AstVisitor visitor = {.pre = enter_node, .post = compile_node, .enter_block = enter_block,
+                          .exit_block = exit_block, .context = builder};
+    ast_walk(node, &visitor);
+}
+
+static void begin_function(IrBuilder *builder, IrFunction *function, AstNode *definition) {
+    builder->function = function;
+    builder->definition = definition;
+    builder->variables_len = 0;
+    builder->incomplete_len = 0;
+    table_clear(&builder->definitions);
+    builder->block = new_block(builder);
+    seal_block(builder, builder->block);
+}
+
+/*
+Removes the phis that became trivial after their operands were, and replaces the
+uses of everything removed.
+*/
+static void end_function(IrBuilder *builder) {
+    IrFunction *function = builder->function;
+    uint32_t i;
+    int changed = 1;
+
+    emit_default_return(builder);
+    while (changed) {
+        changed = 0;
+        for (i = 0; i < function->len; i++) {
+            if (function->instructions[i].op == IR_PHI && remove_trivial_phi(builder, i) != i)
+                changed = 1;
+        }
+    }
+    ir_resolve_operands(function);
+}
+
+static void compile_function(IrBuilder *builder, AstNode *definition) {
+    FunctionDefinition *function = &definition->data.function_definition;
+    Variable *arg;
+    uint32_t i, id;
+
+    begin_function(builder, builder->program->functions->items[
+            (size_t) hashmap_get(builder->program->function_ids, function->func_name) - 1], definition);
+    builder->depth = 1;
+    for (i = 0; i < function->args->size; i++) {
+        arg = function->args->items[i];
+        id = new_local(builder, arg->value->type);
+        write_variable(builder, id, builder->block, emit(builder, IR_ARG, arg->value->type, i, 0));
+        bind_variable(builder, arg, id, 0);
+    }
+    compile_tree(builder, definition);
+    end_function(builder);
+    truncate_bindings(builder->locals, 0);
+}
+
+/*
+Adds the functions of a module to the program, so calls can refer to functions
+defined later in the file or in other modules.
+*/
+static void declare_functions(IrBuilder *builder, Module *module) {
+    List *children = module->root->data.compound.children;
+    FunctionDefinition *definition;
+    AstNode *child;
+    char *errMsg;
+    size_t i;
+
+    for (i = 0; i < children->size; i++) {
+        child = children->items[i];
+        if (child->type != AST_FUNCTION_DEFINITION)
+            continue;
+        definition = &child->data.function_definition;
+        if (hashmap_get(builder->program->function_ids, definition->func_name)) {
+            alsprintf(&errMsg, "Function '%s' is already defined", definition->func_name);
+            throw_exception_at(OPTIMIZER, module->src, child->row, child->col, errMsg);
+        }
+        init_ir_function(builder->program, definition->func_name, definition->returnType, definition->args->size);
+    }
+}
+
+/*
+Builds all the modules of `graph` into a single program. The top level statements
+of the modules are the first function, imports first.
+*/
+IrProgram *ir_build(ModuleGraph *graph) {
+    IrBuilder builder = {.program = init_ir_program()};
+    IrFunction *top_level = init_ir_function(builder.program, NULL, TYPE_VOID, 0);
+    List **module_globals, *children;
+    Module *module;
+    AstNode *child;
+    size_t i, j;
+
+    builder.locals = init_list(sizeof(Binding *));
+    builder.scopes = init_list(sizeof(size_t));
+    builder.blocks = init_list(sizeof(size_t));
+    table_resize(&builder.definitions, 256);
+    module_globals = malloc(graph->modules->size * sizeof(List *));
+    if (!module_globals)
+        log_error(OPTIMIZER, "Can't allocate memory for the IR.");
+
+    for (i = 0; i < graph->modules->size; i++)
+        declare_functions(&builder, graph->modules->items[i]);
+
+    begin_function(&builder, top_level, NULL);
+    for (i = 0; i < graph->modules->size; i++) {
+        module = graph->modules->items[i];
+        builder.src = module->src;
+        builder.globals = module_globals[i] = init_list(sizeof(Binding *));
+        builder.depth = 0;
+        compile_tree(&builder, module->root);
+    }
+    end_function(&builder);
+
+    for (i = 0; i < graph->modules->size; i++) {
+        module = graph->modules->items[i];
+        builder.src = module->src;
+        builder.globals = module_globals[i];
+        children = module->root->data.compound.children;
+        for (j = 0; j < children->size; j++) {
+            child = children->items[j];
+            if (child->type == AST_FUNCTION_DEFINITION)
+                compile_function(&builder, child);
+        }
+        truncate_bindings(builder.globals, 0);
+        list_dispose(builder.globals);
+    }
+
+    free(module_globals);
+    free(builder.values);
+    free(builder.variable_types);
+    free(builder.sealed);
+    free(builder.incomplete);
+    free(builder.walking);
+    free(builder.lookups);
+    free(builder.definitions.keys);
+    free(builder.definitions.values);
+    list_dispose(builder.locals);
+    list_dispose(builder.scopes);
+    list_dispose(builder.blocks); // empty, every if statement and loop has ended
+    return builder.program;
+}
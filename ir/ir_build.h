@@ -0,0 +1,9 @@
+#ifndef INFINITY_COMPILER_IR_BUILD_H
+#define INFINITY_COMPILER_IR_BUILD_H
+
+#include "ir.h"
+#include "../module/module.h"
+
+IrProgram *ir_build(ModuleGraph *graph);
+
+#endif //INFINITY_COMPILER_IR_BUILD_H
@@ -0,0 +1,239 @@
+#include "ir_dce.h"
+#include "../logging/logging.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Dead code elimination: removes the blocks that can't be reached from the entry,
+like the code after a return, the stores to global variables that are never
+read or are overwritten before anything reads them, and the instructions whose
+values are not used and that have no other effect.
+*/
+
+static void *allocate(size_t len, size_t item_size) {
+    void *array = calloc(len + 1, item_size);
+
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for dead code elimination.");
+    return array;
+}
+
+/*
+Drops the blocks without a path from the entry, and numbers the others in reverse
+postorder, the order the code generator lays them out in: a block comes after
+the ones that go to it, except through back edges. The first successor of a
+branch is visited last, so it comes right after the branch when it can, and
+going there takes no jump.
+*/
+static void remove_unreachable_blocks(IrFunction *function) {
+    uint8_t *visits = allocate(function->blocks_len, sizeof(uint8_t)); // 1 + successors visited, 0 if unreachable
+    uint32_t *stack = allocate(function->blocks_len, sizeof(uint32_t)), stack_len = 0;
+    uint32_t *postorder = allocate(function->blocks_len, sizeof(uint32_t));
+    uint32_t *numbers = allocate(function->blocks_len, sizeof(uint32_t));
+    uint32_t blocks_len = 0, successor, b, i;
+    IrBlock *block;
+
+    visits[0] = 1;
+    stack[stack_len++] = 0;
+    while (stack_len > 0) {
+        b = stack[stack_len - 1];
+        block = &function->blocks[b];
+        if (visits[b] > block->successors_len) {
+            postorder[blocks_len++] = b;
+            stack_len--;
+            continue;
+        }
+        successor = block->successors[block->successors_len - visits[b]++];
+        if (!visits[successor]) {
+            visits[successor] = 1;
+            stack[stack_len++] = successor;
+        }
+    }
+
+    for (b = 0; b < function->blocks_len; b++) {
+        block = &function->blocks[b];
+        numbers[b] = IR_NONE;
+        if (visits[b])
+            continue;
+        while (block->successors_len > 0)
+            ir_remove_edge(function, b, 0);
+        for (i = 0; i < block->len; i++) // their values are only used in unreachable blocks
+            function->instructions[block->code[i]] = (IrInstruction) {.op = IR_NOP, .block = IR_NONE, .a = IR_NONE};
+    }
+    for (i = 0; i < blocks_len; i++)
+        numbers[postorder[i]] = blocks_len - 1 - i;
+    ir_renumber_blocks(function, numbers);
+    free(visits);
+    free(stack);
+    free(postorder);
+    free(numbers);
+}
+
+/*
+Replaces the phis whose operands are all the same value, or the phi itself, by
+that value. Blocks that lost predecessors leave some.
+*/
+static void remove_trivial_phis(IrFunction *function) {
+    IrInstruction *phi;
+    uint32_t *operands, same, value, len, b, i, k;
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+        for (b = 0; b < function->blocks_len; b++) {
+            for (i = 0; i < function->blocks[b].len; i++) {
+                phi = &function->instructions[function->blocks[b].code[i]];
+                if (phi->op != IR_PHI)
+                    break;
+                operands = ir_list(function, phi->b);
+                len = ir_list_len(function, phi->b);
+                for (same = IR_NONE, k = 0; k < len; k++) {
+                    value = ir_resolve(function, operands[k]);
+                    if (value == same || value == function->blocks[b].code[i])
+                        continue;
+                    if (same != IR_NONE)
+                        break;
+                    same = value;
+                }
+                if (k < len || same == IR_NONE)
+                    continue;
+                ir_remove(function, function->blocks[b].code[i], same);
+                changed = 1;
+                i--;
+            }
+        }
+    }
+    ir_resolve_operands(function);
+}
+
+/*
+Marks the globals that some instruction of the program loads.
+*/
+static uint8_t *find_read_globals(const IrProgram *program) {
+    uint8_t *read = allocate(program->globals_len, sizeof(uint8_t));
+    const IrFunction *function;
+    const IrInstruction *instruction;
+    size_t f;
+    uint32_t b, i;
+
+    for (f = 0; f < program->functions->size; f++) {
+        function = program->functions->items[f];
+        for (b = 0; b < function->blocks_len; b++) {
+            for (i = 0; i < function->blocks[b].len; i++) {
+                instruction = &function->instructions[function->blocks[b].code[i]];
+                if (instruction->op == IR_LOAD_GLOBAL)
+                    read[instruction->a] = 1;
+            }
+        }
+    }
+    return read;
+}
+
+/*
+Walks each block backwards: a store is dead if its global is never read, or if
+another store to it follows before any load or call.
+*/
+static void remove_dead_stores(IrFunction *function, const uint8_t *read, uint32_t *stored, uint32_t *stamp) {
+    IrInstruction *instruction;
+    IrBlock *block;
+    uint32_t b, i;
+
+    for (b = 0; b < function->blocks_len; b++) {
+        block = &function->blocks[b];
+        ++*stamp;
+        for (i = block->len; i-- > 0;) {
+            instruction = &function->instructions[block->code[i]];
+            if (instruction->op == IR_STORE_GLOBAL) {
+                if (!read[instruction->a] || stored[instruction->a] == *stamp)
+                    ir_remove(function, block->code[i], IR_NONE);
+                else
+                    stored[instruction->a] = *stamp;
+            } else if (instruction->op == IR_LOAD_GLOBAL) {
+                stored[instruction->a] = 0;
+            } else if (instruction->op == IR_CALL) { // the callee can read any global
+                ++*stamp;
+            }
+        }
+    }
+}
+
+/*
+Instructions that must run even if their value is unused.
+*/
+static int has_effect(const IrFunction *function, const IrInstruction *instruction) {
+    const IrInstruction *divisor;
+
+    switch (instruction->op) {
+        case IR_STORE_GLOBAL:
+        case IR_CALL:
+        case IR_PRINT:
+        case IR_JUMP:
+        case IR_BRANCH:
+        case IR_RETURN:
+            return 1;
+        case IR_DIV: // stops the program on division by zero, and INT_MIN / -1 traps
+            divisor = &function->instructions[instruction->b];
+            return divisor->op != IR_CONST || divisor->a == 0 || (int32_t) divisor->a == -1;
+        default:
+            return 0;
+    }
+}
+
+/*
+Marks the instructions with an effect and everything they use, then removes the rest.
+*/
+static void remove_dead_instructions(IrFunction *function) {
+    uint8_t *live = allocate(function->len, sizeof(uint8_t));
+    uint32_t *worklist = allocate(function->len, sizeof(uint32_t)), *operands, len, worklist_len = 0, kept, id, b, i;
+    IrBlock *block;
+
+    for (b = 0; b < function->blocks_len; b++) {
+        for (i = 0; i < function->blocks[b].len; i++) {
+            id = function->blocks[b].code[i];
+            if (has_effect(function, &function->instructions[id])) {
+                live[id] = 1;
+                worklist[worklist_len++] = id;
+            }
+        }
+    }
+    while (worklist_len > 0) {
+        operands = ir_value_operands(function, &function->instructions[worklist[--worklist_len]], &len);
+        for (i = 0; i < len; i++) {
+            if (!live[operands[i]]) {
+                live[operands[i]] = 1;
+                worklist[worklist_len++] = operands[i];
+            }
+        }
+    }
+    for (b = 0; b < function->blocks_len; b++) {
+        block = &function->blocks[b];
+        for (kept = 0, i = 0; i < block->len; i++) {
+            id = block->code[i];
+            if (live[id])
+                block->code[kept++] = id;
+            else
+                function->instructions[id] = (IrInstruction) {.op = IR_NOP, .block = IR_NONE, .a = IR_NONE};
+        }
+        block->len = kept;
+    }
+    free(live);
+    free(worklist);
+}
+
+void ir_dce(IrProgram *program) {
+    uint32_t *stored = allocate(program->globals_len, sizeof(uint32_t)), stamp = 0;
+    uint8_t *read;
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++) {
+        remove_unreachable_blocks(program->functions->items[i]);
+        remove_trivial_phis(program->functions->items[i]);
+    }
+    read = find_read_globals(program);
+    for (i = 0; i < program->functions->size; i++) {
+        remove_dead_stores(program->functions->items[i], read, stored, &stamp);
+        remove_dead_instructions(program->functions->items[i]);
+    }
+    free(read);
+    free(stored);
+}
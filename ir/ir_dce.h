@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_IR_DCE_H
+#define INFINITY_COMPILER_IR_DCE_H
+
+#include "ir.h"
+
+void ir_dce(IrProgram *program);
+
+#endif //INFINITY_COMPILER_IR_DCE_H
@@ -0,0 +1,468 @@
+#include "ir_inline.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Replaces calls to small functions that are not recursive by a copy of their body.
+
+The call graph is walked bottom up, so a function has the calls it makes inlined
+before it is inlined anywhere. A call is inlined if the callee has at most
+`budget` instructions, or INLINE_HOT_FACTOR times that if the call is in a loop or
+is the only one to the callee, and if the caller doesn't grow past INLINE_GROWTH
+times its size plus the budget. Functions that end up called nowhere are dropped.
+
+The block of the call is split after it: the copy of the callee's blocks goes
+in between, and its returns jump to the second half, where a phi takes the
+result if there are several.
+*/
+
+#define INLINE_HOT_FACTOR 4
+#define INLINE_GROWTH 2
+
+/**
+\Graph
+ A directed graph in compressed form: the edges of node n are
+ edges[starts[n]] to edges[starts[n + 1] - 1].
+*/
+typedef struct {
+    uint32_t len;
+    uint32_t *starts;
+    uint32_t *edges;
+} Graph;
+
+typedef struct {
+    uint32_t block;
+    uint8_t hot; // in a loop
+} PendingBlock;
+
+typedef struct {
+    IrProgram *program;
+    uint32_t budget;
+    uint32_t *sizes;       // by function: instructions in its blocks
+    uint32_t *calls;       // by function: calls to it in the program
+    uint8_t *recursive;    // by function: on a cycle of the call graph
+    uint32_t *order;       // of the functions, callees first
+    IrFunction *caller;
+    uint32_t *layout;      // by block of the caller: the block placed after it, IR_NONE for the last
+    uint32_t layout_capacity;
+    PendingBlock *blocks;  // of the caller, with their calls left to look at
+    uint32_t blocks_len;
+    uint32_t blocks_capacity;
+} Inliner;
+
+static void *allocate(size_t len, size_t item_size) {
+    void *array = calloc(len + 1, item_size);
+
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for the inliner.");
+    return array;
+}
+
+static void *grow(void *array, uint32_t *capacity, uint32_t needed, size_t item_size) {
+    if (needed <= *capacity)
+        return array;
+    *capacity = MAX(MAX(*capacity * 2, needed), 16);
+    array = realloc(array, *capacity * item_size);
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for the inliner.");
+    return array;
+}
+
+static void graph_dispose(Graph *graph) {
+    free(graph->starts);
+    free(graph->edges);
+}
+
+/*
+Tarjan's strongly connected components, without recursion. Marks the nodes on
+a cycle in `cyclic`, and lists every node in `order`, where each component
+comes after those it has edges to.
+*/
+static void find_cycles(const Graph *graph, uint8_t *cyclic, uint32_t *order) {
+    uint32_t n = graph->len, *index = allocate(n, sizeof(uint32_t)), *low = allocate(n, sizeof(uint32_t));
+    uint32_t *next = allocate(n, sizeof(uint32_t)), *frames = allocate(n, sizeof(uint32_t));
+    uint32_t *stack = allocate(n, sizeof(uint32_t)), frames_len = 0, stack_len = 0, order_len = 0, counter = 0;
+    uint32_t root, v, w, start;
+    uint8_t *on_stack = allocate(n, sizeof(uint8_t));
+
+    for (v = 0; v < n; v++)
+        index[v] = IR_NONE;
+    for (root = 0; root < n; root++) {
+        if (index[root] != IR_NONE)
+            continue;
+        index[root] = low[root] = counter++;
+        next[root] = graph->starts[root];
+        stack[stack_len++] = root;
+        on_stack[root] = 1;
+        frames[frames_len++] = root;
+        while (frames_len > 0) {
+            v = frames[frames_len - 1];
+            if (next[v] < graph->starts[v + 1]) {
+                w = graph->edges[next[v]++];
+                if (w == v) {
+                    cyclic[v] = 1;
+                } else if (index[w] == IR_NONE) {
+                    index[w] = low[w] = counter++;
+                    next[w] = graph->starts[w];
+                    stack[stack_len++] = w;
+                    on_stack[w] = 1;
+                    frames[frames_len++] = w;
+                } else if (on_stack[w]) {
+                    low[v] = MIN(low[v], index[w]);
+                }
+                continue;
+            }
+            frames_len--;
+            if (frames_len > 0)
+                low[frames[frames_len - 1]] = MIN(low[frames[frames_len - 1]], low[v]);
+            if (low[v] != index[v])
+                continue;
+            start = order_len;
+            do {
+                w = stack[--stack_len];
+                on_stack[w] = 0;
+                order[order_len++] = w;
+            } while (w != v);
+            if (order_len - start > 1) {
+                for (; start < order_len; start++)
+                    cyclic[order[start]] = 1;
+            }
+        }
+    }
+    free(index);
+    free(low);
+    free(next);
+    free(frames);
+    free(stack);
+    free(on_stack);
+}
+
+static Graph call_graph(const IrProgram *program) {
+    Graph graph = {.len = (uint32_t) program->functions->size};
+    const IrFunction *function;
+    const IrInstruction *instruction;
+    uint32_t len = 0, f, b, i;
+
+    graph.starts = allocate(graph.len + 1, sizeof(uint32_t));
+    for (f = 0; f < graph.len; f++) {
+        function = program->functions->items[f];
+        for (b = 0; b < function->blocks_len; b++) {
+            for (i = 0; i < function->blocks[b].len; i++)
+                len += function->instructions[function->blocks[b].code[i]].op == IR_CALL;
+        }
+    }
+    graph.edges = allocate(len, sizeof(uint32_t));
+    for (len = 0, f = 0; f < graph.len; f++) {
+        graph.starts[f] = len;
+        function = program->functions->items[f];
+        for (b = 0; b < function->blocks_len; b++) {
+            for (i = 0; i < function->blocks[b].len; i++) {
+                instruction = &function->instructions[function->blocks[b].code[i]];
+                if (instruction->op == IR_CALL)
+                    graph.edges[len++] = instruction->a;
+            }
+        }
+    }
+    graph.starts[graph.len] = len;
+    return graph;
+}
+
+static Graph control_flow_graph(const IrFunction *function) {
+    Graph graph = {.len = function->blocks_len};
+    uint32_t len = 0, b, i;
+
+    graph.starts = allocate(graph.len + 1, sizeof(uint32_t));
+    graph.edges = allocate(2 * graph.len, sizeof(uint32_t));
+    for (b = 0; b < graph.len; b++) {
+        graph.starts[b] = len;
+        for (i = 0; i < function->blocks[b].successors_len; i++)
+            graph.edges[len++] = function->blocks[b].successors[i];
+    }
+    graph.starts[graph.len] = len;
+    return graph;
+}
+
+static void push_block(Inliner *inliner, uint32_t block, uint8_t hot) {
+    inliner->blocks = grow(inliner->blocks, &inliner->blocks_capacity, inliner->blocks_len + 1, sizeof(PendingBlock));
+    inliner->blocks[inliner->blocks_len++] = (PendingBlock) {.block = block, .hot = hot};
+}
+
+static uint32_t add_block(Inliner *inliner) {
+    uint32_t block = ir_add_block(inliner->caller);
+
+    inliner->layout = grow(inliner->layout, &inliner->layout_capacity, block + 1, sizeof(uint32_t));
+    return block;
+}
+
+/*
+Moves the instructions of `block` after `position`, and its successors, to the
+new block `continuation`.
+*/
+static void split_block(IrFunction *function, uint32_t block, uint32_t position, uint32_t continuation) {
+    IrBlock *source = &function->blocks[block], *target = &function->blocks[continuation], *successor;
+    uint32_t i, k;
+
+    for (i = position + 1; i < source->len; i++)
+        ir_insert(function, continuation, target->len, source->code[i]);
+    source->len = position + 1;
+    memcpy(target->successors, source->successors, sizeof(source->successors));
+    target->successors_len = source->successors_len;
+    source->successors_len = 0;
+    for (i = 0; i < target->successors_len; i++) {
+        successor = &function->blocks[target->successors[i]];
+        for (k = 0; k < successor->predecessors_len; k++) {
+            if (successor->predecessors[k] == block)
+                successor->predecessors[k] = continuation;
+        }
+    }
+}
+
+/*
+Copies the blocks of `callee` from block `base` of the caller on, with its
+arguments replaced by `arguments`. Its returns jump to `continuation`, the values
+they return go to `results`, returns how many.
+*/
+static uint32_t copy_body(Inliner *inliner, const IrFunction *callee, const uint32_t *arguments, uint32_t base,
+                          uint32_t continuation, uint32_t *results) {
+    IrFunction *caller = inliner->caller;
+    uint32_t *map = allocate(callee->len, sizeof(uint32_t)), *list, len, results_len = 0, id, b, i, k;
+    const IrInstruction *source;
+    const IrBlock *block;
+    IrBlock *target;
+    IrInstruction *copy;
+
+    for (b = 0; b < callee->blocks_len; b++) {
+        block = &callee->blocks[b];
+        for (i = 0; i < block->len; i++) {
+            source = &callee->instructions[block->code[i]];
+            if (source->op == IR_ARG) {
+                map[block->code[i]] = arguments[source->a];
+                continue;
+            }
+            id = ir_new_instruction(caller, source->op, source->type, source->a, source->b);
+            ir_insert(caller, base + b, caller->blocks[base + b].len, id);
+            map[block->code[i]] = id;
+        }
+        target = &caller->blocks[base + b];
+        target->successors_len = block->successors_len;
+        for (k = 0; k < block->successors_len; k++)
+            target->successors[k] = base + block->successors[k];
+        target->predecessors_capacity = block->predecessors_len;
+        target->predecessors_len = block->predecessors_len;
+        target->predecessors = allocate(block->predecessors_len, sizeof(uint32_t));
+        for (k = 0; k < block->predecessors_len; k++)
+            target->predecessors[k] = base + block->predecessors[k];
+    }
+
+    for (b = 0; b < callee->blocks_len; b++) {
+        block = &callee->blocks[b];
+        for (i = 0; i < block->len; i++) {
+            source = &callee->instructions[block->code[i]];
+            if (source->op == IR_ARG)
+                continue;
+            copy = &caller->instructions[map[block->code[i]]];
+            switch (source->op) {
+                case IR_PHI:
+                case IR_CALL:
+                    len = ir_list_len(callee, source->b);
+                    list = allocate(len, sizeof(uint32_t));
+                    for (k = 0; k < len; k++)
+                        list[k] = map[ir_list(callee, source->b)[k]];
+                    copy->b = ir_add_operands(caller, list, len);
+                    free(list);
+                    if (source->op == IR_CALL)
+                        inliner->calls[source->a]++;
+                    break;
+                case IR_RETURN:
+                    if (source->a != IR_NONE)
+                        results[results_len] = map[source->a];
+                    results_len++;
+                    copy->op = IR_JUMP;
+                    copy->a = 0;
+                    ir_add_edge(caller, base + b, continuation);
+                    break;
+                default:
+                    list = ir_value_operands(caller, copy, &len);
+                    for (k = 0; k < len; k++)
+                        list[k] = map[list[k]];
+                    break;
+            }
+        }
+    }
+    free(map);
+    return results_len;
+}
+
+/*
+Inlines the call at `position` in `block` of the caller. Returns the block with
+the instructions that followed the call.
+*/
+static uint32_t inline_call(Inliner *inliner, uint32_t block, uint32_t position) {
+    IrFunction *caller = inliner->caller;
+    uint32_t call = caller->blocks[block].code[position], base = caller->blocks_len, continuation, result, phi;
+    IrInstruction instruction = caller->instructions[call];
+    const IrFunction *callee = inliner->program->functions->items[instruction.a];
+    uint32_t len = ir_list_len(caller, instruction.b), *arguments = allocate(len, sizeof(uint32_t));
+    uint32_t *results = allocate(callee->blocks_len, sizeof(uint32_t)), results_len, b;
+
+    memcpy(arguments, ir_list(caller, instruction.b), len * sizeof(uint32_t));
+    for (b = 0; b < callee->blocks_len; b++)
+        add_block(inliner);
+    continuation = add_block(inliner);
+
+    // block -> the callee's blocks -> continuation -> what followed block
+    inliner->layout[continuation] = inliner->layout[block];
+    inliner->layout[block] = base;
+    for (b = base; b < continuation; b++)
+        inliner->layout[b] = b + 1;
+
+    split_block(caller, block, position, continuation);
+    results_len = copy_body(inliner, callee, arguments, base, continuation, results);
+    if (callee->return_type == TYPE_VOID || results_len == 0) {
+        result = IR_NONE;
+    } else if (results_len == 1) {
+        result = results[0];
+    } else {
+        phi = ir_new_instruction(caller, IR_PHI, callee->return_type, 0, ir_add_operands(caller, results, results_len));
+        ir_insert(caller, continuation, 0, phi);
+        result = phi;
+    }
+    ir_remove(caller, call, result);
+    ir_emit(caller, block, IR_JUMP, TYPE_VOID, 0, 0);
+    ir_add_edge(caller, block, base);
+
+    free(arguments);
+    free(results);
+    return continuation;
+}
+
+static uint32_t function_size(const IrFunction *function) {
+    uint32_t size = 0, b;
+
+    for (b = 0; b < function->blocks_len; b++)
+        size += function->blocks[b].len;
+    return size;
+}
+
+static int should_inline(const Inliner *inliner, uint32_t callee, uint8_t hot, uint32_t limit) {
+    const IrFunction *function = inliner->program->functions->items[callee];
+    uint32_t budget = inliner->budget;
+
+    if (inliner->recursive[callee] || callee == 0 || function->blocks[0].predecessors_len > 0)
+        return 0;
+    if (hot || inliner->calls[callee] == 1)
+        budget *= INLINE_HOT_FACTOR;
+    return inliner->sizes[callee] <= budget && inliner->sizes[callee] + function_size(inliner->caller) <= limit;
+}
+
+static void inline_calls(Inliner *inliner, uint32_t f) {
+    IrFunction *caller = inliner->program->functions->items[f];
+    const IrInstruction *instruction;
+    uint32_t limit = inliner->sizes[f] * INLINE_GROWTH + inliner->budget, *numbers, block, number, b, i;
+    uint8_t *loops = allocate(caller->blocks_len, sizeof(uint8_t)), hot;
+    Graph graph = control_flow_graph(caller);
+    int inlined = 0;
+
+    inliner->caller = caller;
+    numbers = allocate(caller->blocks_len, sizeof(uint32_t));
+    find_cycles(&graph, loops, numbers);
+    graph_dispose(&graph);
+    free(numbers);
+
+    inliner->layout = grow(inliner->layout, &inliner->layout_capacity, caller->blocks_len, sizeof(uint32_t));
+    for (b = 0; b < caller->blocks_len; b++) {
+        inliner->layout[b] = b + 1 < caller->blocks_len ? b + 1 : IR_NONE;
+        push_block(inliner, caller->blocks_len - 1 - b, loops[caller->blocks_len - 1 - b]);
+    }
+    free(loops);
+
+    while (inliner->blocks_len > 0) {
+        block = inliner->blocks[--inliner->blocks_len].block;
+        hot = inliner->blocks[inliner->blocks_len].hot;
+        for (i = 0; i < caller->blocks[block].len; i++) {
+            instruction = &caller->instructions[caller->blocks[block].code[i]];
+            if (instruction->op != IR_CALL || !should_inline(inliner, instruction->a, hot, limit))
+                continue;
+            inliner->calls[instruction->a]--;
+            push_block(inliner, inline_call(inliner, block, i), hot);
+            inlined = 1;
+            break;
+        }
+    }
+
+    if (inlined) { // the blocks go in the order of the layout
+        numbers = allocate(caller->blocks_len, sizeof(uint32_t));
+        for (number = 0, block = 0; block != IR_NONE; block = inliner->layout[block])
+            numbers[block] = number++;
+        ir_renumber_blocks(caller, numbers);
+        ir_resolve_operands(caller);
+        free(numbers);
+    }
+    inliner->sizes[f] = function_size(caller);
+}
+
+/*
+Drops the functions that neither the top level code nor main call anymore.
+*/
+static void remove_uncalled_functions(IrProgram *program) {
+    size_t main_id = (size_t) hashmap_get(program->function_ids, "main");
+    uint8_t *used = allocate(program->functions->size, sizeof(uint8_t));
+    uint32_t *stack = allocate(program->functions->size, sizeof(uint32_t)), stack_len = 0, b, i;
+    const IrFunction *function;
+    const IrInstruction *instruction;
+
+    used[0] = 1;
+    stack[stack_len++] = 0;
+    if (main_id) {
+        used[main_id - 1] = 1;
+        stack[stack_len++] = main_id - 1;
+    }
+    while (stack_len > 0) {
+        function = program->functions->items[stack[--stack_len]];
+        for (b = 0; b < function->blocks_len; b++) {
+            for (i = 0; i < function->blocks[b].len; i++) {
+                instruction = &function->instructions[function->blocks[b].code[i]];
+                if (instruction->op == IR_CALL && !used[instruction->a]) {
+                    used[instruction->a] = 1;
+                    stack[stack_len++] = instruction->a;
+                }
+            }
+        }
+    }
+    ir_remove_functions(program, used);
+    free(used);
+    free(stack);
+}
+
+void ir_inline(IrProgram *program, uint32_t budget) {
+    Inliner inliner = {.program = program, .budget = budget};
+    uint32_t len = (uint32_t) program->functions->size, f, i;
+    Graph graph;
+
+    if (budget == 0)
+        return;
+    graph = call_graph(program);
+    inliner.sizes = allocate(len, sizeof(uint32_t));
+    inliner.calls = allocate(len, sizeof(uint32_t));
+    inliner.recursive = allocate(len, sizeof(uint8_t));
+    inliner.order = allocate(len, sizeof(uint32_t));
+    for (f = 0; f < len; f++)
+        inliner.sizes[f] = function_size(program->functions->items[f]);
+    for (i = 0; i < graph.starts[len]; i++)
+        inliner.calls[graph.edges[i]]++;
+    find_cycles(&graph, inliner.recursive, inliner.order);
+    graph_dispose(&graph);
+
+    for (i = 0; i < len; i++)
+        inline_calls(&inliner, inliner.order[i]);
+    remove_uncalled_functions(program);
+
+    free(inliner.sizes);
+    free(inliner.calls);
+    free(inliner.recursive);
+    free(inliner.order);
+    free(inliner.layout);
+    free(inliner.blocks);
+}
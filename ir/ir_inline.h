@@ -0,0 +1,11 @@
+#ifndef INFINITY_COMPILER_IR_INLINE_H
+#define INFINITY_COMPILER_IR_INLINE_H
+
+#include "ir.h"
+
+// instructions a callee can have to be inlined, see --inline-budget
+#define DEFAULT_INLINE_BUDGET 40
+
+void ir_inline(IrProgram *program, uint32_t budget);
+
+#endif //INFINITY_COMPILER_IR_INLINE_H
@@ -0,0 +1,428 @@
+#include "ir_loop.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Optimizations of the natural loops of every function, innermost first.
+
+A back edge goes to a block that dominates its source, the header of the loop.
+The loop is the header and the blocks that reach one of its back edges without
+going through it. Loops are only optimized if they have a preheader: a single
+predecessor of the header outside the loop, which jumps nowhere else. ir_build
+gives one to every loop.
+
+Loop invariant code motion moves the instructions whose operands are all computed
+outside the loop to the preheader. They run even if the loop doesn't, so they
+must not stop the program: arithmetic, comparisons, divisions by a constant other
+than 0 and -1, and loads of the globals that the loop doesn't store to, if it
+calls no function (which could store to them).
+
+Strength reduction replaces the products of an induction variable by a loop
+invariant factor with a new induction variable, that adds the step times the
+factor each iteration instead of multiplying. An induction variable is a phi of
+the header that starts from its operand from the preheader, and whose operand
+from the back edge is itself plus or minus a loop invariant step. Integers wrap
+around, so (i + step) * factor = i * factor + step * factor even on overflow.
+*/
+
+/**
+\Loop
+ A natural loop, with all its back edges.
+*/
+typedef struct {
+    uint32_t header;
+    uint32_t preheader; // IR_NONE if the loop has none
+    uint32_t latch;     // source of the back edge, IR_NONE if there are several
+    uint64_t *blocks;   // number in the dominator tree << 32 | block, sorted: the header first
+    uint32_t blocks_len;
+} Loop;
+
+/**
+\InductionVariable
+ A phi of a loop header that goes from `start` by `step` each iteration.
+*/
+typedef struct {
+    uint32_t phi;
+    uint32_t start;
+    uint32_t step;
+    int down; // the step is subtracted
+} InductionVariable;
+
+/**
+\Reduction
+ A new induction variable, the product of an induction variable by a factor.
+*/
+typedef struct {
+    uint32_t variable; // index in the induction variables of the loop
+    uint32_t factor;
+    uint32_t phi;
+} Reduction;
+
+typedef struct {
+    IrFunction *function;
+    IrDominators dominators;
+    Loop *loops;
+    uint32_t loops_len;
+    uint32_t loops_capacity;
+    uint32_t *members;   // by block: the stamp of the last loop found to contain it
+    uint32_t *stored;    // by global: the stamp of the last loop that stores to it
+    uint32_t stamp;      // of the loop being found or optimized, never reused
+    uint32_t *worklist;  // blocks
+    InductionVariable *variables;
+    uint32_t variables_len;
+    uint32_t variables_capacity;
+    Reduction *reductions;
+    uint32_t reductions_len;
+    uint32_t reductions_capacity;
+    uint32_t *products;  // multiplications to reduce
+    uint32_t products_len;
+    uint32_t products_capacity;
+} LoopOptimizer;
+
+static void *allocate(size_t len, size_t item_size) {
+    void *array = calloc(len + 1, item_size);
+
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for loop optimization.");
+    return array;
+}
+
+static void *grow(void *array, uint32_t *capacity, uint32_t needed, size_t item_size) {
+    if (needed <= *capacity)
+        return array;
+    *capacity = MAX(MAX(*capacity * 2, needed), 16);
+    array = realloc(array, *capacity * item_size);
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for loop optimization.");
+    return array;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+Inner loops have fewer blocks than the loops around them.
+*/
+static int compare_loops(const void *a, const void *b) {
+    uint32_t x = ((const Loop *) a)->blocks_len, y = ((const Loop *) b)->blocks_len;
+    return (x > y) - (x < y);
+}
+
+static int is_reachable(const LoopOptimizer *o, uint32_t block) {
+    return o->dominators.idom[block] != IR_NONE;
+}
+
+/*
+Finds the loop of `header` if it is the target of back edges: walks the
+predecessors back from their sources, up to the header.
+*/
+static void find_loop(LoopOptimizer *o, uint32_t header) {
+    IrFunction *function = o->function;
+    const IrBlock *block = &function->blocks[header];
+    uint32_t stamp = ++o->stamp, worklist_len = 0, latches = 0, latch = IR_NONE, outside = 0, preheader = IR_NONE;
+    uint32_t b, i;
+    Loop *loop;
+
+    o->members[header] = stamp;
+    for (i = 0; i < block->predecessors_len; i++) {
+        b = block->predecessors[i];
+        if (!is_reachable(o, b) || !ir_dominates(&o->dominators, header, b))
+            continue;
+        latches++;
+        latch = b;
+        if (o->members[b] != stamp) {
+            o->members[b] = stamp;
+            o->worklist[worklist_len++] = b;
+        }
+    }
+    if (latches == 0)
+        return;
+
+    o->loops = grow(o->loops, &o->loops_capacity, o->loops_len + 1, sizeof(Loop));
+    loop = &o->loops[o->loops_len++];
+    *loop = (Loop) {.header = header, .latch = latches == 1 ? latch : IR_NONE,
+                    .blocks = allocate(function->blocks_len, sizeof(uint64_t))};
+    loop->blocks[loop->blocks_len++] = (uint64_t) o->dominators.first[header] << 32 | header;
+    while (worklist_len > 0) {
+        b = o->worklist[--worklist_len];
+        loop->blocks[loop->blocks_len++] = (uint64_t) o->dominators.first[b] << 32 | b;
+        for (i = 0; i < function->blocks[b].predecessors_len; i++) {
+            if (is_reachable(o, function->blocks[b].predecessors[i]) &&
+                o->members[function->blocks[b].predecessors[i]] != stamp) {
+                o->members[function->blocks[b].predecessors[i]] = stamp;
+                o->worklist[worklist_len++] = function->blocks[b].predecessors[i];
+            }
+        }
+    }
+    qsort(loop->blocks, loop->blocks_len, sizeof(uint64_t), compare_keys);
+
+    for (i = 0; i < block->predecessors_len; i++) {
+        b = block->predecessors[i];
+        if (is_reachable(o, b) && o->members[b] != stamp) {
+            outside++;
+            preheader = b;
+        }
+    }
+    if (outside == 1 && function->blocks[preheader].successors_len == 1)
+        loop->preheader = preheader;
+    else
+        loop->preheader = IR_NONE;
+}
+
+static int is_invariant(const LoopOptimizer *o, uint32_t value) {
+    return o->members[o->function->instructions[value].block] != o->stamp;
+}
+
+static int can_hoist(const LoopOptimizer *o, const IrInstruction *instruction, int calls) {
+    const IrInstruction *divisor;
+
+    switch (instruction->op) {
+        case IR_CONST:
+        case IR_STRING:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_NEG:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            return 1;
+        case IR_DIV:
+            divisor = &o->function->instructions[instruction->b];
+            return divisor->op == IR_CONST && divisor->a != 0 && (int32_t) divisor->a != -1;
+        case IR_LOAD_GLOBAL:
+            return !calls && o->stored[instruction->a] != o->stamp;
+        default:
+            return 0;
+    }
+}
+
+/*
+Inserts `id` at the end of `block`, before its jump.
+*/
+static void insert_before_end(IrFunction *function, uint32_t block, uint32_t id) {
+    ir_insert(function, block, function->blocks[block].len - 1, id);
+}
+
+/*
+The blocks are visited in dominator tree order, so the operands computed in the
+loop are hoisted before their uses are looked at.
+*/
+static void hoist_invariants(LoopOptimizer *o, const Loop *loop, int calls) {
+    IrFunction *function = o->function;
+    IrBlock *block;
+    uint32_t *operands, len, kept, id, b, i, k;
+    int invariant;
+
+    for (b = 0; b < loop->blocks_len; b++) {
+        block = &function->blocks[(uint32_t) loop->blocks[b]];
+        for (kept = 0, i = 0; i < block->len; i++) {
+            id = block->code[i];
+            invariant = can_hoist(o, &function->instructions[id], calls);
+            operands = ir_value_operands(function, &function->instructions[id], &len);
+            for (k = 0; k < len && invariant; k++)
+                invariant = is_invariant(o, operands[k]);
+            if (invariant)
+                insert_before_end(function, loop->preheader, id);
+            else
+                block->code[kept++] = id;
+        }
+        block->len = kept;
+    }
+}
+
+static void find_induction_variables(LoopOptimizer *o, const Loop *loop, uint32_t entry) {
+    IrFunction *function = o->function;
+    const IrBlock *header = &function->blocks[loop->header];
+    const IrInstruction *update;
+    InductionVariable variable;
+    uint32_t *operands, i;
+
+    o->variables_len = 0;
+    for (i = 0; i < header->len && function->instructions[header->code[i]].op == IR_PHI; i++) {
+        variable.phi = header->code[i];
+        if (function->instructions[variable.phi].type != TYPE_INT)
+            continue;
+        operands = ir_list(function, function->instructions[variable.phi].b);
+        variable.start = operands[entry];
+        update = &function->instructions[operands[1 - entry]];
+        if (is_invariant(o, operands[1 - entry]))
+            continue;
+        if ((update->op == IR_ADD || update->op == IR_SUB) && update->a == variable.phi && is_invariant(o, update->b))
+            variable.step = update->b;
+        else if (update->op == IR_ADD && update->b == variable.phi && is_invariant(o, update->a))
+            variable.step = update->a;
+        else
+            continue;
+        variable.down = update->op == IR_SUB;
+        o->variables = grow(o->variables, &o->variables_capacity, o->variables_len + 1, sizeof(InductionVariable));
+        o->variables[o->variables_len++] = variable;
+    }
+}
+
+static int same_value(const IrFunction *function, uint32_t a, uint32_t b) {
+    return a == b || (function->instructions[a].op == IR_CONST && function->instructions[b].op == IR_CONST &&
+                      function->instructions[a].a == function->instructions[b].a);
+}
+
+/*
+a * b at the end of `block`, folded if both are constants.
+*/
+static uint32_t emit_product(IrFunction *function, uint32_t block, uint32_t a, uint32_t b) {
+    const IrInstruction *x = &function->instructions[a], *y = &function->instructions[b];
+    uint32_t id;
+
+    if (x->op == IR_CONST && y->op == IR_CONST)
+        id = ir_new_instruction(function, IR_CONST, TYPE_INT, x->a * y->a, 0);
+    else
+        id = ir_new_instruction(function, IR_MUL, TYPE_INT, a, b);
+    insert_before_end(function, block, id);
+    return id;
+}
+
+/*
+The phi of the induction variable `variable` times `factor`, made the first time:
+    preheader: start * factor, step * factor
+    header: phi(start * factor, next)
+    latch: next = phi + step * factor
+*/
+static uint32_t reduce(LoopOptimizer *o, const Loop *loop, uint32_t entry, uint32_t variable, uint32_t factor) {
+    IrFunction *function = o->function;
+    const InductionVariable *induction = &o->variables[variable];
+    uint32_t operands[2], increment, phi, i;
+
+    for (i = 0; i < o->reductions_len; i++) {
+        if (o->reductions[i].variable == variable && same_value(function, o->reductions[i].factor, factor))
+            return o->reductions[i].phi;
+    }
+    operands[entry] = emit_product(function, loop->preheader, induction->start, factor);
+    increment = emit_product(function, loop->preheader, induction->step, factor);
+    phi = ir_new_instruction(function, IR_PHI, TYPE_INT, 0, IR_NONE);
+    ir_insert(function, loop->header, 0, phi);
+    operands[1 - entry] = ir_new_instruction(function, induction->down ? IR_SUB : IR_ADD, TYPE_INT, phi, increment);
+    insert_before_end(function, loop->latch, operands[1 - entry]);
+    function->instructions[phi].b = ir_add_operands(function, operands, 2);
+
+    o->reductions = grow(o->reductions, &o->reductions_capacity, o->reductions_len + 1, sizeof(Reduction));
+    o->reductions[o->reductions_len++] = (Reduction) {.variable = variable, .factor = factor, .phi = phi};
+    return phi;
+}
+
+/*
+Looks for the induction variables of a loop entered from its preheader and
+repeated from a single latch, then reduces their products.
+*/
+static void reduce_strength(LoopOptimizer *o, const Loop *loop) {
+    IrFunction *function = o->function;
+    uint32_t entry = ir_predecessor_index(function, loop->header, loop->preheader), id, a, factor, v, b, i;
+    const IrBlock *block;
+
+    find_induction_variables(o, loop, entry);
+    if (o->variables_len == 0)
+        return;
+    // the reductions add phis to the header, so the products are listed first
+    o->products_len = 0;
+    for (b = 0; b < loop->blocks_len; b++) {
+        block = &function->blocks[(uint32_t) loop->blocks[b]];
+        for (i = 0; i < block->len; i++) {
+            if (function->instructions[block->code[i]].op != IR_MUL)
+                continue;
+            o->products = grow(o->products, &o->products_capacity, o->products_len + 1, sizeof(uint32_t));
+            o->products[o->products_len++] = block->code[i];
+        }
+    }
+
+    o->reductions_len = 0;
+    for (i = 0; i < o->products_len; i++) {
+        id = o->products[i];
+        // an operand can be a product reduced before
+        a = ir_resolve(function, function->instructions[id].a);
+        factor = ir_resolve(function, function->instructions[id].b);
+        for (v = 0; v < o->variables_len; v++) {
+            if (a == o->variables[v].phi && is_invariant(o, factor))
+                break;
+            if (factor == o->variables[v].phi && is_invariant(o, a)) {
+                factor = a;
+                break;
+            }
+        }
+        if (v < o->variables_len)
+            ir_remove(function, id, reduce(o, loop, entry, v, factor));
+    }
+    // the loops around this one look at the operands again
+    if (o->reductions_len > 0)
+        ir_resolve_operands(function);
+}
+
+static void optimize_loop(LoopOptimizer *o, const Loop *loop) {
+    IrFunction *function = o->function;
+    const IrInstruction *instruction;
+    const IrBlock *block;
+    uint32_t b, i;
+    int calls = 0;
+
+    if (loop->preheader == IR_NONE)
+        return;
+    o->stamp++;
+    for (b = 0; b < loop->blocks_len; b++)
+        o->members[(uint32_t) loop->blocks[b]] = o->stamp;
+    for (b = 0; b < loop->blocks_len; b++) {
+        block = &function->blocks[(uint32_t) loop->blocks[b]];
+        for (i = 0; i < block->len; i++) {
+            instruction = &function->instructions[block->code[i]];
+            if (instruction->op == IR_CALL)
+                calls = 1;
+            else if (instruction->op == IR_STORE_GLOBAL)
+                o->stored[instruction->a] = o->stamp;
+        }
+    }
+
+    hoist_invariants(o, loop, calls);
+    if (loop->latch != IR_NONE && function->blocks[loop->header].predecessors_len == 2)
+        reduce_strength(o, loop);
+}
+
+static void optimize_function(LoopOptimizer *o, IrFunction *function) {
+    uint32_t b, i;
+
+    o->function = function;
+    o->dominators = ir_compute_dominators(function);
+    o->members = allocate(function->blocks_len, sizeof(uint32_t));
+    o->worklist = allocate(function->blocks_len, sizeof(uint32_t));
+    o->loops_len = 0;
+    for (b = 0; b < function->blocks_len; b++) {
+        if (is_reachable(o, b))
+            find_loop(o, b);
+    }
+    if (o->loops_len > 0)
+        qsort(o->loops, o->loops_len, sizeof(Loop), compare_loops);
+    for (i = 0; i < o->loops_len; i++) {
+        optimize_loop(o, &o->loops[i]);
+        free(o->loops[i].blocks);
+    }
+
+    ir_dominators_dispose(&o->dominators);
+    free(o->members);
+    free(o->worklist);
+}
+
+void ir_optimize_loops(IrProgram *program) {
+    LoopOptimizer o = {.stored = allocate(program->globals_len, sizeof(uint32_t))};
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++)
+        optimize_function(&o, program->functions->items[i]);
+
+    free(o.stored);
+    free(o.loops);
+    free(o.variables);
+    free(o.reductions);
+    free(o.products);
+}
@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_IR_LOOP_H
+#define INFINITY_COMPILER_IR_LOOP_H
+
+#include "ir.h"
+
+void ir_optimize_loops(IrProgram *program);
+
+#endif //INFINITY_COMPILER_IR_LOOP_H
@@ -0,0 +1,327 @@
+#include "ir_sccp.h"
+#include "../logging/logging.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+Sparse conditional constant propagation (Wegman and Zadeck).
+
+Every value starts unknown and only goes down to a constant, then to varying.
+Blocks are visited when an edge into them is found executable, and a branch on
+a constant only makes one of its edges executable, so values that are constant
+on the paths the program can take are found even through phis of loops.
+Afterwards the constant values become IR_CONST and the branches on a constant
+become jumps. The blocks that can't run are left to ir_dce.
+*/
+
+typedef enum {
+    LATTICE_UNKNOWN,
+    LATTICE_CONSTANT,
+    LATTICE_VARYING,
+} LatticeState;
+
+typedef struct {
+    IrFunction *function;
+    uint32_t len;            // instructions before the rewrite
+    uint8_t *states;         // by instruction: LatticeState
+    int32_t *constants;      // by instruction, for LATTICE_CONSTANT
+    uint8_t *reachable;      // by block
+    uint8_t *edges;          // one flag per predecessor of each block: the edge is executable
+    uint32_t *edge_starts;   // by block: its first flag in `edges`
+    uint32_t *uses;          // instructions using each value, from `use_starts`
+    uint32_t *use_starts;
+    uint32_t *blocks;        // to visit, after an edge into them became executable
+    uint32_t blocks_len;
+    uint32_t *values;        // whose state changed, their uses are evaluated again
+    uint32_t values_len;
+} Sccp;
+
+static void *allocate(size_t len, size_t item_size) {
+    void *array = calloc(len + 1, item_size);
+
+    if (!array)
+        log_error(OPTIMIZER, "Can't allocate memory for constant propagation.");
+    return array;
+}
+
+/*
+Lists the uses of every value, in blocks or not.
+*/
+static void count_uses(Sccp *s) {
+    IrFunction *function = s->function;
+    uint32_t *operands, *next, len, b, i, k;
+
+    s->use_starts = allocate(function->len + 1, sizeof(uint32_t));
+    for (b = 0; b < function->blocks_len; b++) {
+        for (i = 0; i < function->blocks[b].len; i++) {
+            operands = ir_value_operands(function, &function->instructions[function->blocks[b].code[i]], &len);
+            for (k = 0; k < len; k++)
+                s->use_starts[operands[k] + 1]++;
+        }
+    }
+    for (i = 0; i < function->len; i++)
+        s->use_starts[i + 1] += s->use_starts[i];
+    s->uses = allocate(s->use_starts[function->len], sizeof(uint32_t));
+    next = allocate(function->len, sizeof(uint32_t));
+    for (b = 0; b < function->blocks_len; b++) {
+        for (i = 0; i < function->blocks[b].len; i++) {
+            operands = ir_value_operands(function, &function->instructions[function->blocks[b].code[i]], &len);
+            for (k = 0; k < len; k++)
+                s->uses[s->use_starts[operands[k]] + next[operands[k]]++] = function->blocks[b].code[i];
+        }
+    }
+    free(next);
+}
+
+static void mark_edge(Sccp *s, uint32_t from, uint32_t to) {
+    const IrBlock *target = &s->function->blocks[to];
+    uint32_t i;
+
+    for (i = 0; i < target->predecessors_len; i++) {
+        if (target->predecessors[i] == from && !s->edges[s->edge_starts[to] + i]) {
+            s->edges[s->edge_starts[to] + i] = 1;
+            s->blocks[s->blocks_len++] = to;
+        }
+    }
+}
+
+static void set_state(Sccp *s, uint32_t id, LatticeState state, int32_t constant) {
+    if (s->states[id] == state && (state != LATTICE_CONSTANT || s->constants[id] == constant))
+        return;
+    if (s->states[id] == LATTICE_VARYING || (s->states[id] == LATTICE_CONSTANT && state == LATTICE_UNKNOWN))
+        return; // values only go down
+    if (s->states[id] == LATTICE_CONSTANT)
+        state = LATTICE_VARYING; // another constant
+    s->states[id] = state;
+    s->constants[id] = constant;
+    s->values[s->values_len++] = id;
+}
+
+/*
+Folds an operation on constants like the program computes it at run time.
+Returns 0 when it would overflow or stop the program: it is left to run.
+*/
+static int fold(IrOpcode op, int32_t a, int32_t b, int32_t *result) {
+    switch (op) {
+        case IR_ADD:
+            return !__builtin_add_overflow(a, b, result);
+        case IR_SUB:
+            return !__builtin_sub_overflow(a, b, result);
+        case IR_MUL:
+            return !__builtin_mul_overflow(a, b, result);
+        case IR_DIV:
+            if (b == 0 || (a == INT_MIN && b == -1))
+                return 0;
+            *result = a / b;
+            return 1;
+        case IR_NEG:
+            *result = -a;
+            return a != INT_MIN;
+        case IR_EQ:
+            *result = a == b;
+            return 1;
+        case IR_NE:
+            *result = a != b;
+            return 1;
+        case IR_LT:
+            *result = a < b;
+            return 1;
+        case IR_GT:
+            *result = a > b;
+            return 1;
+        case IR_LE:
+            *result = a <= b;
+            return 1;
+        case IR_GE:
+            *result = a >= b;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void evaluate_phi(Sccp *s, uint32_t id) {
+    const IrInstruction *phi = &s->function->instructions[id];
+    const uint32_t *operands = ir_list(s->function, phi->b);
+    uint32_t len = ir_list_len(s->function, phi->b), start = s->edge_starts[phi->block], i;
+    LatticeState state = LATTICE_UNKNOWN;
+    int32_t constant = 0;
+
+    for (i = 0; i < len && state != LATTICE_VARYING; i++) {
+        if (!s->edges[start + i] || s->states[operands[i]] == LATTICE_UNKNOWN)
+            continue;
+        if (s->states[operands[i]] == LATTICE_VARYING ||
+            (state == LATTICE_CONSTANT && s->constants[operands[i]] != constant)) {
+            state = LATTICE_VARYING;
+        } else {
+            state = LATTICE_CONSTANT;
+            constant = s->constants[operands[i]];
+        }
+    }
+    set_state(s, id, state, constant);
+}
+
+static void evaluate(Sccp *s, uint32_t id) {
+    const IrInstruction *instruction = &s->function->instructions[id];
+    const IrBlock *block = &s->function->blocks[instruction->block];
+    LatticeState a, b;
+    int32_t result;
+
+    switch (instruction->op) {
+        case IR_CONST:
+            set_state(s, id, LATTICE_CONSTANT, (int32_t) instruction->a);
+            break;
+        case IR_PHI:
+            evaluate_phi(s, id);
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_NEG:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_GT:
+        case IR_LE:
+        case IR_GE:
+            a = s->states[instruction->a];
+            b = instruction->op == IR_NEG ? LATTICE_CONSTANT : s->states[instruction->b];
+            if (a == LATTICE_UNKNOWN || b == LATTICE_UNKNOWN)
+                break;
+            if (a == LATTICE_CONSTANT && b == LATTICE_CONSTANT &&
+                fold(instruction->op, s->constants[instruction->a], s->constants[instruction->b], &result))
+                set_state(s, id, LATTICE_CONSTANT, result);
+            else
+                set_state(s, id, LATTICE_VARYING, 0);
+            break;
+        case IR_JUMP:
+            mark_edge(s, instruction->block, block->successors[0]);
+            break;
+        case IR_BRANCH:
+            if (s->states[instruction->a] != LATTICE_CONSTANT || s->constants[instruction->a])
+                mark_edge(s, instruction->block, block->successors[0]);
+            if (s->states[instruction->a] != LATTICE_CONSTANT || !s->constants[instruction->a])
+                mark_edge(s, instruction->block, block->successors[1]);
+            break;
+        case IR_STRING:
+        case IR_ARG:
+        case IR_LOAD_GLOBAL:
+        case IR_CALL:
+            set_state(s, id, LATTICE_VARYING, 0);
+            break;
+        default: // no value
+            break;
+    }
+}
+
+static void propagate(Sccp *s) {
+    const IrFunction *function = s->function;
+    const IrBlock *block;
+    uint32_t id, b, i;
+
+    s->reachable[0] = 1;
+    for (i = 0; i < function->blocks[0].len; i++)
+        evaluate(s, function->blocks[0].code[i]);
+    while (s->blocks_len > 0 || s->values_len > 0) {
+        while (s->values_len > 0) {
+            id = s->values[--s->values_len];
+            for (i = s->use_starts[id]; i < s->use_starts[id + 1]; i++) {
+                if (s->reachable[function->instructions[s->uses[i]].block])
+                    evaluate(s, s->uses[i]);
+            }
+        }
+        if (s->blocks_len == 0)
+            break;
+        b = s->blocks[--s->blocks_len];
+        block = &function->blocks[b];
+        if (s->reachable[b]) { // a new edge only changes the phis
+            for (i = 0; i < block->len && function->instructions[block->code[i]].op == IR_PHI; i++)
+                evaluate(s, block->code[i]);
+            continue;
+        }
+        s->reachable[b] = 1;
+        for (i = 0; i < block->len; i++)
+            evaluate(s, block->code[i]);
+    }
+}
+
+/*
+Replaces the constant values by IR_CONST, and the branches on a constant by jumps.
+*/
+static void rewrite(Sccp *s) {
+    IrFunction *function = s->function;
+    IrInstruction *instruction;
+    IrBlock *block;
+    uint32_t phis, id, constant, b, i;
+
+    for (b = 0; b < function->blocks_len; b++) {
+        if (!s->reachable[b])
+            continue;
+        block = &function->blocks[b];
+        for (phis = 0; phis < block->len && function->instructions[block->code[phis]].op == IR_PHI; phis++);
+        for (i = 0; i < block->len; i++) {
+            id = block->code[i];
+            instruction = &function->instructions[id];
+            if (id >= s->len || s->states[id] != LATTICE_CONSTANT || instruction->op == IR_CONST)
+                continue;
+            if (instruction->op != IR_PHI) {
+                instruction->op = IR_CONST;
+                instruction->a = (uint32_t) s->constants[id];
+                instruction->b = 0;
+                continue;
+            }
+            // the constant goes after the phis, where the phi was defined
+            constant = ir_new_instruction(function, IR_CONST, instruction->type, (uint32_t) s->constants[id], 0);
+            ir_insert(function, b, phis, constant);
+            ir_remove(function, id, constant);
+            i--;
+        }
+        instruction = &function->instructions[block->code[block->len - 1]];
+        if (instruction->op == IR_BRANCH && s->states[instruction->a] == LATTICE_CONSTANT) {
+            ir_remove_edge(function, b, s->constants[instruction->a] ? 1 : 0);
+            instruction->op = IR_JUMP;
+            instruction->a = 0;
+        }
+    }
+    ir_resolve_operands(function);
+}
+
+static void sccp_function(IrFunction *function) {
+    Sccp s = {.function = function, .len = function->len};
+    uint32_t edges_len = 0, b;
+
+    s.edge_starts = allocate(function->blocks_len, sizeof(uint32_t));
+    for (b = 0; b < function->blocks_len; b++) {
+        s.edge_starts[b] = edges_len;
+        edges_len += function->blocks[b].predecessors_len;
+    }
+    s.states = allocate(function->len, sizeof(uint8_t));
+    s.constants = allocate(function->len, sizeof(int32_t));
+    s.reachable = allocate(function->blocks_len, sizeof(uint8_t));
+    s.edges = allocate(edges_len, sizeof(uint8_t));
+    s.blocks = allocate(edges_len, sizeof(uint32_t));     // every edge is marked once
+    s.values = allocate(2 * function->len, sizeof(uint32_t)); // every value goes down twice at most
+    count_uses(&s);
+
+    propagate(&s);
+    rewrite(&s);
+
+    free(s.states);
+    free(s.constants);
+    free(s.reachable);
+    free(s.edges);
+    free(s.edge_starts);
+    free(s.uses);
+    free(s.use_starts);
+    free(s.blocks);
+    free(s.values);
+}
+
+void ir_sccp(IrProgram *program) {
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++)
+        sccp_function(program->functions->items[i]);
+}
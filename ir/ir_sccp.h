@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_IR_SCCP_H
+#define INFINITY_COMPILER_IR_SCCP_H
+
+#include "ir.h"
+
+void ir_sccp(IrProgram *program);
+
+#endif //INFINITY_COMPILER_IR_SCCP_H
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE // RTLD_DEFAULT
+
+#include "jit.h"
+#include "../logging/logging.h"
+#include "../io/io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+
+/*
+Runs an encoded program in the compiler's process (--jit).
+
+The text, the read only data and the bss are copied to their own pages of one
+mapping, relocated, then the text becomes executable and the read only data read
+only: no page is ever writable and executable at once. Functions of other objects,
+like printf, are out of reach of a 32 bit call, so each one gets a stub after the
+text that jumps to the address dlsym finds.
+*/
+
+#define STUB_SIZE 16 // jmp [rip], then the address
+
+typedef int (*JitMain)(void);
+
+/**
+\JitImage
+ The program loaded in memory, every section starting on its own page.
+*/
+typedef struct {
+    const MachineProgram *program;
+    const MachineCode *code;
+    unsigned char *base; // of the mapping, and of the text
+    size_t size;
+    size_t stubs;        // offsets from `base`
+    size_t rodata;
+    size_t bss;
+    size_t *stub_ids;    // by symbol: index of its stub + 1, for undefined symbols
+} JitImage;
+
+static size_t align(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void store32(unsigned char *field, int32_t value) {
+    memcpy(field, &value, sizeof(value)); // x86-64 is little endian
+}
+
+/*
+Writes a stub for every symbol defined by another object.
+*/
+static void place_stubs(JitImage *image) {
+    const MachineProgram *program = image->program;
+    unsigned char *stub = image->base + image->stubs;
+    char *errMsg;
+    void *address;
+    size_t i, len = 0;
+
+    for (i = 0; i < program->symbols_len; i++) {
+        if (program->symbols[i].section != SECTION_UNDEFINED)
+            continue;
+        address = dlsym(RTLD_DEFAULT, program->symbols[i].name);
+        if (!address) {
+            alsprintf(&errMsg, "Can't find symbol '%s' for the JIT.", program->symbols[i].name);
+            log_error(CODE_GENERATOR, errMsg);
+        }
+        image->stub_ids[i] = ++len;
+        stub[0] = 0xFF; // jmp [rip + 0]
+        stub[1] = 0x25;
+        store32(stub + 2, 0);
+        memcpy(stub + 6, &address, sizeof(address));
+        stub += STUB_SIZE;
+    }
+}
+
+static unsigned char *symbol_address(const JitImage *image, unsigned int symbol) {
+    size_t offset = image->code->offsets[symbol];
+
+    switch (image->program->symbols[symbol].section) {
+        case SECTION_TEXT:
+            return image->base + offset;
+        case SECTION_RODATA:
+            return image->base + image->rodata + offset;
+        case SECTION_BSS:
+            return image->base + image->bss + offset;
+        default:
+            return image->base + image->stubs + (image->stub_ids[symbol] - 1) * STUB_SIZE;
+    }
+}
+
+/*
+All the sections are in the same mapping, so every field reaches its symbol.
+*/
+static void relocate(JitImage *image) {
+    const MachineRelocation *relocation;
+    unsigned char *field;
+    size_t i;
+
+    for (i = 0; i < image->code->relocations_len; i++) {
+        relocation = &image->code->relocations[i];
+        field = image->base + relocation->offset;
+        store32(field, (int32_t) (symbol_address(image, relocation->symbol) + relocation->addend - field));
+    }
+}
+
+/*
+Loads the program and calls its main function. Returns its result, the exit code.
+*/
+int jit_run(const MachineProgram *program, const MachineCode *code) {
+    JitImage image = {.program = program, .code = code};
+    size_t page = (size_t) sysconf(_SC_PAGESIZE), stubs_len = 0, i;
+    long main_symbol = machine_lookup_symbol(program, "main");
+    JitMain entry;
+    int exit_code;
+
+    for (i = 0; i < program->symbols_len; i++)
+        stubs_len += program->symbols[i].section == SECTION_UNDEFINED;
+    image.stubs = align(code->text_len, STUB_SIZE);
+    image.rodata = align(image.stubs + stubs_len * STUB_SIZE, page);
+    image.bss = align(image.rodata + code->rodata_len, page);
+    image.size = align(image.bss + code->bss_len, page);
+    image.stub_ids = calloc(program->symbols_len + 1, sizeof(size_t));
+    image.base = mmap(NULL, image.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!image.stub_ids || image.base == MAP_FAILED)
+        log_error(CODE_GENERATOR, "Can't allocate memory for the JIT.");
+
+    // the mapping is zeroed, which is the bss
+    memcpy(image.base, code->text, code->text_len);
+    memcpy(image.base + image.rodata, code->rodata, code->rodata_len);
+    place_stubs(&image);
+    relocate(&image);
+    if (mprotect(image.base, image.rodata, PROT_READ | PROT_EXEC) ||
+        (image.bss > image.rodata && mprotect(image.base + image.rodata, image.bss - image.rodata, PROT_READ)))
+        log_error(CODE_GENERATOR, "Can't make the JIT code executable.");
+
+    entry = (JitMain) (uintptr_t) symbol_address(&image, (unsigned int) main_symbol);
+    exit_code = entry();
+
+    munmap(image.base, image.size);
+    free(image.stub_ids);
+    return exit_code;
+}
@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_JIT_H
+#define INFINITY_COMPILER_JIT_H
+
+#include "../codegen/encoder.h"
+
+int jit_run(const MachineProgram *program, const MachineCode *code);
+
+#endif //INFINITY_COMPILER_JIT_H
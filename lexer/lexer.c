@@ -22,11 +22,32 @@ Lexer *init_lexer(char *src) {
     return lexer;
 }
 
+/*
+Creates a lexer that starts at index `idx` of `src`,
+which is at line `row` and column `col`.
+Takes the length of `src`, to lex many parts of a long source without measuring it every time.
+*/
+Lexer *init_lexer_at(char *src, size_t src_len, unsigned int idx, unsigned int row, unsigned int col) {
+    Lexer *lexer = malloc(sizeof(Lexer));
+    if (!lexer)
+        log_error(LEXER, "Cant allocate memory for lexer.");
+
+    lexer->src = src;
+    lexer->src_len = src_len;
+    lexer->idx = idx;
+    lexer->row = row;
+    lexer->col = col;
+    lexer->c = src[idx];
+    return lexer;
+}
+
 void lexer_dispose(Lexer *lexer) {
     free(lexer);
 }
 
 void lexer_forward(Lexer *lexer) {
+    if (lexer->c == 0) // never move past the end of the source
+        return;
     (lexer->idx)++;
     (lexer->col)++;
     lexer->c = lexer->src[lexer->idx];
@@ -77,6 +98,18 @@ Token *lexer_parse_id_token(Lexer *lexer) {
         return init_token(val, IF_KEYWORD);
     else if (!strcmp(val, "else"))
         return init_token(val, ELSE_KEYWORD);
+    else if (!strcmp(val, "for"))
+        return init_token(val, FOR_KEYWORD);
+    else if (!strcmp(val, "while"))
+        return init_token(val, WHILE_KEYWORD);
+    else if (!strcmp(val, "import"))
+        return init_token(val, IMPORT_KEYWORD);
+    else if (!strcmp(val, "define"))
+        return init_token(val, DEFINE_KEYWORD);
+    else if (!strcmp(val, "true"))
+        return init_token(val, TRUE_KEYWORD);
+    else if (!strcmp(val, "false"))
+        return init_token(val, FALSE_KEYWORD);
 
     return init_token(val, ID);
 }
@@ -95,39 +128,52 @@ Token *lexer_parse_int_token(Lexer *lexer) {
     return init_token(val, INT);
 }
 
-char *get_escape_character(Lexer *lexer) {
-    char next = lexer_peek(lexer, 1);
-    switch (next) {
+/*
+Returns the character of the escape sequence at the current backslash,
+or 0 if it isn't a known escape sequence (then the backslash is kept).
+*/
+char get_escape_character(Lexer *lexer) {
+    switch (lexer_peek(lexer, 1)) {
         case 'n':
-            return (char[]) {'\n', 0};
+            return '\n';
         case 't':
-            return (char[]) {'\t', 0};
+            return '\t';
         case 'r':
-            return (char[]) {'\r', 0};
+            return '\r';
         case 'b':
-            return (char[]) {'\b', 0};
+            return '\b';
         case '"':
-            return (char[]) {'"', 0};
+            return '"';
         default:
-            return (char[]) {lexer->c, next, 0};
+            return 0;
     }
 }
 
 Token *lexer_parse_string_token(Lexer *lexer) {
-    size_t val_len = 1;
-    char *val = calloc(val_len, sizeof(char));
+    size_t val_len = 0;
+    char *val = calloc(1, sizeof(char)), escaped;
     if (!val)
         log_error(LEXER, "Cant allocate memory for token value_expr.");
 
     lexer_forward(lexer);
     while (lexer->c != '"') {
-        val = realloc(val, ++val_len);
+        if (lexer->c == 0)
+            throw_exception_with_trace(LEXER, lexer, "String unclosed at end of file");
+        // an escape sequence is at most two characters
+        val = realloc(val, val_len + 3);
         if (lexer->c == '\\') { // support escape characters
-            strcat(val, get_escape_character(lexer));
+            escaped = get_escape_character(lexer);
+            if (escaped) {
+                val[val_len++] = escaped;
+            } else {
+                val[val_len++] = lexer->c;
+                val[val_len++] = lexer_peek(lexer, 1);
+            }
             lexer_forward(lexer);
         } else {
-            strcat(val, (char[]) {lexer->c, 0});
+            val[val_len++] = lexer->c;
         }
+        val[val_len] = 0;
         lexer_forward(lexer);
     }
 
@@ -151,6 +197,10 @@ void lexer_skip_multi_line_comment(Lexer *lexer) {
             lexer->idx = idx;
             throw_exception_with_trace(LEXER, lexer, "Comment unclosed at end of file");
         }
+        if (lexer->c == '\n') {
+            lexer->row++;
+            lexer->col = -1;
+        }
         lexer_forward(lexer);
     }
     lexer_forward(lexer);
@@ -161,8 +211,13 @@ Token *lexer_next_token(Lexer *lexer) {
     Token *t;
     char *errorMsg;
     char *currC;
+    unsigned int row, col, idx;
+    Lexer at;
 
     lexer_skip_whitespace(lexer);
+    row = lexer->row;
+    col = lexer->col;
+    idx = lexer->idx;
 
     if (isalpha(lexer->c))
         t = lexer_parse_id_token(lexer);
@@ -201,21 +256,24 @@ Token *lexer_next_token(Lexer *lexer) {
                 break;
             case '=':
                 if (lexer_peek(lexer, 1) == '=') {
-                    t = init_token("==", EQUALS);
+                    free(currC);
+                    t = init_token(strdup("=="), EQUALS);
                     lexer_forward(lexer);
                 } else
                     t = init_token(currC, ASSIGNMENT);
                 break;
             case '>':
                 if (lexer_peek(lexer, 1) == '=') {
-                    t = init_token(">=", GRATER_EQUAL);
+                    free(currC);
+                    t = init_token(strdup(">="), GRATER_EQUAL);
                     lexer_forward(lexer);
                 } else
                     t = init_token(currC, GRATER_THAN);
                 break;
             case '<':
                 if (lexer_peek(lexer, 1) == '=') {
-                    t = init_token("<=", LOWER_EQUAL);
+                    free(currC);
+                    t = init_token(strdup("<="), LOWER_EQUAL);
                     lexer_forward(lexer);
                 } else
                     t = init_token(currC, LOWER_THAN);
@@ -229,17 +287,19 @@ Token *lexer_next_token(Lexer *lexer) {
                     t = init_token(currC, DIVIDE);
                     break;
                 }
-                t = lexer_next_token(lexer);
-                break;
+                free(currC);
+                return lexer_next_token(lexer);
             case '"':
                 t = lexer_parse_string_token(lexer);
                 break;
             case '-':
                 if (lexer_peek(lexer, 1) == '>') {
-                    t = init_token("->", ARROW);
+                    free(currC);
+                    t = init_token(strdup("->"), ARROW);
                     lexer_forward(lexer);
                 } else if (lexer_peek(lexer, 1) == '-') {
-                    t = init_token("--", DEC);
+                    free(currC);
+                    t = init_token(strdup("--"), DEC);
                     lexer_forward(lexer);
                 } else {
                     t = init_token(currC, SUB);
@@ -247,7 +307,8 @@ Token *lexer_next_token(Lexer *lexer) {
                 break;
             case '+':
                 if (lexer_peek(lexer, 1) == '+') {
-                    t = init_token("++", INC);
+                    free(currC);
+                    t = init_token(strdup("++"), INC);
                     lexer_forward(lexer);
                 } else {
                     t = init_token(currC, ADD);
@@ -256,16 +317,40 @@ Token *lexer_next_token(Lexer *lexer) {
             case '*':
                 t = init_token(currC, MUL);
                 break;
+            case '!':
+                if (lexer_peek(lexer, 1) == '=') {
+                    free(currC);
+                    t = init_token(strdup("!="), NOT_EQUALS);
+                    lexer_forward(lexer);
+                } else
+                    t = init_token(currC, NOT);
+                break;
             case 0: // EOF
                 t = init_token(currC, EOF_TOKEN);
                 break;
+            case '&':
+            case '|':
+                // only doubled, as && and ||
+                if (lexer_peek(lexer, 1) == lexer->c) {
+                    free(currC);
+                    t = init_token(strdup(lexer->c == '&' ? "&&" : "||"), lexer->c == '&' ? AND : OR);
+                    lexer_forward(lexer);
+                    break;
+                }
+                // fall through
             default:
                 alsprintf(&errorMsg, "Unknown token '%c'", lexer->c);
-                throw_exception_with_trace(LEXER, lexer, errorMsg);
+                // skip the character first, so lexing can go on if the error is recovered from
+                at = *lexer;
+                lexer_forward(lexer);
+                throw_exception_with_trace(LEXER, &at, errorMsg);
                 break;
         }
         lexer_forward(lexer);
     }
 
+    t->row = row;
+    t->col = col;
+    t->idx = idx;
     return t;
 }
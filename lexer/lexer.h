@@ -15,6 +15,8 @@ typedef struct LexerStruct {
 
 Lexer *init_lexer(char *src);
 
+Lexer *init_lexer_at(char *src, size_t src_len, unsigned int idx, unsigned int row, unsigned int col);
+
 void lexer_dispose(Lexer *lexer);
 
 void lexer_forward(Lexer *lexer);
@@ -27,7 +29,7 @@ Token *lexer_parse_id_token(Lexer *lexer);
 
 Token *lexer_parse_int_token(Lexer *lexer);
 
-char *get_escape_character(Lexer *lexer);
+char get_escape_character(Lexer *lexer);
 
 Token *lexer_parse_string_token(Lexer *lexer);
 
@@ -64,7 +64,7 @@ void list_insert(List *list, size_t idx, void *item) {
         list->items = realloc(list->items, list->size * list->item_size);
     }
 
-    memmove(&list->items[idx + 1], &list->items[idx], (list->size - idx) * list->item_size);
+    memmove(&list->items[idx + 1], &list->items[idx], (list->size - idx - 1) * list->item_size);
 
     list->items[idx] = item;
 }
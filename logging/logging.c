@@ -1,4 +1,5 @@
 #include "logging.h"
+#include "../diagnostics/diagnostics.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -12,23 +13,78 @@ char *caller_type_to_str(Caller caller) {
             return "Compiler";
         case CODE_GENERATOR:
             return "Code Generator";
+        case OPTIMIZER:
+            return "Optimizer";
+        case VIRTUAL_MACHINE:
+            return "VM";
+        case SEMANTIC_ANALYZER:
+            return "Semantic Analyzer";
         default:
             return "Unknown";
     }
 }
 
-void log_curr_line(const Lexer *lexer) {
-    int rowNoLen, i;
+/*
+Prints the source line that starts at `line`, with a marker under column `col`.
+*/
+static void print_line(FILE *out, const char *line, unsigned int row, unsigned int col) {
+    int rowNoLen;
 
     // print line number
-    rowNoLen = printf(" %d", lexer->row + 1);
-    printf(" |  ");
+    rowNoLen = fprintf(out, " %d", row + 1);
+    fprintf(out, " |  ");
     // print source code line
-    i = lexer->idx - lexer->col;
-    while (lexer->src[i] != '\n' && lexer->src[i] != 0)
-        printf("%c", lexer->src[i++]);
+    while (*line != '\n' && *line != 0)
+        fputc(*line++, out);
     // print message
-    printf("\n%*s |  %*s^\n", rowNoLen, "", lexer->col, "");
+    fprintf(out, "\n%*s |  %*s^\n", rowNoLen, "", col, "");
+}
+
+static const char *find_line(const char *src, unsigned int row) {
+    unsigned int line;
+    const char *p = src;
+
+    for (line = 0; line < row && *p; p++) {
+        if (*p == '\n')
+            line++;
+    }
+    return p;
+}
+
+/*
+Where errors and warnings go: the diagnostics of the current thread, if it collects them.
+*/
+static FILE *error_output(void) {
+    Diagnostics *diagnostics = diagnostics_installed();
+    return diagnostics && diagnostics->recover ? diagnostics->stream : stdout;
+}
+
+/*
+Reports an error at column `col` of the source line starting at `line`.
+If the current thread collects its errors, the pass that threw it recovers,
+otherwise the compiler exits.
+*/
+static void throw_error(Caller caller, const char *line, unsigned int row, unsigned int col, const char *msg) {
+    Diagnostics *diagnostics = diagnostics_installed();
+    FILE *out = error_output();
+
+    print_line(out, line, row, col);
+    fprintf(out, "[%s] %s\n", caller_type_to_str(caller), msg);
+    if (out == stdout)
+        exit(1);
+    diagnostics->count++;
+    longjmp(*diagnostics->recover, 1);
+}
+
+void log_curr_line(const Lexer *lexer) {
+    print_line(stdout, lexer->src + lexer->idx - lexer->col, lexer->row, lexer->col);
+}
+
+/*
+Prints line `row` of `src` with a marker under column `col`.
+*/
+void log_source_line(const char *src, unsigned int row, unsigned int col) {
+    print_line(stdout, find_line(src, row), row, col);
 }
 
 void log_debug(Caller caller, const char *msg) {
@@ -41,13 +97,20 @@ void log_error(Caller caller, const char *msg) {
 }
 
 void log_warning(const Lexer *lexer, const char *msg) {
-    log_curr_line(lexer);
-    printf("[Warning] %s\n", msg);
+    FILE *out = error_output();
+
+    print_line(out, lexer->src + lexer->idx - lexer->col, lexer->row, lexer->col);
+    fprintf(out, "[Warning] %s\n", msg);
 }
 
 void throw_exception_with_trace(Caller caller, const Lexer *lexer, const char *msg) {
-    log_curr_line(lexer);
-    log_debug(caller, msg);
+    throw_error(caller, lexer->src + lexer->idx - lexer->col, lexer->row, lexer->col, msg);
+}
 
-    exit(1);
+/*
+Reports an error at a position of `src`, for errors found away from the lexer's
+position, like after parsing.
+*/
+void throw_exception_at(Caller caller, const char *src, unsigned int row, unsigned int col, const char *msg) {
+    throw_error(caller, find_line(src, row), row, col, msg);
 }
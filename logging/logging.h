@@ -8,10 +8,15 @@ typedef enum {
     LEXER,
     PARSER,
     CODE_GENERATOR,
+    OPTIMIZER,
+    VIRTUAL_MACHINE,
+    SEMANTIC_ANALYZER,
 } Caller;
 
 char *caller_type_to_str(Caller caller);
 
+void log_source_line(const char *src, unsigned int row, unsigned int col);
+
 void log_curr_line(const Lexer *lexer);
 
 void log_debug(Caller caller, const char *msg);
@@ -22,4 +27,6 @@ void log_warning(const Lexer *lexer, const char *msg);
 
 void throw_exception_with_trace(Caller caller, const Lexer *lexer, const char *msg);
 
+void throw_exception_at(Caller caller, const char *src, unsigned int row, unsigned int col, const char *msg);
+
 #endif //INFINITY_COMPILER_LOGGING_H
@@ -2,27 +2,39 @@
 #include <stdlib.h>
 #include <string.h>
 #include "config/globals.h"
+#include "config/options.h"
 #include "compiler/compiler.h"
 #include "io/io.h"
+#include "perf/perf.h"
+#include "profiler/profiler.h"
 
 // TODO: add EOF proof to parser
 
 int main(int argc, char **argv) {
+    int exit_code;
+
+    parse_options(argc, argv);
+
     // check that target file is specified
-    if (argc < 2) {
+    if (!compiler_options.target_file) {
         printf("Please provide target file path as a command line argument.\n");
+        print_usage(argv[0]);
         exit(0);
     }
     // check file extension
-    if (strcmp(get_file_extension(argv[1]), EXTENSION) != 0) {
+    if (strcmp(get_file_extension(compiler_options.target_file), EXTENSION) != 0) {
         printf("File extension not supported. Must be *.%s files only.\n", EXTENSION);
         exit(0);
     }
 
-    compiler_compile_file(argv[1]);
-    printf("\nDone\n");
+    perf_init(compiler_options.time_report, compiler_options.perf_counters);
+    if (compiler_options.self_profile)
+        profiler_start(compiler_options.self_profile);
+    exit_code = compiler_compile_file(compiler_options.target_file);
+    if (!compiler_options.run && !compiler_options.jit)
+        printf("\nDone\n");
 
-    return 0;
+    return exit_code;
 }
 
 //#include "test_evals/expression_evaluator.c"
@@ -0,0 +1,236 @@
+#include "interface.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+Binary interface file of a module. All integers are little endian.
+
+    magic       "INFI"
+    version     u8
+    key         u64                  what the module was checked from, see `interface_read`
+    count       u32                  number of functions
+    functions   count * {
+        name_len    u16
+        name        name_len bytes (not null terminated)
+        return_type u8
+        args_len    u8
+        arg_types   args_len * u8
+    }
+*/
+
+#define INTERFACE_MAGIC "INFI"
+#define INTERFACE_VERSION 2
+#define INTERFACE_HEADER_LEN 13 // magic, version and key
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+} ByteBuffer;
+
+FunctionSignature *init_function_signature(char *name, DataType return_type, size_t args_len) {
+    FunctionSignature *signature = malloc(sizeof(FunctionSignature));
+    if (!signature)
+        log_error(COMPILER, "Can't allocate memory for function signature.");
+
+    signature->name = name;
+    signature->return_type = return_type;
+    signature->args_len = args_len;
+    signature->arg_types = calloc(args_len ? args_len : 1, sizeof(DataType));
+
+    return signature;
+}
+
+void function_signature_dispose(FunctionSignature *signature) {
+    free(signature->arg_types);
+    free(signature);
+}
+
+FunctionSignature *function_signature_from_definition(const FunctionDefinition *definition) {
+    FunctionSignature *signature;
+    size_t i;
+
+    signature = init_function_signature(definition->func_name, definition->returnType, definition->args->size);
+    for (i = 0; i < definition->args->size; i++)
+        signature->arg_types[i] = ((Variable *) definition->args->items[i])->value->type;
+
+    return signature;
+}
+
+/*
+Returns the signatures of all the functions defined at the top level of a module.
+*/
+List *interface_from_ast(const AstNode *root) {
+    List *interface = init_list(sizeof(FunctionSignature *));
+    AstNode *child;
+    size_t i;
+
+    for (i = 0; i < root->data.compound.children->size; i++) {
+        child = root->data.compound.children->items[i];
+        if (child->type == AST_FUNCTION_DEFINITION)
+            list_push(interface, function_signature_from_definition(&child->data.function_definition));
+    }
+
+    return interface;
+}
+
+static void buffer_write(ByteBuffer *buf, const void *data, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        buf->capacity = MAX(buf->capacity * 2, buf->len + len);
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void buffer_write_uint(ByteBuffer *buf, uint64_t value, int bytes) {
+    unsigned char le[8];
+    int i;
+    for (i = 0; i < bytes; i++)
+        le[i] = (value >> (8 * i)) & 0xff;
+    buffer_write(buf, le, bytes);
+}
+
+static void buffer_write_functions(ByteBuffer *buf, const List *interface) {
+    FunctionSignature *signature;
+    size_t i, j, name_len;
+
+    buffer_write_uint(buf, interface->size, 4);
+    for (i = 0; i < interface->size; i++) {
+        signature = interface->items[i];
+        name_len = strlen(signature->name);
+        buffer_write_uint(buf, name_len, 2);
+        buffer_write(buf, signature->name, name_len);
+        buffer_write_uint(buf, signature->return_type, 1);
+        buffer_write_uint(buf, signature->args_len, 1);
+        for (j = 0; j < signature->args_len; j++)
+            buffer_write_uint(buf, signature->arg_types[j], 1);
+    }
+}
+
+/*
+Hash of the signatures of an interface, which changes when a dependent must be checked again.
+*/
+uint64_t interface_hash(const List *interface) {
+    ByteBuffer buf = {};
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    buffer_write_functions(&buf, interface);
+    for (i = 0; i < buf.len; i++) {
+        hash ^= buf.data[i];
+        hash *= 1099511628211ULL;
+    }
+    free(buf.data);
+    return hash;
+}
+
+/*
+Writes the interface of a module to `path`, with the `key` it was checked from.
+Returns 0 on success.
+*/
+int interface_write(const char *path, const List *interface, uint64_t key) {
+    ByteBuffer buf = {};
+    FILE *fp;
+
+    buffer_write(&buf, INTERFACE_MAGIC, 4);
+    buffer_write_uint(&buf, INTERFACE_VERSION, 1);
+    buffer_write_uint(&buf, key, 8);
+    buffer_write_functions(&buf, interface);
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        free(buf.data);
+        return -1;
+    }
+    fwrite(buf.data, 1, buf.len, fp);
+    fclose(fp);
+    free(buf.data);
+    return 0;
+}
+
+static uint64_t read_uint(const unsigned char *data, int bytes) {
+    uint64_t value = 0;
+    int i;
+    for (i = 0; i < bytes; i++)
+        value |= (uint64_t) data[i] << (8 * i);
+    return value;
+}
+
+/*
+Reads an interface file written by `interface_write`.
+Returns a list of FunctionSignatures, or NULL if the file is missing, corrupted,
+or was written with another `key` (the module or one of its imports changed since).
+*/
+List *interface_read(const char *path, uint64_t key) {
+    FILE *fp;
+    long file_len;
+    unsigned char *data, *p, *end;
+    unsigned long count, i, j, name_len, args_len;
+    FunctionSignature *signature;
+    char *name;
+    DataType return_type;
+    List *interface;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    file_len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = malloc(file_len + 1);
+    if (fread(data, 1, file_len, fp) != (size_t) file_len) {
+        fclose(fp);
+        free(data);
+        return NULL;
+    }
+    fclose(fp);
+
+    p = data;
+    end = data + file_len;
+    if (file_len < INTERFACE_HEADER_LEN + 4 || memcmp(p, INTERFACE_MAGIC, 4) != 0 ||
+        p[4] != INTERFACE_VERSION || read_uint(p + 5, 8) != key) {
+        free(data);
+        return NULL;
+    }
+    count = read_uint(p + INTERFACE_HEADER_LEN, 4);
+    p += INTERFACE_HEADER_LEN + 4;
+
+    interface = init_list(sizeof(FunctionSignature *));
+    for (i = 0; i < count; i++) {
+        if (end - p < 2 || end - p < 2 + (long) (name_len = read_uint(p, 2)) + 2)
+            goto corrupted;
+        name = malloc(name_len + 1);
+        memcpy(name, p + 2, name_len);
+        name[name_len] = '\0';
+        p += 2 + name_len;
+
+        return_type = (DataType) p[0];
+        args_len = p[1];
+        p += 2;
+        if (end - p < (long) args_len) {
+            free(name);
+            goto corrupted;
+        }
+        signature = init_function_signature(name, return_type, args_len);
+        for (j = 0; j < args_len; j++)
+            signature->arg_types[j] = (DataType) p[j];
+        p += args_len;
+        list_push(interface, signature);
+    }
+
+    free(data);
+    return interface;
+
+    corrupted:
+    for (i = 0; i < interface->size; i++)
+        function_signature_dispose(interface->items[i]);
+    free(interface->items);
+    free(interface);
+    free(data);
+    return NULL;
+}
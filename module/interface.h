@@ -0,0 +1,36 @@
+#ifndef INFINITY_COMPILER_INTERFACE_H
+#define INFINITY_COMPILER_INTERFACE_H
+
+#include "../ast/ast.h"
+#include "../list/list.h"
+#include "../types/types.h"
+#include <stdint.h>
+
+#define INTERFACE_EXTENSION ".ifc"
+
+/**
+\FunctionSignature
+ Everything a module needs to know about a function to call it.
+*/
+typedef struct FunctionSignatureStruct {
+    char *name;
+    DataType return_type;
+    size_t args_len;
+    DataType *arg_types;
+} FunctionSignature;
+
+FunctionSignature *init_function_signature(char *name, DataType return_type, size_t args_len);
+
+void function_signature_dispose(FunctionSignature *signature);
+
+FunctionSignature *function_signature_from_definition(const FunctionDefinition *definition);
+
+List *interface_from_ast(const AstNode *root);
+
+uint64_t interface_hash(const List *interface);
+
+int interface_write(const char *path, const List *interface, uint64_t key);
+
+List *interface_read(const char *path, uint64_t key);
+
+#endif //INFINITY_COMPILER_INTERFACE_H
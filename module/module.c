@@ -0,0 +1,331 @@
+#include "module.h"
+#include "interface.h"
+#include "../lexer/lexer.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include "../hashmap/hashmap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define VISIT_NEW 0
+#define VISIT_IN_PROGRESS 1
+#define VISIT_DONE 2
+#define MODULES_INITIAL_CAPACITY 64
+
+/**
+\ModuleScheduler
+ Shared state of the workers compiling a module graph.
+ A module is ready once all of its imports are compiled.
+*/
+typedef struct {
+    List *ready;      // modules that can be compiled now
+    size_t remaining; // modules that are not compiled yet
+    Module *root;
+    int check_only;   // the trees of the imports aren't needed once they are checked
+    void (*compile)(Module *);
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} ModuleScheduler;
+
+Module *init_module(char *path) {
+    Module *module = malloc(sizeof(Module));
+    if (!module)
+        log_error(COMPILER, "Can't allocate memory for module.");
+
+    module->path = path;
+    alsprintf(&module->interface_path, "%s%s", path, INTERFACE_EXTENSION);
+    module->src = NULL;
+    module->imports = init_list(sizeof(Module *));
+    module->dependents = init_list(sizeof(Module *));
+    module->pending_imports = 0;
+    module->visit_state = VISIT_NEW;
+    module->root = NULL;
+    module->interface = NULL;
+    module->interface_hash = 0;
+    module->imported_functions = init_list(sizeof(FunctionSignature *));
+
+    return module;
+}
+
+void module_dispose(Module *module) {
+    // the graph owns the modules, so the lists only hold references
+    free(module->imports->items);
+    free(module->imports);
+    free(module->dependents->items);
+    free(module->dependents);
+    free(module->path);
+    free(module->interface_path);
+    free(module->src);
+    free(module);
+}
+
+/*
+Resolves `import_path` relative to the directory of the importing file.
+Returns the canonical path, or NULL if the file does not exist.
+*/
+static char *resolve_import_path(const char *importer_path, const char *import_path) {
+    char *joined, *resolved;
+    const char *slash = strrchr(importer_path, '/');
+
+    if (import_path[0] == '/' || !slash)
+        joined = strdup(import_path);
+    else
+        alsprintf(&joined, "%.*s/%s", (int) (slash - importer_path), importer_path, import_path);
+
+    resolved = realpath(joined, NULL);
+    free(joined);
+    return resolved;
+}
+
+/*
+Reads the imports at the beginning of a module, without parsing the rest of it.
+Returns a list of the canonical paths of the imported files.
+*/
+static List *module_scan_imports(Module *module) {
+    List *paths = init_list(sizeof(char *));
+    Lexer *lexer = init_lexer(module->src);
+    Token *tok;
+    char *path, *errMsg;
+
+    while ((tok = lexer_next_token(lexer))->type == IMPORT_KEYWORD) {
+        tok = lexer_next_token(lexer);
+        if (tok->type != STRING)
+            throw_exception_with_trace(COMPILER, lexer, "Expected the path of the imported file");
+
+        path = resolve_import_path(module->path, tok->value);
+        if (!path) {
+            alsprintf(&errMsg, "Can't find imported file \"%s\"", tok->value);
+            throw_exception_with_trace(COMPILER, lexer, errMsg);
+        }
+        list_push(paths, path);
+
+        if (lexer_next_token(lexer)->type != SEMICOLON)
+            throw_exception_with_trace(COMPILER, lexer, "Expected ';' after import");
+    }
+
+    lexer_dispose(lexer);
+    return paths;
+}
+
+static void report_import_cycle(List *visiting, Module *module) {
+    size_t i = 0;
+
+    printf("[%s] Import cycle detected:\n", caller_type_to_str(COMPILER));
+    while (visiting->items[i] != module)
+        i++;
+    for (; i < visiting->size; i++)
+        printf("  %s imports\n", ((Module *) visiting->items[i])->path);
+    printf("  %s\n", module->path);
+    exit(1);
+}
+
+/*
+Depth first traversal of the imports.
+`visiting` is the current import chain, used to report cycles.
+`by_path` maps the path of every module met so far to it.
+Modules are added to the graph after all of their imports (post-order).
+*/
+static void module_graph_visit(ModuleGraph *graph, List *visiting, HashMap *by_path, Module *module) {
+    List *import_paths;
+    Module *imported;
+    size_t i;
+
+    module->visit_state = VISIT_IN_PROGRESS;
+    list_push(visiting, module);
+
+    module->src = read_file(module->path);
+    import_paths = module_scan_imports(module);
+    for (i = 0; i < import_paths->size; i++) {
+        imported = hashmap_get(by_path, import_paths->items[i]);
+        if (!imported) {
+            imported = init_module(strdup(import_paths->items[i]));
+            hashmap_put(by_path, imported->path, imported);
+            module_graph_visit(graph, visiting, by_path, imported);
+        } else if (imported->visit_state == VISIT_IN_PROGRESS) {
+            report_import_cycle(visiting, imported);
+        }
+        list_push(module->imports, imported);
+        list_push(imported->dependents, module);
+    }
+    list_dispose(import_paths);
+
+    list_pop(visiting);
+    module->visit_state = VISIT_DONE;
+    list_push(graph->modules, module);
+}
+
+/*
+Builds the module graph of the file at `root_path`,
+by reading it and every file it imports, recursively.
+*/
+ModuleGraph *module_graph_build(const char *root_path) {
+    ModuleGraph *graph = malloc(sizeof(ModuleGraph));
+    List *visiting = init_list(sizeof(Module *));
+    HashMap *by_path = init_hashmap(MODULES_INITIAL_CAPACITY);
+    char *path = realpath(root_path, NULL);
+
+    if (!graph)
+        log_error(COMPILER, "Can't allocate memory for module graph.");
+    if (!path) {
+        printf("Error opening file \"%s\". It may does not exist.\n", root_path);
+        exit(1);
+    }
+
+    graph->modules = init_list(sizeof(Module *));
+    graph->root = init_module(path);
+    hashmap_put(by_path, graph->root->path, graph->root);
+    module_graph_visit(graph, visiting, by_path, graph->root);
+
+    hashmap_dispose(by_path);
+    free(visiting->items);
+    free(visiting);
+    return graph;
+}
+
+void module_graph_dispose(ModuleGraph *graph) {
+    size_t i;
+    for (i = 0; i < graph->modules->size; i++)
+        module_dispose(graph->modules->items[i]);
+    free(graph->modules->items);
+    free(graph->modules);
+    free(graph);
+}
+
+/*
+Adds the interfaces of the imports of `module` to its imported functions.
+The imports are already compiled, or their interface files were up to date.
+*/
+static void module_load_imported_interfaces(Module *module) {
+    Module *imported;
+    size_t i, j;
+
+    for (i = 0; i < module->imports->size; i++) {
+        imported = module->imports->items[i];
+        for (j = 0; j < imported->interface->size; j++)
+            list_push(module->imported_functions, imported->interface->items[j]);
+    }
+}
+
+/*
+What a module is checked from: its source and the interfaces of its imports.
+Its interface file is up to date while the key in the file is the same.
+*/
+static uint64_t module_interface_key(const Module *module) {
+    uint64_t key = hash_string(module->src);
+    size_t i;
+
+    for (i = 0; i < module->imports->size; i++) {
+        key ^= ((Module *) module->imports->items[i])->interface_hash;
+        key *= 1099511628211ULL;
+    }
+    return key;
+}
+
+static void module_compile(ModuleScheduler *scheduler, Module *module) {
+    uint64_t key = module_interface_key(module);
+    char *errMsg;
+
+    // an import checked before from the same key is neither parsed nor checked again
+    if (scheduler->check_only && module != scheduler->root &&
+        (module->interface = interface_read(module->interface_path, key))) {
+        module->interface_hash = interface_hash(module->interface);
+        return;
+    }
+
+    module_load_imported_interfaces(module);
+    scheduler->compile(module);
+
+    // the resolver may have built the interface already
+    if (!module->interface)
+        module->interface = interface_from_ast(module->root);
+    module->interface_hash = interface_hash(module->interface);
+    if (interface_write(module->interface_path, module->interface, key) != 0) {
+        alsprintf(&errMsg, "Can't write interface file \"%s\".", module->interface_path);
+        log_error(COMPILER, errMsg);
+    }
+}
+
+static void *module_worker(void *arg) {
+    ModuleScheduler *scheduler = arg;
+    Module *module, *dependent;
+    size_t i;
+
+    while (1) {
+        pthread_mutex_lock(&scheduler->mutex);
+        while (scheduler->ready->size == 0 && scheduler->remaining > 0)
+            pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+        if (scheduler->remaining == 0) {
+            pthread_mutex_unlock(&scheduler->mutex);
+            return NULL;
+        }
+        module = list_pop(scheduler->ready);
+        pthread_mutex_unlock(&scheduler->mutex);
+
+        module_compile(scheduler, module);
+
+        pthread_mutex_lock(&scheduler->mutex);
+        scheduler->remaining--;
+        for (i = 0; i < module->dependents->size; i++) {
+            dependent = module->dependents->items[i];
+            if (--dependent->pending_imports == 0)
+                list_push(scheduler->ready, dependent);
+        }
+        pthread_cond_broadcast(&scheduler->cond);
+        pthread_mutex_unlock(&scheduler->mutex);
+    }
+}
+
+/*
+Compiles every module of the graph with `compile`, on up to `jobs` threads
+(or one per cpu if `jobs` <= 0). A module is compiled only after all of its
+imports, so modules that don't depend on each other compile in parallel.
+After a module is compiled, its interface file is written for the next builds.
+With `check_only`, nothing is generated from the trees, so the imports whose
+interface files are up to date are skipped and have no tree.
+*/
+void module_graph_compile(ModuleGraph *graph, int jobs, int check_only, void (*compile)(Module *)) {
+    ModuleScheduler scheduler;
+    pthread_t *workers;
+    Module *module;
+    size_t i;
+
+    if (jobs <= 0)
+        jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = MAX(1, MIN(jobs, (int) graph->modules->size));
+
+    scheduler.ready = init_list(sizeof(Module *));
+    scheduler.remaining = graph->modules->size;
+    scheduler.root = graph->root;
+    scheduler.check_only = check_only;
+    scheduler.compile = compile;
+    pthread_mutex_init(&scheduler.mutex, NULL);
+    pthread_cond_init(&scheduler.cond, NULL);
+
+    for (i = 0; i < graph->modules->size; i++) {
+        module = graph->modules->items[i];
+        module->pending_imports = module->imports->size;
+        if (module->pending_imports == 0)
+            list_push(scheduler.ready, module);
+    }
+
+    if (jobs == 1) {
+        module_worker(&scheduler);
+    } else {
+        workers = malloc(jobs * sizeof(pthread_t));
+        for (i = 0; i < jobs; i++)
+            pthread_create(&workers[i], NULL, module_worker, &scheduler);
+        for (i = 0; i < jobs; i++)
+            pthread_join(workers[i], NULL);
+        free(workers);
+    }
+
+    pthread_mutex_destroy(&scheduler.mutex);
+    pthread_cond_destroy(&scheduler.cond);
+    free(scheduler.ready->items);
+    free(scheduler.ready);
+}
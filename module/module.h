@@ -0,0 +1,48 @@
+#ifndef INFINITY_COMPILER_MODULE_H
+#define INFINITY_COMPILER_MODULE_H
+
+#include "../ast/ast.h"
+#include "../list/list.h"
+#include <stdint.h>
+
+typedef struct ModuleStruct Module;
+
+/**
+\Module
+ A single source file and its place in the module graph.
+*/
+struct ModuleStruct {
+    char *path;            // canonical path of the source file
+    char *interface_path;  // path of the binary interface file written after compiling
+    char *src;
+    List *imports;         // list of Modules this module imports
+    List *dependents;      // list of Modules that import this module
+    size_t pending_imports; // imports that are not compiled yet
+    int visit_state;       // for cycle detection while building the graph
+    AstNode *root;
+    List *interface;          // FunctionSignatures of the functions defined in this module
+    uint64_t interface_hash;  // hash of `interface`, part of the interface keys of the dependents
+    List *imported_functions; // FunctionSignatures of the interfaces of `imports`
+};
+
+/**
+\ModuleGraph
+ All the modules reachable from the compiled file through imports.
+ The graph is acyclic; import cycles are reported while building it.
+*/
+typedef struct {
+    Module *root;
+    List *modules; // list of Modules, every module appears after all of its imports
+} ModuleGraph;
+
+Module *init_module(char *path);
+
+void module_dispose(Module *module);
+
+ModuleGraph *module_graph_build(const char *root_path);
+
+void module_graph_dispose(ModuleGraph *graph);
+
+void module_graph_compile(ModuleGraph *graph, int jobs, int check_only, void (*compile)(Module *));
+
+#endif //INFINITY_COMPILER_MODULE_H
@@ -0,0 +1,245 @@
+#include "parallel_parse.h"
+#include "../function_scan/function_scan.h"
+#include "../parser/parser.h"
+#include "../lexer/lexer.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+Parses the top level functions of a source on several threads.
+
+A quick scan finds the source range of every top level function. The main
+thread parses everything else (imports, macros and top level statements) and
+leaves a slot for each function, then the functions are split into contiguous
+runs of about the same length and every run is parsed on its own thread.
+The macros are only read by then, so the threads share them. Each thread
+allocates the nodes of its functions, glibc gives it its own malloc arena.
+Errors stop the threads, then the file is parsed again sequentially,
+so they are reported in order and recovered from like in any other parse.
+*/
+
+#define PARALLEL_PARSE_MIN_FUNCTIONS 64 // below this, the threads cost more than they save
+
+/**
+\ParseWorker
+ A run of functions parsed by one thread.
+*/
+typedef struct {
+    char *src;
+    size_t src_len;
+    HashMap *macros;
+    TopLevelFunction *functions;
+    size_t start, end;
+    Diagnostics *diagnostics; // the warnings, printed if no thread stopped at an error
+    int failed;               // stopped at an error
+    pthread_t thread;
+} ParseWorker;
+
+static AstNode *parse_sequential(char *src, Diagnostics *diagnostics) {
+    Parser *parser = init_parser(init_lexer(src));
+    AstNode *root;
+
+    parser->diagnostics = diagnostics;
+    root = parser_parse(parser);
+    parser_dispose(parser);
+    return root;
+}
+
+/*
+Runs `parse` on `arg`, stopping at the first error.
+Returns 0 if it stopped, the errors are reported by the sequential parse.
+*/
+static int try_parse(Diagnostics *diagnostics, void (*parse)(void *), void *arg) {
+    Diagnostics *outer;
+    jmp_buf recover;
+    int ok = 1;
+
+    diagnostics->recover = &recover;
+    outer = diagnostics_install(diagnostics);
+    if (setjmp(recover) == 0)
+        parse(arg);
+    else
+        ok = 0;
+    diagnostics_install(outer);
+    diagnostics->recover = NULL;
+    return ok;
+}
+
+static void parse_functions(void *arg) {
+    ParseWorker *worker = arg;
+    // the macros are shared, the macros being expanded are not
+    Preprocessor preprocessor = {.macros = worker->macros};
+    size_t i;
+
+    for (i = worker->start; i < worker->end; i++)
+        worker->functions[i].node = parse_top_level_function(&preprocessor, worker->src, worker->src_len,
+                                                              &worker->functions[i]);
+    free(preprocessor.expansions);
+}
+
+static void *parse_worker(void *arg) {
+    ParseWorker *worker = arg;
+    worker->failed = !try_parse(worker->diagnostics, parse_functions, worker);
+    return NULL;
+}
+
+/*
+Parses everything but the functions of `scan`, leaving a NULL child for each of them.
+Returns NULL if the statements don't end where the functions start,
+then the functions can't be parsed on their own.
+*/
+static AstNode *parse_outside_functions(Parser *parser, FunctionScan *scan) {
+    AstNode *root = init_ast(AST_COMPOUND);
+    List *children = root->data.compound.children;
+    Lexer *lexer = parser->lexer;
+    TopLevelFunction *function;
+    size_t next = 0;
+
+    while (parser->token->type == IMPORT_KEYWORD)
+        list_push(children, parser_parse_import(parser));
+    while (parser->token->type != EOF_TOKEN) {
+        function = next < scan->len ? &scan->functions[next] : NULL;
+        if (!function || parser->token->idx != function->start || parser->preprocessor->expansions_len > 0) {
+            list_push(children, parser_parse_statement(parser));
+            continue;
+        }
+
+        // skip the function, a worker parses it
+        function->child_index = children->size;
+        list_push(children, NULL);
+        lexer->idx = function->end;
+        lexer->row = function->end_row;
+        lexer->col = function->end_col + 1;
+        lexer->c = lexer->src[lexer->idx];
+        token_dispose(parser->token);
+        parser->token = preprocessor_next_token(parser->preprocessor);
+        next++;
+    }
+
+    if (next < scan->len) {
+        free(children->items);
+        free(children);
+        ast_dispose(root);
+        return NULL;
+    }
+    return root;
+}
+
+/**
+\OutsideParse
+ The arguments and result of `parse_outside_functions`, for `try_parse`.
+*/
+typedef struct {
+    Parser *parser;
+    FunctionScan *scan;
+    AstNode *root;
+} OutsideParse;
+
+static void parse_outside(void *arg) {
+    OutsideParse *outside = arg;
+    outside->root = parse_outside_functions(outside->parser, outside->scan);
+}
+
+/*
+Moves the warnings of a thread to `diagnostics`, or prints them if it is NULL.
+*/
+static void print_warnings(Diagnostics *thread_diagnostics, Diagnostics *diagnostics) {
+    fflush(thread_diagnostics->stream);
+    fwrite(thread_diagnostics->text, 1, thread_diagnostics->len, diagnostics ? diagnostics->stream : stdout);
+}
+
+/*
+Parses `src`, with the top level functions on up to `jobs` threads
+(or one per cpu if `jobs` <= 0). Falls back to the sequential parser when
+the functions can't be parsed on their own: when a macro is defined after
+the first function, or expands to braces, and when there are errors.
+The errors are collected in `diagnostics`, if not NULL.
+*/
+AstNode *parallel_parse(char *src, int jobs, Diagnostics *diagnostics) {
+    unsigned int src_len = strlen(src);
+    FunctionScan scan;
+    Parser *parser;
+    AstNode *root;
+    ParseWorker *workers;
+    OutsideParse outside;
+    Diagnostics *outside_diagnostics;
+    size_t workers_len, functions_len, i, j, first;
+    unsigned long total = 0, length = 0;
+    int failed = 0;
+
+    if (jobs <= 0)
+        jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs <= 1)
+        return parse_sequential(src, diagnostics);
+
+    scan = scan_top_level_functions(src, 0, 0, 0, src_len);
+    functions_len = scan.len;
+    if (functions_len < PARALLEL_PARSE_MIN_FUNCTIONS || scan.brace_macros ||
+        scan.macros_end > scan.functions[0].start) {
+        free(scan.functions);
+        return parse_sequential(src, diagnostics);
+    }
+
+    parser = init_parser(init_lexer(src));
+    outside = (OutsideParse) {.parser = parser, .scan = &scan};
+    outside_diagnostics = init_diagnostics(1);
+    if (!try_parse(outside_diagnostics, parse_outside, &outside) || !outside.root) {
+        diagnostics_dispose(outside_diagnostics);
+        parser_dispose(parser);
+        free(scan.functions);
+        return parse_sequential(src, diagnostics);
+    }
+    root = outside.root;
+
+    // contiguous runs of functions with about the same length of source
+    workers_len = MIN((size_t) jobs, functions_len);
+    workers = calloc(workers_len, sizeof(ParseWorker));
+    if (!workers)
+        log_error(PARSER, "Can't allocate memory for parse workers.");
+    for (i = 0; i < functions_len; i++)
+        total += scan.functions[i].end - scan.functions[i].start;
+    for (i = 0, j = 0, first = 0; i < workers_len; i++) {
+        while (j < functions_len && (i == workers_len - 1 || length * workers_len < total * (i + 1))) {
+            length += scan.functions[j].end - scan.functions[j].start;
+            j++;
+        }
+        workers[i] = (ParseWorker) {
+                .src = src, .src_len = src_len, .macros = parser->preprocessor->macros,
+                .functions = scan.functions, .start = first, .end = j, .diagnostics = init_diagnostics(1),
+        };
+        first = j;
+    }
+
+    // the main thread parses the first run
+    for (i = 1; i < workers_len; i++)
+        pthread_create(&workers[i].thread, NULL, parse_worker, &workers[i]);
+    parse_worker(&workers[0]);
+    for (i = 1; i < workers_len; i++)
+        pthread_join(workers[i].thread, NULL);
+    for (i = 0; i < workers_len; i++)
+        failed |= workers[i].failed;
+
+    for (i = 0; i < functions_len; i++)
+        root->data.compound.children->items[scan.functions[i].child_index] = scan.functions[i].node;
+
+    // the warnings, unless the sequential parse reports them again
+    if (!failed)
+        print_warnings(outside_diagnostics, diagnostics);
+    diagnostics_dispose(outside_diagnostics);
+    for (i = 0; i < workers_len; i++) {
+        if (!failed)
+            print_warnings(workers[i].diagnostics, diagnostics);
+        diagnostics_dispose(workers[i].diagnostics);
+    }
+
+    parser_dispose(parser);
+    free(workers);
+    free(scan.functions);
+    if (failed) // the tree is dropped, the compilation fails anyway
+        return parse_sequential(src, diagnostics);
+    return root;
+}
@@ -0,0 +1,9 @@
+#ifndef INFINITY_COMPILER_PARALLEL_PARSE_H
+#define INFINITY_COMPILER_PARALLEL_PARSE_H
+
+#include "../ast/ast.h"
+#include "../diagnostics/diagnostics.h"
+
+AstNode *parallel_parse(char *src, int jobs, Diagnostics *diagnostics);
+
+#endif //INFINITY_COMPILER_PARALLEL_PARSE_H
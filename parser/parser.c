@@ -4,6 +4,9 @@
 #include "../logging/logging.h"
 #include "../io/io.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
 
 Parser *init_parser(Lexer *lexer) {
     Parser *parser = malloc(sizeof(Parser));
@@ -11,11 +14,14 @@ Parser *init_parser(Lexer *lexer) {
         log_error(PARSER, "Cant allocate memory for parser.");
 
     parser->lexer = lexer;
-    parser->token = lexer_next_token(lexer);
+    parser->preprocessor = init_preprocessor(lexer);
+    parser->token = preprocessor_next_token(parser->preprocessor);
+    parser->diagnostics = NULL;
     return parser;
 }
 
 void parser_dispose(Parser *parser) {
+    preprocessor_dispose(parser->preprocessor);
     lexer_dispose(parser->lexer);
     token_dispose(parser->token);
     free(parser);
@@ -39,7 +45,7 @@ Token *parser_forward(Parser *parser, TokenType type) {
         parser_handle_unexpected_token(parser, token_type_to_str(type));
     }
     currTok = parser->token;
-    parser->token = lexer_next_token(parser->lexer);
+    parser->token = preprocessor_next_token(parser->preprocessor);
 
     return currTok;
 }
@@ -59,33 +65,195 @@ Token *parser_forward_with_list(Parser *parser, TokenType *types, size_t types_l
     return NULL;
 }
 
+/*
+Parses the whole source. With `parser->diagnostics`, every syntax error is
+collected there and parsing goes on after it, up to the error limit.
+The tree is then incomplete if there were errors: statements with errors are left out.
+*/
 AstNode *parser_parse(Parser *parser) {
-    return parser_parse_compound(parser);
+    Diagnostics *outer;
+    AstNode *root;
+
+    if (!parser->diagnostics)
+        return parser_parse_compound(parser);
+
+    outer = diagnostics_install(parser->diagnostics);
+    root = parser_parse_compound(parser);
+    diagnostics_install(outer);
+    return root;
+}
+
+/*
+Panic mode: skips the rest of the statement with an error, up to its `;` or to
+the `}` that ends the block it is in. A block in the statement is skipped whole,
+with its `else` blocks. At the `top_level` there is no block to end,
+so a `}` is skipped like a `;`.
+*/
+static void parser_synchronize(Parser *parser, int top_level) {
+    size_t depth = 0;
+    TokenType type;
+    Token *skipped;
+
+    while ((type = parser->token->type) != EOF_TOKEN) {
+        if (type == R_CURLY_BRACE && depth == 0 && !top_level)
+            return;
+        skipped = parser->token;
+        // the lexer may throw an error, then skipping goes on from the same token
+        parser->token = preprocessor_next_token(parser->preprocessor);
+        token_dispose(skipped);
+        if (type == L_CURLY_BRACE) {
+            depth++;
+        } else if (type == R_CURLY_BRACE) {
+            if (depth == 0 || (--depth == 0 && parser->token->type != ELSE_KEYWORD))
+                return;
+        } else if (type == SEMICOLON && depth == 0) {
+            return;
+        }
+    }
+}
+
+/*
+Called when an error jumped back to the statement loop of a block, or of the file at the `top_level`.
+Skips the statement with the error and returns 1 to go on with the next one,
+or returns 0 to stop parsing: at the end of the file or at the error limit.
+The errors thrown while skipping jump back here too.
+*/
+static int parser_recover(Parser *parser, jmp_buf *recover, int top_level) {
+    // the blocks the error came from ended without restoring their recovery points
+    parser->diagnostics->recover = recover;
+    if (parser->token->type == EOF_TOKEN || diagnostics_limit_reached(parser->diagnostics))
+        return 0;
+    parser_synchronize(parser, top_level);
+    // a statement cut by the end of the file already has its error
+    return parser->token->type != EOF_TOKEN;
+}
+
+/*
+Returns the precedence of a binary operator token,
+or PRECEDENCE_NONE if the token is not a binary operator.
+*/
+Precedence get_binary_precedence(TokenType type) {
+    switch (type) {
+        case OR:
+            return PRECEDENCE_OR;
+        case AND:
+            return PRECEDENCE_AND;
+        case EQUALS:
+        case NOT_EQUALS:
+            return PRECEDENCE_EQUALITY;
+        case GRATER_THAN:
+        case LOWER_THAN:
+        case GRATER_EQUAL:
+        case LOWER_EQUAL:
+            return PRECEDENCE_COMPARISON;
+        case ADD:
+        case SUB:
+            return PRECEDENCE_TERM;
+        case MUL:
+        case DIVIDE:
+            return PRECEDENCE_FACTOR;
+        default:
+            return PRECEDENCE_NONE;
+    }
+}
+
+/**
+ * Parses an expression straight from the token stream into an expression tree.
+ * Stops at the first token that can't continue the expression (like ';' or ')').
+ */
+AstNode *parser_parse_expression(Parser *parser) {
+    return parser_parse_binary_expression(parser, PRECEDENCE_NONE);
+}
+
+/**
+ * Precedence climbing: parses operands and every binary operator that binds
+ * tighter than `min_precedence`. All binary operators are left associative,
+ * so the right operand only takes operators that bind strictly tighter.
+ */
+AstNode *parser_parse_binary_expression(Parser *parser, Precedence min_precedence) {
+    AstNode *left, *right;
+    Token *operator;
+    Precedence precedence;
+
+    left = parser_parse_unary_expression(parser);
+    while ((precedence = get_binary_precedence(parser->token->type)) > min_precedence) {
+        operator = parser_forward(parser, parser->token->type);
+        right = parser_parse_binary_expression(parser, precedence);
+        left = ast_set_location(init_ast_binary_expression(operator->type, left, right), operator);
+    }
+
+    return left;
+}
+
+AstNode *parser_parse_unary_expression(Parser *parser) {
+    Token *operator;
+
+    if (parser->token->type == SUB || parser->token->type == NOT) {
+        operator = parser_forward(parser, parser->token->type);
+        return ast_set_location(init_ast_unary_expression(operator->type, parser_parse_unary_expression(parser)),
+                                operator);
+    }
+    return parser_parse_primary_expression(parser);
 }
 
-AstNode *parser_parse_expression(Expression *expression) {
-    AstNode *expr_node = init_ast(AST_EXPRESSION);
+AstNode *parser_parse_primary_expression(Parser *parser) {
+    AstNode *node;
+    Token *tok;
+    char *errMsg, *end;
+    long value;
 
-    switch (((Token *) expression->tokens->items[0])->type) {
+    switch (parser->token->type) {
+        case INT:
+            tok = parser_forward(parser, INT);
+            errno = 0; // strtol only sets it on failure
+            value = strtol(tok->value, &end, 10);
+            if (value > INT_MAX || errno == ERANGE) {
+                alsprintf(&errMsg, "Integer literal '%s' is too large", tok->value);
+                throw_exception_at(PARSER, parser->lexer->src, tok->row, tok->col, errMsg);
+            }
+            return ast_set_location(init_ast_literal(TYPE_INT, (Value) {.integer_value = (int) value}), tok);
         case STRING:
-            expr_node->data.expression.value = init_literal_value(
-                    TYPE_STRING,
-                    (Value) {.string_value = ((Token *) expression->tokens->items[0])->value}
-            );
-            break;
-        case SEMICOLON: // void
-            expr_node->data.expression.value = init_literal_value(
-                    TYPE_VOID,
-                    (Value) {.void_value = NULL}
-            );
-            break;
+            tok = parser_forward(parser, STRING);
+            return ast_set_location(init_ast_literal(TYPE_STRING, (Value) {.string_value = tok->value}), tok);
+        case TRUE_KEYWORD:
+            tok = parser_forward(parser, TRUE_KEYWORD);
+            return ast_set_location(init_ast_literal(TYPE_BOOL, (Value) {.bool_value = 1}), tok);
+        case FALSE_KEYWORD:
+            tok = parser_forward(parser, FALSE_KEYWORD);
+            return ast_set_location(init_ast_literal(TYPE_BOOL, (Value) {.bool_value = 0}), tok);
+        case ID:
+            tok = parser_forward(parser, ID);
+            if (parser->token->type == L_PARENTHESES)
+                return parser_parse_function_call(parser, tok);
+            return ast_set_location(init_ast_variable(tok->value), tok);
+        case L_PARENTHESES:
+            parser_forward(parser, L_PARENTHESES);
+            node = parser_parse_expression(parser);
+            parser_forward(parser, R_PARENTHESES);
+            return node;
         default:
-            // parse expression
-            // TODO: Link here parse expression function
-            break;
+            alsprintf(&errMsg, "Expected an expression, got '%s'", parser->token->value);
+            throw_exception_with_trace(PARSER, parser->lexer, errMsg);
+            return NULL;
     }
+}
+
+/**
+ * Parses the arguments of a function call. The function name was already read.
+ */
+AstNode *parser_parse_function_call(Parser *parser, Token *id_token) {
+    AstNode *node = ast_set_location(init_ast(AST_FUNCTION_CALL), id_token);
 
-    return expr_node;
+    node->data.function_call.func_name = id_token->value;
+    parser_forward(parser, L_PARENTHESES);
+    while (parser->token->type != R_PARENTHESES) {
+        list_push(node->data.function_call.args, parser_parse_expression(parser));
+        if (parser->token->type != R_PARENTHESES)
+            parser_forward(parser, COMMA);
+    }
+    parser_forward(parser, R_PARENTHESES);
+
+    return node;
 }
 
 LiteralValue *get_default_literal_value(TokenType type) {
@@ -97,7 +265,7 @@ LiteralValue *get_default_literal_value(TokenType type) {
         case STRING_KEYWORD:
             return init_literal_value(TYPE_STRING, (Value) {.string_value = ""});
         case CHAR_KEYWORD:
-            return init_literal_value(TYPE_INT, (Value) {.char_value = '\0'});
+            return init_literal_value(TYPE_CHAR, (Value) {.char_value = '\0'});
         case BOOL_KEYWORD:
             return init_literal_value(TYPE_BOOL, (Value) {.bool_value = 0});
         default:
@@ -107,27 +275,57 @@ LiteralValue *get_default_literal_value(TokenType type) {
     }
 }
 
-void parser_get_tokens_until(Parser *parser, List *tokens, TokenType terminator) {
-    while (parser->token->type != terminator) {
-        list_push(tokens, parser_forward(parser, parser->token->type));
-    }
-    parser_forward(parser, terminator);
-}
-
 AstNode *parser_parse_compound(Parser *parser) {
     AstNode *root = init_ast(AST_COMPOUND);
+    jmp_buf recover, *outer = NULL;
+
+    if (parser->diagnostics) {
+        outer = parser->diagnostics->recover;
+        parser->diagnostics->recover = &recover;
+        if (setjmp(recover) != 0) {
+            if (!parser_recover(parser, &recover, 1)) {
+                parser->diagnostics->recover = outer;
+                return root;
+            }
+        }
+    }
 
+    // imports come first, so modules can be scanned for dependencies without parsing them
+    while (parser->token->type == IMPORT_KEYWORD) {
+        list_push(root->data.compound.children, parser_parse_import(parser));
+    }
     while (parser->token->type != EOF_TOKEN) {
         list_push(root->data.compound.children, parser_parse_statement(parser));
     }
+
+    if (parser->diagnostics)
+        parser->diagnostics->recover = outer;
     return root;
 }
 
 void parser_parse_block(Parser *parser, List *block) {
+    jmp_buf recover, *outer = NULL;
+
     parser_forward(parser, L_CURLY_BRACE);
+    if (parser->diagnostics) {
+        outer = parser->diagnostics->recover;
+        parser->diagnostics->recover = &recover;
+        // an error in a statement of the block skips only that statement
+        if (setjmp(recover) != 0) {
+            if (!parser_recover(parser, &recover, 0)) {
+                // stop parsing: unwind to the statement loop of the file, through the enclosing blocks
+                parser->diagnostics->recover = outer;
+                longjmp(*outer, 1);
+            }
+        }
+    }
+
     while (parser->token->type != R_CURLY_BRACE) {
         list_push(block, parser_parse_statement(parser));
     }
+
+    if (parser->diagnostics)
+        parser->diagnostics->recover = outer;
     parser_forward(parser, R_CURLY_BRACE);
 }
 
@@ -145,8 +343,15 @@ AstNode *parser_parse_statement(Parser *parser) {
             return parser_parse_var_declaration(parser);
         case IF_KEYWORD:
             return parser_parse_if_statement(parser);
+        case WHILE_KEYWORD:
+            return parser_parse_while_statement(parser);
+        case FOR_KEYWORD:
+            return parser_parse_for_statement(parser);
         case RETURN_KEYWORD:
             return parser_parse_return_statement(parser);
+        case IMPORT_KEYWORD:
+            throw_exception_with_trace(PARSER, parser->lexer, "Imports must appear at the beginning of the file");
+            return NULL;
         default:
             alsprintf(&errMsg, "Expected an expression, got %s", token_type_to_str(parser->token->type));
             throw_exception_with_trace(PARSER, parser->lexer, errMsg);
@@ -155,29 +360,37 @@ AstNode *parser_parse_statement(Parser *parser) {
 }
 
 AstNode *parser_parse_id(Parser *parser) {
+    AstNode *node;
     Token *id_token = parser_forward(parser, ID);
     switch (parser->token->type) {
         case ASSIGNMENT:
-            return parser_parse_assignment(parser, id_token);
+            node = parser_parse_assignment(parser, id_token);
+            parser_forward(parser, SEMICOLON);
+            return node;
+        case INC:
+        case DEC:
+            node = parser_parse_increment(parser, id_token);
+            parser_forward(parser, SEMICOLON);
+            return node;
         case L_PARENTHESES:
-//            return parser_parse_function_call();
-            break;
+            node = parser_parse_function_call(parser, id_token);
+            parser_forward(parser, SEMICOLON);
+            return node;
         case SEMICOLON:
             log_warning(parser->lexer, "Meaningless expression");
             parser_forward(parser, SEMICOLON);
-            return init_ast(AST_NOOP);
+            return ast_set_location(init_ast(AST_NOOP), id_token);
         default:
-            throw_exception_with_trace(PARSER, parser->lexer, "Expected");
-            break;
+            parser_handle_unexpected_token(parser, "=', '++', '--' or '(");
+            return NULL;
     }
 }
 
 AstNode *parser_parse_var_declaration(Parser *parser) {
     AstNode *node, *value_expr;
     Token *var_type;
-    Expression *expr;
 
-    node = init_ast(AST_VARIABLE_DECLARATION);
+    node = ast_set_location(init_ast(AST_VARIABLE_DECLARATION), parser->token);
     var_type = parser_forward_with_list(parser, data_types, data_types_len, "type definition");
     node->data.variable_declaration.var = init_variable(
             parser_forward(parser, ID)->value,
@@ -186,14 +399,12 @@ AstNode *parser_parse_var_declaration(Parser *parser) {
 
     // if value_expr is immediately assigned to variable
     if (parser->token->type == ASSIGNMENT) {
-        expr = init_expression_p();
         parser_forward(parser, ASSIGNMENT);
-
-        parser_get_tokens_until(parser, expr->tokens, SEMICOLON);
-        node->data.variable_declaration.value = parser_parse_expression(expr);
+        node->data.variable_declaration.value = parser_parse_expression(parser);
+        parser_forward(parser, SEMICOLON);
     } else {
         // variable is initialized with default value_expr
-        value_expr = init_ast(AST_EXPRESSION);
+        value_expr = ast_set_location(init_ast(AST_EXPRESSION), parser->token);
         parser_forward(parser, SEMICOLON);
 
         value_expr->data.expression.value = get_default_literal_value(var_type->type);
@@ -209,7 +420,7 @@ AstNode *parser_parse_function_definition(Parser *parser) {
     char *errMsg;
     Variable *arg;
     DataType argType;
-    AstNode *node = init_ast(AST_FUNCTION_DEFINITION);
+    AstNode *node = ast_set_location(init_ast(AST_FUNCTION_DEFINITION), parser->token);
 
     parser_forward(parser, FUNC_KEYWORD);
 
@@ -221,7 +432,7 @@ AstNode *parser_parse_function_definition(Parser *parser) {
     while (parser->token->type != R_PARENTHESES) {
         // get arg type
         argType = token_type_to_data_type(parser->token->type);
-        if ((int)argType == -1) // invalid type
+        if ((int)argType == -1 || argType == TYPE_VOID) // invalid type
         {
             alsprintf(&errMsg, "Expected argument type, got %s token.", token_type_to_str(parser->token->type));
             throw_exception_with_trace(PARSER, parser->lexer, errMsg);
@@ -247,53 +458,150 @@ AstNode *parser_parse_function_definition(Parser *parser) {
 
     parser_parse_block(parser, node->data.function_definition.body);
 
-    printf("name: %s\n", node->data.function_definition.func_name);
-    printf("return type: %d\n", node->data.function_definition.returnType);
-    for (int i = 0; i < node->data.function_definition.args->size; i++) {
-        printf("var %s\n", ((Variable *) (node->data.function_definition.args->items[i]))->name);
-    }
-    AstNode *v1 = ((AstNode *) (node->data.function_definition.body->items[0]));
-    AstNode *v2 = ((AstNode *) (node->data.function_definition.body->items[1]));
-    AstNode *v3 = ((AstNode *) (node->data.function_definition.body->items[2]));
-
     return node;
 }
 
+/*
+Parses `= <expression>` after the variable name, without the semicolon:
+the step of a for loop ends with ')'.
+*/
 AstNode *parser_parse_assignment(Parser *parser, Token *id_token) {
-    AstNode *node = init_ast(AST_ASSIGNMENT);
+    AstNode *node = ast_set_location(init_ast(AST_ASSIGNMENT), id_token);
     parser_forward(parser, ASSIGNMENT);
     node->data.assignment.dst_variable = id_token;
-    node->data.assignment.expression = parser_parse_statement(parser);
+    node->data.assignment.expression = parser_parse_expression(parser);
     return node;
 }
 
+/*
+`x++` and `x--` are statements, parsed as `x = x + 1` and `x = x - 1`.
+*/
+AstNode *parser_parse_increment(Parser *parser, Token *id_token) {
+    AstNode *node = ast_set_location(init_ast(AST_ASSIGNMENT), id_token);
+    Token *operator = parser_forward_with_list(parser, (TokenType[]) {INC, DEC}, 2, "=', '++' or '--");
+    AstNode *one = ast_set_location(init_ast_literal(TYPE_INT, (Value) {.integer_value = 1}), operator);
+
+    node->data.assignment.dst_variable = id_token;
+    node->data.assignment.expression = ast_set_location(
+            init_ast_binary_expression(operator->type == INC ? ADD : SUB,
+                                       ast_set_location(init_ast_variable(id_token->value), id_token), one),
+            operator);
+    return node;
+}
+
+/*
+`else if` is an else block with a single if statement in it.
+The chain is parsed in a loop, so its length doesn't grow the stack.
+*/
 AstNode *parser_parse_if_statement(Parser *parser) {
-    AstNode *node = init_ast(AST_IF_STATEMENT);
+    AstNode *node = ast_set_location(init_ast(AST_IF_STATEMENT), parser->token);
+    AstNode *current = node, *next;
 
     parser_forward(parser, IF_KEYWORD);
+    while (1) {
+        parser_forward(parser, L_PARENTHESES);
+        current->data.if_statement.condition = parser_parse_expression(parser);
+        parser_forward(parser, R_PARENTHESES);
+        parser_parse_block(parser, current->data.if_statement.body_node);
+        if (parser->token->type != ELSE_KEYWORD)
+            break;
+        parser_forward(parser, ELSE_KEYWORD);
+        if (parser->token->type != IF_KEYWORD) {
+            parser_parse_block(parser, current->data.if_statement.else_node);
+            break;
+        }
+        next = ast_set_location(init_ast(AST_IF_STATEMENT), parser->token);
+        parser_forward(parser, IF_KEYWORD);
+        list_push(current->data.if_statement.else_node, next);
+        current = next;
+    }
+
+    return node;
+}
+
+/*
+`while (<condition>) {...}`, a loop without initializer and step.
+*/
+AstNode *parser_parse_while_statement(Parser *parser) {
+    AstNode *node = ast_set_location(init_ast(AST_LOOP_STATEMENT), parser->token);
+
+    parser_forward(parser, WHILE_KEYWORD);
     parser_forward(parser, L_PARENTHESES);
-    // parse boolean expression
+    node->data.loop_statement.condition = parser_parse_expression(parser);
     parser_forward(parser, R_PARENTHESES);
-    parser_parse_block(parser, node->data.if_statement.body_node);
-    if (parser->token->type == ELSE_KEYWORD) {
-        parser_forward(parser, ELSE_KEYWORD);
-        if (parser->token->type == IF_KEYWORD)
-            list_push(node->data.if_statement.else_node, parser_parse_if_statement(parser));
+    parser_parse_block(parser, node->data.loop_statement.body);
+
+    return node;
+}
+
+/*
+`for (<initializer>; <condition>; <step>) {...}`, each part may be empty.
+The initializer is a declaration or a statement starting with a variable,
+the step an assignment, an increment or a decrement.
+A loop without condition runs until it returns.
+*/
+AstNode *parser_parse_for_statement(Parser *parser) {
+    AstNode *node = ast_set_location(init_ast(AST_LOOP_STATEMENT), parser->token);
+    LoopStatement *loop = &node->data.loop_statement;
+    Token *id_token;
+
+    parser_forward(parser, FOR_KEYWORD);
+    parser_forward(parser, L_PARENTHESES);
+    switch (parser->token->type) {
+        case INT_KEYWORD:
+        case CHAR_KEYWORD:
+        case BOOL_KEYWORD:
+        case STRING_KEYWORD:
+            loop->initializer = parser_parse_var_declaration(parser);
+            break;
+        case ID:
+            loop->initializer = parser_parse_id(parser);
+            break;
+        default:
+            parser_forward(parser, SEMICOLON);
+            break;
+    }
+
+    if (parser->token->type == SEMICOLON)
+        loop->condition = ast_set_location(init_ast_literal(TYPE_BOOL, (Value) {.bool_value = 1}), parser->token);
+    else
+        loop->condition = parser_parse_expression(parser);
+    parser_forward(parser, SEMICOLON);
+
+    if (parser->token->type != R_PARENTHESES) {
+        id_token = parser_forward(parser, ID);
+        if (parser->token->type == ASSIGNMENT)
+            loop->step = parser_parse_assignment(parser, id_token);
         else
-            parser_parse_block(parser, node->data.if_statement.else_node);
+            loop->step = parser_parse_increment(parser, id_token);
     }
+    parser_forward(parser, R_PARENTHESES);
+    parser_parse_block(parser, loop->body);
 
     return node;
 }
 
 AstNode *parser_parse_return_statement(Parser *parser) {
-    AstNode *node = init_ast(AST_RETURN_STATEMENT);
-    Expression *expr = init_expression_p();
+    AstNode *node = ast_set_location(init_ast(AST_RETURN_STATEMENT), parser->token);
 
     parser_forward(parser, RETURN_KEYWORD);
 
-    parser_get_tokens_until(parser, expr->tokens, SEMICOLON);
-    node->data.return_statement.value_expr = parser_parse_expression(expr);
+    if (parser->token->type == SEMICOLON) // void
+        node->data.return_statement.value_expr = ast_set_location(
+                init_ast_literal(TYPE_VOID, (Value) {.void_value = NULL}), parser->token);
+    else
+        node->data.return_statement.value_expr = parser_parse_expression(parser);
+    parser_forward(parser, SEMICOLON);
+
+    return node;
+}
+
+AstNode *parser_parse_import(Parser *parser) {
+    AstNode *node = ast_set_location(init_ast(AST_IMPORT), parser->token);
+
+    parser_forward(parser, IMPORT_KEYWORD);
+    node->data.import.path = parser_forward(parser, STRING)->value;
+    parser_forward(parser, SEMICOLON);
 
     return node;
 }
@@ -2,11 +2,28 @@
 #define INFINITY_COMPILER_PARSER_H
 
 #include "../lexer/lexer.h"
+#include "../preprocessor/preprocessor.h"
 #include "../ast/ast.h"
+#include "../diagnostics/diagnostics.h"
+
+/**
+ * Binding power of binary operators, from loosest to tightest.
+ */
+typedef enum {
+    PRECEDENCE_NONE,
+    PRECEDENCE_OR,         // ||
+    PRECEDENCE_AND,        // &&
+    PRECEDENCE_EQUALITY,   // == !=
+    PRECEDENCE_COMPARISON, // < > <= >=
+    PRECEDENCE_TERM,       // + -
+    PRECEDENCE_FACTOR,     // * /
+} Precedence;
 
 typedef struct ParserStruct {
     Lexer *lexer;
+    Preprocessor *preprocessor; // expands macros in the tokens of `lexer`
     Token *token;
+    Diagnostics *diagnostics; // collects the errors, which the parser recovers from. NULL to exit on the first one
 } Parser;
 
 Parser *init_parser(Lexer *lexer);
@@ -21,11 +38,19 @@ Token *parser_forward_with_list(Parser *parser, TokenType *types, size_t types_l
 
 AstNode *parser_parse(Parser *parser);
 
-AstNode *parser_parse_expression(Expression *expression);
+Precedence get_binary_precedence(TokenType type);
 
-LiteralValue *get_default_literal_value(TokenType type);
+AstNode *parser_parse_expression(Parser *parser);
+
+AstNode *parser_parse_binary_expression(Parser *parser, Precedence min_precedence);
+
+AstNode *parser_parse_unary_expression(Parser *parser);
+
+AstNode *parser_parse_primary_expression(Parser *parser);
+
+AstNode *parser_parse_function_call(Parser *parser, Token *id_token);
 
-void parser_get_tokens_until(Parser *parser, List *tokens, TokenType terminator);
+LiteralValue *get_default_literal_value(TokenType type);
 
 AstNode *parser_parse_compound(Parser *parser);
 
@@ -41,8 +66,16 @@ AstNode *parser_parse_function_definition(Parser *parser);
 
 AstNode *parser_parse_assignment(Parser *parser, Token *id_token);
 
+AstNode *parser_parse_increment(Parser *parser, Token *id_token);
+
 AstNode *parser_parse_if_statement(Parser *parser);
 
+AstNode *parser_parse_while_statement(Parser *parser);
+
+AstNode *parser_parse_for_statement(Parser *parser);
+
 AstNode *parser_parse_return_statement(Parser *parser);
 
+AstNode *parser_parse_import(Parser *parser);
+
 #endif //INFINITY_COMPILER_PARSER_H
@@ -0,0 +1,287 @@
+#include "peephole.h"
+#include "../logging/logging.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Rewrites short sequences of instructions into shorter or cheaper ones.
+
+The instructions are copied one by one to the output, and every time one is
+added, the rules triggered by its opcode try to rewrite the end of the output.
+A rewrite can enable another one, so the rules are tried again until none matches.
+It runs before register allocation, where a virtual register that is used nowhere
+else can be dropped, and again once the function is laid out.
+
+Values of 4 bytes only ever use the low half of their registers, so moves
+between the same places don't need to zero extend again.
+*/
+
+typedef struct {
+    MachineFunction *function;
+    MachineInstruction *code; // the output, over the input already read
+    size_t len;
+    size_t next;              // next instruction of the input
+    unsigned int *uses;       // number of operands naming each virtual register, counted when first needed
+} Peephole;
+
+/**
+\PeepholeRule
+ A rewrite of the last `window` instructions of the output. Returns 1 if it rewrote them.
+*/
+typedef struct {
+    unsigned char window;
+    int (*rewrite)(Peephole *peephole, MachineInstruction *window);
+} PeepholeRule;
+
+/**
+\PeepholeRules
+ The rules tried when an instruction with a given opcode is added to the output.
+*/
+typedef struct {
+    const PeepholeRule *rules;
+    size_t len;
+} PeepholeRules;
+
+static int same_operand(const MachineOperand *a, const MachineOperand *b) {
+    return a->kind == b->kind && a->size == b->size && a->reg == b->reg && a->value == b->value &&
+           a->symbol == b->symbol;
+}
+
+static int names_register(const MachineOperand *operand, unsigned int reg) {
+    return (operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) && operand->reg == reg;
+}
+
+static int is_immediate(const MachineOperand *operand, int value) {
+    return operand->kind == OPERAND_IMMEDIATE && operand->value == value;
+}
+
+/*
+Removes `len` instructions of the output, from `window`.
+*/
+static void drop(Peephole *peephole, MachineInstruction *window, size_t len) {
+    size_t start = window - peephole->code;
+
+    memmove(window, window + len, (peephole->len - start - len) * sizeof(MachineInstruction));
+    peephole->len -= len;
+}
+
+/*
+mov x, x
+*/
+static int remove_self_move(Peephole *peephole, MachineInstruction *window) {
+    if (!same_operand(&window[0].dst, &window[0].src))
+        return 0;
+    drop(peephole, window, 1);
+    return 1;
+}
+
+/*
+mov x, y   mov y, x    ->    mov x, y
+A store followed by a load of the same value, or the other way around.
+*/
+static int remove_reverse_move(Peephole *peephole, MachineInstruction *window) {
+    if (window[0].op != X86_MOV || !same_operand(&window[0].dst, &window[1].src) ||
+        !same_operand(&window[0].src, &window[1].dst) ||
+        (window[0].src.kind == OPERAND_MEMORY && names_register(&window[0].src, window[0].dst.reg)))
+        return 0;
+    drop(peephole, window + 1, 1);
+    return 1;
+}
+
+/*
+mov r, a   mov r, b    ->    mov r, b
+*/
+static int remove_overwritten_move(Peephole *peephole, MachineInstruction *window) {
+    if (window[0].op != X86_MOV || window[0].dst.kind != OPERAND_REGISTER ||
+        !same_operand(&window[0].dst, &window[1].dst) ||
+        window[0].dst.size < 4 || names_register(&window[1].src, window[1].dst.reg))
+        return 0;
+    drop(peephole, window, 1);
+    return 1;
+}
+
+/*
+add x, 0    sub x, 0
+The flags they set are never read: comparisons set their own.
+*/
+static int remove_add_zero(Peephole *peephole, MachineInstruction *window) {
+    if (!is_immediate(&window[0].src, 0))
+        return 0;
+    drop(peephole, window, 1);
+    return 1;
+}
+
+/*
+imul x, 1    ->    nothing
+imul x, 2^k    ->    shl x, k
+*/
+static int reduce_multiply(Peephole *peephole, MachineInstruction *window) {
+    int value = window[0].src.value, shift = 0;
+
+    if (window[0].src.kind != OPERAND_IMMEDIATE || value <= 0 || (value & (value - 1)))
+        return 0;
+    if (value == 1) {
+        drop(peephole, window, 1);
+        return 1;
+    }
+    while (value >>= 1)
+        shift++;
+    window[0].op = X86_SHL;
+    window[0].src = operand_immediate(shift);
+    return 1;
+}
+
+static void count_operand(Peephole *peephole, const MachineOperand *operand) {
+    if ((operand->kind == OPERAND_REGISTER || operand->kind == OPERAND_MEMORY) && IS_VIRTUAL_REGISTER(operand->reg))
+        peephole->uses[operand->reg - FIRST_VIRTUAL_REGISTER]++;
+}
+
+/*
+Number of operands naming the virtual register `reg` in the function. Counted on
+the output and the rest of the input: the instructions dropped so far didn't
+need their operands.
+*/
+static unsigned int count_uses(Peephole *peephole, unsigned int reg) {
+    MachineFunction *function = peephole->function;
+    size_t i;
+
+    if (!peephole->uses) {
+        peephole->uses = calloc(function->registers_len, sizeof(unsigned int));
+        if (!peephole->uses)
+            log_error(OPTIMIZER, "Can't allocate memory for the peephole optimizer.");
+        for (i = 0; i < peephole->len; i++) {
+            count_operand(peephole, &peephole->code[i].dst);
+            count_operand(peephole, &peephole->code[i].src);
+        }
+        for (i = peephole->next; i < function->len; i++) {
+            count_operand(peephole, &function->code[i].dst);
+            count_operand(peephole, &function->code[i].src);
+        }
+    }
+    return peephole->uses[reg - FIRST_VIRTUAL_REGISTER];
+}
+
+/*
+cmp a, b   setcc r8   movzx r, r8   test r, r   je label    ->    cmp a, b   jncc label
+When the comparison is only used by the branch, its result doesn't need a register.
+*/
+static int fuse_compare_branch(Peephole *peephole, MachineInstruction *window) {
+    const MachineOperand *result = &window[2].dst;
+    ConditionCode cond = window[1].cond;
+
+    if (window[0].op != X86_CMP || window[1].op != X86_SETCC || window[2].op != X86_MOVZX ||
+        window[3].op != X86_TEST || result->kind != OPERAND_REGISTER || !IS_VIRTUAL_REGISTER(result->reg) ||
+        !names_register(&window[1].dst, result->reg) || !names_register(&window[2].src, result->reg) ||
+        !same_operand(&window[3].dst, result) || !same_operand(&window[3].src, result) ||
+        (window[4].cond != CC_E && window[4].cond != CC_NE) || count_uses(peephole, result->reg) != 5)
+        return 0;
+    window[1] = window[4];
+    window[1].cond = window[4].cond == CC_E ? negate_condition(cond) : cond;
+    peephole->len -= 3;
+    return 1;
+}
+
+/*
+jmp label   label:    ->    label:
+The jump can be followed by other labels before its own. A label keeps the number
+of labels that end with it as its source, so the jump is found without going over
+them again: only the last one is new to the jump, the others were checked when
+they came. Removing a jump between two runs of labels makes their numbers short,
+the whole run is checked then.
+*/
+static int remove_jump_to_next(Peephole *peephole, MachineInstruction *window) {
+    MachineInstruction *jump, *label;
+    int joined = 0;
+
+    window->src.value = window > peephole->code && window[-1].op == X86_LABEL ? window[-1].src.value + 1 : 1;
+    jump = window + 1 - window->src.value;
+    if (jump > peephole->code && jump[-1].op == X86_LABEL) {
+        joined = 1;
+        while (jump > peephole->code && jump[-1].op == X86_LABEL)
+            jump--;
+        window->src.value = (int) (window + 1 - jump);
+    }
+    if (jump == peephole->code || (jump[-1].op != X86_JMP && jump[-1].op != X86_JCC) ||
+        jump[-1].dst.kind != OPERAND_LABEL)
+        return 0;
+    for (label = joined ? jump : window; label <= window; label++) {
+        if (label->dst.value == jump[-1].dst.value) {
+            drop(peephole, jump - 1, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+jcc a   jmp b   a:    ->    jncc b   a:
+*/
+static int invert_jump_over_jump(Peephole *peephole, MachineInstruction *window) {
+    if (window[0].op != X86_JCC || window[1].op != X86_JMP || window[0].dst.kind != OPERAND_LABEL ||
+        window[1].dst.kind != OPERAND_LABEL || window[0].dst.value != window[2].dst.value)
+        return 0;
+    window[0].cond = negate_condition(window[0].cond);
+    window[0].dst = window[1].dst;
+    drop(peephole, window + 1, 1);
+    return 1;
+}
+
+static const PeepholeRule move_rules[] = {
+        {1, remove_self_move},
+        {2, remove_reverse_move},
+        {2, remove_overwritten_move},
+};
+static const PeepholeRule add_rules[] = {{1, remove_add_zero}};
+static const PeepholeRule multiply_rules[] = {{1, reduce_multiply}};
+static const PeepholeRule branch_rules[] = {{5, fuse_compare_branch}};
+static const PeepholeRule label_rules[] = {
+        {3, invert_jump_over_jump},
+        {1, remove_jump_to_next},
+};
+
+#define RULES(array) {array, sizeof(array) / sizeof(array[0])}
+
+static const PeepholeRules rules[X86_OPCODES_LEN] = {
+        [X86_MOV] = RULES(move_rules),
+        [X86_ADD] = RULES(add_rules),
+        [X86_SUB] = RULES(add_rules),
+        [X86_IMUL] = RULES(multiply_rules),
+        [X86_JCC] = RULES(branch_rules),
+        [X86_LABEL] = RULES(label_rules),
+};
+
+/*
+Tries the rules on the end of the output until none matches.
+*/
+static void rewrite_tail(Peephole *peephole) {
+    const PeepholeRules *candidates;
+    size_t i;
+    int changed = 1;
+
+    while (changed && peephole->len > 0) {
+        changed = 0;
+        candidates = &rules[peephole->code[peephole->len - 1].op];
+        for (i = 0; i < candidates->len && !changed; i++) {
+            if (peephole->len >= candidates->rules[i].window)
+                changed = candidates->rules[i].rewrite(peephole,
+                                                       peephole->code + peephole->len - candidates->rules[i].window);
+        }
+    }
+}
+
+/*
+Rewrites the code of `function` in place: the output never gets longer than the input.
+*/
+void peephole_optimize(MachineFunction *function) {
+    Peephole peephole = {.function = function, .code = function->code};
+
+    while (peephole.next < function->len) {
+        if (peephole.len != peephole.next)
+            peephole.code[peephole.len] = function->code[peephole.next];
+        peephole.len++;
+        peephole.next++;
+        rewrite_tail(&peephole);
+    }
+    function->len = peephole.len;
+    free(peephole.uses);
+}
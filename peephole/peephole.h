@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_PEEPHOLE_H
+#define INFINITY_COMPILER_PEEPHOLE_H
+
+#include "../codegen/machine.h"
+
+void peephole_optimize(MachineFunction *function);
+
+#endif //INFINITY_COMPILER_PEEPHOLE_H
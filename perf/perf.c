@@ -0,0 +1,239 @@
+#include "perf.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#endif
+
+#define MAX_PHASES 64
+#define MAX_COUNTER_GROUPS 256
+
+/**
+\PerfPhaseTotals
+ Accumulated measurements of all the runs of a phase with the same name.
+*/
+typedef struct {
+    const char *name;
+    unsigned long runs;
+    double elapsed_ms;
+    unsigned long long counters[PERF_COUNTERS_LEN];
+    int has_counters;
+} PerfPhaseTotals;
+
+/**
+\CounterGroup
+ The hardware counters of one thread, opened as a single perf event group
+ so all of them are scheduled on the PMU together and read with one syscall.
+*/
+typedef struct {
+    int leader_fd;                 // -2 if not opened yet, -1 if unavailable
+    int slot[PERF_COUNTERS_LEN];   // index of each counter in a group read, -1 if unsupported
+    int slots_len;
+} CounterGroup;
+
+static int report_enabled = 0;
+static int counters_enabled = 0;
+static int counters_errno = 0; // why opening the counters failed, if it did
+
+static PerfPhaseTotals phases[MAX_PHASES];
+static int phases_len = 0;
+static int group_fds[MAX_COUNTER_GROUPS * PERF_COUNTERS_LEN];
+static int group_fds_len = 0;
+static pthread_mutex_t perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local CounterGroup thread_group = {.leader_fd = -2};
+
+static const char *counter_names[] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+
+void perf_init(int time_report, int hardware_counters) {
+    report_enabled = time_report;
+    counters_enabled = hardware_counters;
+#ifndef __linux__
+    if (counters_enabled) {
+        counters_enabled = 0;
+        counters_errno = ENOSYS;
+    }
+#endif
+}
+
+#ifdef __linux__
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd) {
+    // measure the calling thread on any cpu
+    return (int) syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static void counter_group_open(CounterGroup *group) {
+    static const unsigned long long configs[] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    struct perf_event_attr attr;
+    int i, fd;
+
+    group->leader_fd = -1;
+    group->slots_len = 0;
+    for (i = 0; i < PERF_COUNTERS_LEN; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        // user space only, so it works with the default perf_event_paranoid level
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd = perf_event_open(&attr, i == 0 ? -1 : group->leader_fd);
+        if (fd < 0) {
+            group->slot[i] = -1;
+            if (i == 0) { // without the leader there is no group
+                counters_errno = errno;
+                return;
+            }
+            continue;
+        }
+        if (i == 0)
+            group->leader_fd = fd;
+        group->slot[i] = group->slots_len++;
+
+        pthread_mutex_lock(&perf_mutex);
+        if (group_fds_len < (int) (sizeof(group_fds) / sizeof(group_fds[0])))
+            group_fds[group_fds_len++] = fd;
+        pthread_mutex_unlock(&perf_mutex);
+    }
+}
+
+/*
+Reads the counters of the calling thread into `values`.
+Returns 0 if the counters are unavailable.
+*/
+static int counter_group_read(unsigned long long values[PERF_COUNTERS_LEN]) {
+    unsigned long long buf[1 + PERF_COUNTERS_LEN]; // {nr, values[nr]}
+    int i;
+
+    if (thread_group.leader_fd == -2)
+        counter_group_open(&thread_group);
+    if (thread_group.leader_fd < 0)
+        return 0;
+    if (read(thread_group.leader_fd, buf, sizeof(buf)) < (ssize_t) sizeof(unsigned long long))
+        return 0;
+
+    for (i = 0; i < PERF_COUNTERS_LEN; i++)
+        values[i] = thread_group.slot[i] >= 0 ? buf[1 + thread_group.slot[i]] : 0;
+    return 1;
+}
+
+#else
+
+static int counter_group_read(unsigned long long values[PERF_COUNTERS_LEN]) {
+    return 0;
+}
+
+#endif
+
+static double timespec_diff_ms(const struct timespec *start, const struct timespec *end) {
+    return (double) (end->tv_sec - start->tv_sec) * 1000 + (double) (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+void perf_phase_begin(PerfPhase *phase, const char *name) {
+    phase->name = name;
+    if (!report_enabled)
+        return;
+
+    phase->has_counters = counters_enabled && counter_group_read(phase->counters_start);
+    // take the time last, so opening the counters is not measured
+    clock_gettime(CLOCK_MONOTONIC, &phase->start);
+}
+
+void perf_phase_end(PerfPhase *phase) {
+    struct timespec end;
+    unsigned long long counters_end[PERF_COUNTERS_LEN];
+    PerfPhaseTotals *totals = NULL;
+    int i, has_counters;
+
+    if (!report_enabled)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    has_counters = phase->has_counters && counter_group_read(counters_end);
+
+    pthread_mutex_lock(&perf_mutex);
+    for (i = 0; i < phases_len; i++) {
+        if (!strcmp(phases[i].name, phase->name)) {
+            totals = &phases[i];
+            break;
+        }
+    }
+    if (!totals && phases_len < MAX_PHASES) {
+        totals = &phases[phases_len++];
+        *totals = (PerfPhaseTotals) {.name = phase->name};
+    }
+    if (totals) {
+        totals->runs++;
+        totals->elapsed_ms += timespec_diff_ms(&phase->start, &end);
+        if (has_counters) {
+            totals->has_counters = 1;
+            for (i = 0; i < PERF_COUNTERS_LEN; i++)
+                totals->counters[i] += counters_end[i] - phase->counters_start[i];
+        }
+    }
+    pthread_mutex_unlock(&perf_mutex);
+}
+
+/*
+Prints the time report: wall time of every phase and, if enabled,
+cycles, instructions, IPC, and cache and branch misses per 1000 instructions.
+*/
+void perf_report() {
+    int i;
+    PerfPhaseTotals *p;
+    double kilo_instructions;
+
+    if (!report_enabled)
+        return;
+
+    printf("\n%-24s %6s %12s", "Phase", "Runs", "Time (ms)");
+    if (counters_enabled)
+        printf(" %14s %14s %6s %14s %14s", "Cycles", "Instructions", "IPC", "Cache miss/ki", "Branch miss/ki");
+    printf("\n");
+
+    for (i = 0; i < phases_len; i++) {
+        p = &phases[i];
+        printf("%-24s %6lu %12.3f", p->name, p->runs, p->elapsed_ms);
+        if (counters_enabled && p->has_counters) {
+            kilo_instructions = (double) p->counters[PERF_INSTRUCTIONS] / 1000;
+            printf(" %14llu %14llu %6.2f %14.2f %14.2f",
+                   p->counters[PERF_CYCLES],
+                   p->counters[PERF_INSTRUCTIONS],
+                   p->counters[PERF_CYCLES] ? (double) p->counters[PERF_INSTRUCTIONS] / p->counters[PERF_CYCLES] : 0,
+                   kilo_instructions ? p->counters[PERF_CACHE_MISSES] / kilo_instructions : 0,
+                   kilo_instructions ? p->counters[PERF_BRANCH_MISSES] / kilo_instructions : 0);
+        }
+        printf("\n");
+    }
+
+    if (counters_enabled && counters_errno)
+        printf("Hardware counters unavailable: %s\n", strerror(counters_errno));
+#ifdef __linux__
+    for (i = 0; i < PERF_COUNTERS_LEN; i++) {
+        if (counters_enabled && !counters_errno && thread_group.leader_fd >= 0 && thread_group.slot[i] < 0)
+            printf("Hardware counter '%s' is not supported on this machine\n", counter_names[i]);
+    }
+    for (i = 0; i < group_fds_len; i++)
+        close(group_fds[i]);
+    group_fds_len = 0;
+    thread_group.leader_fd = -2;
+#else
+    (void) counter_names;
+#endif
+}
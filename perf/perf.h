@@ -0,0 +1,35 @@
+#ifndef INFINITY_COMPILER_PERF_H
+#define INFINITY_COMPILER_PERF_H
+
+#include <time.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTERS_LEN,
+} PerfCounter;
+
+/**
+\PerfPhase
+ A running measurement of one compiler phase.
+ Lives on the stack of whoever runs the phase, so phases
+ may be nested and may run concurrently on several threads.
+*/
+typedef struct {
+    const char *name;
+    struct timespec start;
+    unsigned long long counters_start[PERF_COUNTERS_LEN];
+    int has_counters; // whether `counters_start` was read successfully
+} PerfPhase;
+
+void perf_init(int time_report, int hardware_counters);
+
+void perf_phase_begin(PerfPhase *phase, const char *name);
+
+void perf_phase_end(PerfPhase *phase);
+
+void perf_report();
+
+#endif //INFINITY_COMPILER_PERF_H
@@ -0,0 +1,175 @@
+#include "preprocessor.h"
+#include "../logging/logging.h"
+#include "../io/io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MACROS_INITIAL_CAPACITY 64
+
+Macro *init_macro(char *name) {
+    Macro *macro = malloc(sizeof(Macro));
+    if (!macro)
+        log_error(LEXER, "Can't allocate memory for macro.");
+
+    macro->name = name;
+    macro->tokens = init_list(sizeof(Token *));
+    macro->expanding = 0;
+    return macro;
+}
+
+void macro_dispose(Macro *macro) {
+    size_t i;
+    for (i = 0; i < macro->tokens->size; i++)
+        token_dispose(macro->tokens->items[i]);
+    free(macro->tokens->items);
+    free(macro->tokens);
+    free(macro->name);
+    free(macro);
+}
+
+Preprocessor *init_preprocessor(Lexer *lexer) {
+    Preprocessor *preprocessor = malloc(sizeof(Preprocessor));
+    if (!preprocessor)
+        log_error(LEXER, "Can't allocate memory for preprocessor.");
+
+    preprocessor->lexer = lexer;
+    preprocessor->macros = init_hashmap(MACROS_INITIAL_CAPACITY);
+    preprocessor->expansions = NULL;
+    preprocessor->expansions_len = 0;
+    preprocessor->expansions_capacity = 0;
+    preprocessor->expansion_row = 0;
+    preprocessor->expansion_col = 0;
+    return preprocessor;
+}
+
+void preprocessor_dispose(Preprocessor *preprocessor) {
+    size_t i;
+    for (i = 0; i < preprocessor->macros->capacity; i++) {
+        if (preprocessor->macros->entries[i].key)
+            macro_dispose(preprocessor->macros->entries[i].value);
+    }
+    hashmap_dispose(preprocessor->macros);
+    free(preprocessor->expansions);
+    free(preprocessor);
+}
+
+/*
+Skips spaces and comments until the end of the current line.
+Returns 1 if there are more tokens on this line.
+*/
+static int preprocessor_skip_to_token_on_line(Lexer *lexer) {
+    while (lexer->c == ' ' || lexer->c == '\t' || lexer->c == '\r')
+        lexer_forward(lexer);
+    if (lexer->c == '/' && lexer_peek(lexer, 1) == '/')
+        lexer_skip_one_line_comment(lexer);
+    return lexer->c != '\n' && lexer->c != 0;
+}
+
+/*
+Reads a `define NAME <tokens>` directive. The `define` keyword was already read.
+The replacement is every token until the end of the line, and may be empty.
+*/
+void preprocessor_parse_define(Preprocessor *preprocessor) {
+    Lexer *lexer = preprocessor->lexer;
+    Token *name;
+    Macro *macro;
+    size_t i;
+    char *msg;
+
+    if (!preprocessor_skip_to_token_on_line(lexer))
+        throw_exception_with_trace(LEXER, lexer, "Expected macro name after 'define'");
+    name = lexer_next_token(lexer);
+    if (name->type != ID) {
+        alsprintf(&msg, "Expected macro name after 'define', got '%s'", name->value);
+        throw_exception_with_trace(LEXER, lexer, msg);
+    }
+
+    macro = hashmap_get(preprocessor->macros, name->value);
+    if (macro) {
+        // the new replacement overrides the old one
+        alsprintf(&msg, "Macro '%s' redefined", name->value);
+        log_warning(lexer, msg);
+        for (i = 0; i < macro->tokens->size; i++)
+            token_dispose(macro->tokens->items[i]);
+        macro->tokens->size = 0;
+        token_dispose(name);
+    } else {
+        macro = init_macro(name->value);
+        free(name);
+        hashmap_put(preprocessor->macros, macro->name, macro);
+    }
+
+    while (preprocessor_skip_to_token_on_line(lexer))
+        list_push(macro->tokens, lexer_next_token(lexer));
+}
+
+static void preprocessor_push_expansion(Preprocessor *preprocessor, Macro *macro) {
+    if (preprocessor->expansions_len == preprocessor->expansions_capacity) {
+        preprocessor->expansions_capacity = preprocessor->expansions_capacity ? preprocessor->expansions_capacity * 2 : 4;
+        preprocessor->expansions = realloc(preprocessor->expansions,
+                                           preprocessor->expansions_capacity * sizeof(MacroExpansion));
+    }
+    preprocessor->expansions[preprocessor->expansions_len++] = (MacroExpansion) {.macro = macro, .idx = 0};
+    macro->expanding = 1;
+}
+
+/*
+Returns the next token of the innermost expansion, or NULL if no macro is being expanded.
+*/
+static Token *preprocessor_next_expanded_token(Preprocessor *preprocessor) {
+    MacroExpansion *expansion;
+    Token *tok, *copy;
+
+    while (preprocessor->expansions_len > 0) {
+        expansion = &preprocessor->expansions[preprocessor->expansions_len - 1];
+        if (expansion->idx < expansion->macro->tokens->size) {
+            tok = expansion->macro->tokens->items[expansion->idx++];
+            // the parser owns the tokens it gets, so hand out a copy
+            copy = init_token(strdup(tok->value), tok->type);
+            // errors in expanded tokens point at the macro usage
+            copy->row = preprocessor->expansion_row;
+            copy->col = preprocessor->expansion_col;
+            return copy;
+        }
+        expansion->macro->expanding = 0;
+        preprocessor->expansions_len--;
+    }
+    return NULL;
+}
+
+/*
+Returns the next token after macro expansion.
+`define` directives are consumed here and never reach the parser.
+Every identifier costs a single hash map lookup.
+*/
+Token *preprocessor_next_token(Preprocessor *preprocessor) {
+    Token *tok;
+    Macro *macro;
+
+    while (1) {
+        tok = preprocessor_next_expanded_token(preprocessor);
+        if (!tok) {
+            tok = lexer_next_token(preprocessor->lexer);
+            if (tok->type == DEFINE_KEYWORD) {
+                token_dispose(tok);
+                preprocessor_parse_define(preprocessor);
+                continue;
+            }
+        }
+
+        if (tok->type != ID || preprocessor->macros->size == 0)
+            return tok;
+        macro = hashmap_get(preprocessor->macros, tok->value);
+        // a macro is not expanded inside its own expansion, to prevent infinite recursion
+        if (!macro || macro->expanding)
+            return tok;
+
+        if (preprocessor->expansions_len == 0) {
+            preprocessor->expansion_row = tok->row;
+            preprocessor->expansion_col = tok->col;
+        }
+        token_dispose(tok);
+        preprocessor_push_expansion(preprocessor, macro);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef INFINITY_COMPILER_PREPROCESSOR_H
+#define INFINITY_COMPILER_PREPROCESSOR_H
+
+#include "../lexer/lexer.h"
+#include "../hashmap/hashmap.h"
+#include "../list/list.h"
+
+/**
+\Macro
+ A `define NAME <tokens>` directive.
+ The replacement tokens are lexed once, when the macro is defined.
+*/
+typedef struct {
+    char *name;
+    List *tokens; // list of Tokens the name expands to
+    int expanding; // 1 while the macro is on the expansion stack
+} Macro;
+
+/**
+\MacroExpansion
+ A macro that is being expanded, and the index of its next token.
+*/
+typedef struct {
+    Macro *macro;
+    size_t idx;
+} MacroExpansion;
+
+/**
+\Preprocessor
+ Sits between the lexer and the parser.
+ Records `define` directives and substitutes macros in the token stream.
+*/
+typedef struct {
+    Lexer *lexer;
+    HashMap *macros;              // macro name -> Macro
+    MacroExpansion *expansions;   // stack of the macros being expanded (nested macros)
+    size_t expansions_len;
+    size_t expansions_capacity;
+    unsigned int expansion_row; // position of the outermost macro being expanded
+    unsigned int expansion_col;
+} Preprocessor;
+
+Macro *init_macro(char *name);
+
+void macro_dispose(Macro *macro);
+
+Preprocessor *init_preprocessor(Lexer *lexer);
+
+void preprocessor_dispose(Preprocessor *preprocessor);
+
+void preprocessor_parse_define(Preprocessor *preprocessor);
+
+Token *preprocessor_next_token(Preprocessor *preprocessor);
+
+#endif //INFINITY_COMPILER_PREPROCESSOR_H
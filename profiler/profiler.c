@@ -0,0 +1,229 @@
+#define _GNU_SOURCE // dladdr
+
+#include "profiler.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+/*
+Sampling profiler for the compiler process itself.
+
+SIGPROF is delivered every PROFILER_INTERVAL_US microseconds of cpu time
+(of all threads). The signal handler only copies the return addresses of
+the interrupted stack into a preallocated buffer; symbolizing and merging
+the stacks is done once, at exit, into a folded-stacks file:
+    main;compiler_compile_file;parser_parse 12
+which can be rendered by flamegraph.pl, speedscope, inferno, etc.
+*/
+
+#define PROFILER_INTERVAL_US 1000
+#define PROFILER_MAX_DEPTH 128
+#define PROFILER_BUFFER_LEN (1 << 21) // in words, 16MB
+// frames of the signal handler and the kernel's signal trampoline
+#define PROFILER_SKIPPED_FRAMES 2
+
+typedef struct {
+    void *address;
+    char *name;
+} Symbol;
+
+/*
+Samples are stored back to back in `samples_buffer`:
+    [depth, frame_0 ... frame_depth-1] [depth, ...] ...
+*/
+static void **samples_buffer = NULL;
+static atomic_size_t samples_cursor = 0;
+static atomic_size_t samples_dropped = 0;
+static const char *profile_path = NULL;
+static int running = 0;
+
+static void profiler_handle_signal(int sig) {
+    void *frames[PROFILER_MAX_DEPTH];
+    int depth, saved_errno = errno;
+    size_t pos;
+
+    depth = backtrace(frames, PROFILER_MAX_DEPTH);
+    pos = atomic_fetch_add(&samples_cursor, depth + 1);
+    if (pos + depth + 1 > PROFILER_BUFFER_LEN) {
+        atomic_fetch_add(&samples_dropped, 1);
+    } else {
+        samples_buffer[pos] = (void *) (uintptr_t) depth;
+        memcpy(samples_buffer + pos + 1, frames, depth * sizeof(void *));
+    }
+    errno = saved_errno;
+}
+
+static void profiler_write_at_exit() {
+    profiler_stop();
+    profiler_write_folded(profile_path);
+}
+
+/*
+Starts sampling the process.
+The folded stacks are written to `output_path` when the process exits.
+*/
+void profiler_start(const char *output_path) {
+    struct sigaction action = {};
+    struct itimerval timer = {
+            .it_interval = {.tv_sec = 0, .tv_usec = PROFILER_INTERVAL_US},
+            .it_value = {.tv_sec = 0, .tv_usec = PROFILER_INTERVAL_US},
+    };
+    void *warmup[1];
+
+    samples_buffer = malloc(PROFILER_BUFFER_LEN * sizeof(void *));
+    if (!samples_buffer)
+        log_error(COMPILER, "Can't allocate memory for the profiler.");
+    profile_path = output_path;
+
+    // the first call of backtrace loads libgcc, which is not async-signal-safe
+    backtrace(warmup, 1);
+
+    action.sa_handler = profiler_handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0 || setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        log_debug(COMPILER, "Can't start the profiler.");
+        return;
+    }
+    running = 1;
+    atexit(profiler_write_at_exit);
+}
+
+void profiler_stop() {
+    struct itimerval timer = {};
+
+    if (!running)
+        return;
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    running = 0;
+}
+
+static int compare_addresses(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) ((const Symbol *) a)->address, y = (uintptr_t) ((const Symbol *) b)->address;
+    return (x > y) - (x < y);
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static char *symbolize(void *address) {
+    Dl_info info = {};
+    const char *file_name;
+    char *name;
+
+    if (dladdr(address, &info) && info.dli_sname)
+        return strdup(info.dli_sname);
+    if (info.dli_fname) {
+        // static functions are not in the dynamic symbol table: use file+offset
+        file_name = strrchr(info.dli_fname, '/');
+        alsprintf(&name, "%s+0x%lx", file_name ? file_name + 1 : info.dli_fname,
+                  (unsigned long) ((uintptr_t) address - (uintptr_t) info.dli_fbase));
+    } else {
+        alsprintf(&name, "0x%lx", (unsigned long) (uintptr_t) address);
+    }
+    return name;
+}
+
+/*
+Symbolizes the recorded samples and writes them as folded stacks.
+Every unique address is symbolized once; identical stacks are merged.
+Returns the amount of samples written, or -1 on error.
+*/
+int profiler_write_folded(const char *output_path) {
+    size_t end, pos, depth, i, j, symbols_len = 0, stacks_len = 0, stack_len, count;
+    Symbol *symbols, key, *found;
+    char **stacks, *stack;
+    FILE *fp;
+    int result;
+
+    if (!samples_buffer)
+        return -1;
+    end = atomic_load(&samples_cursor);
+    end = MIN(end, PROFILER_BUFFER_LEN);
+
+    // collect every address once, sorted, so frames are symbolized only once
+    symbols = malloc(end * sizeof(Symbol) + 1);
+    for (pos = 0; pos < end; pos += depth + 1) {
+        depth = (size_t) (uintptr_t) samples_buffer[pos];
+        if (pos + depth + 1 > end)
+            break;
+        for (i = PROFILER_SKIPPED_FRAMES; i < depth; i++)
+            symbols[symbols_len++].address = samples_buffer[pos + 1 + i];
+    }
+    qsort(symbols, symbols_len, sizeof(Symbol), compare_addresses);
+    for (i = 0, j = 0; i < symbols_len; i++) {
+        if (j == 0 || symbols[j - 1].address != symbols[i].address)
+            symbols[j++] = symbols[i];
+    }
+    symbols_len = j;
+    for (i = 0; i < symbols_len; i++) {
+        // the first real frame is the interrupted pc, the others are return addresses.
+        // looking up `address - 1` attributes a return address to the calling instruction.
+        symbols[i].name = symbolize((char *) symbols[i].address - 1);
+    }
+
+    // build one folded line per sample, outermost frame first
+    stacks = malloc((end + 1) * sizeof(char *));
+    for (pos = 0; pos < end; pos += depth + 1) {
+        depth = (size_t) (uintptr_t) samples_buffer[pos];
+        if (pos + depth + 1 > end)
+            break;
+        stack_len = 0;
+        for (i = PROFILER_SKIPPED_FRAMES; i < depth; i++) {
+            key.address = samples_buffer[pos + 1 + i];
+            found = bsearch(&key, symbols, symbols_len, sizeof(Symbol), compare_addresses);
+            stack_len += strlen(found->name) + 1;
+        }
+        stack = malloc(stack_len + 1);
+        stack[0] = '\0';
+        for (i = depth; i-- > PROFILER_SKIPPED_FRAMES;) {
+            key.address = samples_buffer[pos + 1 + i];
+            found = bsearch(&key, symbols, symbols_len, sizeof(Symbol), compare_addresses);
+            strcat(stack, found->name);
+            if (i > PROFILER_SKIPPED_FRAMES)
+                strcat(stack, ";");
+        }
+        stacks[stacks_len++] = stack;
+    }
+
+    fp = fopen(output_path, "w");
+    if (!fp) {
+        printf("Error opening profile output file \"%s\".\n", output_path);
+        result = -1;
+        goto cleanup;
+    }
+    // identical stacks are adjacent after sorting
+    qsort(stacks, stacks_len, sizeof(char *), compare_strings);
+    for (i = 0; i < stacks_len; i += count) {
+        for (count = 1; i + count < stacks_len && !strcmp(stacks[i], stacks[i + count]); count++);
+        fprintf(fp, "%s %zu\n", stacks[i], count);
+    }
+    fclose(fp);
+
+    printf("Wrote %zu samples to \"%s\"", stacks_len, output_path);
+    if (atomic_load(&samples_dropped))
+        printf(" (%zu samples dropped, buffer full)", atomic_load(&samples_dropped));
+    printf("\n");
+    result = (int) stacks_len;
+
+    cleanup:
+    for (i = 0; i < stacks_len; i++)
+        free(stacks[i]);
+    free(stacks);
+    for (i = 0; i < symbols_len; i++)
+        free(symbols[i].name);
+    free(symbols);
+    return result;
+}
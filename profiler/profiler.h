@@ -0,0 +1,10 @@
+#ifndef INFINITY_COMPILER_PROFILER_H
+#define INFINITY_COMPILER_PROFILER_H
+
+void profiler_start(const char *output_path);
+
+void profiler_stop();
+
+int profiler_write_folded(const char *output_path);
+
+#endif //INFINITY_COMPILER_PROFILER_H
@@ -0,0 +1,693 @@
+#include "regalloc.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Linear scan register allocation, after Poletto and Sarkar.
+
+The code generator uses as many virtual registers as it likes. Each of them gets
+one live interval, from the first position where it is live to the last one, with
+the positions numbered along the code: instruction i reads its operands at 2i and
+writes its result at 2i + 1. Liveness across basic blocks is found by walking back
+from the uses that are not preceded by a definition in their block.
+
+The intervals are scanned in order of their start. Each one takes a free register,
+or the register of the active interval that ends last, which goes to a frame slot
+instead. Registers the code uses by name, like the arguments of calls, and the ones
+calls clobber, are busy at those positions: an interval can only take a register
+that is not busy while it is live, so values live across calls end up in callee
+saved registers. Copies between registers that got the same register disappear.
+*/
+
+#define NONE ((size_t) -1)
+#define NO_REGISTER ((unsigned int) -1)
+#define SLOT_SIZE 8
+#define USE_POSITION(i) (2 * (i))
+#define DEF_POSITION(i) (2 * (i) + 1)
+
+// caller saved ones first, they don't have to be saved in the prologue
+static const Register allocatable_registers[] = {
+        REG_R10, REG_R9, REG_R8, REG_RCX, REG_RDX, REG_RSI, REG_RDI,
+        REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+#define ALLOCATABLE_LEN (sizeof(allocatable_registers) / sizeof(Register))
+
+static const Register argument_registers[] = {
+        REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9,
+};
+
+#define CALLER_SAVED_MASK (1u << REG_RAX | 1u << REG_RCX | 1u << REG_RDX | 1u << REG_RSI | 1u << REG_RDI | \
+                           1u << REG_R8 | 1u << REG_R9 | 1u << REG_R10 | 1u << REG_R11)
+
+/**
+\LiveInterval
+ Where a virtual register is live, and where it ends up.
+*/
+typedef struct {
+    size_t start;      // first position where the register is live, NONE if it is never used
+    size_t end;        // last position where it is live
+    unsigned int reg;  // the physical register, NO_REGISTER if it lives in a frame slot
+    int slot;          // frame offset, once spilled
+    unsigned int hint; // a register it is copied from or to, NO_REGISTER if none
+} LiveInterval;
+
+/**
+\BasicBlock
+ Instructions [start, end) of a function, which run from the first to the last.
+*/
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t successors[2];
+    int successors_len;
+} BasicBlock;
+
+/**
+\BusyRanges
+ The positions where the code uses a physical register by name, sorted.
+*/
+typedef struct {
+    size_t *starts;
+    size_t *ends;
+    size_t len;
+    size_t capacity;
+} BusyRanges;
+
+typedef struct {
+    MachineFunction *function;
+    BasicBlock *blocks;
+    size_t blocks_len;
+    size_t *predecessors;           // of block b: from predecessors_start[b] to predecessors_start[b + 1]
+    size_t *predecessors_start;
+    LiveInterval *intervals;        // by virtual register
+    size_t *exposed;                // (register, block) pairs: uses not preceded by a definition in the block
+    size_t exposed_len;
+    size_t *defined;                // (register, block) pairs: definitions
+    size_t defined_len;
+    BusyRanges busy[REGISTERS_LEN];
+    unsigned int callee_saved;      // mask of the callee saved registers allocated
+} RegisterAllocator;
+
+static void *allocate(size_t count, size_t size) {
+    void *ptr = calloc(count ? count : 1, size);
+
+    if (!ptr)
+        log_error(CODE_GENERATOR, "Can't allocate memory for register allocation.");
+    return ptr;
+}
+
+static int is_allocatable(unsigned int reg) {
+    size_t i;
+
+    for (i = 0; i < ALLOCATABLE_LEN; i++) {
+        if (allocatable_registers[i] == reg)
+            return 1;
+    }
+    return 0;
+}
+
+static unsigned int virtual_register(const MachineOperand *operand) {
+    if (operand->kind != OPERAND_REGISTER || !IS_VIRTUAL_REGISTER(operand->reg))
+        return NO_REGISTER;
+    return operand->reg - FIRST_VIRTUAL_REGISTER;
+}
+
+static unsigned int physical_register(const MachineOperand *operand) {
+    if ((operand->kind != OPERAND_REGISTER && operand->kind != OPERAND_MEMORY) || IS_VIRTUAL_REGISTER(operand->reg))
+        return NO_REGISTER;
+    return operand->reg;
+}
+
+static int reads_destination(X86Opcode op) {
+    switch (op) {
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_SHL:
+        case X86_NEG:
+        case X86_XOR:
+        case X86_CMP:
+        case X86_TEST:
+        case X86_IDIV:
+        case X86_PUSH:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int writes_destination(X86Opcode op) {
+    switch (op) {
+        case X86_MOV:
+        case X86_MOVZX:
+        case X86_LEA:
+        case X86_ADD:
+        case X86_SUB:
+        case X86_IMUL:
+        case X86_SHL:
+        case X86_NEG:
+        case X86_XOR:
+        case X86_SETCC:
+        case X86_POP:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+Physical registers an instruction reads, as a mask, including the ones it doesn't name.
+*/
+static unsigned int physical_uses(const MachineInstruction *instruction) {
+    unsigned int mask = 0, reg;
+    int i;
+
+    if ((reg = physical_register(&instruction->src)) != NO_REGISTER)
+        mask |= 1u << reg;
+    reg = physical_register(&instruction->dst);
+    if (reg != NO_REGISTER && (instruction->dst.kind == OPERAND_MEMORY || reads_destination(instruction->op)))
+        mask |= 1u << reg;
+    switch (instruction->op) {
+        case X86_CALL:
+            for (i = 0; i < instruction->cond; i++)
+                mask |= 1u << argument_registers[i];
+            break;
+        case X86_CDQ:
+        case X86_RET:
+            mask |= 1u << REG_RAX;
+            break;
+        case X86_IDIV:
+            mask |= 1u << REG_RAX | 1u << REG_RDX;
+            break;
+        default:
+            break;
+    }
+    return mask;
+}
+
+/*
+Physical registers an instruction writes, as a mask.
+*/
+static unsigned int physical_definitions(const MachineInstruction *instruction) {
+    unsigned int mask = 0;
+
+    if (instruction->dst.kind == OPERAND_REGISTER && !IS_VIRTUAL_REGISTER(instruction->dst.reg) &&
+        writes_destination(instruction->op))
+        mask |= 1u << instruction->dst.reg;
+    switch (instruction->op) {
+        case X86_CALL:
+            mask |= CALLER_SAVED_MASK;
+            break;
+        case X86_CDQ:
+            mask |= 1u << REG_RDX;
+            break;
+        case X86_IDIV:
+            mask |= 1u << REG_RAX | 1u << REG_RDX;
+            break;
+        default:
+            break;
+    }
+    return mask;
+}
+
+static void add_block(RegisterAllocator *ra, size_t start, size_t end) {
+    ra->blocks[ra->blocks_len++] = (BasicBlock) {.start = start, .end = end};
+}
+
+/*
+Splits the code at labels and after jumps, and links the blocks.
+*/
+static void build_blocks(RegisterAllocator *ra) {
+    MachineFunction *function = ra->function;
+    MachineInstruction *last;
+    BasicBlock *block;
+    size_t *label_blocks = allocate(function->labels_len, sizeof(size_t)), *filled;
+    size_t start = 0, i, b;
+    int k;
+
+    ra->blocks = allocate(function->len, sizeof(BasicBlock));
+    for (i = 0; i < function->len; i++) {
+        switch (function->code[i].op) {
+            case X86_LABEL:
+                if (i > start) {
+                    add_block(ra, start, i);
+                    start = i;
+                }
+                label_blocks[function->code[i].dst.value] = ra->blocks_len;
+                break;
+            case X86_JMP:
+            case X86_JCC:
+            case X86_RET:
+                add_block(ra, start, i + 1);
+                start = i + 1;
+                break;
+            default:
+                break;
+        }
+    }
+    if (start < function->len)
+        add_block(ra, start, function->len);
+
+    for (b = 0; b < ra->blocks_len; b++) {
+        block = &ra->blocks[b];
+        last = &function->code[block->end - 1];
+        if (last->op == X86_JMP || last->op == X86_JCC)
+            block->successors[block->successors_len++] = label_blocks[last->dst.value];
+        if (last->op != X86_JMP && last->op != X86_RET && b + 1 < ra->blocks_len)
+            block->successors[block->successors_len++] = b + 1;
+    }
+    free(label_blocks);
+
+    ra->predecessors_start = allocate(ra->blocks_len + 1, sizeof(size_t));
+    for (b = 0; b < ra->blocks_len; b++) {
+        for (k = 0; k < ra->blocks[b].successors_len; k++)
+            ra->predecessors_start[ra->blocks[b].successors[k] + 1]++;
+    }
+    for (b = 0; b < ra->blocks_len; b++)
+        ra->predecessors_start[b + 1] += ra->predecessors_start[b];
+    ra->predecessors = allocate(ra->predecessors_start[ra->blocks_len], sizeof(size_t));
+    filled = allocate(ra->blocks_len, sizeof(size_t));
+    for (b = 0; b < ra->blocks_len; b++) {
+        for (k = 0; k < ra->blocks[b].successors_len; k++) {
+            i = ra->blocks[b].successors[k];
+            ra->predecessors[ra->predecessors_start[i] + filled[i]++] = b;
+        }
+    }
+    free(filled);
+}
+
+static void extend_interval(LiveInterval *interval, size_t position) {
+    if (interval->start == NONE) {
+        interval->start = interval->end = position;
+        return;
+    }
+    interval->start = MIN(interval->start, position);
+    interval->end = MAX(interval->end, position);
+}
+
+static void push_pair(size_t **pairs, size_t *len, size_t reg, size_t block) {
+    // a pair per occurrence at most, the arrays are allocated for all of them
+    (*pairs)[2 * *len] = reg;
+    (*pairs)[2 * *len + 1] = block;
+    (*len)++;
+}
+
+/*
+Finds where each virtual register is read and written inside the blocks,
+and which blocks read it before writing it.
+*/
+static void scan_blocks(RegisterAllocator *ra) {
+    MachineFunction *function = ra->function;
+    MachineInstruction *instruction;
+    LiveInterval *interval;
+    size_t *exposed_in = allocate(function->registers_len, sizeof(size_t));
+    size_t *defined_in = allocate(function->registers_len, sizeof(size_t));
+    size_t b, i;
+    unsigned int dst, src;
+
+    memset(exposed_in, 0xff, function->registers_len * sizeof(size_t));
+    memset(defined_in, 0xff, function->registers_len * sizeof(size_t));
+    ra->exposed = allocate(4 * function->len, sizeof(size_t));
+    ra->defined = allocate(2 * function->len, sizeof(size_t));
+
+    for (b = 0; b < ra->blocks_len; b++) {
+        for (i = ra->blocks[b].start; i < ra->blocks[b].end; i++) {
+            instruction = &function->code[i];
+            src = virtual_register(&instruction->src);
+            dst = virtual_register(&instruction->dst);
+
+            if (src != NO_REGISTER) {
+                extend_interval(&ra->intervals[src], USE_POSITION(i));
+                if (defined_in[src] != b && exposed_in[src] != b) {
+                    exposed_in[src] = b;
+                    push_pair(&ra->exposed, &ra->exposed_len, src, b);
+                }
+            }
+            if (dst == NO_REGISTER)
+                continue;
+            interval = &ra->intervals[dst];
+            if (reads_destination(instruction->op)) {
+                extend_interval(interval, USE_POSITION(i));
+                if (defined_in[dst] != b && exposed_in[dst] != b) {
+                    exposed_in[dst] = b;
+                    push_pair(&ra->exposed, &ra->exposed_len, dst, b);
+                }
+            }
+            if (writes_destination(instruction->op)) {
+                extend_interval(interval, DEF_POSITION(i));
+                if (defined_in[dst] != b) {
+                    defined_in[dst] = b;
+                    push_pair(&ra->defined, &ra->defined_len, dst, b);
+                }
+            }
+
+            // copies are cheaper between registers that end up the same
+            if (instruction->op != X86_MOV || instruction->src.kind != OPERAND_REGISTER || interval->hint != NO_REGISTER)
+                continue;
+            interval->hint = src != NO_REGISTER ? src + FIRST_VIRTUAL_REGISTER : instruction->src.reg;
+        }
+    }
+    // and a register copied into an argument register prefers it
+    for (i = 0; i < function->len; i++) {
+        instruction = &function->code[i];
+        src = virtual_register(&instruction->src);
+        if (instruction->op == X86_MOV && src != NO_REGISTER && instruction->dst.kind == OPERAND_REGISTER &&
+            !IS_VIRTUAL_REGISTER(instruction->dst.reg) && ra->intervals[src].hint == NO_REGISTER)
+            ra->intervals[src].hint = instruction->dst.reg;
+    }
+    free(exposed_in);
+    free(defined_in);
+}
+
+/*
+Sorts (register, block) pairs by register, returns the blocks.
+The blocks of register r are from `(*starts)[r]` to `(*starts)[r + 1]`.
+*/
+static size_t *group_pairs(const size_t *pairs, size_t len, size_t registers_len, size_t **starts) {
+    size_t *blocks = allocate(len, sizeof(size_t)), *filled = allocate(registers_len, sizeof(size_t));
+    size_t i, r;
+
+    *starts = allocate(registers_len + 1, sizeof(size_t));
+    for (i = 0; i < len; i++)
+        (*starts)[pairs[2 * i] + 1]++;
+    for (r = 0; r < registers_len; r++)
+        (*starts)[r + 1] += (*starts)[r];
+    for (i = 0; i < len; i++) {
+        r = pairs[2 * i];
+        blocks[(*starts)[r] + filled[r]++] = pairs[2 * i + 1];
+    }
+    free(filled);
+    return blocks;
+}
+
+/*
+Extends the intervals over the blocks where the registers are live on entry or exit:
+a register read before it is written in a block is live on entry, so it is live on
+exit of the predecessors, and on their entry too unless they write it.
+Each register only visits the blocks where it is live.
+*/
+static void compute_liveness(RegisterAllocator *ra) {
+    size_t registers_len = ra->function->registers_len, blocks_len = ra->blocks_len;
+    size_t *exposed_starts, *defined_starts;
+    size_t *exposed = group_pairs(ra->exposed, ra->exposed_len, registers_len, &exposed_starts);
+    size_t *defined = group_pairs(ra->defined, ra->defined_len, registers_len, &defined_starts);
+    size_t *defines = allocate(blocks_len, sizeof(size_t));
+    size_t *live_in = allocate(blocks_len, sizeof(size_t)), *live_out = allocate(blocks_len, sizeof(size_t));
+    size_t *worklist = allocate(blocks_len, sizeof(size_t)), worklist_len;
+    size_t r, k, b, p, pred;
+    LiveInterval *interval;
+
+    memset(defines, 0xff, blocks_len * sizeof(size_t));
+    memset(live_in, 0xff, blocks_len * sizeof(size_t));
+    memset(live_out, 0xff, blocks_len * sizeof(size_t));
+    for (r = 0; r < registers_len; r++) {
+        interval = &ra->intervals[r];
+        for (k = defined_starts[r]; k < defined_starts[r + 1]; k++)
+            defines[defined[k]] = r;
+        worklist_len = 0;
+        for (k = exposed_starts[r]; k < exposed_starts[r + 1]; k++) {
+            b = exposed[k];
+            live_in[b] = r;
+            extend_interval(interval, USE_POSITION(ra->blocks[b].start));
+            worklist[worklist_len++] = b;
+        }
+        while (worklist_len > 0) {
+            b = worklist[--worklist_len];
+            for (p = ra->predecessors_start[b]; p < ra->predecessors_start[b + 1]; p++) {
+                pred = ra->predecessors[p];
+                if (live_out[pred] != r) {
+                    live_out[pred] = r;
+                    extend_interval(interval, DEF_POSITION(ra->blocks[pred].end - 1));
+                }
+                if (defines[pred] != r && live_in[pred] != r) {
+                    live_in[pred] = r;
+                    extend_interval(interval, USE_POSITION(ra->blocks[pred].start));
+                    worklist[worklist_len++] = pred;
+                }
+            }
+        }
+    }
+    free(exposed);
+    free(exposed_starts);
+    free(defined);
+    free(defined_starts);
+    free(defines);
+    free(live_in);
+    free(live_out);
+    free(worklist);
+}
+
+static void add_busy_range(BusyRanges *busy, size_t start, size_t end) {
+    if (busy->len == busy->capacity) {
+        busy->capacity = MAX(busy->capacity * 2, 16);
+        busy->starts = realloc(busy->starts, busy->capacity * sizeof(size_t));
+        busy->ends = realloc(busy->ends, busy->capacity * sizeof(size_t));
+        if (!busy->starts || !busy->ends)
+            log_error(CODE_GENERATOR, "Can't allocate memory for register allocation.");
+    }
+    busy->starts[busy->len] = start;
+    busy->ends[busy->len++] = end;
+}
+
+/*
+Finds the positions where the allocatable registers are used by name, from each
+write to the last read of the value. They never live across blocks.
+The code is walked backwards, then the ranges are put back in order.
+*/
+static void compute_busy_ranges(RegisterAllocator *ra) {
+    MachineInstruction *instruction;
+    BusyRanges *busy;
+    size_t live_end[REGISTERS_LEN], b, i, k, tmp;
+    unsigned int uses, definitions, reg;
+
+    for (reg = 0; reg < REGISTERS_LEN; reg++)
+        live_end[reg] = NONE;
+    for (b = ra->blocks_len; b-- > 0;) {
+        for (i = ra->blocks[b].end; i-- > ra->blocks[b].start;) {
+            instruction = &ra->function->code[i];
+            uses = physical_uses(instruction);
+            definitions = physical_definitions(instruction);
+            for (k = 0; k < ALLOCATABLE_LEN; k++) {
+                reg = allocatable_registers[k];
+                if (definitions & 1u << reg) {
+                    add_busy_range(&ra->busy[reg], DEF_POSITION(i), live_end[reg] != NONE ? live_end[reg] : DEF_POSITION(i));
+                    live_end[reg] = NONE;
+                }
+                if (uses & 1u << reg && live_end[reg] == NONE)
+                    live_end[reg] = USE_POSITION(i);
+            }
+        }
+        for (k = 0; k < ALLOCATABLE_LEN; k++) {
+            reg = allocatable_registers[k];
+            if (live_end[reg] != NONE)
+                add_busy_range(&ra->busy[reg], USE_POSITION(ra->blocks[b].start), live_end[reg]);
+            live_end[reg] = NONE;
+        }
+    }
+    for (reg = 0; reg < REGISTERS_LEN; reg++) {
+        busy = &ra->busy[reg];
+        for (i = 0, k = busy->len; i + 1 < k; i++, k--) {
+            tmp = busy->starts[i], busy->starts[i] = busy->starts[k - 1], busy->starts[k - 1] = tmp;
+            tmp = busy->ends[i], busy->ends[i] = busy->ends[k - 1], busy->ends[k - 1] = tmp;
+        }
+    }
+}
+
+/*
+Whether `reg` is used by name between `start` and `end`: a binary search of its busy ranges.
+*/
+static int is_busy(const RegisterAllocator *ra, unsigned int reg, size_t start, size_t end) {
+    const BusyRanges *busy = &ra->busy[reg];
+    size_t low = 0, high = busy->len, middle;
+
+    while (low < high) { // the first range that ends at start or later
+        middle = (low + high) / 2;
+        if (busy->ends[middle] < start)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < busy->len && busy->starts[low] <= end;
+}
+
+static void spill(RegisterAllocator *ra, LiveInterval *interval) {
+    ra->function->frame_size += SLOT_SIZE;
+    interval->slot = -(int) ra->function->frame_size;
+    interval->reg = NO_REGISTER;
+}
+
+static unsigned int choose_register(RegisterAllocator *ra, const LiveInterval *interval, const char *taken) {
+    unsigned int hint = interval->hint, reg;
+    size_t i;
+
+    if (hint != NO_REGISTER && IS_VIRTUAL_REGISTER(hint))
+        hint = ra->intervals[hint - FIRST_VIRTUAL_REGISTER].reg;
+    if (hint != NO_REGISTER && is_allocatable(hint) && !taken[hint] &&
+        !is_busy(ra, hint, interval->start, interval->end))
+        return hint;
+    for (i = 0; i < ALLOCATABLE_LEN; i++) {
+        reg = allocatable_registers[i];
+        if (!taken[reg] && !is_busy(ra, reg, interval->start, interval->end))
+            return reg;
+    }
+    return NO_REGISTER;
+}
+
+/*
+Adds `index` to the active intervals, sorted by end.
+*/
+static void activate(RegisterAllocator *ra, size_t *active, size_t *active_len, size_t index) {
+    size_t i = (*active_len)++;
+
+    for (; i > 0 && ra->intervals[active[i - 1]].end > ra->intervals[index].end; i--)
+        active[i] = active[i - 1];
+    active[i] = index;
+}
+
+static void linear_scan(RegisterAllocator *ra) {
+    size_t registers_len = ra->function->registers_len, positions = DEF_POSITION(ra->function->len) + 1;
+    size_t *starts = allocate(positions + 1, sizeof(size_t)), *order = allocate(registers_len, sizeof(size_t));
+    size_t active[ALLOCATABLE_LEN], active_len = 0, order_len = 0, i, k, r;
+    char taken[REGISTERS_LEN] = {0};
+    LiveInterval *interval, *victim;
+    unsigned int reg;
+
+    // counting sort by start
+    for (r = 0; r < registers_len; r++) {
+        if (ra->intervals[r].start != NONE)
+            starts[ra->intervals[r].start + 1]++;
+    }
+    for (i = 0; i < positions; i++)
+        starts[i + 1] += starts[i];
+    for (r = 0; r < registers_len; r++) {
+        if (ra->intervals[r].start != NONE) {
+            order[starts[ra->intervals[r].start]++] = r;
+            order_len++;
+        }
+    }
+
+    for (i = 0; i < order_len; i++) {
+        interval = &ra->intervals[order[i]];
+        while (active_len > 0 && ra->intervals[active[0]].end < interval->start) {
+            taken[ra->intervals[active[0]].reg] = 0;
+            memmove(active, active + 1, --active_len * sizeof(size_t));
+        }
+
+        reg = choose_register(ra, interval, taken);
+        if (reg == NO_REGISTER) {
+            // take the register of the interval that ends last, if it ends after this one
+            for (k = active_len; k-- > 0;) {
+                victim = &ra->intervals[active[k]];
+                if (victim->end <= interval->end)
+                    break;
+                if (!is_busy(ra, victim->reg, interval->start, interval->end)) {
+                    reg = victim->reg;
+                    spill(ra, victim);
+                    memmove(active + k, active + k + 1, (--active_len - k) * sizeof(size_t));
+                    break;
+                }
+            }
+        }
+        if (reg == NO_REGISTER) {
+            spill(ra, interval);
+            continue;
+        }
+        interval->reg = reg;
+        taken[reg] = 1;
+        if (IS_CALLEE_SAVED(reg))
+            ra->callee_saved |= 1u << reg;
+        activate(ra, active, &active_len, order[i]);
+    }
+    free(starts);
+    free(order);
+}
+
+static MachineOperand allocated_operand(const RegisterAllocator *ra, MachineOperand operand) {
+    unsigned int r = virtual_register(&operand);
+
+    if (r == NO_REGISTER)
+        return operand;
+    if (ra->intervals[r].reg != NO_REGISTER)
+        return operand_register(ra->intervals[r].reg, operand.size);
+    return operand_memory(REG_RBP, ra->intervals[r].slot, operand.size);
+}
+
+/*
+Replaces the virtual registers. Spilled ones become frame slots, through the
+scratch register where x86 needs a register.
+*/
+static void rewrite_code(RegisterAllocator *ra) {
+    MachineFunction *function = ra->function;
+    MachineInstruction *code = function->code, instruction;
+    MachineOperand scratch;
+    size_t len = function->len, i, index;
+
+    function->code = NULL;
+    function->len = function->capacity = 0;
+    for (i = 0; i < len; i++) {
+        instruction = code[i];
+        instruction.dst = allocated_operand(ra, instruction.dst);
+        instruction.src = allocated_operand(ra, instruction.src);
+
+        if (instruction.op == X86_MOV && instruction.dst.kind == OPERAND_REGISTER &&
+            instruction.src.kind == OPERAND_REGISTER && instruction.dst.reg == instruction.src.reg &&
+            instruction.dst.size == instruction.src.size)
+            continue;
+        if (instruction.dst.kind == OPERAND_MEMORY &&
+            (instruction.op == X86_IMUL || instruction.op == X86_MOVZX || instruction.op == X86_LEA)) {
+            // the destination must be a register
+            scratch = operand_register(SCRATCH_REGISTER, instruction.dst.size);
+            if (instruction.op == X86_IMUL)
+                machine_emit(function, X86_MOV, scratch, instruction.dst);
+            machine_emit(function, instruction.op, scratch, instruction.src);
+            machine_emit(function, X86_MOV, instruction.dst, scratch);
+            continue;
+        }
+        if (instruction.dst.kind == OPERAND_MEMORY && instruction.src.kind == OPERAND_MEMORY) {
+            scratch = operand_register(SCRATCH_REGISTER, instruction.src.size);
+            machine_emit(function, X86_MOV, scratch, instruction.src);
+            instruction.src = scratch;
+        }
+        index = machine_emit(function, instruction.op, instruction.dst, instruction.src);
+        function->code[index].cond = instruction.cond;
+    }
+    free(code);
+}
+
+/*
+Replaces the virtual registers of `function` with physical registers and frame slots,
+which grow its frame. Returns the mask of the callee saved registers it now uses,
+which the prologue has to save.
+*/
+unsigned int allocate_registers(MachineFunction *function) {
+    RegisterAllocator ra = {.function = function};
+    unsigned int r;
+
+    if (function->registers_len == 0 || function->len == 0)
+        return 0;
+    ra.intervals = allocate(function->registers_len, sizeof(LiveInterval));
+    for (r = 0; r < function->registers_len; r++)
+        ra.intervals[r] = (LiveInterval) {.start = NONE, .end = NONE, .reg = NO_REGISTER, .hint = NO_REGISTER};
+
+    build_blocks(&ra);
+    scan_blocks(&ra);
+    compute_liveness(&ra);
+    compute_busy_ranges(&ra);
+    linear_scan(&ra);
+    rewrite_code(&ra);
+
+    free(ra.blocks);
+    free(ra.predecessors);
+    free(ra.predecessors_start);
+    free(ra.intervals);
+    free(ra.exposed);
+    free(ra.defined);
+    for (r = 0; r < REGISTERS_LEN; r++) {
+        free(ra.busy[r].starts);
+        free(ra.busy[r].ends);
+    }
+    return ra.callee_saved;
+}
@@ -0,0 +1,11 @@
+#ifndef INFINITY_COMPILER_REGALLOC_H
+#define INFINITY_COMPILER_REGALLOC_H
+
+#include "../codegen/machine.h"
+
+#define SCRATCH_REGISTER REG_R11 // reloads spilled operands, never allocated
+#define IS_CALLEE_SAVED(reg) ((reg) == REG_RBX || (reg) == REG_RBP || ((reg) >= REG_R12 && (reg) <= REG_R15))
+
+unsigned int allocate_registers(MachineFunction *function);
+
+#endif //INFINITY_COMPILER_REGALLOC_H
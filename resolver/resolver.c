@@ -0,0 +1,257 @@
+#include "resolver.h"
+#include "../symbol_table/symbol_table.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include "../visitor/visitor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Name resolution.
+Binds every use of a name to its declaration: variable expressions and
+assignments to their `Variable`, function calls to their signature and
+definition. Functions are visible in the whole module (and its dependents),
+variables from their declaration to the end of their block.
+*/
+
+typedef struct {
+    SymbolTable *table;
+    const char *src;
+    AstNode *definition; // the function being resolved, NULL for top level statements
+} Resolver;
+
+static void resolve_error(Resolver *resolver, const AstNode *node, const char *msg) {
+    throw_exception_at(SEMANTIC_ANALYZER, resolver->src, node->row, node->col, msg);
+}
+
+static Variable *resolve_variable(Resolver *resolver, const AstNode *node, const char *name) {
+    Symbol *symbol = symbol_table_lookup(resolver->table, name);
+    char *errMsg;
+
+    if (!symbol) {
+        alsprintf(&errMsg, "Unknown variable '%s'", name);
+        resolve_error(resolver, node, errMsg);
+    }
+    if (symbol->kind != SYMBOL_VARIABLE) {
+        alsprintf(&errMsg, "'%s' is a function, not a variable", name);
+        resolve_error(resolver, node, errMsg);
+    }
+    return symbol->variable;
+}
+
+static void declare_variable(Resolver *resolver, const AstNode *node, Variable *variable) {
+    char *errMsg;
+
+    if (!symbol_table_declare_variable(resolver->table, variable)) {
+        alsprintf(&errMsg, "'%s' is already declared in this scope", variable->name);
+        resolve_error(resolver, node, errMsg);
+    }
+}
+
+static void resolve_function_call(Resolver *resolver, AstNode *node) {
+    FunctionCall *call = &node->data.function_call;
+    Symbol *symbol = symbol_table_lookup(resolver->table, call->func_name);
+    char *errMsg;
+
+    if (!symbol && !strcmp(call->func_name, PRINT_FUNCTION)) {
+        if (call->args->size != 1)
+            resolve_error(resolver, node, "print takes exactly one argument");
+    } else if (!symbol) {
+        alsprintf(&errMsg, "Unknown function '%s'", call->func_name);
+        resolve_error(resolver, node, errMsg);
+    } else if (symbol->kind != SYMBOL_FUNCTION) {
+        alsprintf(&errMsg, "'%s' is a variable, not a function", call->func_name);
+        resolve_error(resolver, node, errMsg);
+    } else {
+        if (call->args->size != symbol->signature->args_len) {
+            alsprintf(&errMsg, "Function '%s' takes %zu arguments, got %zu",
+                      call->func_name, symbol->signature->args_len, call->args->size);
+            resolve_error(resolver, node, errMsg);
+        }
+        call->signature = symbol->signature;
+        call->definition = symbol->definition;
+    }
+}
+
+static void enter_function(Resolver *resolver, AstNode *node) {
+    FunctionDefinition *definition = &node->data.function_definition;
+    size_t i;
+
+    // top level functions are declared and resolved separately
+    if (node != resolver->definition)
+        resolve_error(resolver, node, "Functions can only be defined at the top level");
+    // the arguments are in the same scope as the body, so the body can't redeclare them
+    symbol_table_enter_scope(resolver->table);
+    for (i = 0; i < definition->args->size; i++)
+        declare_variable(resolver, node, definition->args->items[i]);
+}
+
+/*
+Called before the children of `node`: uses are resolved in source order.
+*/
+static int resolve_node(AstNode *node, void *context) {
+    Resolver *resolver = context;
+
+    switch (node->type) {
+        case AST_EXPRESSION:
+            if (node->data.expression.kind == EXPRESSION_VARIABLE)
+                node->data.expression.variable = resolve_variable(resolver, node,
+                                                                  node->data.expression.variable_name);
+            break;
+        case AST_ASSIGNMENT:
+            node->data.assignment.variable = resolve_variable(resolver, node,
+                                                              node->data.assignment.dst_variable->value);
+            break;
+        case AST_FUNCTION_CALL:
+            resolve_function_call(resolver, node);
+            break;
+        case AST_FUNCTION_DEFINITION:
+            enter_function(resolver, node);
+            break;
+        case AST_LOOP_STATEMENT:
+            // the variable declared by the initializer is visible in the whole loop, and only there
+            symbol_table_enter_scope(resolver->table);
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/*
+Called after the children of `node`.
+*/
+static void leave_node(AstNode *node, void *context) {
+    Resolver *resolver = context;
+
+    switch (node->type) {
+        case AST_VARIABLE_DECLARATION:
+            // after the initializer, so it can't see the variable it initializes
+            declare_variable(resolver, node, node->data.variable_declaration.var);
+            break;
+        case AST_FUNCTION_DEFINITION:
+        case AST_LOOP_STATEMENT:
+            symbol_table_exit_scope(resolver->table);
+            break;
+        default:
+            break;
+    }
+}
+
+static void enter_block(AstNode *owner, List *block, void *context) {
+    Resolver *resolver = context;
+    if (owner->type == AST_IF_STATEMENT || owner->type == AST_LOOP_STATEMENT)
+        symbol_table_enter_scope(resolver->table);
+}
+
+static void exit_block(AstNode *owner, List *block, void *context) {
+    Resolver *resolver = context;
+    if (owner->type == AST_IF_STATEMENT || owner->type == AST_LOOP_STATEMENT)
+        symbol_table_exit_scope(resolver->table);
+}
+
+/*
+Resolves `node`, a top level statement or, if `definition` is `node`, a top level function.
+*/
+static void resolve_statement(Resolver *resolver, AstNode *node, AstNode *definition) {
+    AstVisitor visitor = {.pre = resolve_node, .post = leave_node, .enter_block = enter_block,
+                          .exit_block = exit_block, .context = resolver};
+
+    resolver->definition = definition;
+    ast_walk(node, &visitor);
+}
+
+/*
+Declares the imported functions and the functions of the module,
+so they can be called before (or without) their definition in the file.
+*/
+static void declare_functions(Resolver *resolver, Module *module) {
+    FunctionSignature *signature;
+    AstNode *child;
+    char *errMsg;
+    size_t i, j = 0;
+
+    for (i = 0; i < module->imported_functions->size; i++) {
+        signature = module->imported_functions->items[i];
+        if (!symbol_table_declare_function(resolver->table, signature, NULL)) {
+            alsprintf(&errMsg, "Function '%s' is imported from more than one module.", signature->name);
+            log_error(SEMANTIC_ANALYZER, errMsg);
+        }
+    }
+
+    // kept across resolutions of the same tree, calls outside the resolved functions refer to it
+    if (!module->interface)
+        module->interface = interface_from_ast(module->root);
+    for (i = 0; i < module->root->data.compound.children->size; i++) {
+        child = module->root->data.compound.children->items[i];
+        if (child->type != AST_FUNCTION_DEFINITION)
+            continue;
+        // the interface has the signatures of the top level functions, in order
+        signature = module->interface->items[j++];
+        if (!symbol_table_declare_function(resolver->table, signature, child)) {
+            alsprintf(&errMsg, "Function '%s' is already defined", signature->name);
+            resolve_error(resolver, child, errMsg);
+        }
+    }
+}
+
+/*
+Declares the functions and resolves the top level statements.
+The top level statements run before any function is called,
+so function bodies see every top level variable.
+*/
+static void resolve_top_level(Resolver *resolver, Module *module) {
+    List *children = module->root->data.compound.children;
+    AstNode *child;
+    size_t i;
+
+    declare_functions(resolver, module);
+    for (i = 0; i < children->size; i++) {
+        child = children->items[i];
+        if (child->type != AST_FUNCTION_DEFINITION)
+            resolve_statement(resolver, child, NULL);
+    }
+}
+
+/*
+Resolves the names of a parsed module.
+*/
+void resolve_module(Module *module) {
+    Resolver resolver = {.table = init_symbol_table(), .src = module->src};
+    List *children = module->root->data.compound.children;
+    AstNode *child;
+    size_t i;
+
+    if (module->interface) { // the tree was changed since the last resolution
+        for (i = 0; i < module->interface->size; i++)
+            function_signature_dispose(module->interface->items[i]);
+        free(module->interface->items);
+        free(module->interface);
+        module->interface = NULL;
+    }
+
+    resolve_top_level(&resolver, module);
+    for (i = 0; i < children->size; i++) {
+        child = children->items[i];
+        if (child->type == AST_FUNCTION_DEFINITION)
+            resolve_statement(&resolver, child, child);
+    }
+
+    symbol_table_dispose(resolver.table);
+}
+
+/*
+Resolves only the bodies of `definitions`, functions of a module that was
+resolved before and whose function signatures didn't change since.
+*/
+void resolve_functions(Module *module, const List *definitions) {
+    Resolver resolver = {.table = init_symbol_table(), .src = module->src};
+    size_t i;
+
+    resolve_top_level(&resolver, module);
+    for (i = 0; i < definitions->size; i++)
+        resolve_statement(&resolver, definitions->items[i], definitions->items[i]);
+
+    symbol_table_dispose(resolver.table);
+}
@@ -0,0 +1,10 @@
+#ifndef INFINITY_COMPILER_RESOLVER_H
+#define INFINITY_COMPILER_RESOLVER_H
+
+#include "../module/module.h"
+
+void resolve_module(Module *module);
+
+void resolve_functions(Module *module, const List *definitions);
+
+#endif //INFINITY_COMPILER_RESOLVER_H
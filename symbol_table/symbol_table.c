@@ -0,0 +1,108 @@
+#include "symbol_table.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdlib.h>
+
+#define INITIAL_SYMBOLS_CAPACITY 64
+#define INITIAL_SCOPES_CAPACITY 16
+
+SymbolTable *init_symbol_table() {
+    SymbolTable *table = malloc(sizeof(SymbolTable));
+    if (!table)
+        log_error(SEMANTIC_ANALYZER, "Can't allocate memory for symbol table.");
+
+    table->visible = init_hashmap(INITIAL_SYMBOLS_CAPACITY);
+    table->declared = malloc(INITIAL_SYMBOLS_CAPACITY * sizeof(Symbol *));
+    table->declared_len = 0;
+    table->declared_capacity = INITIAL_SYMBOLS_CAPACITY;
+    table->scope_starts = malloc(INITIAL_SCOPES_CAPACITY * sizeof(size_t));
+    table->depth = 0;
+    table->scopes_capacity = INITIAL_SCOPES_CAPACITY;
+    if (!table->declared || !table->scope_starts)
+        log_error(SEMANTIC_ANALYZER, "Can't allocate memory for symbol table.");
+
+    return table;
+}
+
+void symbol_table_dispose(SymbolTable *table) {
+    size_t i;
+    for (i = 0; i < table->declared_len; i++)
+        free(table->declared[i]);
+    free(table->declared);
+    free(table->scope_starts);
+    hashmap_dispose(table->visible);
+    free(table);
+}
+
+void symbol_table_enter_scope(SymbolTable *table) {
+    if (table->depth == table->scopes_capacity) {
+        table->scopes_capacity *= 2;
+        table->scope_starts = realloc(table->scope_starts, table->scopes_capacity * sizeof(size_t));
+        if (!table->scope_starts)
+            log_error(SEMANTIC_ANALYZER, "Can't allocate memory for symbol table.");
+    }
+    table->scope_starts[table->depth++] = table->declared_len;
+}
+
+/*
+Drops the symbols of the innermost scope,
+making the symbols they shadowed visible again.
+*/
+void symbol_table_exit_scope(SymbolTable *table) {
+    size_t start = table->scope_starts[--table->depth];
+    Symbol *symbol;
+
+    while (table->declared_len > start) {
+        symbol = table->declared[--table->declared_len];
+        hashmap_put(table->visible, symbol->name, symbol->shadowed);
+        free(symbol);
+    }
+}
+
+Symbol *symbol_table_lookup(const SymbolTable *table, const char *name) {
+    return hashmap_get(table->visible, name);
+}
+
+/*
+Returns the new symbol, or NULL if `name` is already declared in the current scope.
+*/
+static Symbol *symbol_table_declare(SymbolTable *table, SymbolKind kind, const char *name) {
+    Symbol *symbol, *outer = hashmap_get(table->visible, name);
+
+    if (outer && outer->depth == table->depth)
+        return NULL;
+
+    symbol = calloc(1, sizeof(Symbol));
+    if (!symbol)
+        log_error(SEMANTIC_ANALYZER, "Can't allocate memory for symbol.");
+    symbol->kind = kind;
+    symbol->name = name;
+    symbol->depth = table->depth;
+    symbol->shadowed = outer;
+
+    if (table->declared_len == table->declared_capacity) {
+        table->declared_capacity *= 2;
+        table->declared = realloc(table->declared, table->declared_capacity * sizeof(Symbol *));
+        if (!table->declared)
+            log_error(SEMANTIC_ANALYZER, "Can't allocate memory for symbol table.");
+    }
+    table->declared[table->declared_len++] = symbol;
+    hashmap_put(table->visible, name, symbol);
+    return symbol;
+}
+
+Symbol *symbol_table_declare_variable(SymbolTable *table, Variable *variable) {
+    Symbol *symbol = symbol_table_declare(table, SYMBOL_VARIABLE, variable->name);
+    if (symbol)
+        symbol->variable = variable;
+    return symbol;
+}
+
+Symbol *symbol_table_declare_function(SymbolTable *table, FunctionSignature *signature, AstNode *definition) {
+    Symbol *symbol = symbol_table_declare(table, SYMBOL_FUNCTION, signature->name);
+    if (symbol) {
+        symbol->signature = signature;
+        symbol->definition = definition;
+    }
+    return symbol;
+}
@@ -0,0 +1,60 @@
+#ifndef INFINITY_COMPILER_SYMBOL_TABLE_H
+#define INFINITY_COMPILER_SYMBOL_TABLE_H
+
+#include "../hashmap/hashmap.h"
+#include "../module/interface.h"
+#include "../variable/variable.h"
+
+typedef enum {
+    SYMBOL_VARIABLE,
+    SYMBOL_FUNCTION,
+} SymbolKind;
+
+typedef struct SymbolStruct Symbol;
+
+/**
+\Symbol
+ A declared name, and what it refers to.
+*/
+struct SymbolStruct {
+    SymbolKind kind;
+    const char *name;
+    size_t depth;                 // depth of the declaring scope, 0 is the top level
+    Variable *variable;           // SYMBOL_VARIABLE
+    FunctionSignature *signature; // SYMBOL_FUNCTION
+    AstNode *definition;          // SYMBOL_FUNCTION, NULL if the function is imported
+    Symbol *shadowed;             // the symbol with the same name in an outer scope
+};
+
+/**
+\SymbolTable
+ One flat table of the visible symbols, with shadow chains.
+ Declaring a name that is declared in an outer scope hides the outer symbol
+ until the scope ends, so lookups are a single hash map access
+ no matter how deep the scopes are nested.
+*/
+typedef struct {
+    HashMap *visible;     // name -> innermost Symbol, NULL once it went out of scope
+    Symbol **declared;    // stack of the symbols of all the open scopes, in declaration order
+    size_t declared_len;
+    size_t declared_capacity;
+    size_t *scope_starts; // index in `declared` of the first symbol of every open scope
+    size_t depth;         // number of open scopes, besides the top level
+    size_t scopes_capacity;
+} SymbolTable;
+
+SymbolTable *init_symbol_table();
+
+void symbol_table_dispose(SymbolTable *table);
+
+void symbol_table_enter_scope(SymbolTable *table);
+
+void symbol_table_exit_scope(SymbolTable *table);
+
+Symbol *symbol_table_lookup(const SymbolTable *table, const char *name);
+
+Symbol *symbol_table_declare_variable(SymbolTable *table, Variable *variable);
+
+Symbol *symbol_table_declare_function(SymbolTable *table, FunctionSignature *signature, AstNode *definition);
+
+#endif //INFINITY_COMPILER_SYMBOL_TABLE_H
@@ -0,0 +1,32 @@
+# Compares the assembly of a program with a golden file, and assembles it when
+# the assembler is there.
+#   cmake -DCOMPILER=<compiler> -DPROGRAM=<file.txt> -DSYNTAX=<gas|nasm> -DWORK_DIR=<dir>
+#         [-DASSEMBLER=<command>] -P check_asm.cmake
+# The golden file is <program>.<syntax>.expected.
+
+get_filename_component(name "${PROGRAM}" NAME_WE)
+get_filename_component(directory "${PROGRAM}" DIRECTORY)
+file(MAKE_DIRECTORY "${WORK_DIR}")
+set(source "${WORK_DIR}/${name}.txt")
+set(assembly "${WORK_DIR}/${name}.${SYNTAX}")
+configure_file("${PROGRAM}" "${source}" COPYONLY)
+
+execute_process(COMMAND "${COMPILER}" -S --asm-syntax=${SYNTAX} -o "${assembly}" "${source}"
+                OUTPUT_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+if (NOT result EQUAL 0)
+    message(FATAL_ERROR "-S failed (${result}):\n${output}")
+endif ()
+file(READ "${assembly}" actual)
+file(READ "${directory}/${name}.${SYNTAX}.expected" expected)
+if (NOT actual STREQUAL expected)
+    message(FATAL_ERROR "${assembly} differs from ${name}.${SYNTAX}.expected")
+endif ()
+
+if (ASSEMBLER)
+    separate_arguments(assembler UNIX_COMMAND "${ASSEMBLER}")
+    execute_process(COMMAND ${assembler} "${assembly}" -o "${WORK_DIR}/${name}.o"
+                    OUTPUT_VARIABLE output ERROR_VARIABLE output RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${ASSEMBLER} rejected ${assembly}:\n${output}")
+    endif ()
+endif ()
@@ -0,0 +1,50 @@
+# Checks the modules of modules/ again after edits, and counts the modules parsed:
+# an import whose interface file is up to date is only parsed when code is generated
+# from it, and an edited signature checks its dependents again.
+#   cmake -DCOMPILER=<compiler> -DMODULES=<dir> -DWORK_DIR=<dir> -P check_interfaces.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(COPY "${MODULES}/" DESTINATION "${WORK_DIR}")
+set(main "${WORK_DIR}/main.txt")
+set(util "${WORK_DIR}/util.txt")
+
+# Compiles main.txt with the options after the arguments, expects it to parse `parsed`
+# modules (0 to skip the count) and to exit with `expected_result`. Sets `output`.
+function(compile_main parsed expected_result)
+    execute_process(COMMAND "${COMPILER}" --time-report ${ARGN} "${main}"
+                    OUTPUT_VARIABLE out ERROR_VARIABLE out RESULT_VARIABLE result TIMEOUT 60)
+    if (NOT result EQUAL expected_result)
+        message(FATAL_ERROR "Expected exit ${expected_result}, got ${result} (${ARGN}):\n${out}")
+    endif ()
+    if (parsed GREATER 0)
+        string(REGEX MATCH "lex\\+parse +([0-9]+)" match "${out}")
+        if (NOT CMAKE_MATCH_1 EQUAL parsed)
+            message(FATAL_ERROR "Expected ${parsed} modules parsed, got '${CMAKE_MATCH_1}' (${ARGN}):\n${out}")
+        endif ()
+    endif ()
+    set(output "${out}" PARENT_SCOPE)
+endfunction()
+
+function(edit_util from to)
+    file(READ "${util}" src)
+    string(REPLACE "${from}" "${to}" src "${src}")
+    file(WRITE "${util}" "${src}")
+endfunction()
+
+compile_main(3 0)
+# nothing changed, only the root is parsed
+compile_main(1 0)
+# a new body keeps the interface of util, so lib is still up to date
+edit_util("a * 2" "a + a")
+compile_main(2 0)
+# running needs every tree
+compile_main(3 0 --run)
+if (NOT output MATCHES "^12\n")
+    message(FATAL_ERROR "Expected 12 from --run:\n${output}")
+endif ()
+# a new signature of util must check lib again, whose call is wrong now
+edit_util("int a)" "int a, int b)")
+compile_main(0 1)
+if (NOT output MATCHES "takes 2 arguments, got 1")
+    message(FATAL_ERROR "Expected the call of lib to be wrong:\n${output}")
+endif ()
@@ -0,0 +1,62 @@
+# Runs one test program and compares what it prints and its exit code with
+# <program>.expected, whose last line is "exit <code>".
+#   cmake -DCOMPILER=<compiler> -DPROGRAM=<file.txt> -DMODE=<mode> -DWORK_DIR=<dir>
+#         [-DOPTIONS=<compiler options>] [-DC_COMPILER=<cc>] -P run_test.cmake
+# MODE is run (the bytecode VM), jit, object (-c, then linked with C_COMPILER),
+# assembly (-S, then assembled and linked with C_COMPILER) or ast_image (run twice
+# with --emit-ast-bin, the second run uses the AST image written by the first).
+# The program is copied to WORK_DIR first, as the compiler writes its interface file next to it.
+
+get_filename_component(name "${PROGRAM}" NAME_WE)
+file(MAKE_DIRECTORY "${WORK_DIR}")
+set(source "${WORK_DIR}/${name}.txt")
+configure_file("${PROGRAM}" "${source}" COPYONLY)
+separate_arguments(options UNIX_COMMAND "${OPTIONS}")
+
+if (MODE STREQUAL "run")
+    execute_process(COMMAND "${COMPILER}" ${options} --run "${source}"
+                    OUTPUT_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+elseif (MODE STREQUAL "ast_image")
+    file(REMOVE "${source}.astbin")
+    execute_process(COMMAND "${COMPILER}" ${options} --emit-ast-bin --run "${source}"
+                    OUTPUT_QUIET RESULT_VARIABLE result TIMEOUT 60)
+    if (NOT EXISTS "${source}.astbin")
+        message(FATAL_ERROR "--emit-ast-bin didn't write ${source}.astbin (${result})")
+    endif ()
+    execute_process(COMMAND "${COMPILER}" ${options} --emit-ast-bin --run "${source}"
+                    OUTPUT_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+elseif (MODE STREQUAL "jit")
+    execute_process(COMMAND "${COMPILER}" ${options} --jit "${source}"
+                    OUTPUT_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+elseif (MODE STREQUAL "object" OR MODE STREQUAL "assembly")
+    if (MODE STREQUAL "object")
+        set(output_file "${WORK_DIR}/${name}.o")
+        set(output_option -c)
+    else ()
+        set(output_file "${WORK_DIR}/${name}.s")
+        set(output_option -S)
+    endif ()
+    execute_process(COMMAND "${COMPILER}" ${options} ${output_option} -o "${output_file}" "${source}"
+                    OUTPUT_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "${output_option} failed (${result}):\n${output}")
+    endif ()
+    execute_process(COMMAND "${C_COMPILER}" "${output_file}" -o "${WORK_DIR}/${name}"
+                    OUTPUT_VARIABLE output ERROR_VARIABLE output RESULT_VARIABLE result)
+    if (NOT result EQUAL 0)
+        message(FATAL_ERROR "Linking failed:\n${output}")
+    endif ()
+    execute_process(COMMAND "${WORK_DIR}/${name}"
+                    OUTPUT_VARIABLE output RESULT_VARIABLE result TIMEOUT 60)
+else ()
+    message(FATAL_ERROR "Unknown mode '${MODE}'")
+endif ()
+
+get_filename_component(directory "${PROGRAM}" DIRECTORY)
+file(READ "${directory}/${name}.expected" expected)
+string(APPEND output "exit ${result}\n")
+if (NOT output STREQUAL expected)
+    file(WRITE "${WORK_DIR}/${name}.actual" "${output}")
+    message(FATAL_ERROR "Output of ${name} (${MODE} ${OPTIONS}) differs from ${name}.expected, "
+                        "see ${WORK_DIR}/${name}.actual:\n${output}")
+endif ()
@@ -10,6 +10,9 @@ Token *init_token(char *value, TokenType type) {
     }
     token->value = value;
     token->type = type;
+    token->row = 0;
+    token->col = 0;
+    token->idx = 0;
 
     return token;
 }
@@ -41,6 +44,18 @@ char *token_type_to_str(TokenType type) {
             return "<IF_KEYWORD>";
         case ELSE_KEYWORD:
             return "<ELSE_KEYWORD>";
+        case FOR_KEYWORD:
+            return "<FOR_KEYWORD>";
+        case WHILE_KEYWORD:
+            return "<WHILE_KEYWORD>";
+        case IMPORT_KEYWORD:
+            return "<IMPORT_KEYWORD>";
+        case DEFINE_KEYWORD:
+            return "<DEFINE_KEYWORD>";
+        case TRUE_KEYWORD:
+            return "<TRUE_KEYWORD>";
+        case FALSE_KEYWORD:
+            return "<FALSE_KEYWORD>";
         case L_PARENTHESES:
             return "<LEFT_PARENTHESES>";
         case R_PARENTHESES:
@@ -63,6 +78,8 @@ char *token_type_to_str(TokenType type) {
             return "<ASSIGNMENT>";
         case EQUALS:
             return "<EQUALS>";
+        case NOT_EQUALS:
+            return "<NOT_EQUALS>";
         case GRATER_THAN:
             return "<GRATER_THAN>";
         case GRATER_EQUAL:
@@ -71,6 +88,12 @@ char *token_type_to_str(TokenType type) {
             return "<LOWER_THAN>";
         case LOWER_EQUAL:
             return "<LOWER_EQUAL>";
+        case AND:
+            return "<AND>";
+        case OR:
+            return "<OR>";
+        case NOT:
+            return "<NOT>";
         case ADD:
             return "<ADD>";
         case SUB:
@@ -16,6 +16,12 @@ typedef enum TokenType {
     FUNC_KEYWORD,
     IF_KEYWORD,
     ELSE_KEYWORD,
+    FOR_KEYWORD,
+    WHILE_KEYWORD,
+    IMPORT_KEYWORD,
+    DEFINE_KEYWORD,
+    TRUE_KEYWORD,
+    FALSE_KEYWORD,
     /** Parentheses */
     L_PARENTHESES,     // (
     R_PARENTHESES,     // )
@@ -29,10 +35,14 @@ typedef enum TokenType {
     COLON,
     ASSIGNMENT, // =
     EQUALS,     // ==
+    NOT_EQUALS, // !=
     GRATER_THAN,
     LOWER_THAN,
     GRATER_EQUAL,
     LOWER_EQUAL,
+    AND, // &&
+    OR,  // ||
+    NOT, // !
     ADD,
     SUB,
     MUL,
@@ -47,6 +57,9 @@ typedef enum TokenType {
 typedef struct TokenStruct {
     TokenType type;
     char *value;
+    unsigned int row; // position of the first character of the token
+    unsigned int col;
+    unsigned int idx; // index of the first character of the token in the source
 } Token;
 
 Token *init_token(char *value, TokenType type);
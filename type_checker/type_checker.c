@@ -0,0 +1,246 @@
+#include "type_checker.h"
+#include "../module/interface.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include "../visitor/visitor.h"
+
+/*
+Type checking.
+Runs after name resolution, in a single post-order walk. The type of every
+expression and function call is computed once, from the types of its
+operands, and stored in `data_type` of its node, so later passes don't recompute it.
+int and char are both integers and convert to each other implicitly.
+*/
+
+typedef struct {
+    const char *src;
+    DataType return_type; // of the function being checked, void at the top level
+} TypeChecker;
+
+static void type_error(TypeChecker *checker, const AstNode *node, const char *msg) {
+    throw_exception_at(SEMANTIC_ANALYZER, checker->src, node->row, node->col, msg);
+}
+
+static int is_integer(DataType type) {
+    return type == TYPE_INT || type == TYPE_CHAR;
+}
+
+static int is_assignable(DataType dst, DataType src) {
+    return dst == src || (is_integer(dst) && is_integer(src));
+}
+
+static char *operator_to_str(TokenType operator) {
+    switch (operator) {
+        case ADD:
+            return "+";
+        case SUB:
+            return "-";
+        case MUL:
+            return "*";
+        case DIVIDE:
+            return "/";
+        case EQUALS:
+            return "==";
+        case NOT_EQUALS:
+            return "!=";
+        case GRATER_THAN:
+            return ">";
+        case LOWER_THAN:
+            return "<";
+        case GRATER_EQUAL:
+            return ">=";
+        case LOWER_EQUAL:
+            return "<=";
+        case AND:
+            return "&&";
+        case OR:
+            return "||";
+        case NOT:
+            return "!";
+        default:
+            return token_type_to_str(operator);
+    }
+}
+
+static void check_function_call(TypeChecker *checker, AstNode *node) {
+    FunctionCall *call = &node->data.function_call;
+    DataType arg_type;
+    char *errMsg;
+    size_t i;
+
+    for (i = 0; i < call->args->size; i++) {
+        arg_type = ((AstNode *) call->args->items[i])->data_type;
+        if (!call->signature) { // print
+            if (arg_type == TYPE_VOID)
+                type_error(checker, call->args->items[i], "Can't print a void value");
+        } else if (!is_assignable(call->signature->arg_types[i], arg_type)) {
+            alsprintf(&errMsg, "Argument %zu of '%s' must be '%s', got '%s'", i + 1, call->func_name,
+                      data_type_to_str(call->signature->arg_types[i]), data_type_to_str(arg_type));
+            type_error(checker, call->args->items[i], errMsg);
+        }
+    }
+    node->data_type = call->signature ? call->signature->return_type : TYPE_VOID;
+}
+
+static DataType check_binary_expression(TypeChecker *checker, AstNode *node) {
+    Expression *expr = &node->data.expression;
+    DataType left = expr->left->data_type;
+    DataType right = expr->right->data_type;
+    char *errMsg;
+
+    switch (expr->operator) {
+        case EQUALS:
+        case NOT_EQUALS:
+            if (!(is_integer(left) && is_integer(right)) && !(left == TYPE_BOOL && right == TYPE_BOOL))
+                break;
+            return TYPE_BOOL;
+        case AND:
+        case OR:
+            if (left != TYPE_BOOL || right != TYPE_BOOL)
+                break;
+            return TYPE_BOOL;
+        case GRATER_THAN:
+        case LOWER_THAN:
+        case GRATER_EQUAL:
+        case LOWER_EQUAL:
+            if (!is_integer(left) || !is_integer(right))
+                break;
+            return TYPE_BOOL;
+        default: // arithmetic
+            if (!is_integer(left) || !is_integer(right))
+                break;
+            return TYPE_INT;
+    }
+    alsprintf(&errMsg, "Invalid operands to '%s': '%s' and '%s'", operator_to_str(expr->operator),
+              data_type_to_str(left), data_type_to_str(right));
+    type_error(checker, node, errMsg);
+    return TYPE_VOID;
+}
+
+static void check_expression(TypeChecker *checker, AstNode *node) {
+    Expression *expr = &node->data.expression;
+    char *errMsg;
+
+    switch (expr->kind) {
+        case EXPRESSION_LITERAL:
+            node->data_type = expr->value->type;
+            break;
+        case EXPRESSION_VARIABLE:
+            node->data_type = expr->variable->value->type;
+            break;
+        case EXPRESSION_BINARY:
+            node->data_type = check_binary_expression(checker, node);
+            break;
+        case EXPRESSION_UNARY:
+            if (expr->operator == NOT) {
+                if (expr->left->data_type != TYPE_BOOL) {
+                    alsprintf(&errMsg, "Invalid operand to '!': '%s'", data_type_to_str(expr->left->data_type));
+                    type_error(checker, node, errMsg);
+                }
+                node->data_type = TYPE_BOOL;
+                break;
+            }
+            if (!is_integer(expr->left->data_type)) {
+                alsprintf(&errMsg, "Can't negate a '%s'", data_type_to_str(expr->left->data_type));
+                type_error(checker, node, errMsg);
+            }
+            node->data_type = TYPE_INT;
+            break;
+    }
+}
+
+static void check_assignment(TypeChecker *checker, const AstNode *node, const Variable *variable,
+                             const AstNode *value) {
+    DataType type = value->data_type;
+    char *errMsg;
+
+    if (!is_assignable(variable->value->type, type)) {
+        alsprintf(&errMsg, "Can't assign '%s' to '%s', of type '%s'", data_type_to_str(type),
+                  variable->name, data_type_to_str(variable->value->type));
+        type_error(checker, node, errMsg);
+    }
+}
+
+static void check_return(TypeChecker *checker, const AstNode *node) {
+    DataType type = node->data.return_statement.value_expr->data_type;
+    char *errMsg;
+
+    if (checker->return_type == TYPE_VOID && type != TYPE_VOID) {
+        type_error(checker, node, "Can't return a value from a void function");
+    } else if (!is_assignable(checker->return_type, type)) {
+        alsprintf(&errMsg, "Must return '%s', got '%s'", data_type_to_str(checker->return_type),
+                  data_type_to_str(type));
+        type_error(checker, node, errMsg);
+    }
+}
+
+static int enter_function(AstNode *node, void *context) {
+    TypeChecker *checker = context;
+
+    if (node->type == AST_FUNCTION_DEFINITION)
+        checker->return_type = node->data.function_definition.returnType;
+    return 0;
+}
+
+/*
+The condition of an if statement or a loop is checked before its body,
+so its errors come first, like in the source.
+*/
+static void check_condition(AstNode *owner, List *block, void *context) {
+    AstNode *condition;
+    char *errMsg;
+
+    if (owner->type == AST_IF_STATEMENT && block == owner->data.if_statement.body_node)
+        condition = owner->data.if_statement.condition;
+    else if (owner->type == AST_LOOP_STATEMENT)
+        condition = owner->data.loop_statement.condition;
+    else
+        return;
+    if (condition->data_type != TYPE_BOOL) {
+        alsprintf(&errMsg, "Condition must be 'bool', got '%s'", data_type_to_str(condition->data_type));
+        type_error(context, condition, errMsg);
+    }
+}
+
+/*
+Called after the children of `node` are checked.
+*/
+static void check_node(AstNode *node, void *context) {
+    TypeChecker *checker = context;
+
+    switch (node->type) {
+        case AST_EXPRESSION:
+            check_expression(checker, node);
+            break;
+        case AST_VARIABLE_DECLARATION:
+            check_assignment(checker, node, node->data.variable_declaration.var,
+                             node->data.variable_declaration.value);
+            break;
+        case AST_ASSIGNMENT:
+            check_assignment(checker, node, node->data.assignment.variable, node->data.assignment.expression);
+            break;
+        case AST_FUNCTION_DEFINITION:
+            checker->return_type = TYPE_VOID;
+            break;
+        case AST_FUNCTION_CALL:
+            check_function_call(checker, node);
+            break;
+        case AST_RETURN_STATEMENT:
+            check_return(checker, node);
+            break;
+        default: // compounds, if statements, loops, imports and noops
+            break;
+    }
+}
+
+/*
+Type checks a resolved module.
+`src` is the source of the module, for error messages.
+*/
+void type_check(AstNode *root, const char *src) {
+    TypeChecker checker = {.src = src, .return_type = TYPE_VOID};
+    AstVisitor visitor = {.pre = enter_function, .post = check_node, .enter_block = check_condition,
+                          .context = &checker};
+    ast_walk(root, &visitor);
+}
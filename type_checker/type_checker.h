@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_TYPE_CHECKER_H
+#define INFINITY_COMPILER_TYPE_CHECKER_H
+
+#include "../ast/ast.h"
+
+void type_check(AstNode *root, const char *src);
+
+#endif //INFINITY_COMPILER_TYPE_CHECKER_H
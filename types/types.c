@@ -20,23 +20,28 @@ void literal_value_dispose(LiteralValue *value) {
 
 Expression *init_expression_p() {
     Expression *expr = malloc(sizeof(Expression));
-    expr->tokens = init_list(sizeof(Token *));
+    if (!expr) {
+        printf("Cant allocate Expression\n");
+        exit(1);
+    }
+    *expr = init_expression();
     return expr;
 }
 
 Expression init_expression() {
     return (Expression) {
-            .tokens = init_list(sizeof(Token *)),
+            .kind = EXPRESSION_LITERAL,
     };
 }
 
 void expression_dispose(Expression *expr) {
-    list_dispose(expr->tokens);
     free(expr);
 }
 
 DataType token_type_to_data_type(TokenType type) {
     switch (type) {
+        case VOID_KEYWORD:
+            return TYPE_VOID;
         case INT_KEYWORD:
             return TYPE_INT;
         case STRING_KEYWORD:
@@ -49,3 +54,22 @@ DataType token_type_to_data_type(TokenType type) {
             return -1;
     }
 }
+
+char *data_type_to_str(DataType type) {
+    switch (type) {
+        case TYPE_VOID:
+            return "void";
+        case TYPE_INT:
+            return "int";
+        case TYPE_CHAR:
+            return "char";
+        case TYPE_STRING:
+            return "string";
+        case TYPE_BOOL:
+            return "bool";
+        case TYPE_DOUBLE:
+            return "double";
+        default:
+            return "unknown";
+    }
+}
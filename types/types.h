@@ -27,14 +27,32 @@ typedef struct {
     Value value;
 } LiteralValue;
 
+struct astNode;
+struct VariableStruct;
+
+typedef enum {
+    EXPRESSION_LITERAL,  // a constant value: 5, "hello", true
+    EXPRESSION_VARIABLE, // the value of a variable: x
+    EXPRESSION_BINARY,   // two operands and an operator: 5 + x
+    EXPRESSION_UNARY,    // an operator and one operand: -x
+} ExpressionKind;
+
 /*
 An `Expression` represents an expression with or without variables.
 Like: 5+7 or x*2-3
+Expressions are trees; the operands of binary and unary expressions
+are AST nodes (expressions or function calls).
+Expressions are most of the nodes of a tree, the small fields share the last 8 bytes.
 */
 typedef struct {
-    List *tokens;
-    LiteralValue *value;
-    int contains_variables; // contains variables, like: 2 * x + 3
+    struct astNode *left;   // left operand, or the operand of a unary expression
+    struct astNode *right;  // right operand of a binary expression
+    char *variable_name;    // variable expressions
+    struct VariableStruct *variable; // declaration of the variable, set by the resolver
+    LiteralValue *value;    // literal expressions
+    TokenType operator;     // binary and unary expressions
+    unsigned char kind;     // ExpressionKind
+    unsigned char contains_variables; // contains variables, like: 2 * x + 3
     // without variables: 5 - 8 / 4
 } Expression;
 
@@ -50,4 +68,6 @@ void expression_dispose(Expression *expr);
 
 DataType token_type_to_data_type(TokenType type);
 
+char *data_type_to_str(DataType type);
+
 #endif //INFINITY_COMPILER_TYPES_H
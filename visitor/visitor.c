@@ -0,0 +1,134 @@
+#include "visitor.h"
+#include "../logging/logging.h"
+#include <stdlib.h>
+
+/*
+Tree walks without recursion.
+The nodes still to visit are kept on a heap allocated stack, so the depth of
+the tree (long else if chains, long expressions) is only limited by memory.
+Every node is pushed with a step telling what to do when it is popped,
+the children are pushed in reverse so they are popped in source order.
+*/
+
+#define INITIAL_WALK_CAPACITY 64
+
+typedef enum {
+    WALK_NODE,        // call `pre`, push the post step and the children
+    WALK_POST,        // call `post`
+    WALK_ENTER_BLOCK, // call `enter_block`
+    WALK_EXIT_BLOCK,  // call `exit_block`
+} WalkStep;
+
+typedef struct {
+    WalkStep step;
+    AstNode *node;
+    List *block;
+} WalkFrame;
+
+typedef struct {
+    WalkFrame *frames;
+    size_t len;
+    size_t capacity;
+} WalkStack;
+
+static void walk_push(WalkStack *stack, WalkStep step, AstNode *node, List *block) {
+    if (step == WALK_NODE && !node)
+        return;
+    if (stack->len == stack->capacity) {
+        stack->capacity *= 2;
+        stack->frames = realloc(stack->frames, stack->capacity * sizeof(WalkFrame));
+        if (!stack->frames)
+            log_error(COMPILER, "Can't allocate memory for tree walk.");
+    }
+    stack->frames[stack->len++] = (WalkFrame) {.step = step, .node = node, .block = block};
+}
+
+static void walk_push_list(WalkStack *stack, List *nodes) {
+    size_t i;
+    for (i = nodes->size; i > 0; i--)
+        walk_push(stack, WALK_NODE, nodes->items[i - 1], NULL);
+}
+
+static void walk_push_block(WalkStack *stack, AstNode *owner, List *block) {
+    walk_push(stack, WALK_EXIT_BLOCK, owner, block);
+    walk_push_list(stack, block);
+    walk_push(stack, WALK_ENTER_BLOCK, owner, block);
+}
+
+static void walk_push_children(WalkStack *stack, AstNode *node) {
+    switch (node->type) {
+        case AST_COMPOUND:
+            walk_push_list(stack, node->data.compound.children);
+            break;
+        case AST_EXPRESSION:
+            walk_push(stack, WALK_NODE, node->data.expression.right, NULL);
+            walk_push(stack, WALK_NODE, node->data.expression.left, NULL);
+            break;
+        case AST_VARIABLE_DECLARATION:
+            walk_push(stack, WALK_NODE, node->data.variable_declaration.value, NULL);
+            break;
+        case AST_ASSIGNMENT:
+            walk_push(stack, WALK_NODE, node->data.assignment.expression, NULL);
+            break;
+        case AST_FUNCTION_DEFINITION:
+            walk_push_block(stack, node, node->data.function_definition.body);
+            break;
+        case AST_FUNCTION_CALL:
+            walk_push_list(stack, node->data.function_call.args);
+            break;
+        case AST_IF_STATEMENT:
+            walk_push_block(stack, node, node->data.if_statement.else_node);
+            walk_push_block(stack, node, node->data.if_statement.body_node);
+            walk_push(stack, WALK_NODE, node->data.if_statement.condition, NULL);
+            break;
+        case AST_LOOP_STATEMENT:
+            walk_push(stack, WALK_NODE, node->data.loop_statement.step, NULL);
+            walk_push_block(stack, node, node->data.loop_statement.body);
+            walk_push(stack, WALK_NODE, node->data.loop_statement.condition, NULL);
+            walk_push(stack, WALK_NODE, node->data.loop_statement.initializer, NULL);
+            break;
+        case AST_RETURN_STATEMENT:
+            walk_push(stack, WALK_NODE, node->data.return_statement.value_expr, NULL);
+            break;
+        default: // imports and noops
+            break;
+    }
+}
+
+/*
+Visits `root` and all of its descendants with `visitor`.
+*/
+void ast_walk(AstNode *root, const AstVisitor *visitor) {
+    WalkStack stack = {.frames = malloc(INITIAL_WALK_CAPACITY * sizeof(WalkFrame)), .len = 0,
+                       .capacity = INITIAL_WALK_CAPACITY};
+    WalkFrame frame;
+
+    if (!stack.frames)
+        log_error(COMPILER, "Can't allocate memory for tree walk.");
+
+    walk_push(&stack, WALK_NODE, root, NULL);
+    while (stack.len > 0) {
+        frame = stack.frames[--stack.len];
+        switch (frame.step) {
+            case WALK_NODE:
+                walk_push(&stack, WALK_POST, frame.node, NULL);
+                if (!visitor->pre || !visitor->pre(frame.node, visitor->context))
+                    walk_push_children(&stack, frame.node);
+                break;
+            case WALK_POST:
+                if (visitor->post)
+                    visitor->post(frame.node, visitor->context);
+                break;
+            case WALK_ENTER_BLOCK:
+                if (visitor->enter_block)
+                    visitor->enter_block(frame.node, frame.block, visitor->context);
+                break;
+            case WALK_EXIT_BLOCK:
+                if (visitor->exit_block)
+                    visitor->exit_block(frame.node, frame.block, visitor->context);
+                break;
+        }
+    }
+
+    free(stack.frames);
+}
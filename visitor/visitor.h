@@ -0,0 +1,27 @@
+#ifndef INFINITY_COMPILER_VISITOR_H
+#define INFINITY_COMPILER_VISITOR_H
+
+#include "../ast/ast.h"
+
+/**
+\AstVisitor
+ Callbacks of a tree walk, any of them may be NULL.\n
+ `pre` is called before the children of a node and `post` after them.
+ If `pre` returns nonzero, the children of the node are skipped (`post` is still called).\n
+ The statement lists of function bodies, if statements and loops are blocks:
+ `enter_block` and `exit_block` are called around each of them, with the node that owns it.\n
+ The children of a node are visited in source order, an if statement's
+ condition first, then its body, then its else block. A loop's step is
+ visited last, after its body, like it runs.
+*/
+typedef struct {
+    int (*pre)(AstNode *node, void *context);
+    void (*post)(AstNode *node, void *context);
+    void (*enter_block)(AstNode *owner, List *block, void *context);
+    void (*exit_block)(AstNode *owner, List *block, void *context);
+    void *context;
+} AstVisitor;
+
+void ast_walk(AstNode *root, const AstVisitor *visitor);
+
+#endif //INFINITY_COMPILER_VISITOR_H
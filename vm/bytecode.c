@@ -0,0 +1,618 @@
+#include "bytecode.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include "../io/io.h"
+#include "../visitor/visitor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+\Binding
+ A variable that is visible to the code being compiled.
+*/
+typedef struct {
+    char *name;
+    size_t slot;
+    DataType type;
+    int global;
+} Binding;
+
+typedef struct {
+    Program *program;
+    BytecodeFunction *function; // the function being compiled
+    List *locals;               // Bindings of the current function, innermost last
+    List *globals;              // Bindings of the top level variables of the current module
+    size_t depth;               // nesting of blocks, top level variables are global
+    size_t stack_depth;         // operand stack depth at the current instruction
+    const char *src;            // source of the current module, for error messages
+    size_t value_depth;         // number of enclosing nodes that use the value of the current one
+    List *jumps;                // jump chains of the enclosing if statements and loops, and loop tops, to patch
+    List *scopes;               // size of `locals` when each enclosing block was entered
+    AstNode *condition;         // of the if statement or loop being walked, the walk skips it
+} BytecodeCompiler;
+
+size_t opcode_operands_len(OpCode op) {
+    switch (op) {
+        case OP_CONST:
+        case OP_STRING:
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_LOAD_GLOBAL:
+        case OP_STORE_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_CALL:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+char *opcode_to_str(OpCode op) {
+    static char *names[] = {
+            "CONST", "STRING", "LOAD", "STORE", "LOAD_GLOBAL", "STORE_GLOBAL",
+            "ADD", "SUB", "MUL", "DIV", "NEG", "EQ", "NE", "LT", "GT", "LE", "GE",
+            "JUMP", "JUMP_IF_FALSE", "JUMP_IF_TRUE", "CALL", "RETURN", "POP",
+            "PRINT_INT", "PRINT_BOOL", "PRINT_STRING",
+    };
+    return op < OPCODES_LEN ? names[op] : "UNKNOWN";
+}
+
+static BytecodeFunction *init_bytecode_function(char *name, DataType return_type, size_t args_len) {
+    BytecodeFunction *function = calloc(1, sizeof(BytecodeFunction));
+    if (!function)
+        log_error(CODE_GENERATOR, "Can't allocate memory for bytecode function.");
+
+    function->name = name;
+    function->return_type = return_type;
+    function->args_len = args_len;
+    function->locals_len = args_len;
+    return function;
+}
+
+static void bytecode_function_dispose(BytecodeFunction *function) {
+    free(function->code);
+    free(function);
+}
+
+static void emit_bytes(BytecodeCompiler *compiler, const unsigned char *bytes, size_t len) {
+    BytecodeFunction *function = compiler->function;
+
+    if (function->code_len + len > function->code_capacity) {
+        function->code_capacity = MAX(function->code_capacity * 2, 64);
+        function->code = realloc(function->code, function->code_capacity);
+        if (!function->code)
+            log_error(CODE_GENERATOR, "Can't allocate memory for bytecode.");
+    }
+    memcpy(function->code + function->code_len, bytes, len);
+    function->code_len += len;
+}
+
+/*
+Emits an instruction and keeps track of the operand stack depth,
+`stack_effect` is how many values the instruction pushes minus how many it pops.
+Returns the offset of the operand, for patching jumps.
+*/
+static size_t emit(BytecodeCompiler *compiler, OpCode op, unsigned long operand, long stack_effect) {
+    unsigned char bytes[5];
+    size_t i, operands_len = opcode_operands_len(op);
+
+    bytes[0] = op;
+    for (i = 0; i < operands_len; i++)
+        bytes[1 + i] = (operand >> (8 * i)) & 0xff;
+    emit_bytes(compiler, bytes, 1 + operands_len);
+
+    compiler->stack_depth += stack_effect;
+    compiler->function->max_stack = MAX(compiler->function->max_stack, compiler->stack_depth);
+    return compiler->function->code_len - operands_len;
+}
+
+static void patch_jump(BytecodeCompiler *compiler, size_t operand_offset) {
+    size_t i, target = compiler->function->code_len;
+    for (i = 0; i < 4; i++)
+        compiler->function->code[operand_offset + i] = (target >> (8 * i)) & 0xff;
+}
+
+/*
+The jumps that go to the same place are chained until it is known: the operand
+of each one holds the operand offset of the previous one, 0 ends the chain.
+*/
+static size_t emit_chained_jump(BytecodeCompiler *compiler, OpCode op, size_t chain) {
+    return emit(compiler, op, chain, op == OP_JUMP ? 0 : -1);
+}
+
+static void patch_chain(BytecodeCompiler *compiler, size_t chain) {
+    const unsigned char *operand;
+    size_t previous;
+
+    while (chain) {
+        operand = compiler->function->code + chain;
+        previous = operand[0] | operand[1] << 8 | (size_t) operand[2] << 16 | (size_t) operand[3] << 24;
+        patch_jump(compiler, chain);
+        chain = previous;
+    }
+}
+
+static void compile_error(BytecodeCompiler *compiler, const AstNode *node, const char *msg) {
+    throw_exception_at(CODE_GENERATOR, compiler->src, node->row, node->col, msg);
+}
+
+static Binding *lookup_variable(BytecodeCompiler *compiler, const char *name) {
+    size_t i;
+    Binding *binding;
+
+    for (i = compiler->locals->size; i-- > 0;) {
+        binding = compiler->locals->items[i];
+        if (!strcmp(binding->name, name))
+            return binding;
+    }
+    for (i = 0; i < compiler->globals->size; i++) {
+        binding = compiler->globals->items[i];
+        if (!strcmp(binding->name, name))
+            return binding;
+    }
+    return NULL;
+}
+
+static Binding *lookup_variable_or_fail(BytecodeCompiler *compiler, const AstNode *node, const char *name) {
+    Binding *binding = lookup_variable(compiler, name);
+    char *errMsg;
+
+    if (!binding) {
+        alsprintf(&errMsg, "Unknown variable '%s'", name);
+        compile_error(compiler, node, errMsg);
+    }
+    return binding;
+}
+
+static void bind_variable(BytecodeCompiler *compiler, Variable *var) {
+    Binding *binding = malloc(sizeof(Binding));
+
+    binding->name = var->name;
+    binding->type = var->value->type;
+    binding->global = compiler->function == compiler->program->init && compiler->depth == 0;
+    if (binding->global) {
+        binding->slot = compiler->program->globals_len++;
+        list_push(compiler->globals, binding);
+    } else {
+        binding->slot = compiler->function->locals_len++;
+        list_push(compiler->locals, binding);
+    }
+}
+
+/*
+Drops the bindings declared after the first `size` ones, at the end of a block.
+*/
+static void truncate_bindings(List *bindings, size_t size) {
+    while (bindings->size > size)
+        free(list_pop(bindings));
+}
+
+static long lookup_function(const Program *program, const char *name) {
+    return (long) (size_t) hashmap_get(program->function_ids, name) - 1;
+}
+
+static void compile_print(BytecodeCompiler *compiler, AstNode *node) {
+    List *args = node->data.function_call.args;
+
+    switch (((AstNode *) args->items[0])->data_type) {
+        case TYPE_BOOL:
+            emit(compiler, OP_PRINT_BOOL, 0, 0);
+            break;
+        case TYPE_STRING:
+            emit(compiler, OP_PRINT_STRING, 0, 0);
+            break;
+        default:
+            emit(compiler, OP_PRINT_INT, 0, 0);
+            break;
+    }
+}
+
+/*
+Called after the arguments are compiled.
+*/
+static void compile_function_call(BytecodeCompiler *compiler, AstNode *node) {
+    FunctionCall *call = &node->data.function_call;
+
+    // the resolver checked the function exists and the arguments count
+    if (!call->signature)
+        compile_print(compiler, node);
+    else
+        emit(compiler, OP_CALL, lookup_function(compiler->program, call->func_name), 1 - (long) call->args->size);
+    if (compiler->value_depth == 0) // a statement, the result is unused
+        emit(compiler, OP_POP, 0, -1);
+}
+
+static void compile_literal(BytecodeCompiler *compiler, const LiteralValue *value) {
+    switch (value->type) {
+        case TYPE_INT:
+            emit(compiler, OP_CONST, (unsigned int) value->value.integer_value, 1);
+            break;
+        case TYPE_CHAR:
+            emit(compiler, OP_CONST, (unsigned int) value->value.char_value, 1);
+            break;
+        case TYPE_BOOL:
+            emit(compiler, OP_CONST, value->value.bool_value != 0, 1);
+            break;
+        case TYPE_STRING:
+            list_push(compiler->program->strings, value->value.string_value);
+            emit(compiler, OP_STRING, compiler->program->strings->size - 1, 1);
+            break;
+        default: // void
+            emit(compiler, OP_CONST, 0, 1);
+            break;
+    }
+}
+
+static OpCode binary_opcode(TokenType operator) {
+    switch (operator) {
+        case ADD:
+            return OP_ADD;
+        case SUB:
+            return OP_SUB;
+        case MUL:
+            return OP_MUL;
+        case DIVIDE:
+            return OP_DIV;
+        case EQUALS:
+            return OP_EQ;
+        case NOT_EQUALS:
+            return OP_NE;
+        case LOWER_THAN:
+            return OP_LT;
+        case GRATER_THAN:
+            return OP_GT;
+        case LOWER_EQUAL:
+            return OP_LE;
+        case GRATER_EQUAL:
+            return OP_GE;
+        default:
+            return OPCODES_LEN;
+    }
+}
+
+static void compile_tree(BytecodeCompiler *compiler, AstNode *node);
+
+/*
+Jumps when the condition is `when` and goes on otherwise, returns the chain of
+its jumps with `chain` appended. No boolean is computed on the way: && and ||
+jump as soon as an operand decides, and ! swaps what the jumps test.
+*/
+static size_t compile_jump_if(BytecodeCompiler *compiler, AstNode *condition, int when, size_t chain) {
+    Expression *expr = &condition->data.expression;
+    size_t skip;
+
+    if (condition->type == AST_EXPRESSION && expr->kind == EXPRESSION_UNARY && expr->operator == NOT)
+        return compile_jump_if(compiler, expr->left, !when, chain);
+    if (ast_is_short_circuit(condition)) {
+        // a || b is true as soon as a is, a && b is false as soon as a is
+        if ((expr->operator == OR) == when) {
+            chain = compile_jump_if(compiler, expr->left, when, chain);
+            return compile_jump_if(compiler, expr->right, when, chain);
+        }
+        // otherwise a can only skip b
+        skip = compile_jump_if(compiler, expr->left, !when, 0);
+        chain = compile_jump_if(compiler, expr->right, when, chain);
+        patch_chain(compiler, skip);
+        return chain;
+    }
+    if (condition->type == AST_EXPRESSION && expr->kind == EXPRESSION_LITERAL) // while (true)
+        return !expr->value->value.bool_value == !when ? emit_chained_jump(compiler, OP_JUMP, chain) : chain;
+    compiler->value_depth++;
+    compile_tree(compiler, condition);
+    compiler->value_depth--;
+    return emit_chained_jump(compiler, when ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, chain);
+}
+
+/*
+&& and || used as values:
+    <jump to false if the expression is false>  CONST 1  JUMP end  false: CONST 0  end:
+*/
+static void compile_logical(BytecodeCompiler *compiler, AstNode *node) {
+    size_t false_chain = compile_jump_if(compiler, node, 0, 0), end_jump;
+
+    emit(compiler, OP_CONST, 1, 1);
+    end_jump = emit(compiler, OP_JUMP, 0, 0);
+    patch_chain(compiler, false_chain);
+    compiler->stack_depth--; // only one of the constants is pushed
+    emit(compiler, OP_CONST, 0, 1);
+    patch_jump(compiler, end_jump);
+}
+
+/*
+Called after the operands are compiled, except the ones of && and ||.
+*/
+static void compile_expression(BytecodeCompiler *compiler, AstNode *node) {
+    Expression *expr = &node->data.expression;
+    Binding *binding;
+    OpCode op;
+
+    switch (expr->kind) {
+        case EXPRESSION_LITERAL:
+            compile_literal(compiler, expr->value);
+            break;
+        case EXPRESSION_VARIABLE:
+            binding = lookup_variable_or_fail(compiler, node, expr->variable_name);
+            emit(compiler, binding->global ? OP_LOAD_GLOBAL : OP_LOAD, binding->slot, 1);
+            break;
+        case EXPRESSION_BINARY:
+            if (ast_is_short_circuit(node)) {
+                compile_logical(compiler, node);
+                break;
+            }
+            if ((op = binary_opcode(expr->operator)) == OPCODES_LEN)
+                compile_error(compiler, node, "Unsupported operator");
+            emit(compiler, op, 0, -1);
+            break;
+        case EXPRESSION_UNARY:
+            if (expr->operator == NOT) { // x == false
+                emit(compiler, OP_CONST, 0, 1);
+                emit(compiler, OP_EQ, 0, -1);
+            } else {
+                emit(compiler, OP_NEG, 0, 0);
+            }
+            break;
+    }
+}
+
+static void compile_store(BytecodeCompiler *compiler, const AstNode *node, const char *name) {
+    Binding *binding = lookup_variable_or_fail(compiler, node, name);
+    emit(compiler, binding->global ? OP_STORE_GLOBAL : OP_STORE, binding->slot, -1);
+}
+
+/*
+Called before the children of `node`. Expressions and statements use the
+values of their children. The conditions of if statements and loops are
+compiled to jumps when their bodies are entered, and the operands of && and ||
+when the operator is.
+*/
+static int enter_node(AstNode *node, void *context) {
+    BytecodeCompiler *compiler = context;
+
+    if (node == compiler->condition)
+        return 1;
+    switch (node->type) {
+        case AST_FUNCTION_DEFINITION:
+            // function definitions are compiled on their own
+            return node != compiler->function->definition;
+        case AST_IF_STATEMENT:
+            compiler->condition = node->data.if_statement.condition;
+            return 0;
+        case AST_LOOP_STATEMENT:
+            // the variable of the initializer is local to the loop, even at the top level
+            compiler->depth++;
+            list_push(compiler->scopes, (void *) compiler->locals->size);
+            compiler->condition = node->data.loop_statement.condition;
+            return 0;
+        case AST_COMPOUND:
+        case AST_IMPORT:
+        case AST_NOOP:
+            return 0;
+        default:
+            compiler->value_depth++;
+            return ast_is_short_circuit(node);
+    }
+}
+
+/*
+Called after the children of `node`.
+*/
+static void compile_node(AstNode *node, void *context) {
+    BytecodeCompiler *compiler = context;
+    size_t end_chain;
+
+    if (node == compiler->condition) {
+        compiler->condition = NULL;
+        return;
+    }
+    switch (node->type) {
+        case AST_EXPRESSION:
+            compiler->value_depth--;
+            compile_expression(compiler, node);
+            break;
+        case AST_FUNCTION_CALL:
+            compiler->value_depth--;
+            compile_function_call(compiler, node);
+            break;
+        case AST_VARIABLE_DECLARATION:
+            compiler->value_depth--;
+            bind_variable(compiler, node->data.variable_declaration.var);
+            compile_store(compiler, node, node->data.variable_declaration.var->name);
+            break;
+        case AST_ASSIGNMENT:
+            compiler->value_depth--;
+            compile_store(compiler, node, node->data.assignment.dst_variable->value);
+            break;
+        case AST_RETURN_STATEMENT:
+            compiler->value_depth--;
+            emit(compiler, OP_RETURN, 0, -1);
+            break;
+        case AST_LOOP_STATEMENT: // the step is compiled by now
+            end_chain = (size_t) list_pop(compiler->jumps);
+            emit(compiler, OP_JUMP, (size_t) list_pop(compiler->jumps), 0);
+            patch_chain(compiler, end_chain);
+            truncate_bindings(compiler->locals, (size_t) list_pop(compiler->scopes));
+            compiler->depth--;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+The blocks of if statements and loops.
+    <jump to else if the condition is false>  <body>  JUMP end  else: <else block>  end:
+The condition of a loop is tested at the top, the step runs after the body:
+    <initializer>  top: <jump to end if the condition is false>  <body> <step> JUMP top  end:
+*/
+static void enter_block(AstNode *owner, List *block, void *context) {
+    BytecodeCompiler *compiler = context;
+
+    if (owner->type == AST_LOOP_STATEMENT) {
+        list_push(compiler->jumps, (void *) compiler->function->code_len);
+        list_push(compiler->jumps, (void *) compile_jump_if(compiler, owner->data.loop_statement.condition, 0, 0));
+    } else if (owner->type != AST_IF_STATEMENT) {
+        return;
+    } else if (block == owner->data.if_statement.body_node) {
+        list_push(compiler->jumps, (void *) compile_jump_if(compiler, owner->data.if_statement.condition, 0, 0));
+    }
+    compiler->depth++;
+    list_push(compiler->scopes, (void *) compiler->locals->size);
+}
+
+static void exit_block(AstNode *owner, List *block, void *context) {
+    BytecodeCompiler *compiler = context;
+    size_t else_chain;
+
+    if (owner->type != AST_IF_STATEMENT && owner->type != AST_LOOP_STATEMENT)
+        return;
+    compiler->depth--;
+    truncate_bindings(compiler->locals, (size_t) list_pop(compiler->scopes));
+
+    if (owner->type == AST_LOOP_STATEMENT)
+        return;
+    if (block == owner->data.if_statement.else_node) {
+        if (block->size > 0)
+            patch_jump(compiler, (size_t) list_pop(compiler->jumps));
+        return;
+    }
+    else_chain = (size_t) list_pop(compiler->jumps);
+    if (owner->data.if_statement.else_node->size > 0)
+        list_push(compiler->jumps, (void *) emit(compiler, OP_JUMP, 0, 0));
+    patch_chain(compiler, else_chain);
+}
+
+static void compile_tree(BytecodeCompiler *compiler, AstNode *node) {
+    AstVisitor visitor = {.pre = enter_node, .post = compile_node, .enter_block = enter_block,
+                          .exit_block = exit_block, .context = compiler};
+    ast_walk(node, &visitor);
+}
+
+/*
+Every function ends with `return 0`, so falling off the end returns to the caller.
+*/
+static void compile_implicit_return(BytecodeCompiler *compiler) {
+    emit(compiler, OP_CONST, 0, 1);
+    emit(compiler, OP_RETURN, 0, -1);
+}
+
+static void compile_function(BytecodeCompiler *compiler, BytecodeFunction *function) {
+    FunctionDefinition *definition = &function->definition->data.function_definition;
+    Binding *binding;
+    size_t i;
+
+    compiler->function = function;
+    compiler->stack_depth = 0;
+    compiler->depth = 1;
+    for (i = 0; i < definition->args->size; i++) {
+        binding = malloc(sizeof(Binding));
+        binding->name = ((Variable *) definition->args->items[i])->name;
+        binding->type = ((Variable *) definition->args->items[i])->value->type;
+        binding->slot = i;
+        binding->global = 0;
+        list_push(compiler->locals, binding);
+    }
+    compile_tree(compiler, function->definition);
+    compile_implicit_return(compiler);
+    truncate_bindings(compiler->locals, 0);
+}
+
+/*
+Registers the functions of a module, so calls can refer to functions
+defined later in the file or in other modules.
+*/
+static void declare_functions(Program *program, Module *module) {
+    AstNode *child;
+    BytecodeFunction *function;
+    size_t i;
+    char *errMsg;
+
+    for (i = 0; i < module->root->data.compound.children->size; i++) {
+        child = module->root->data.compound.children->items[i];
+        if (child->type != AST_FUNCTION_DEFINITION)
+            continue;
+
+        if (hashmap_get(program->function_ids, child->data.function_definition.func_name)) {
+            alsprintf(&errMsg, "Function '%s' is already defined", child->data.function_definition.func_name);
+            throw_exception_at(CODE_GENERATOR, module->src, child->row, child->col, errMsg);
+        }
+        function = init_bytecode_function(child->data.function_definition.func_name,
+                                          child->data.function_definition.returnType,
+                                          child->data.function_definition.args->size);
+        function->definition = child;
+        list_push(program->functions, function);
+        hashmap_put(program->function_ids, function->name, (void *) program->functions->size);
+    }
+}
+
+/*
+Compiles all the modules of `graph` into a single program.
+The top level statements of the modules run before `main`, imports first.
+*/
+Program *bytecode_compile(ModuleGraph *graph) {
+    Program *program = malloc(sizeof(Program));
+    BytecodeCompiler compiler = {};
+    BytecodeFunction *function;
+    Module *module;
+    size_t i, j;
+    AstNode *child;
+
+    if (!program)
+        log_error(CODE_GENERATOR, "Can't allocate memory for program.");
+    program->functions = init_list(sizeof(BytecodeFunction *));
+    program->function_ids = init_hashmap(64);
+    program->strings = init_list(sizeof(char *));
+    program->globals_len = 0;
+    program->init = init_bytecode_function("<init>", TYPE_VOID, 0);
+
+    for (i = 0; i < graph->modules->size; i++)
+        declare_functions(program, graph->modules->items[i]);
+    program->main = lookup_function(program, "main");
+
+    compiler.program = program;
+    compiler.locals = init_list(sizeof(Binding *));
+    compiler.jumps = init_list(sizeof(size_t));
+    compiler.scopes = init_list(sizeof(size_t));
+    for (i = 0; i < graph->modules->size; i++) {
+        module = graph->modules->items[i];
+        compiler.src = module->src;
+        compiler.globals = init_list(sizeof(Binding *));
+
+        // top level statements first, so the functions see the global variables
+        compiler.function = program->init;
+        compiler.depth = 0;
+        compile_tree(&compiler, module->root);
+        for (j = 0; j < module->root->data.compound.children->size; j++) {
+            child = module->root->data.compound.children->items[j];
+            if (child->type != AST_FUNCTION_DEFINITION)
+                continue;
+            function = program->functions->items[lookup_function(program, child->data.function_definition.func_name)];
+            compile_function(&compiler, function);
+        }
+
+        truncate_bindings(compiler.globals, 0);
+        list_dispose(compiler.globals);
+    }
+    compiler.function = program->init;
+    compile_implicit_return(&compiler);
+
+    list_dispose(compiler.locals);
+    list_dispose(compiler.jumps); // empty, all the jumps are patched
+    list_dispose(compiler.scopes);
+    return program;
+}
+
+void program_dispose(Program *program) {
+    size_t i;
+
+    for (i = 0; i < program->functions->size; i++)
+        bytecode_function_dispose(program->functions->items[i]);
+    free(program->functions->items);
+    free(program->functions);
+    hashmap_dispose(program->function_ids);
+    free(program->strings->items);
+    free(program->strings);
+    bytecode_function_dispose(program->init);
+    free(program);
+}
@@ -0,0 +1,79 @@
+#ifndef INFINITY_COMPILER_BYTECODE_H
+#define INFINITY_COMPILER_BYTECODE_H
+
+#include "../module/module.h"
+#include "../hashmap/hashmap.h"
+#include "../types/types.h"
+
+/*
+Instructions are one opcode byte followed by their operands, little endian.
+Jump targets are byte offsets in the code of the same function.
+*/
+typedef enum {
+    OP_CONST,         // i32 value: push value
+    OP_STRING,        // u32 index: push a string of the program's string table
+    OP_LOAD,          // u32 slot: push a local variable (arguments are the first locals)
+    OP_STORE,         // u32 slot: pop into a local variable
+    OP_LOAD_GLOBAL,   // u32 slot
+    OP_STORE_GLOBAL,  // u32 slot
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_JUMP,          // u32 target
+    OP_JUMP_IF_FALSE, // u32 target: pop a condition
+    OP_JUMP_IF_TRUE,  // u32 target: pop a condition
+    OP_CALL,          // u32 function: the arguments are on the stack
+    OP_RETURN,        // pop the result, return to the caller and push it there
+    OP_POP,
+    OP_PRINT_INT,     // print builtin, one opcode per argument type
+    OP_PRINT_BOOL,
+    OP_PRINT_STRING,
+    OPCODES_LEN,
+} OpCode;
+
+/**
+\BytecodeFunction
+ A compiled function. Void functions return 0.
+*/
+typedef struct {
+    char *name;
+    DataType return_type;
+    size_t args_len;
+    size_t locals_len;  // including the arguments
+    size_t max_stack;   // the deepest the operand stack gets while running the function
+    unsigned char *code;
+    size_t code_len;
+    size_t code_capacity;
+    AstNode *definition; // NULL for the top level code
+} BytecodeFunction;
+
+/**
+\Program
+ The bytecode of all the modules of a module graph.
+*/
+typedef struct {
+    List *functions;      // list of BytecodeFunctions, indexed by OP_CALL
+    HashMap *function_ids; // function name -> index + 1
+    List *strings;        // string table, not owned
+    size_t globals_len;
+    BytecodeFunction *init; // runs the top level statements of every module, in import order
+    long main;             // index of `main`, -1 if there is none
+} Program;
+
+Program *bytecode_compile(ModuleGraph *graph);
+
+void program_dispose(Program *program);
+
+size_t opcode_operands_len(OpCode op);
+
+char *opcode_to_str(OpCode op);
+
+#endif //INFINITY_COMPILER_BYTECODE_H
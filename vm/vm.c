@@ -0,0 +1,332 @@
+#include "vm.h"
+#include "../logging/logging.h"
+#include "../config/globals.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+Direct threaded interpreter.
+
+Before running, the bytecode of every function is translated to threaded code:
+every instruction becomes the address of its handler (a label, taken with the
+labels-as-values extension) followed by its decoded operand, and the operands
+of jumps and calls become pointers. Each handler ends by jumping straight to the
+handler of the next instruction, so there is no decoding and no central switch.
+*/
+
+#define VM_STACK_LEN (1 << 20)
+#define VM_MAX_FRAMES (1 << 16)
+
+#define DISPATCH() goto *(ip++)->handler
+
+typedef union VmWord VmWord;
+typedef struct ThreadedFunction ThreadedFunction;
+
+union VmWord {
+    const void *handler;
+    long operand;
+    VmWord *target;             // jumps
+    ThreadedFunction *function; // calls
+};
+
+struct ThreadedFunction {
+    VmWord *code;
+    size_t args_len;
+    size_t locals_len;
+    size_t frame_len; // locals and the deepest operand stack
+};
+
+typedef struct {
+    VmWord *return_ip;
+    long *bp;
+} Frame;
+
+static unsigned long read_operand(const unsigned char *code, size_t len) {
+    unsigned long value = 0;
+    size_t i;
+    for (i = 0; i < len; i++)
+        value |= (unsigned long) code[i] << (8 * i);
+    return value;
+}
+
+/*
+Translates the bytecode of `function` to threaded code.
+`handlers` holds the address of the handler of every opcode.
+*/
+static void thread_function(const Program *program, const BytecodeFunction *function, ThreadedFunction *threaded,
+                            ThreadedFunction *functions, const void *const *handlers) {
+    size_t *word_index = malloc((function->code_len + 1) * sizeof(size_t));
+    size_t pc, len, words_len = 0;
+    unsigned long operand;
+    VmWord *code;
+    OpCode op;
+
+    // the word of every instruction, to resolve jump targets
+    for (pc = 0; pc < function->code_len; pc += 1 + len) {
+        len = opcode_operands_len(function->code[pc]);
+        word_index[pc] = words_len;
+        words_len += len ? 2 : 1;
+    }
+    word_index[function->code_len] = words_len;
+
+    code = malloc(words_len * sizeof(VmWord));
+    if (!word_index || !code)
+        log_error(VIRTUAL_MACHINE, "Can't allocate memory for threaded code.");
+    words_len = 0;
+    for (pc = 0; pc < function->code_len; pc += 1 + len) {
+        op = function->code[pc];
+        len = opcode_operands_len(op);
+        code[words_len++].handler = handlers[op];
+        if (!len)
+            continue;
+
+        operand = read_operand(function->code + pc + 1, len);
+        switch (op) {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+                code[words_len++].target = code + word_index[operand];
+                break;
+            case OP_CALL:
+                code[words_len++].function = &functions[operand];
+                break;
+            case OP_CONST:
+                code[words_len++].operand = (int) (unsigned int) operand;
+                break;
+            case OP_STRING: // a constant pointer
+                code[words_len++].operand = (long) (intptr_t) program->strings->items[operand];
+                break;
+            default:
+                code[words_len++].operand = (long) operand;
+                break;
+        }
+    }
+
+    threaded->code = code;
+    threaded->args_len = function->args_len;
+    threaded->locals_len = function->locals_len;
+    threaded->frame_len = function->locals_len + function->max_stack;
+    free(word_index);
+}
+
+/*
+Runs the top level statements of the program, then `main`.
+Returns the value returned by `main` as the exit code.
+*/
+int vm_run(const Program *program) {
+    static const void *handlers[OPCODES_LEN] = {
+            [OP_CONST] = &&op_const,
+            [OP_STRING] = &&op_const,
+            [OP_LOAD] = &&op_load,
+            [OP_STORE] = &&op_store,
+            [OP_LOAD_GLOBAL] = &&op_load_global,
+            [OP_STORE_GLOBAL] = &&op_store_global,
+            [OP_ADD] = &&op_add,
+            [OP_SUB] = &&op_sub,
+            [OP_MUL] = &&op_mul,
+            [OP_DIV] = &&op_div,
+            [OP_NEG] = &&op_neg,
+            [OP_EQ] = &&op_eq,
+            [OP_NE] = &&op_ne,
+            [OP_LT] = &&op_lt,
+            [OP_GT] = &&op_gt,
+            [OP_LE] = &&op_le,
+            [OP_GE] = &&op_ge,
+            [OP_JUMP] = &&op_jump,
+            [OP_JUMP_IF_FALSE] = &&op_jump_if_false,
+            [OP_JUMP_IF_TRUE] = &&op_jump_if_true,
+            [OP_CALL] = &&op_call,
+            [OP_RETURN] = &&op_return,
+            [OP_POP] = &&op_pop,
+            [OP_PRINT_INT] = &&op_print_int,
+            [OP_PRINT_BOOL] = &&op_print_bool,
+            [OP_PRINT_STRING] = &&op_print_string,
+    };
+    size_t functions_len = program->functions->size, entries_len = 0, entry_index = 0, i;
+    ThreadedFunction *functions, *function, *entries[2];
+    VmWord entry_code[3], *ip;
+    Frame *frames;
+    size_t frames_len = 0;
+    long *stack, *stack_end, *sp, *bp, *globals, result = 0;
+    int exit_code = 0;
+
+    // the top level code is threaded after the functions
+    functions = malloc((functions_len + 1) * sizeof(ThreadedFunction));
+    stack = malloc(VM_STACK_LEN * sizeof(long));
+    frames = malloc(VM_MAX_FRAMES * sizeof(Frame));
+    globals = calloc(program->globals_len + 1, sizeof(long));
+    if (!functions || !stack || !frames || !globals)
+        log_error(VIRTUAL_MACHINE, "Can't allocate memory for the VM.");
+    for (i = 0; i < functions_len; i++)
+        thread_function(program, program->functions->items[i], &functions[i], functions, handlers);
+    thread_function(program, program->init, &functions[functions_len], functions, handlers);
+
+    entries[entries_len++] = &functions[functions_len];
+    if (program->main >= 0) {
+        if (functions[program->main].args_len > 0)
+            log_error(VIRTUAL_MACHINE, "'main' must not take arguments.");
+        entries[entries_len++] = &functions[program->main];
+    }
+
+    stack_end = stack + VM_STACK_LEN;
+    sp = bp = stack;
+    // calls an entry function and halts when it returns
+    entry_code[0].handler = &&op_call;
+    entry_code[2].handler = &&op_halt;
+
+    next_entry:
+    if (entry_index == entries_len)
+        goto done;
+    entry_code[1].function = entries[entry_index++];
+    ip = entry_code;
+    DISPATCH();
+
+    op_halt:
+    result = *--sp;
+    goto next_entry;
+
+    op_const:
+    *sp++ = (ip++)->operand;
+    DISPATCH();
+
+    op_load:
+    *sp++ = bp[(ip++)->operand];
+    DISPATCH();
+
+    op_store:
+    bp[(ip++)->operand] = *--sp;
+    DISPATCH();
+
+    op_load_global:
+    *sp++ = globals[(ip++)->operand];
+    DISPATCH();
+
+    op_store_global:
+    globals[(ip++)->operand] = *--sp;
+    DISPATCH();
+
+    // integers are 32 bit and wrap around
+    op_add:
+    sp--;
+    sp[-1] = (int) ((unsigned int) sp[-1] + (unsigned int) sp[0]);
+    DISPATCH();
+
+    op_sub:
+    sp--;
+    sp[-1] = (int) ((unsigned int) sp[-1] - (unsigned int) sp[0]);
+    DISPATCH();
+
+    op_mul:
+    sp--;
+    sp[-1] = (int) ((unsigned int) sp[-1] * (unsigned int) sp[0]);
+    DISPATCH();
+
+    op_div:
+    sp--;
+    if (sp[0] == 0)
+        log_error(VIRTUAL_MACHINE, "Division by zero.");
+    // INT_MIN / -1 wraps around
+    sp[-1] = sp[0] == -1 ? (int) (0u - (unsigned int) sp[-1]) : sp[-1] / sp[0];
+    DISPATCH();
+
+    op_neg:
+    sp[-1] = (int) (0u - (unsigned int) sp[-1]);
+    DISPATCH();
+
+    op_eq:
+    sp--;
+    sp[-1] = sp[-1] == sp[0];
+    DISPATCH();
+
+    op_ne:
+    sp--;
+    sp[-1] = sp[-1] != sp[0];
+    DISPATCH();
+
+    op_lt:
+    sp--;
+    sp[-1] = sp[-1] < sp[0];
+    DISPATCH();
+
+    op_gt:
+    sp--;
+    sp[-1] = sp[-1] > sp[0];
+    DISPATCH();
+
+    op_le:
+    sp--;
+    sp[-1] = sp[-1] <= sp[0];
+    DISPATCH();
+
+    op_ge:
+    sp--;
+    sp[-1] = sp[-1] >= sp[0];
+    DISPATCH();
+
+    op_jump:
+    ip = ip->target;
+    DISPATCH();
+
+    op_jump_if_false:
+    ip = *--sp ? ip + 1 : ip->target;
+    DISPATCH();
+
+    op_jump_if_true:
+    ip = *--sp ? ip->target : ip + 1;
+    DISPATCH();
+
+    op_call:
+    function = (ip++)->function;
+    if (frames_len == VM_MAX_FRAMES || sp + function->frame_len > stack_end)
+        log_error(VIRTUAL_MACHINE, "Stack overflow.");
+    frames[frames_len++] = (Frame) {.return_ip = ip, .bp = bp};
+    // the arguments are already on the stack, they are the first locals
+    bp = sp - function->args_len;
+    memset(sp, 0, (function->locals_len - function->args_len) * sizeof(long));
+    sp = bp + function->locals_len;
+    ip = function->code;
+    DISPATCH();
+
+    op_return:
+    result = *--sp;
+    sp = bp;
+    frames_len--;
+    ip = frames[frames_len].return_ip;
+    bp = frames[frames_len].bp;
+    *sp++ = result;
+    DISPATCH();
+
+    op_pop:
+    sp--;
+    DISPATCH();
+
+    op_print_int:
+    printf("%d\n", (int) sp[-1]);
+    sp[-1] = 0;
+    DISPATCH();
+
+    op_print_bool:
+    printf("%s\n", sp[-1] ? "true" : "false");
+    sp[-1] = 0;
+    DISPATCH();
+
+    op_print_string:
+    printf("%s\n", (char *) (intptr_t) sp[-1]);
+    sp[-1] = 0;
+    DISPATCH();
+
+    done:
+    if (program->main >= 0 &&
+        ((BytecodeFunction *) program->functions->items[program->main])->return_type == TYPE_INT)
+        exit_code = (int) result;
+
+    for (i = 0; i <= functions_len; i++)
+        free(functions[i].code);
+    free(functions);
+    free(stack);
+    free(frames);
+    free(globals);
+    return exit_code;
+}
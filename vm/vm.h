@@ -0,0 +1,8 @@
+#ifndef INFINITY_COMPILER_VM_H
+#define INFINITY_COMPILER_VM_H
+
+#include "bytecode.h"
+
+int vm_run(const Program *program);
+
+#endif //INFINITY_COMPILER_VM_H